@@ -0,0 +1,41 @@
+# Converts and renders each of the scenes in SCENES with fixed settings. The
+# statistics of gp and gatling are written as JSON files to OUTPUT_DIR, named
+# after the scene, so that runs of different builds can be compared.
+#
+# Expects GP, GATLING, SCENES (separated by '|') and OUTPUT_DIR to be defined.
+
+string(REPLACE "|" ";" SCENES "${SCENES}")
+
+if (NOT SCENES)
+  message(FATAL_ERROR "No benchmark scenes given. Please set GATLING_BENCHMARK_SCENES.")
+endif()
+
+file(MAKE_DIRECTORY "${OUTPUT_DIR}")
+
+foreach(SCENE ${SCENES})
+  get_filename_component(SCENE_NAME "${SCENE}" NAME_WE)
+  set(SCENE_PREFIX "${OUTPUT_DIR}/${SCENE_NAME}")
+
+  message(STATUS "Benchmarking ${SCENE_NAME}")
+
+  execute_process(
+    COMMAND "${GP}" "${SCENE}" "${SCENE_PREFIX}.gsd" "--stats=${SCENE_PREFIX}_gp.json"
+    RESULT_VARIABLE GP_RESULT
+  )
+  if (NOT GP_RESULT EQUAL 0)
+    message(FATAL_ERROR "gp failed on ${SCENE}")
+  endif()
+
+  execute_process(
+    COMMAND "${GATLING}" "${SCENE_PREFIX}.gsd" "${SCENE_PREFIX}.png"
+      --image-width=1024
+      --image-height=1024
+      --spp=64
+      --bounces=4
+      "--stats=${SCENE_PREFIX}_gatling.json"
+    RESULT_VARIABLE GATLING_RESULT
+  )
+  if (NOT GATLING_RESULT EQUAL 0)
+    message(FATAL_ERROR "gatling failed on ${SCENE}")
+  endif()
+endforeach()
@@ -25,11 +25,16 @@ define_property(
 # we want to recompile a shader each time included files change. Unfortunately, for
 # now, we can only recompile on a per-target basis. The target property
 # SHADER_OUTPUT_DIRECTORY can be set to define the compilation output directory.
-# It's initialized with the value of CMAKE_RUNTIME_OUTPUT_DIRECTORY.
+# It's initialized with the value of CMAKE_RUNTIME_OUTPUT_DIRECTORY. The optional
+# TARGET_ENV argument selects the SPIR-V environment and defaults to vulkan1.1.
 function(add_shader_library target)
 
   # Read input args, extract shader file paths and names.
-  cmake_parse_arguments("TARGET" "" "" "INCLUDES" ${ARGN})
+  cmake_parse_arguments("TARGET" "" "TARGET_ENV" "INCLUDES" ${ARGN})
+
+  if (NOT TARGET_TARGET_ENV)
+    set(TARGET_TARGET_ENV "vulkan1.1")
+  endif()
 
   list(APPEND TARGET_SHADERS_INPUT_FILE_PATHS "")
   list(APPEND TARGET_SHADERS_INPUT_FILE_NAMES "")
@@ -75,7 +80,7 @@ function(add_shader_library target)
       MAIN_DEPENDENCY ${input_path}
       WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
       COMMENT "Compiling GLSL shader ${input_name}"
-      COMMAND ${CMAKE_GLSL_COMPILER} --target-env=vulkan1.1 -o ${output_path} -c ${input_path}
+      COMMAND ${CMAKE_GLSL_COMPILER} --target-env=${TARGET_TARGET_ENV} -o ${output_path} -c ${input_path}
       VERBATIM
       # Rebuild if an included file changes.
       DEPENDS ${TARGET_INCLUDES}
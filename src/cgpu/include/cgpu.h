@@ -90,7 +90,13 @@ typedef enum CgpuResult {
   CGPU_FAIL_MAX_SPECIALIZATION_BUFFER_SIZE_REACHED = -33,
   CGPU_FAIL_MAX_TIMESTAMP_QUERY_INDEX_REACHED = -34,
   CGPU_FAIL_VK_VERSION_NOT_SUPPORTED = -35,
-  CGPU_FAIL_FEATURE_REQUIREMENTS_NOT_MET = -36
+  CGPU_FAIL_FEATURE_REQUIREMENTS_NOT_MET = -36,
+  CGPU_FAIL_HOST_MEMORY_NOT_ALIGNED = -37,
+  CGPU_FAIL_UNABLE_TO_IMPORT_HOST_MEMORY = -38,
+  CGPU_FAIL_UNABLE_TO_CREATE_ACCELERATION_STRUCTURE = -39,
+  CGPU_FAIL_UNABLE_TO_CREATE_PIPELINE_CACHE = -40,
+  CGPU_FAIL_INCOMPATIBLE_PIPELINE_CACHE = -41,
+  CGPU_FAIL_UNABLE_TO_GET_PIPELINE_CACHE_DATA = -42
 } CgpuResult;
 
 typedef uint32_t CgpuBufferUsageFlags;
@@ -101,7 +107,10 @@ typedef enum CgpuBufferUsageFlagBits {
   CGPU_BUFFER_USAGE_FLAG_UNIFORM_BUFFER = 4,
   CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER = 8,
   CGPU_BUFFER_USAGE_FLAG_UNIFORM_TEXEL_BUFFER = 16,
-  CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER = 32
+  CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER = 32,
+  CGPU_BUFFER_USAGE_FLAG_INDIRECT_BUFFER = 64,
+  CGPU_BUFFER_USAGE_FLAG_SHADER_DEVICE_ADDRESS = 128,
+  CGPU_BUFFER_USAGE_FLAG_ACCELERATION_STRUCTURE_BUILD_INPUT = 256
 } CgpuBufferUsageFlagBits;
 
 typedef uint32_t CgpuMemoryPropertyFlags;
@@ -426,7 +435,8 @@ typedef enum CgpuMemoryAccessFlagBits {
   CGPU_MEMORY_ACCESS_FLAG_HOST_READ = 32,
   CGPU_MEMORY_ACCESS_FLAG_HOST_WRITE = 64,
   CGPU_MEMORY_ACCESS_FLAG_MEMORY_READ = 128,
-  CGPU_MEMORY_ACCESS_FLAG_MEMORY_WRITE = 256
+  CGPU_MEMORY_ACCESS_FLAG_MEMORY_WRITE = 256,
+  CGPU_MEMORY_ACCESS_FLAG_INDIRECT_COMMAND_READ = 512
 } CgpuMemoryAccessFlagBits;
 
 typedef struct cgpu_instance       { uint64_t handle; } cgpu_instance;
@@ -437,6 +447,8 @@ typedef struct cgpu_shader         { uint64_t handle; } cgpu_shader;
 typedef struct cgpu_pipeline       { uint64_t handle; } cgpu_pipeline;
 typedef struct cgpu_fence          { uint64_t handle; } cgpu_fence;
 typedef struct cgpu_command_buffer { uint64_t handle; } cgpu_command_buffer;
+typedef struct cgpu_blas           { uint64_t handle; } cgpu_blas;
+typedef struct cgpu_tlas           { uint64_t handle; } cgpu_tlas;
 
 typedef struct cgpu_shader_resource_buffer {
   uint32_t binding;
@@ -450,6 +462,17 @@ typedef struct cgpu_shader_resource_image {
   cgpu_image image;
 } cgpu_shader_resource_image;
 
+typedef struct cgpu_shader_resource_tlas {
+  uint32_t binding;
+  cgpu_tlas tlas;
+} cgpu_shader_resource_tlas;
+
+typedef struct cgpu_blas_instance {
+  cgpu_blas blas;
+  uint32_t instance_custom_index;
+  float transform[3][4];
+} cgpu_blas_instance;
+
 typedef struct cgpu_memory_barrier {
   CgpuMemoryAccessFlags src_access_flags;
   CgpuMemoryAccessFlags dst_access_flags;
@@ -575,14 +598,44 @@ typedef struct cgpu_physical_device_limits {
   uint64_t             optimalBufferCopyRowPitchAlignment;
   uint64_t             nonCoherentAtomSize;
   uint32_t             subgroupSize;
+  uint64_t             minImportedHostPointerAlignment;
+  bool                 rayQuery;
+  uint32_t             vendorID;
+  uint32_t             deviceID;
+  uint32_t             driverVersion;
+  uint8_t              pipelineCacheUUID[16];
 } cgpu_physical_device_limits;
 
+typedef struct cgpu_memory_stats {
+  uint32_t block_count;
+  uint32_t dedicated_allocation_count;
+  uint32_t allocation_count;
+  uint64_t allocated_size;
+  uint64_t used_size;
+  uint64_t device_local_allocated_size;
+  uint64_t device_local_used_size;
+} cgpu_memory_stats;
+
 typedef struct cgpu_specialization_constant {
   uint32_t constant_id;
   uint32_t size;
   void* p_data;
 } cgpu_specialization_constant;
 
+typedef struct cgpu_pipeline_create_info {
+  uint32_t buffer_resource_count;
+  const cgpu_shader_resource_buffer* p_buffer_resources;
+  uint32_t image_resource_count;
+  const cgpu_shader_resource_image* p_image_resources;
+  uint32_t tlas_resource_count;
+  const cgpu_shader_resource_tlas* p_tlas_resources;
+  cgpu_shader shader;
+  const char* p_shader_entry_point;
+  uint32_t specialization_constant_count;
+  const cgpu_specialization_constant* p_specialization_constants;
+  uint32_t push_constants_size;
+} cgpu_pipeline_create_info;
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_initialize(
   const char* p_app_name,
   uint32_t version_major,
@@ -625,6 +678,14 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_create_buffer(
   cgpu_buffer* p_buffer
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_create_buffer_from_host_memory(
+  cgpu_device device,
+  CgpuBufferUsageFlags usage,
+  void* p_host_memory,
+  uint64_t size,
+  cgpu_buffer* p_buffer
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_destroy_buffer(
   cgpu_device device,
   cgpu_buffer buffer
@@ -677,6 +738,8 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_create_pipeline(
   const cgpu_shader_resource_buffer* p_buffer_resources,
   uint32_t shader_resource_count,
   const cgpu_shader_resource_image* p_image_resources,
+  uint32_t tlas_resource_count,
+  const cgpu_shader_resource_tlas* p_tlas_resources,
   cgpu_shader shader,
   const char* p_shader_entry_point,
   uint32_t specialization_constant_count,
@@ -685,11 +748,47 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_create_pipeline(
   cgpu_pipeline* p_pipeline
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_create_pipelines(
+  cgpu_device device,
+  uint32_t pipeline_count,
+  const cgpu_pipeline_create_info* p_create_infos,
+  cgpu_pipeline* p_pipelines
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_destroy_pipeline(
   cgpu_device device,
   cgpu_pipeline pipeline
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_create_blas(
+  cgpu_device device,
+  cgpu_buffer vertex_buffer,
+  uint64_t vertex_offset,
+  uint32_t vertex_count,
+  uint64_t vertex_stride,
+  cgpu_buffer index_buffer,
+  uint64_t index_offset,
+  uint32_t triangle_count,
+  cgpu_blas* p_blas
+);
+
+CGPU_API CgpuResult CGPU_CDECL cgpu_destroy_blas(
+  cgpu_device device,
+  cgpu_blas blas
+);
+
+CGPU_API CgpuResult CGPU_CDECL cgpu_create_tlas(
+  cgpu_device device,
+  uint32_t instance_count,
+  const cgpu_blas_instance* p_instances,
+  cgpu_tlas* p_tlas
+);
+
+CGPU_API CgpuResult CGPU_CDECL cgpu_destroy_tlas(
+  cgpu_device device,
+  cgpu_tlas tlas
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_create_command_buffer(
   cgpu_device device,
   cgpu_command_buffer* p_command_buffer
@@ -713,6 +812,14 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_copy_buffer(
   uint64_t size
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_fill_buffer(
+  cgpu_command_buffer command_buffer,
+  cgpu_buffer buffer,
+  uint64_t offset,
+  uint64_t size,
+  uint32_t data
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_push_constants(
   cgpu_command_buffer command_buffer,
   cgpu_pipeline pipeline,
@@ -727,6 +834,12 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_dispatch(
   uint32_t dim_z
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_dispatch_indirect(
+  cgpu_command_buffer command_buffer,
+  cgpu_buffer buffer,
+  uint64_t offset
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_pipeline_barrier(
   cgpu_command_buffer command_buffer,
   uint32_t barrier_count,
@@ -805,6 +918,23 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_invalidate_mapped_memory(
   uint64_t size
 );
 
+CGPU_API CgpuResult CGPU_CDECL cgpu_load_pipeline_cache(
+  cgpu_device device,
+  uint64_t size,
+  const void* p_data
+);
+
+CGPU_API CgpuResult CGPU_CDECL cgpu_get_pipeline_cache_data(
+  cgpu_device device,
+  uint64_t* p_size,
+  void* p_data
+);
+
+CGPU_API CgpuResult CGPU_CDECL cgpu_get_memory_stats(
+  cgpu_device device,
+  cgpu_memory_stats* p_stats
+);
+
 CGPU_API CgpuResult CGPU_CDECL cgpu_get_physical_device_limits(
   cgpu_device device,
   cgpu_physical_device_limits* p_limits
@@ -0,0 +1,530 @@
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* Size of the device memory blocks that resources are suballocated from.
+   Larger resources get an allocation of their own. */
+#define BLOCK_SIZE (64ull * 1024ull * 1024ull)
+#define MAX_SUBALLOCATION_SIZE (BLOCK_SIZE / 2)
+#define MIN_UNIT_SIZE 256ull
+
+static uint32_t allocator_ceil_log2(
+  uint64_t value)
+{
+  uint32_t log2 = 0;
+  while ((1ull << log2) < value) {
+    log2++;
+  }
+  return log2;
+}
+
+static bool allocator_is_device_local(
+  const allocator* alloc,
+  uint32_t memory_type_index)
+{
+  const VkMemoryPropertyFlags flags =
+    alloc->memory_properties.memoryTypes[memory_type_index].propertyFlags;
+  return (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+}
+
+static void allocator_buddy_init(
+  uint8_t* tree,
+  uint32_t max_order)
+{
+  uint32_t index = 0;
+  for (uint32_t depth = 0; depth <= max_order; ++depth)
+  {
+    const uint32_t node_count = 1u << depth;
+    for (uint32_t i = 0; i < node_count; ++i) {
+      tree[index++] = (uint8_t) (max_order - depth + 1);
+    }
+  }
+}
+
+static void allocator_buddy_update(
+  uint8_t* tree,
+  uint32_t index,
+  uint32_t order)
+{
+  const uint8_t left = tree[index * 2 + 1];
+  const uint8_t right = tree[index * 2 + 2];
+
+  /* Two free buddies merge into a free parent. */
+  if (left == order && right == order) {
+    tree[index] = (uint8_t) (order + 1);
+  } else {
+    tree[index] = (left > right) ? left : right;
+  }
+}
+
+static bool allocator_buddy_allocate(
+  uint8_t* tree,
+  uint32_t max_order,
+  uint32_t order,
+  uint64_t* unit_offset)
+{
+  if (tree[0] < order + 1) {
+    return false;
+  }
+
+  uint32_t index = 0;
+  uint32_t node_order = max_order;
+
+  while (node_order != order)
+  {
+    const uint32_t left = index * 2 + 1;
+    index = (tree[left] >= order + 1) ? left : (left + 1);
+    node_order--;
+  }
+
+  tree[index] = 0;
+
+  *unit_offset = ((uint64_t) (index + 1) << order) - (1ull << max_order);
+
+  while (index > 0)
+  {
+    index = (index - 1) / 2;
+    node_order++;
+    allocator_buddy_update(tree, index, node_order);
+  }
+
+  return true;
+}
+
+static void allocator_buddy_free(
+  uint8_t* tree,
+  uint32_t max_order,
+  uint64_t unit_offset)
+{
+  /* Walk up from the first leaf of the allocation until we find the
+     node which was handed out. Nodes below it are never marked. */
+  uint32_t index = (uint32_t) (unit_offset + (1ull << max_order) - 1);
+  uint32_t node_order = 0;
+
+  while (tree[index] != 0)
+  {
+    assert(index > 0);
+    index = (index - 1) / 2;
+    node_order++;
+  }
+
+  tree[index] = (uint8_t) (node_order + 1);
+
+  while (index > 0)
+  {
+    index = (index - 1) / 2;
+    node_order++;
+    allocator_buddy_update(tree, index, node_order);
+  }
+}
+
+static VkResult allocator_allocate_memory(
+  allocator* alloc,
+  uint64_t size,
+  uint32_t memory_type_index,
+  VkDeviceMemory* memory)
+{
+  /* Memory may back buffers which are referenced by device address,
+     for instance acceleration structure build inputs. */
+  VkMemoryAllocateFlagsInfo alloc_flags_info;
+  alloc_flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+  alloc_flags_info.pNext = NULL;
+  alloc_flags_info.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+  alloc_flags_info.deviceMask = 0;
+
+  VkMemoryAllocateInfo alloc_info;
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext = alloc->device_address ? &alloc_flags_info : NULL;
+  alloc_info.allocationSize = size;
+  alloc_info.memoryTypeIndex = memory_type_index;
+
+  return alloc->table->vkAllocateMemory(
+    alloc->device,
+    &alloc_info,
+    NULL,
+    memory
+  );
+}
+
+static VkResult allocator_create_block(
+  allocator* alloc,
+  uint32_t memory_type_index,
+  allocator_strategy strategy,
+  uint32_t* block_index)
+{
+  uint32_t index = alloc->block_count;
+
+  for (uint32_t i = 0; i < alloc->block_count; ++i)
+  {
+    if (alloc->blocks[i].memory == VK_NULL_HANDLE) {
+      index = i;
+      break;
+    }
+  }
+
+  if (index == alloc->block_capacity)
+  {
+    alloc->block_capacity *= 2;
+    alloc->blocks = realloc(
+      alloc->blocks,
+      alloc->block_capacity * sizeof(allocator_block)
+    );
+  }
+
+  allocator_block* block = &alloc->blocks[index];
+
+  VkResult result = allocator_allocate_memory(
+    alloc,
+    alloc->block_size,
+    memory_type_index,
+    &block->memory
+  );
+  if (result != VK_SUCCESS) {
+    block->memory = VK_NULL_HANDLE;
+    return result;
+  }
+
+  /* Host-visible blocks stay mapped, since suballocations can't be
+     mapped independently of each other. */
+  block->mapped = NULL;
+
+  const VkMemoryPropertyFlags flags =
+    alloc->memory_properties.memoryTypes[memory_type_index].propertyFlags;
+
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+  {
+    result = alloc->table->vkMapMemory(
+      alloc->device,
+      block->memory,
+      0,
+      VK_WHOLE_SIZE,
+      0,
+      &block->mapped
+    );
+    if (result != VK_SUCCESS)
+    {
+      alloc->table->vkFreeMemory(alloc->device, block->memory, NULL);
+      block->memory = VK_NULL_HANDLE;
+      return result;
+    }
+  }
+
+  block->memory_type_index = memory_type_index;
+  block->strategy = strategy;
+  block->allocation_count = 0;
+  block->used_size = 0;
+  block->tree = NULL;
+  block->linear_offset = 0;
+
+  if (strategy == ALLOCATOR_STRATEGY_BUDDY)
+  {
+    const uint32_t node_count = (2u << alloc->max_order) - 1;
+    block->tree = malloc(node_count);
+    allocator_buddy_init(block->tree, alloc->max_order);
+  }
+
+  if (index == alloc->block_count) {
+    alloc->block_count++;
+  }
+
+  *block_index = index;
+
+  return VK_SUCCESS;
+}
+
+static void allocator_destroy_block(
+  allocator* alloc,
+  allocator_block* block)
+{
+  if (block->mapped) {
+    alloc->table->vkUnmapMemory(alloc->device, block->memory);
+  }
+  alloc->table->vkFreeMemory(alloc->device, block->memory, NULL);
+  free(block->tree);
+  block->memory = VK_NULL_HANDLE;
+  block->tree = NULL;
+}
+
+static bool allocator_suballocate(
+  allocator* alloc,
+  allocator_block* block,
+  uint64_t size,
+  uint64_t alignment,
+  uint64_t* offset)
+{
+  if (block->strategy == ALLOCATOR_STRATEGY_BUDDY)
+  {
+    /* Buddy nodes are naturally aligned to their size. */
+    const uint64_t node_size = (size > alignment) ? size : alignment;
+    const uint64_t unit_count = (node_size + alloc->unit_size - 1) / alloc->unit_size;
+    const uint32_t order = allocator_ceil_log2(unit_count);
+
+    uint64_t unit_offset;
+    if (!allocator_buddy_allocate(block->tree, alloc->max_order, order, &unit_offset)) {
+      return false;
+    }
+
+    *offset = unit_offset * alloc->unit_size;
+    return true;
+  }
+
+  const uint64_t aligned_offset =
+    (block->linear_offset + alignment - 1) / alignment * alignment;
+
+  if ((aligned_offset + size) > alloc->block_size) {
+    return false;
+  }
+
+  /* Keep the next offset a multiple of the unit size, which also ensures
+     that linear and optimal resources never share a page. */
+  const uint64_t end = aligned_offset + size;
+  block->linear_offset = (end + alloc->unit_size - 1) / alloc->unit_size * alloc->unit_size;
+
+  *offset = aligned_offset;
+  return true;
+}
+
+void allocator_create(
+  allocator* alloc,
+  VkDevice device,
+  const struct VolkDeviceTable* table,
+  const VkPhysicalDeviceMemoryProperties* memory_properties,
+  uint64_t min_alignment,
+  bool device_address)
+{
+  alloc->device = device;
+  alloc->table = table;
+  alloc->memory_properties = *memory_properties;
+  alloc->device_address = device_address;
+  alloc->block_size = BLOCK_SIZE;
+
+  /* All Vulkan alignment limits are powers of two. Using the largest of
+     them as allocation granularity lets us ignore buffer-image granularity
+     and non-coherent atom size when placing resources. */
+  alloc->unit_size = (min_alignment > MIN_UNIT_SIZE) ? min_alignment : MIN_UNIT_SIZE;
+  alloc->max_order = allocator_ceil_log2(alloc->block_size / alloc->unit_size);
+
+  alloc->block_count = 0;
+  alloc->block_capacity = 8;
+  alloc->blocks = malloc(alloc->block_capacity * sizeof(allocator_block));
+  alloc->dedicated_allocation_count = 0;
+  alloc->dedicated_size = 0;
+  alloc->device_local_dedicated_size = 0;
+}
+
+void allocator_destroy(
+  allocator* alloc)
+{
+  for (uint32_t i = 0; i < alloc->block_count; ++i)
+  {
+    allocator_block* block = &alloc->blocks[i];
+    if (block->memory != VK_NULL_HANDLE) {
+      allocator_destroy_block(alloc, block);
+    }
+  }
+  free(alloc->blocks);
+}
+
+VkResult allocator_allocate(
+  allocator* alloc,
+  const VkMemoryRequirements* requirements,
+  uint32_t memory_type_index,
+  allocator_strategy strategy,
+  allocator_allocation* allocation)
+{
+  allocation->size = requirements->size;
+  allocation->memory_type_index = memory_type_index;
+
+  if (requirements->size > MAX_SUBALLOCATION_SIZE ||
+      requirements->alignment > MAX_SUBALLOCATION_SIZE)
+  {
+    allocation->block_index = ALLOCATOR_DEDICATED_BLOCK;
+    allocation->offset = 0;
+    allocation->mapped = NULL;
+
+    const VkResult result = allocator_allocate_memory(
+      alloc,
+      requirements->size,
+      memory_type_index,
+      &allocation->memory
+    );
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+
+    alloc->dedicated_allocation_count++;
+    alloc->dedicated_size += requirements->size;
+    if (allocator_is_device_local(alloc, memory_type_index)) {
+      alloc->device_local_dedicated_size += requirements->size;
+    }
+    return VK_SUCCESS;
+  }
+
+  uint32_t block_index = ALLOCATOR_DEDICATED_BLOCK;
+  uint64_t offset = 0;
+
+  for (uint32_t i = 0; i < alloc->block_count; ++i)
+  {
+    allocator_block* block = &alloc->blocks[i];
+
+    if (block->memory == VK_NULL_HANDLE ||
+        block->memory_type_index != memory_type_index ||
+        block->strategy != strategy)
+    {
+      continue;
+    }
+
+    if (allocator_suballocate(alloc, block, requirements->size, requirements->alignment, &offset)) {
+      block_index = i;
+      break;
+    }
+  }
+
+  if (block_index == ALLOCATOR_DEDICATED_BLOCK)
+  {
+    const VkResult result = allocator_create_block(
+      alloc,
+      memory_type_index,
+      strategy,
+      &block_index
+    );
+    if (result != VK_SUCCESS) {
+      return result;
+    }
+
+    const bool success = allocator_suballocate(
+      alloc,
+      &alloc->blocks[block_index],
+      requirements->size,
+      requirements->alignment,
+      &offset
+    );
+    assert(success);
+    (void) success;
+  }
+
+  allocator_block* block = &alloc->blocks[block_index];
+  block->allocation_count++;
+  block->used_size += requirements->size;
+
+  allocation->memory = block->memory;
+  allocation->offset = offset;
+  allocation->mapped = block->mapped ? ((uint8_t*) block->mapped + offset) : NULL;
+  allocation->block_index = block_index;
+
+  return VK_SUCCESS;
+}
+
+VkResult allocator_allocate_dedicated(
+  allocator* alloc,
+  const VkMemoryAllocateInfo* allocate_info,
+  allocator_allocation* allocation)
+{
+  const VkResult result = alloc->table->vkAllocateMemory(
+    alloc->device,
+    allocate_info,
+    NULL,
+    &allocation->memory
+  );
+  if (result != VK_SUCCESS) {
+    return result;
+  }
+
+  allocation->offset = 0;
+  allocation->size = allocate_info->allocationSize;
+  allocation->mapped = NULL;
+  allocation->block_index = ALLOCATOR_DEDICATED_BLOCK;
+  allocation->memory_type_index = allocate_info->memoryTypeIndex;
+
+  alloc->dedicated_allocation_count++;
+  alloc->dedicated_size += allocation->size;
+  if (allocator_is_device_local(alloc, allocation->memory_type_index)) {
+    alloc->device_local_dedicated_size += allocation->size;
+  }
+
+  return VK_SUCCESS;
+}
+
+void allocator_free(
+  allocator* alloc,
+  const allocator_allocation* allocation)
+{
+  if (allocation->block_index == ALLOCATOR_DEDICATED_BLOCK)
+  {
+    alloc->table->vkFreeMemory(alloc->device, allocation->memory, NULL);
+
+    alloc->dedicated_allocation_count--;
+    alloc->dedicated_size -= allocation->size;
+    if (allocator_is_device_local(alloc, allocation->memory_type_index)) {
+      alloc->device_local_dedicated_size -= allocation->size;
+    }
+    return;
+  }
+
+  allocator_block* block = &alloc->blocks[allocation->block_index];
+  assert(block->allocation_count > 0);
+
+  block->allocation_count--;
+  block->used_size -= allocation->size;
+
+  if (block->strategy == ALLOCATOR_STRATEGY_BUDDY) {
+    allocator_buddy_free(block->tree, alloc->max_order, allocation->offset / alloc->unit_size);
+  }
+
+  if (block->allocation_count > 0) {
+    return;
+  }
+
+  block->linear_offset = 0;
+
+  /* Keep one empty block per memory type and strategy around, so that
+     creating and destroying a resource repeatedly doesn't hit the driver. */
+  for (uint32_t i = 0; i < alloc->block_count; ++i)
+  {
+    const allocator_block* other = &alloc->blocks[i];
+
+    if (other != block &&
+        other->memory != VK_NULL_HANDLE &&
+        other->allocation_count == 0 &&
+        other->memory_type_index == block->memory_type_index &&
+        other->strategy == block->strategy)
+    {
+      allocator_destroy_block(alloc, block);
+      return;
+    }
+  }
+}
+
+void allocator_get_stats(
+  const allocator* alloc,
+  allocator_stats* stats)
+{
+  stats->block_count = 0;
+  stats->dedicated_allocation_count = alloc->dedicated_allocation_count;
+  stats->allocation_count = alloc->dedicated_allocation_count;
+  stats->allocated_size = alloc->dedicated_size;
+  stats->used_size = alloc->dedicated_size;
+  stats->device_local_allocated_size = alloc->device_local_dedicated_size;
+  stats->device_local_used_size = alloc->device_local_dedicated_size;
+
+  for (uint32_t i = 0; i < alloc->block_count; ++i)
+  {
+    const allocator_block* block = &alloc->blocks[i];
+
+    if (block->memory == VK_NULL_HANDLE) {
+      continue;
+    }
+
+    stats->block_count++;
+    stats->allocation_count += block->allocation_count;
+    stats->allocated_size += alloc->block_size;
+    stats->used_size += block->used_size;
+
+    if (allocator_is_device_local(alloc, block->memory_type_index))
+    {
+      stats->device_local_allocated_size += alloc->block_size;
+      stats->device_local_used_size += block->used_size;
+    }
+  }
+}
@@ -0,0 +1,106 @@
+#ifndef CGPU_ALLOCATOR_H
+#define CGPU_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <volk.h>
+
+#define ALLOCATOR_DEDICATED_BLOCK UINT32_MAX
+
+typedef enum allocator_strategy {
+  /* Power-of-two sizes which are split and merged again on free. */
+  ALLOCATOR_STRATEGY_BUDDY  = 0,
+  /* Bump allocation. Memory is only reused once the whole block is free,
+     which makes it a good fit for short-lived resources. */
+  ALLOCATOR_STRATEGY_LINEAR = 1
+} allocator_strategy;
+
+typedef struct allocator_block {
+  VkDeviceMemory     memory;
+  void*              mapped;
+  uint32_t           memory_type_index;
+  allocator_strategy strategy;
+  uint32_t           allocation_count;
+  uint64_t           used_size;
+  /* Buddy strategy: complete binary tree over the block in which every node
+     holds the order of the largest free node in its subtree, plus one. */
+  uint8_t*           tree;
+  /* Linear strategy: offset of the first free byte. */
+  uint64_t           linear_offset;
+} allocator_block;
+
+typedef struct allocator_allocation {
+  VkDeviceMemory memory;
+  uint64_t       offset;
+  uint64_t       size;
+  /* Only set for host-visible suballocations. Dedicated allocations
+     have to be mapped explicitly. */
+  void*          mapped;
+  uint32_t       block_index;
+  uint32_t       memory_type_index;
+} allocator_allocation;
+
+typedef struct allocator_stats {
+  uint32_t block_count;
+  uint32_t dedicated_allocation_count;
+  uint32_t allocation_count;
+  uint64_t allocated_size;
+  uint64_t used_size;
+  uint64_t device_local_allocated_size;
+  uint64_t device_local_used_size;
+} allocator_stats;
+
+typedef struct allocator {
+  VkDevice                         device;
+  const struct VolkDeviceTable*    table;
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  bool                             device_address;
+  uint64_t                         block_size;
+  uint64_t                         unit_size;
+  uint32_t                         max_order;
+  allocator_block*                 blocks;
+  uint32_t                         block_count;
+  uint32_t                         block_capacity;
+  uint32_t                         dedicated_allocation_count;
+  uint64_t                         dedicated_size;
+  uint64_t                         device_local_dedicated_size;
+} allocator;
+
+void allocator_create(
+  allocator* alloc,
+  VkDevice device,
+  const struct VolkDeviceTable* table,
+  const VkPhysicalDeviceMemoryProperties* memory_properties,
+  uint64_t min_alignment,
+  bool device_address
+);
+
+void allocator_destroy(
+  allocator* alloc
+);
+
+VkResult allocator_allocate(
+  allocator* alloc,
+  const VkMemoryRequirements* requirements,
+  uint32_t memory_type_index,
+  allocator_strategy strategy,
+  allocator_allocation* allocation
+);
+
+VkResult allocator_allocate_dedicated(
+  allocator* alloc,
+  const VkMemoryAllocateInfo* allocate_info,
+  allocator_allocation* allocation
+);
+
+void allocator_free(
+  allocator* alloc,
+  const allocator_allocation* allocation
+);
+
+void allocator_get_stats(
+  const allocator* alloc,
+  allocator_stats* stats
+);
+
+#endif
@@ -1,5 +1,7 @@
 #include "cgpu.h"
 #include "resource_store.h"
+#include "allocator.h"
+#include "thread.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -12,17 +14,20 @@
 
 #define MAX_PHYSICAL_DEVICES 32
 #define MAX_DEVICE_EXTENSIONS 1024
+#define MAX_ENABLED_DEVICE_EXTENSIONS 16
 #define MAX_QUEUE_FAMILIES 64
-#define MAX_TIMESTAMP_QUERIES 32
+#define MAX_TIMESTAMP_QUERIES 4096
 #define MAX_DESCRIPTOR_SET_BINDINGS 128
 #define MAX_DESCRIPTOR_BUFFER_INFOS 64
 #define MAX_DESCRIPTOR_IMAGE_INFOS 64
+#define MAX_DESCRIPTOR_AS_INFOS 8
 #define MAX_WRITE_DESCRIPTOR_SETS 128
 #define MAX_BUFFER_MEMORY_BARRIERS 64
 #define MAX_IMAGE_MEMORY_BARRIERS 64
 #define MAX_MEMORY_BARRIERS 128
 #define MAX_SPECIALIZATION_CONSTANTS 32
 #define MAX_SPECIALIZATION_BUFFER_SIZE 1024
+#define MAX_PIPELINE_THREADS 16
 
 /* Internal structures. */
 
@@ -36,22 +41,37 @@ typedef struct cgpu_idevice {
   VkQueue                     compute_queue;
   VkCommandPool               command_pool;
   VkQueryPool                 timestamp_pool;
+  VkPipelineCache             pipeline_cache;
   VkSampler                   sampler;
   struct VolkDeviceTable      table;
   cgpu_physical_device_limits limits;
+  bool                        supports_external_memory_host;
+  uint32_t                    min_scratch_offset_alignment;
+  allocator                   allocator;
 } cgpu_idevice;
 
 typedef struct cgpu_ibuffer {
-  VkBuffer       buffer;
-  VkDeviceMemory memory;
-  uint64_t       size;
+  VkBuffer             buffer;
+  allocator_allocation allocation;
+  uint64_t             size;
 } cgpu_ibuffer;
 
+typedef struct cgpu_iblas {
+  VkAccelerationStructureKHR as;
+  cgpu_ibuffer               buffer;
+  uint64_t                   address;
+} cgpu_iblas;
+
+typedef struct cgpu_itlas {
+  VkAccelerationStructureKHR as;
+  cgpu_ibuffer               buffer;
+} cgpu_itlas;
+
 typedef struct cgpu_iimage {
-  VkImage        image;
-  VkImageView    image_view;
-  VkDeviceMemory memory;
-  uint64_t       size;
+  VkImage              image;
+  VkImageView          image_view;
+  allocator_allocation allocation;
+  uint64_t             size;
 } cgpu_iimage;
 
 typedef struct cgpu_ipipeline {
@@ -84,6 +104,8 @@ static resource_store iimage_store;
 static resource_store ipipeline_store;
 static resource_store icommand_buffer_store;
 static resource_store ifence_store;
+static resource_store iblas_store;
+static resource_store itlas_store;
 static cgpu_iinstance iinstance;
 
 /* Helper functions. */
@@ -103,6 +125,8 @@ CGPU_RESOLVE_HANDLE(         image,          cgpu_image,          cgpu_iimage,
 CGPU_RESOLVE_HANDLE(      pipeline,       cgpu_pipeline,       cgpu_ipipeline,       ipipeline_store)
 CGPU_RESOLVE_HANDLE(         fence,          cgpu_fence,          cgpu_ifence,          ifence_store)
 CGPU_RESOLVE_HANDLE(command_buffer, cgpu_command_buffer, cgpu_icommand_buffer, icommand_buffer_store)
+CGPU_RESOLVE_HANDLE(          blas,           cgpu_blas,           cgpu_iblas,           iblas_store)
+CGPU_RESOLVE_HANDLE(          tlas,           cgpu_tlas,           cgpu_itlas,           itlas_store)
 
 static VkMemoryPropertyFlags cgpu_translate_memory_properties(
   CgpuMemoryPropertyFlags memory_properties)
@@ -135,6 +159,49 @@ static VkMemoryPropertyFlags cgpu_translate_memory_properties(
   return mem_flags;
 }
 
+static VkBufferUsageFlags cgpu_translate_buffer_usage_flags(
+  CgpuBufferUsageFlags usage)
+{
+  VkBufferUsageFlags vk_buffer_usage = 0;
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC)
+        == CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST)
+        == CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_UNIFORM_BUFFER)
+        == CGPU_BUFFER_USAGE_FLAG_UNIFORM_BUFFER) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER)
+        == CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_UNIFORM_TEXEL_BUFFER)
+        == CGPU_BUFFER_USAGE_FLAG_UNIFORM_TEXEL_BUFFER) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER)
+        == CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_INDIRECT_BUFFER)
+        == CGPU_BUFFER_USAGE_FLAG_INDIRECT_BUFFER) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_SHADER_DEVICE_ADDRESS)
+        == CGPU_BUFFER_USAGE_FLAG_SHADER_DEVICE_ADDRESS) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR;
+  }
+  if ((usage & CGPU_BUFFER_USAGE_FLAG_ACCELERATION_STRUCTURE_BUILD_INPUT)
+        == CGPU_BUFFER_USAGE_FLAG_ACCELERATION_STRUCTURE_BUILD_INPUT) {
+    vk_buffer_usage |= VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+  }
+  return vk_buffer_usage;
+}
+
 static VkAccessFlags cgpu_translate_access_flags(
   CgpuMemoryAccessFlags flags)
 {
@@ -175,6 +242,10 @@ static VkAccessFlags cgpu_translate_access_flags(
               == CGPU_MEMORY_ACCESS_FLAG_MEMORY_WRITE) {
     vk_flags |= VK_ACCESS_MEMORY_WRITE_BIT;
   }
+  if ((flags & CGPU_MEMORY_ACCESS_FLAG_INDIRECT_COMMAND_READ)
+              == CGPU_MEMORY_ACCESS_FLAG_INDIRECT_COMMAND_READ) {
+    vk_flags |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+  }
   return vk_flags;
 }
 
@@ -332,6 +403,12 @@ static cgpu_physical_device_limits cgpu_translate_physical_device_limits(
   limits.optimalBufferCopyRowPitchAlignment = vk_limits.optimalBufferCopyRowPitchAlignment;
   limits.nonCoherentAtomSize = vk_limits.nonCoherentAtomSize;
   limits.subgroupSize = vk_subgroup_props.subgroupSize;
+  limits.minImportedHostPointerAlignment = 0;
+  limits.rayQuery = false;
+  limits.vendorID = 0;
+  limits.deviceID = 0;
+  limits.driverVersion = 0;
+  memset(limits.pipelineCacheUUID, 0, sizeof(limits.pipelineCacheUUID));
   return limits;
 }
 
@@ -965,6 +1042,8 @@ CgpuResult cgpu_initialize(
   resource_store_create(&ipipeline_store, sizeof(cgpu_ipipeline), 8);
   resource_store_create(&icommand_buffer_store, sizeof(cgpu_icommand_buffer), 16);
   resource_store_create(&ifence_store, sizeof(cgpu_ifence), 8);
+  resource_store_create(&iblas_store, sizeof(cgpu_iblas), 64);
+  resource_store_create(&itlas_store, sizeof(cgpu_itlas), 1);
 
   return CGPU_OK;
 }
@@ -978,6 +1057,8 @@ CgpuResult cgpu_destroy(void)
   resource_store_destroy(&ipipeline_store);
   resource_store_destroy(&icommand_buffer_store);
   resource_store_destroy(&ifence_store);
+  resource_store_destroy(&iblas_store);
+  resource_store_destroy(&itlas_store);
 
   vkDestroyInstance(iinstance.instance, NULL);
 
@@ -994,6 +1075,23 @@ CgpuResult cgpu_get_device_count(uint32_t* p_device_count)
   return CGPU_OK;
 }
 
+static bool cgpu_find_device_extension(
+  const char* p_extension_name,
+  uint32_t extension_count,
+  const VkExtensionProperties* p_extensions)
+{
+  for (uint32_t i = 0; i < extension_count; ++i) {
+    if (strcmp(p_extensions[i].extensionName, p_extension_name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Any number of devices can be used at the same time. Objects are kept in
+ * stores shared by all devices, so they must not be created or destroyed
+ * while other threads call cgpu. Recording and submitting commands only
+ * reads from the stores and may happen on one thread per device. */
 CgpuResult cgpu_create_device(
   uint32_t index,
   cgpu_device* p_device)
@@ -1056,7 +1154,8 @@ CgpuResult cgpu_create_device(
 
   if ((subgroup_properties.supportedStages & VK_QUEUE_COMPUTE_BIT) != VK_QUEUE_COMPUTE_BIT ||
       (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_BASIC_BIT) != VK_SUBGROUP_FEATURE_BASIC_BIT ||
-      (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT) != VK_SUBGROUP_FEATURE_BALLOT_BIT)
+      (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_BALLOT_BIT) != VK_SUBGROUP_FEATURE_BALLOT_BIT ||
+      (subgroup_properties.supportedOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT) != VK_SUBGROUP_FEATURE_ARITHMETIC_BIT)
   {
     resource_store_free_handle(&idevice_store, p_device->handle);
     return CGPU_FAIL_FEATURE_REQUIREMENTS_NOT_MET;
@@ -1064,6 +1163,10 @@ CgpuResult cgpu_create_device(
 
   idevice->limits =
     cgpu_translate_physical_device_limits(device_properties.properties.limits, subgroup_properties);
+  idevice->limits.vendorID = device_properties.properties.vendorID;
+  idevice->limits.deviceID = device_properties.properties.deviceID;
+  idevice->limits.driverVersion = device_properties.properties.driverVersion;
+  memcpy(idevice->limits.pipelineCacheUUID, device_properties.properties.pipelineCacheUUID, VK_UUID_SIZE);
 
   uint32_t device_ext_count;
   vkEnumerateDeviceExtensionProperties(
@@ -1095,25 +1198,153 @@ CgpuResult cgpu_create_device(
   };
   const uint32_t required_ext_count = 3;
 
+  const char* enabled_exts[MAX_ENABLED_DEVICE_EXTENSIONS];
+  uint32_t enabled_ext_count = 0;
+
   for (uint32_t i = 0; i < required_ext_count; ++i)
   {
     const char* required_ext = *(required_exts + i);
 
-    bool has_extension = false;
-    for (uint32_t e = 0; e < device_ext_count; ++e) {
-      const VkExtensionProperties* extension = &device_extensions[e];
-      if (strcmp(extension->extensionName, required_ext) == 0) {
-        has_extension = true;
-        break;
-      }
-    }
-
-    if (!has_extension) {
+    if (!cgpu_find_device_extension(required_ext, device_ext_count, device_extensions)) {
       resource_store_free_handle(&idevice_store, p_device->handle);
       return CGPU_FAIL_DEVICE_EXTENSION_NOT_SUPPORTED;
     }
+    enabled_exts[enabled_ext_count++] = required_ext;
+  }
+
+  /* Importing host memory lets callers hand mapped files to the GPU
+     without an intermediate copy. It is optional; without it, data
+     has to be uploaded through staging buffers. */
+  idevice->supports_external_memory_host =
+    cgpu_find_device_extension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME, device_ext_count, device_extensions);
+
+  if (idevice->supports_external_memory_host)
+  {
+    enabled_exts[enabled_ext_count++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT external_memory_host_properties;
+    external_memory_host_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+    external_memory_host_properties.pNext = NULL;
+
+    VkPhysicalDeviceProperties2 ext_device_properties;
+    ext_device_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    ext_device_properties.pNext = &external_memory_host_properties;
+
+    vkGetPhysicalDeviceProperties2(
+      idevice->physical_device,
+      &ext_device_properties
+    );
+
+    idevice->limits.minImportedHostPointerAlignment =
+      external_memory_host_properties.minImportedHostPointerAlignment;
+  }
+
+  /* Hardware ray queries are optional as well. If any of the extensions
+     or features is missing, callers have to fall back to their own
+     traversal code. Descriptor indexing is a dependency of acceleration
+     structures on Vulkan 1.1. */
+  const char* ray_query_exts[] = {
+    VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+    VK_KHR_RAY_QUERY_EXTENSION_NAME,
+    VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+    VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
+    VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+    VK_KHR_SPIRV_1_4_EXTENSION_NAME,
+    VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME
+  };
+  const uint32_t ray_query_ext_count = sizeof(ray_query_exts) / sizeof(ray_query_exts[0]);
+
+  bool supports_ray_query = true;
+
+  for (uint32_t i = 0; i < ray_query_ext_count; ++i)
+  {
+    if (!cgpu_find_device_extension(ray_query_exts[i], device_ext_count, device_extensions)) {
+      supports_ray_query = false;
+    }
+  }
+
+  VkPhysicalDeviceRayQueryFeaturesKHR features_ray_query;
+  features_ray_query.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+  features_ray_query.pNext = NULL;
+  features_ray_query.rayQuery = VK_FALSE;
+
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR features_acceleration_structure;
+  features_acceleration_structure.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+  features_acceleration_structure.pNext = &features_ray_query;
+  features_acceleration_structure.accelerationStructure = VK_FALSE;
+  features_acceleration_structure.accelerationStructureCaptureReplay = VK_FALSE;
+  features_acceleration_structure.accelerationStructureIndirectBuild = VK_FALSE;
+  features_acceleration_structure.accelerationStructureHostCommands = VK_FALSE;
+  features_acceleration_structure.descriptorBindingAccelerationStructureUpdateAfterBind = VK_FALSE;
+
+  /* None of the descriptor indexing features are needed. */
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT features_descriptor_indexing;
+  memset(&features_descriptor_indexing, 0, sizeof(features_descriptor_indexing));
+  features_descriptor_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  features_descriptor_indexing.pNext = &features_acceleration_structure;
+
+  VkPhysicalDeviceBufferDeviceAddressFeaturesKHR features_buffer_device_address;
+  features_buffer_device_address.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+  features_buffer_device_address.pNext = &features_descriptor_indexing;
+  features_buffer_device_address.bufferDeviceAddress = VK_FALSE;
+  features_buffer_device_address.bufferDeviceAddressCaptureReplay = VK_FALSE;
+  features_buffer_device_address.bufferDeviceAddressMultiDevice = VK_FALSE;
+
+  if (supports_ray_query)
+  {
+    VkPhysicalDeviceFeatures2 ext_device_features;
+    ext_device_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    ext_device_features.pNext = &features_buffer_device_address;
+
+    vkGetPhysicalDeviceFeatures2(
+      idevice->physical_device,
+      &ext_device_features
+    );
+
+    supports_ray_query =
+      features_buffer_device_address.bufferDeviceAddress &&
+      features_acceleration_structure.accelerationStructure &&
+      features_ray_query.rayQuery;
+  }
+
+  if (supports_ray_query)
+  {
+    for (uint32_t i = 0; i < ray_query_ext_count; ++i)
+    {
+      enabled_exts[enabled_ext_count++] = ray_query_exts[i];
+    }
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR acceleration_structure_properties;
+    acceleration_structure_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+    acceleration_structure_properties.pNext = NULL;
+
+    VkPhysicalDeviceProperties2 ext_device_properties;
+    ext_device_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    ext_device_properties.pNext = &acceleration_structure_properties;
+
+    vkGetPhysicalDeviceProperties2(
+      idevice->physical_device,
+      &ext_device_properties
+    );
+
+    idevice->min_scratch_offset_alignment =
+      acceleration_structure_properties.minAccelerationStructureScratchOffsetAlignment;
   }
 
+  /* Of the queried features, only enable the ones we need. */
+  features_buffer_device_address.bufferDeviceAddressCaptureReplay = VK_FALSE;
+  features_buffer_device_address.bufferDeviceAddressMultiDevice = VK_FALSE;
+  features_acceleration_structure.accelerationStructureCaptureReplay = VK_FALSE;
+  features_acceleration_structure.accelerationStructureIndirectBuild = VK_FALSE;
+  features_acceleration_structure.accelerationStructureHostCommands = VK_FALSE;
+  features_acceleration_structure.descriptorBindingAccelerationStructureUpdateAfterBind = VK_FALSE;
+
+  memset(&features_descriptor_indexing, 0, sizeof(features_descriptor_indexing));
+  features_descriptor_indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  features_descriptor_indexing.pNext = &features_acceleration_structure;
+
+  idevice->limits.rayQuery = supports_ray_query;
+
   uint32_t queue_family_count = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(
     idevice->physical_device,
@@ -1162,7 +1393,7 @@ CgpuResult cgpu_create_device(
 
   VkPhysicalDeviceShaderFloat16Int8Features features_shader_float16_int8;
   features_shader_float16_int8.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_FLOAT16_INT8_FEATURES;
-  features_shader_float16_int8.pNext = NULL;
+  features_shader_float16_int8.pNext = supports_ray_query ? &features_buffer_device_address : NULL;
   features_shader_float16_int8.shaderFloat16 = VK_FALSE;
   features_shader_float16_int8.shaderInt8 = VK_TRUE;
 
@@ -1242,8 +1473,8 @@ CgpuResult cgpu_create_device(
    nowadays, there is no difference to instance validation layers. */
   device_create_info.enabledLayerCount = 0;
   device_create_info.ppEnabledLayerNames = NULL;
-  device_create_info.enabledExtensionCount = required_ext_count;
-  device_create_info.ppEnabledExtensionNames = required_exts;
+  device_create_info.enabledExtensionCount = enabled_ext_count;
+  device_create_info.ppEnabledExtensionNames = enabled_exts;
   device_create_info.pEnabledFeatures = NULL;
 
   VkResult result = vkCreateDevice(
@@ -1272,7 +1503,8 @@ CgpuResult cgpu_create_device(
   VkCommandPoolCreateInfo pool_info;
   pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   pool_info.pNext = NULL;
-  pool_info.flags = 0;
+  /* Allow command buffers to be re-recorded, e.g. for pipelined uploads. */
+  pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   pool_info.queueFamilyIndex = queue_family_index;
 
   result = idevice->table.vkCreateCommandPool(
@@ -1371,6 +1603,68 @@ CgpuResult cgpu_create_device(
     return CGPU_FAIL_UNABLE_TO_CREATE_QUERY_POOL;
   }
 
+  /* Starts out empty. Callers can fill it with the data of a previous run. */
+  VkPipelineCacheCreateInfo pipeline_cache_info;
+  pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_info.pNext = NULL;
+  pipeline_cache_info.flags = 0;
+  pipeline_cache_info.initialDataSize = 0;
+  pipeline_cache_info.pInitialData = NULL;
+
+  result = idevice->table.vkCreatePipelineCache(
+    idevice->logical_device,
+    &pipeline_cache_info,
+    NULL,
+    &idevice->pipeline_cache
+  );
+
+  if (result != VK_SUCCESS)
+  {
+    resource_store_free_handle(&idevice_store, p_device->handle);
+
+    idevice->table.vkDestroyQueryPool(
+      idevice->logical_device,
+      idevice->timestamp_pool,
+      NULL
+    );
+    idevice->table.vkDestroySampler(
+      idevice->logical_device,
+      idevice->sampler,
+      NULL
+    );
+    idevice->table.vkDestroyCommandPool(
+      idevice->logical_device,
+      idevice->command_pool,
+      NULL
+    );
+    idevice->table.vkDestroyDevice(
+      idevice->logical_device,
+      NULL
+    );
+    return CGPU_FAIL_UNABLE_TO_CREATE_PIPELINE_CACHE;
+  }
+
+  VkPhysicalDeviceMemoryProperties physical_device_memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(
+    idevice->physical_device,
+    &physical_device_memory_properties
+  );
+
+  /* Resources are suballocated from larger blocks, which keeps us far from
+     maxMemoryAllocationCount and makes resource creation cheap. */
+  const uint64_t min_alignment =
+    (idevice->limits.bufferImageGranularity > idevice->limits.nonCoherentAtomSize) ?
+      idevice->limits.bufferImageGranularity : idevice->limits.nonCoherentAtomSize;
+
+  allocator_create(
+    &idevice->allocator,
+    idevice->logical_device,
+    &idevice->table,
+    &physical_device_memory_properties,
+    min_alignment,
+    supports_ray_query
+  );
+
   return CGPU_OK;
 }
 
@@ -1382,6 +1676,13 @@ CgpuResult cgpu_destroy_device(
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
+  allocator_destroy(&idevice->allocator);
+
+  idevice->table.vkDestroyPipelineCache(
+    idevice->logical_device,
+    idevice->pipeline_cache,
+    NULL
+  );
   idevice->table.vkDestroyQueryPool(
     idevice->logical_device,
     idevice->timestamp_pool,
@@ -1471,57 +1772,55 @@ CgpuResult cgpu_destroy_shader(
   return CGPU_OK;
 }
 
-CgpuResult cgpu_create_buffer(
-  cgpu_device device,
-  CgpuBufferUsageFlags usage,
-  CgpuMemoryPropertyFlags memory_properties,
+/* Suballocations of host-visible blocks stay mapped for their whole
+   lifetime, since Vulkan doesn't allow mapping one memory object twice.
+   Only dedicated allocations are actually mapped and unmapped. */
+static VkResult cgpu_map_allocation(
+  cgpu_idevice* idevice,
+  const allocator_allocation* allocation,
+  uint64_t offset,
   uint64_t size,
-  cgpu_buffer* p_buffer)
+  void** pp_mapped_mem)
 {
-  cgpu_idevice* idevice;
-  if (!cgpu_resolve_device(device, &idevice)) {
-    return CGPU_FAIL_INVALID_HANDLE;
+  if (allocation->mapped)
+  {
+    *pp_mapped_mem = (uint8_t*) allocation->mapped + offset;
+    return VK_SUCCESS;
   }
 
-  p_buffer->handle = resource_store_create_handle(&ibuffer_store);
-
-  cgpu_ibuffer* ibuffer;
-  if (!cgpu_resolve_buffer(*p_buffer, &ibuffer)) {
-    return CGPU_FAIL_INVALID_HANDLE;
-  }
+  return idevice->table.vkMapMemory(
+    idevice->logical_device,
+    allocation->memory,
+    allocation->offset + offset,
+    size,
+    0,
+    pp_mapped_mem
+  );
+}
 
-  VkBufferUsageFlags vk_buffer_usage = 0;
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC)
-        == CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-  }
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST)
-        == CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-  }
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_UNIFORM_BUFFER)
-        == CGPU_BUFFER_USAGE_FLAG_UNIFORM_BUFFER) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-  }
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER)
-        == CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-  }
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_UNIFORM_TEXEL_BUFFER)
-        == CGPU_BUFFER_USAGE_FLAG_UNIFORM_TEXEL_BUFFER) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT;
-  }
-  if ((usage & CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER)
-        == CGPU_BUFFER_USAGE_FLAG_STORAGE_TEXEL_BUFFER) {
-    vk_buffer_usage |= VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT;
+static void cgpu_unmap_allocation(
+  cgpu_idevice* idevice,
+  const allocator_allocation* allocation)
+{
+  if (!allocation->mapped) {
+    idevice->table.vkUnmapMemory(idevice->logical_device, allocation->memory);
   }
+}
 
+static CgpuResult cgpu_create_ibuffer(
+  cgpu_idevice* idevice,
+  VkBufferUsageFlags usage,
+  VkMemoryPropertyFlags mem_flags,
+  allocator_strategy strategy,
+  uint64_t size,
+  cgpu_ibuffer* ibuffer)
+{
   VkBufferCreateInfo buffer_info;
   buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   buffer_info.pNext = NULL;
   buffer_info.flags = 0;
   buffer_info.size = size;
-  buffer_info.usage = vk_buffer_usage;
+  buffer_info.usage = usage;
   buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   buffer_info.queueFamilyIndexCount = 0;
   buffer_info.pQueueFamilyIndices = NULL;
@@ -1533,7 +1832,6 @@ CgpuResult cgpu_create_buffer(
     &ibuffer->buffer
   );
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
     return CGPU_FAIL_UNABLE_TO_CREATE_BUFFER;
   }
 
@@ -1550,9 +1848,6 @@ CgpuResult cgpu_create_buffer(
     &mem_requirements
   );
 
-  const VkMemoryPropertyFlags mem_flags =
-      cgpu_translate_memory_properties(memory_properties);
-
   int32_t mem_index = -1;
   for (uint32_t i = 0; i < physical_device_memory_properties.memoryTypeCount; ++i) {
     if ((mem_requirements.memoryTypeBits & (1 << i)) &&
@@ -1562,25 +1857,18 @@ CgpuResult cgpu_create_buffer(
     }
   }
   if (mem_index == -1) {
-    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
     idevice->table.vkDestroyBuffer(idevice->logical_device, ibuffer->buffer, NULL);
     return CGPU_FAIL_NO_SUITABLE_MEMORY_TYPE;
   }
 
-  VkMemoryAllocateInfo mem_alloc_info;
-  mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  mem_alloc_info.pNext = NULL;
-  mem_alloc_info.allocationSize = mem_requirements.size;
-  mem_alloc_info.memoryTypeIndex = mem_index;
-
-  result = idevice->table.vkAllocateMemory(
-    idevice->logical_device,
-    &mem_alloc_info,
-    NULL,
-    &ibuffer->memory
+  result = allocator_allocate(
+    &idevice->allocator,
+    &mem_requirements,
+    mem_index,
+    strategy,
+    &ibuffer->allocation
   );
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
     idevice->table.vkDestroyBuffer(idevice->logical_device, ibuffer->buffer, NULL);
     return CGPU_FAIL_UNABLE_TO_ALLOCATE_MEMORY;
   }
@@ -1588,8 +1876,8 @@ CgpuResult cgpu_create_buffer(
   idevice->table.vkBindBufferMemory(
     idevice->logical_device,
     ibuffer->buffer,
-    ibuffer->memory,
-    0
+    ibuffer->allocation.memory,
+    ibuffer->allocation.offset
   );
 
   ibuffer->size = size;
@@ -1597,104 +1885,276 @@ CgpuResult cgpu_create_buffer(
   return CGPU_OK;
 }
 
-CgpuResult cgpu_destroy_buffer(
-  cgpu_device device,
-  cgpu_buffer buffer)
+static void cgpu_destroy_ibuffer(
+  cgpu_idevice* idevice,
+  cgpu_ibuffer* ibuffer)
 {
-  cgpu_idevice* idevice;
-  if (!cgpu_resolve_device(device, &idevice)) {
-    return CGPU_FAIL_INVALID_HANDLE;
-  }
-  cgpu_ibuffer* ibuffer;
-  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
-    return CGPU_FAIL_INVALID_HANDLE;
-  }
-
   idevice->table.vkDestroyBuffer(
     idevice->logical_device,
     ibuffer->buffer,
     NULL
   );
-  idevice->table.vkFreeMemory(
-    idevice->logical_device,
-    ibuffer->memory,
-    NULL
-  );
-
-  resource_store_free_handle(&ibuffer_store, buffer.handle);
-
-  return CGPU_OK;
+  allocator_free(&idevice->allocator, &ibuffer->allocation);
 }
 
-CgpuResult cgpu_map_buffer(
+CgpuResult cgpu_create_buffer(
   cgpu_device device,
-  cgpu_buffer buffer,
-  uint64_t offset,
+  CgpuBufferUsageFlags usage,
+  CgpuMemoryPropertyFlags memory_properties,
   uint64_t size,
-  void** pp_mapped_mem)
+  cgpu_buffer* p_buffer)
 {
   cgpu_idevice* idevice;
   if (!cgpu_resolve_device(device, &idevice)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
+
+  p_buffer->handle = resource_store_create_handle(&ibuffer_store);
+
   cgpu_ibuffer* ibuffer;
-  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+  if (!cgpu_resolve_buffer(*p_buffer, &ibuffer)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  const VkResult result = idevice->table.vkMapMemory(
-    idevice->logical_device,
-    ibuffer->memory,
-    offset,
-    (size == CGPU_WHOLE_SIZE) ? ibuffer->size : size,
-    0,
-    pp_mapped_mem
+  const VkBufferUsageFlags vk_buffer_usage =
+    cgpu_translate_buffer_usage_flags(usage);
+
+  const VkMemoryPropertyFlags mem_flags =
+      cgpu_translate_memory_properties(memory_properties);
+
+  const CgpuResult result = cgpu_create_ibuffer(
+    idevice,
+    vk_buffer_usage,
+    mem_flags,
+    ALLOCATOR_STRATEGY_BUDDY,
+    size,
+    ibuffer
   );
 
-  if (result != VK_SUCCESS) {
-    return CGPU_FAIL_UNABLE_TO_MAP_MEMORY;
+  if (result != CGPU_OK) {
+    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
+    return result;
   }
 
   return CGPU_OK;
 }
 
-CgpuResult cgpu_unmap_buffer(
+/* Wraps existing host memory without copying it. Both the pointer and the
+   size have to be multiples of minImportedHostPointerAlignment, and the
+   memory has to outlive the buffer. */
+CgpuResult cgpu_create_buffer_from_host_memory(
   cgpu_device device,
-  cgpu_buffer buffer)
+  CgpuBufferUsageFlags usage,
+  void* p_host_memory,
+  uint64_t size,
+  cgpu_buffer* p_buffer)
 {
   cgpu_idevice* idevice;
   if (!cgpu_resolve_device(device, &idevice)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
-  cgpu_ibuffer* ibuffer;
-  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
-    return CGPU_FAIL_INVALID_HANDLE;
+
+  if (!idevice->supports_external_memory_host) {
+    return CGPU_FAIL_DEVICE_EXTENSION_NOT_SUPPORTED;
   }
-  idevice->table.vkUnmapMemory(
-    idevice->logical_device,
-    ibuffer->memory
-  );
-  return CGPU_OK;
-}
 
-CgpuResult cgpu_create_image(
-  cgpu_device device,
-  uint32_t width,
-  uint32_t height,
-  CgpuImageFormat format,
-  CgpuImageUsageFlags usage,
-  CgpuMemoryPropertyFlags memory_properties,
-  cgpu_image* p_image)
-{
-  cgpu_idevice* idevice;
-  if (!cgpu_resolve_device(device, &idevice)) {
-    return CGPU_FAIL_INVALID_HANDLE;
+  const uint64_t alignment = idevice->limits.minImportedHostPointerAlignment;
+  if (((uintptr_t) p_host_memory % alignment) != 0 || (size % alignment) != 0) {
+    return CGPU_FAIL_HOST_MEMORY_NOT_ALIGNED;
   }
 
-  p_image->handle = resource_store_create_handle(&iimage_store);
+  VkMemoryHostPointerPropertiesEXT host_pointer_properties;
+  host_pointer_properties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+  host_pointer_properties.pNext = NULL;
 
-  cgpu_iimage* iimage;
-  if (!cgpu_resolve_image(*p_image, &iimage)) {
+  VkResult result = idevice->table.vkGetMemoryHostPointerPropertiesEXT(
+    idevice->logical_device,
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    p_host_memory,
+    &host_pointer_properties
+  );
+  if (result != VK_SUCCESS) {
+    return CGPU_FAIL_UNABLE_TO_IMPORT_HOST_MEMORY;
+  }
+
+  p_buffer->handle = resource_store_create_handle(&ibuffer_store);
+
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(*p_buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  VkExternalMemoryBufferCreateInfo external_buffer_info;
+  external_buffer_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+  external_buffer_info.pNext = NULL;
+  external_buffer_info.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+  VkBufferCreateInfo buffer_info;
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext = &external_buffer_info;
+  buffer_info.flags = 0;
+  buffer_info.size = size;
+  buffer_info.usage = cgpu_translate_buffer_usage_flags(usage);
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buffer_info.queueFamilyIndexCount = 0;
+  buffer_info.pQueueFamilyIndices = NULL;
+
+  result = idevice->table.vkCreateBuffer(
+    idevice->logical_device,
+    &buffer_info,
+    NULL,
+    &ibuffer->buffer
+  );
+  if (result != VK_SUCCESS) {
+    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
+    return CGPU_FAIL_UNABLE_TO_CREATE_BUFFER;
+  }
+
+  VkMemoryRequirements mem_requirements;
+  idevice->table.vkGetBufferMemoryRequirements(
+    idevice->logical_device,
+    ibuffer->buffer,
+    &mem_requirements
+  );
+
+  /* The memory type has to be compatible with both the buffer
+     and the host allocation. Any such type will do. */
+  const uint32_t mem_type_bits =
+    mem_requirements.memoryTypeBits & host_pointer_properties.memoryTypeBits;
+
+  int32_t mem_index = -1;
+  for (uint32_t i = 0; i < 32; ++i) {
+    if (mem_type_bits & (1u << i)) {
+      mem_index = i;
+      break;
+    }
+  }
+  if (mem_index == -1) {
+    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
+    idevice->table.vkDestroyBuffer(idevice->logical_device, ibuffer->buffer, NULL);
+    return CGPU_FAIL_NO_SUITABLE_MEMORY_TYPE;
+  }
+
+  VkImportMemoryHostPointerInfoEXT import_info;
+  import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+  import_info.pNext = NULL;
+  import_info.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+  import_info.pHostPointer = p_host_memory;
+
+  VkMemoryAllocateInfo mem_alloc_info;
+  mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  mem_alloc_info.pNext = &import_info;
+  mem_alloc_info.allocationSize = size;
+  mem_alloc_info.memoryTypeIndex = mem_index;
+
+  result = allocator_allocate_dedicated(
+    &idevice->allocator,
+    &mem_alloc_info,
+    &ibuffer->allocation
+  );
+  if (result != VK_SUCCESS) {
+    resource_store_free_handle(&ibuffer_store, p_buffer->handle);
+    idevice->table.vkDestroyBuffer(idevice->logical_device, ibuffer->buffer, NULL);
+    return CGPU_FAIL_UNABLE_TO_IMPORT_HOST_MEMORY;
+  }
+
+  idevice->table.vkBindBufferMemory(
+    idevice->logical_device,
+    ibuffer->buffer,
+    ibuffer->allocation.memory,
+    0
+  );
+
+  ibuffer->size = size;
+
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_destroy_buffer(
+  cgpu_device device,
+  cgpu_buffer buffer)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  cgpu_destroy_ibuffer(idevice, ibuffer);
+
+  resource_store_free_handle(&ibuffer_store, buffer.handle);
+
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_map_buffer(
+  cgpu_device device,
+  cgpu_buffer buffer,
+  uint64_t offset,
+  uint64_t size,
+  void** pp_mapped_mem)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  const VkResult result = cgpu_map_allocation(
+    idevice,
+    &ibuffer->allocation,
+    offset,
+    (size == CGPU_WHOLE_SIZE) ? ibuffer->size : size,
+    pp_mapped_mem
+  );
+
+  if (result != VK_SUCCESS) {
+    return CGPU_FAIL_UNABLE_TO_MAP_MEMORY;
+  }
+
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_unmap_buffer(
+  cgpu_device device,
+  cgpu_buffer buffer)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_unmap_allocation(idevice, &ibuffer->allocation);
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_create_image(
+  cgpu_device device,
+  uint32_t width,
+  uint32_t height,
+  CgpuImageFormat format,
+  CgpuImageUsageFlags usage,
+  CgpuMemoryPropertyFlags memory_properties,
+  cgpu_image* p_image)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  p_image->handle = resource_store_create_handle(&iimage_store);
+
+  cgpu_iimage* iimage;
+  if (!cgpu_resolve_image(*p_image, &iimage)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
@@ -1788,17 +2248,12 @@ CgpuResult cgpu_create_image(
     return CGPU_FAIL_NO_SUITABLE_MEMORY_TYPE;
   }
 
-  VkMemoryAllocateInfo mem_alloc_info;
-  mem_alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  mem_alloc_info.pNext = NULL;
-  mem_alloc_info.allocationSize = mem_requirements.size;
-  mem_alloc_info.memoryTypeIndex = mem_index;
-
-  result = idevice->table.vkAllocateMemory(
-    idevice->logical_device,
-    &mem_alloc_info,
-    NULL,
-    &iimage->memory
+  result = allocator_allocate(
+    &idevice->allocator,
+    &mem_requirements,
+    mem_index,
+    ALLOCATOR_STRATEGY_BUDDY,
+    &iimage->allocation
   );
   if (result != VK_SUCCESS) {
     resource_store_free_handle(&iimage_store, p_image->handle);
@@ -1809,8 +2264,8 @@ CgpuResult cgpu_create_image(
   idevice->table.vkBindImageMemory(
     idevice->logical_device,
     iimage->image,
-    iimage->memory,
-    0
+    iimage->allocation.memory,
+    iimage->allocation.offset
   );
 
   iimage->size = mem_requirements.size;
@@ -1842,11 +2297,7 @@ CgpuResult cgpu_create_image(
   {
     resource_store_free_handle(&iimage_store, p_image->handle);
     idevice->table.vkDestroyImage(idevice->logical_device, iimage->image, NULL);
-    idevice->table.vkFreeMemory(
-      idevice->logical_device,
-      iimage->memory,
-      NULL
-    );
+    allocator_free(&idevice->allocator, &iimage->allocation);
   }
 
   return CGPU_OK;
@@ -1877,11 +2328,7 @@ CgpuResult cgpu_destroy_image(
     NULL
   );
 
-  idevice->table.vkFreeMemory(
-    idevice->logical_device,
-    iimage->memory,
-    NULL
-  );
+  allocator_free(&idevice->allocator, &iimage->allocation);
 
   resource_store_free_handle(&iimage_store, image.handle);
 
@@ -1904,12 +2351,11 @@ CgpuResult cgpu_map_image(
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  const VkResult result = idevice->table.vkMapMemory(
-    idevice->logical_device,
-    iimage->memory,
+  const VkResult result = cgpu_map_allocation(
+    idevice,
+    &iimage->allocation,
     offset,
     (size == CGPU_WHOLE_SIZE) ? iimage->size : size,
-    0,
     pp_mapped_mem
   );
 
@@ -1932,40 +2378,81 @@ CgpuResult cgpu_unmap_image(
   if (!cgpu_resolve_image(image, &iimage)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
-  idevice->table.vkUnmapMemory(
+  cgpu_unmap_allocation(idevice, &iimage->allocation);
+  return CGPU_OK;
+}
+
+/* The parts of a pipeline which are compiled by the driver. They are kept
+   apart from the handle storage, so that compilation can run on worker
+   threads. */
+typedef struct cgpu_pipeline_job {
+  cgpu_idevice*               idevice;
+  VkComputePipelineCreateInfo create_info;
+  VkSpecializationInfo        specialization_info;
+  VkSpecializationMapEntry    map_entries[MAX_SPECIALIZATION_CONSTANTS];
+  uint8_t                     specialization_data[MAX_SPECIALIZATION_BUFFER_SIZE];
+  VkPipeline                  pipeline;
+  VkResult                    result;
+} cgpu_pipeline_job;
+
+typedef struct cgpu_pipeline_worker {
+  cgpu_pipeline_job* jobs;
+  uint32_t           job_count;
+  uint32_t           first_job;
+  uint32_t           job_stride;
+} cgpu_pipeline_worker;
+
+static void cgpu_destroy_ipipeline(
+  cgpu_idevice* idevice,
+  cgpu_ipipeline* ipipeline)
+{
+  /* Destroying null handles is a no-op, which simplifies error handling. */
+  idevice->table.vkDestroyDescriptorPool(
+    idevice->logical_device,
+    ipipeline->descriptor_pool,
+    NULL
+  );
+  idevice->table.vkDestroyPipeline(
     idevice->logical_device,
-    iimage->memory
+    ipipeline->pipeline,
+    NULL
+  );
+  idevice->table.vkDestroyPipelineLayout(
+    idevice->logical_device,
+    ipipeline->layout,
+    NULL
+  );
+  idevice->table.vkDestroyDescriptorSetLayout(
+    idevice->logical_device,
+    ipipeline->descriptor_set_layout,
+    NULL
   );
-  return CGPU_OK;
 }
 
-CgpuResult cgpu_create_pipeline(
-  cgpu_device device,
-  uint32_t buffer_resource_count,
-  const cgpu_shader_resource_buffer* p_buffer_resources,
-  uint32_t shader_resource_count,
-  const cgpu_shader_resource_image* p_image_resources,
-  cgpu_shader shader,
-  const char* p_shader_entry_point,
-  uint32_t specialization_constant_count,
-  const cgpu_specialization_constant* specialization_constants,
-  uint32_t push_constants_size,
-  cgpu_pipeline* p_pipeline)
+/* Creates the layouts and the descriptor set of a pipeline and fills in the
+   job for compiling it. */
+static CgpuResult cgpu_prepare_ipipeline(
+  cgpu_idevice* idevice,
+  const cgpu_pipeline_create_info* p_create_info,
+  cgpu_ipipeline* ipipeline,
+  cgpu_pipeline_job* job)
 {
-  cgpu_idevice* idevice;
-  if (!cgpu_resolve_device(device, &idevice)) {
-    return CGPU_FAIL_INVALID_HANDLE;
-  }
+  const uint32_t buffer_resource_count = p_create_info->buffer_resource_count;
+  const uint32_t image_resource_count = p_create_info->image_resource_count;
+  const uint32_t tlas_resource_count = p_create_info->tlas_resource_count;
+  const cgpu_shader_resource_buffer* p_buffer_resources = p_create_info->p_buffer_resources;
+  const cgpu_shader_resource_image* p_image_resources = p_create_info->p_image_resources;
+  const cgpu_shader_resource_tlas* p_tlas_resources = p_create_info->p_tlas_resources;
+  const uint32_t specialization_constant_count = p_create_info->specialization_constant_count;
+  const cgpu_specialization_constant* specialization_constants = p_create_info->p_specialization_constants;
+
   cgpu_ishader* ishader;
-  if (!cgpu_resolve_shader(shader, &ishader)) {
+  if (!cgpu_resolve_shader(p_create_info->shader, &ishader)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  p_pipeline->handle = resource_store_create_handle(&ipipeline_store);
-
-  cgpu_ipipeline* ipipeline;
-  if (!cgpu_resolve_pipeline(*p_pipeline, &ipipeline)) {
-    return CGPU_FAIL_INVALID_HANDLE;
+  if (specialization_constant_count > MAX_SPECIALIZATION_CONSTANTS) {
+    return CGPU_FAIL_MAX_SPECIALIZATION_CONSTANTS_REACHED;
   }
 
   VkDescriptorSetLayoutBinding descriptor_set_bindings[MAX_DESCRIPTOR_SET_BINDINGS];
@@ -1981,7 +2468,7 @@ CgpuResult cgpu_create_pipeline(
     descriptor_set_layout_binding->pImmutableSamplers = NULL;
   }
 
-  for (uint32_t i = 0; i < shader_resource_count; ++i)
+  for (uint32_t i = 0; i < image_resource_count; ++i)
   {
     const cgpu_shader_resource_image* shader_resource_buffer = &p_image_resources[i];
     VkDescriptorSetLayoutBinding* descriptor_set_layout_binding =
@@ -1993,7 +2480,20 @@ CgpuResult cgpu_create_pipeline(
     descriptor_set_layout_binding->pImmutableSamplers = NULL;
   }
 
-  const uint32_t desc_set_binding_count = buffer_resource_count + shader_resource_count;
+  for (uint32_t i = 0; i < tlas_resource_count; ++i)
+  {
+    const cgpu_shader_resource_tlas* shader_resource_tlas = &p_tlas_resources[i];
+    VkDescriptorSetLayoutBinding* descriptor_set_layout_binding =
+        &descriptor_set_bindings[buffer_resource_count + image_resource_count + i];
+    descriptor_set_layout_binding->binding = shader_resource_tlas->binding;
+    descriptor_set_layout_binding->descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    descriptor_set_layout_binding->descriptorCount = 1;
+    descriptor_set_layout_binding->stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    descriptor_set_layout_binding->pImmutableSamplers = NULL;
+  }
+
+  const uint32_t desc_set_binding_count =
+    buffer_resource_count + image_resource_count + tlas_resource_count;
 
   VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info;
   descriptor_set_layout_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -2010,14 +2510,13 @@ CgpuResult cgpu_create_pipeline(
   );
 
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
     return CGPU_FAIL_UNABLE_TO_CREATE_DESCRIPTOR_LAYOUT;
   }
 
   VkPushConstantRange push_const_range;
   push_const_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
   push_const_range.offset = 0;
-  push_const_range.size = push_constants_size;
+  push_const_range.size = p_create_info->push_constants_size;
 
   VkPipelineLayoutCreateInfo pipeline_layout_create_info;
   pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -2025,7 +2524,7 @@ CgpuResult cgpu_create_pipeline(
   pipeline_layout_create_info.flags = 0;
   pipeline_layout_create_info.setLayoutCount = 1;
   pipeline_layout_create_info.pSetLayouts = &ipipeline->descriptor_set_layout;
-  pipeline_layout_create_info.pushConstantRangeCount = push_constants_size ? 1 : 0;
+  pipeline_layout_create_info.pushConstantRangeCount = p_create_info->push_constants_size ? 1 : 0;
   pipeline_layout_create_info.pPushConstantRanges = &push_const_range;
 
   result = idevice->table.vkCreatePipelineLayout(
@@ -2035,144 +2534,38 @@ CgpuResult cgpu_create_pipeline(
     &ipipeline->layout
   );
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-    idevice->table.vkDestroyDescriptorSetLayout(
-      idevice->logical_device,
-      ipipeline->descriptor_set_layout,
-      NULL
-    );
     return CGPU_FAIL_UNABLE_TO_CREATE_PIPELINE_LAYOUT;
   }
 
-  if (specialization_constant_count > MAX_SPECIALIZATION_CONSTANTS)
-  {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-    idevice->table.vkDestroyDescriptorSetLayout(
-      idevice->logical_device,
-      ipipeline->descriptor_set_layout,
-      NULL
-    );
-    return CGPU_FAIL_MAX_SPECIALIZATION_CONSTANTS_REACHED;
-  }
+  VkDescriptorPoolSize descriptor_pool_sizes[2];
+  uint32_t descriptor_pool_size_count = 0;
 
-  VkSpecializationInfo stage_specialization;
-  uint8_t specialization_buffer[MAX_SPECIALIZATION_BUFFER_SIZE];
-  VkSpecializationMapEntry vk_specialization_constants[MAX_SPECIALIZATION_CONSTANTS];
-  uint32_t specialization_buffer_size = 0;
+  VkDescriptorPoolSize* descriptor_pool_size = &descriptor_pool_sizes[descriptor_pool_size_count++];
+  descriptor_pool_size->type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  descriptor_pool_size->descriptorCount = buffer_resource_count + image_resource_count;
 
-  if (specialization_constant_count > 0)
+  if (tlas_resource_count > 0)
   {
-    stage_specialization.pData = &specialization_buffer;
-    stage_specialization.mapEntryCount = specialization_constant_count;
-    stage_specialization.pMapEntries = vk_specialization_constants;
-
-    for (uint32_t i = 0; i < specialization_constant_count; ++i)
-    {
-      VkSpecializationMapEntry* vk_spec_const = &vk_specialization_constants[i];
-      const cgpu_specialization_constant* spec_const = &specialization_constants[i];
-
-      if (specialization_buffer_size + spec_const->size > MAX_SPECIALIZATION_BUFFER_SIZE)
-      {
-        resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-        idevice->table.vkDestroyDescriptorSetLayout(
-          idevice->logical_device,
-          ipipeline->descriptor_set_layout,
-          NULL
-        );
-        return CGPU_FAIL_MAX_SPECIALIZATION_BUFFER_SIZE_REACHED;
-      }
-
-      vk_spec_const->constantID = spec_const->constant_id;
-      vk_spec_const->offset = specialization_buffer_size;
-      vk_spec_const->size = spec_const->size;
-      memcpy(
-        (void*)(&specialization_buffer[specialization_buffer_size]),
-        spec_const->p_data,
-        spec_const->size
-      );
-      specialization_buffer_size += spec_const->size;
-    }
-
-    stage_specialization.dataSize = specialization_buffer_size;
+    descriptor_pool_size = &descriptor_pool_sizes[descriptor_pool_size_count++];
+    descriptor_pool_size->type = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    descriptor_pool_size->descriptorCount = tlas_resource_count;
   }
 
-  VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info;
-  pipeline_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  pipeline_shader_stage_create_info.pNext = NULL;
-  pipeline_shader_stage_create_info.flags = 0;
-  pipeline_shader_stage_create_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-  pipeline_shader_stage_create_info.module = ishader->module;
-  pipeline_shader_stage_create_info.pName = p_shader_entry_point;
-  pipeline_shader_stage_create_info.pSpecializationInfo =
-    (specialization_constant_count > 0) ? &stage_specialization : NULL;
-
-  VkComputePipelineCreateInfo pipeline_create_info;
-  pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-  pipeline_create_info.pNext = NULL;
-  pipeline_create_info.flags = VK_PIPELINE_CREATE_DISPATCH_BASE;
-  pipeline_create_info.stage = pipeline_shader_stage_create_info;
-  pipeline_create_info.layout = ipipeline->layout;
-  pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
-  pipeline_create_info.basePipelineIndex = 0;
-
-  result = idevice->table.vkCreateComputePipelines(
+  VkDescriptorPoolCreateInfo descriptor_pool_create_info;
+  descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptor_pool_create_info.pNext = NULL;
+  descriptor_pool_create_info.flags = 0;
+  descriptor_pool_create_info.maxSets = 1;
+  descriptor_pool_create_info.poolSizeCount = descriptor_pool_size_count;
+  descriptor_pool_create_info.pPoolSizes = descriptor_pool_sizes;
+
+  result = idevice->table.vkCreateDescriptorPool(
     idevice->logical_device,
-    VK_NULL_HANDLE,
-    1,
-    &pipeline_create_info,
+    &descriptor_pool_create_info,
     NULL,
-    &ipipeline->pipeline
+    &ipipeline->descriptor_pool
   );
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-    idevice->table.vkDestroyPipelineLayout(
-      idevice->logical_device,
-      ipipeline->layout,
-      NULL
-    );
-    idevice->table.vkDestroyDescriptorSetLayout(
-      idevice->logical_device,
-      ipipeline->descriptor_set_layout,
-      NULL
-    );
-    return CGPU_FAIL_UNABLE_TO_CREATE_COMPUTE_PIPELINE;
-  }
-
-  VkDescriptorPoolSize descriptor_pool_size;
-  descriptor_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  descriptor_pool_size.descriptorCount = desc_set_binding_count;
-
-  VkDescriptorPoolCreateInfo descriptor_pool_create_info;
-  descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  descriptor_pool_create_info.pNext = NULL;
-  descriptor_pool_create_info.flags = 0;
-  descriptor_pool_create_info.maxSets = 1;
-  descriptor_pool_create_info.poolSizeCount = 1;
-  descriptor_pool_create_info.pPoolSizes = &descriptor_pool_size;
-
-  result = idevice->table.vkCreateDescriptorPool(
-    idevice->logical_device,
-    &descriptor_pool_create_info,
-    NULL,
-    &ipipeline->descriptor_pool
-  );
-  if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-    idevice->table.vkDestroyPipeline(
-      idevice->logical_device,
-      ipipeline->pipeline,
-      NULL
-    );
-    idevice->table.vkDestroyPipelineLayout(
-      idevice->logical_device,
-      ipipeline->layout,
-      NULL
-    );
-    idevice->table.vkDestroyDescriptorSetLayout(
-      idevice->logical_device,
-      ipipeline->descriptor_set_layout,
-      NULL
-    );
     return CGPU_FAIL_UNABLE_TO_CREATE_DESCRIPTOR_POOL;
   }
 
@@ -2189,148 +2582,849 @@ CgpuResult cgpu_create_pipeline(
     &ipipeline->descriptor_set
   );
   if (result != VK_SUCCESS) {
-    resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
-    idevice->table.vkDestroyDescriptorPool(
-      idevice->logical_device,
-      ipipeline->descriptor_pool,
-      NULL
+    return CGPU_FAIL_UNABLE_TO_ALLOCATE_DESCRIPTOR_SET;
+  }
+
+  VkDescriptorBufferInfo descriptor_buffer_infos[MAX_DESCRIPTOR_BUFFER_INFOS];
+  VkDescriptorImageInfo descriptor_image_infos[MAX_DESCRIPTOR_IMAGE_INFOS];
+  VkWriteDescriptorSetAccelerationStructureKHR descriptor_as_infos[MAX_DESCRIPTOR_AS_INFOS];
+  VkWriteDescriptorSet write_descriptor_sets[MAX_WRITE_DESCRIPTOR_SETS];
+
+  uint32_t write_desc_set_count = 0;
+
+  for (uint32_t i = 0; i < buffer_resource_count; ++i)
+  {
+    const cgpu_shader_resource_buffer* shader_resource_buffer = &p_buffer_resources[i];
+
+    cgpu_ibuffer* ibuffer;
+    const cgpu_buffer buffer = shader_resource_buffer->buffer;
+    if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+      return CGPU_FAIL_INVALID_HANDLE;
+    }
+
+    if ((shader_resource_buffer->offset % idevice->limits.minStorageBufferOffsetAlignment) != 0) {
+      return CGPU_FAIL_BUFFER_OFFSET_NOT_ALIGNED;
+    }
+
+    VkDescriptorBufferInfo* descriptor_buffer_info = &descriptor_buffer_infos[i];
+    descriptor_buffer_info->buffer = ibuffer->buffer;
+    descriptor_buffer_info->offset = shader_resource_buffer->offset;
+    descriptor_buffer_info->range =
+      (shader_resource_buffer->size == CGPU_WHOLE_SIZE) ?
+        ibuffer->size - shader_resource_buffer->offset :
+        shader_resource_buffer->size;
+
+    VkWriteDescriptorSet* write_descriptor_set = &write_descriptor_sets[write_desc_set_count];
+    write_descriptor_set->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set->pNext = NULL;
+    write_descriptor_set->dstSet = ipipeline->descriptor_set;
+    write_descriptor_set->dstBinding = shader_resource_buffer->binding;
+    write_descriptor_set->dstArrayElement = 0;
+    write_descriptor_set->descriptorCount = 1;
+    write_descriptor_set->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set->pImageInfo = NULL;
+    write_descriptor_set->pBufferInfo = descriptor_buffer_info;
+    write_descriptor_set->pTexelBufferView = NULL;
+    write_desc_set_count++;
+  }
+
+  for (uint32_t i = 0; i < image_resource_count; ++i)
+  {
+    const cgpu_shader_resource_image* shader_resource_image = &p_image_resources[i];
+
+    cgpu_iimage* iimage;
+    const cgpu_image image = shader_resource_image->image;
+    if (!cgpu_resolve_image(image, &iimage)) {
+      return CGPU_FAIL_INVALID_HANDLE;
+    }
+
+    VkDescriptorImageInfo* descriptor_image_info = &descriptor_image_infos[i];
+    descriptor_image_info->sampler = idevice->sampler;
+    descriptor_image_info->imageView = iimage->image_view;
+    descriptor_image_info->imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkWriteDescriptorSet* write_descriptor_set =
+      &write_descriptor_sets[write_desc_set_count];
+    write_descriptor_set->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set->pNext = NULL;
+    write_descriptor_set->dstSet = ipipeline->descriptor_set;
+    write_descriptor_set->dstBinding = shader_resource_image->binding;
+    write_descriptor_set->dstArrayElement = 0;
+    write_descriptor_set->descriptorCount = 1;
+    write_descriptor_set->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    write_descriptor_set->pImageInfo = descriptor_image_info;
+    write_descriptor_set->pBufferInfo = NULL;
+    write_descriptor_set->pTexelBufferView = NULL;
+    write_desc_set_count++;
+  }
+
+  for (uint32_t i = 0; i < tlas_resource_count; ++i)
+  {
+    const cgpu_shader_resource_tlas* shader_resource_tlas = &p_tlas_resources[i];
+
+    cgpu_itlas* itlas;
+    const cgpu_tlas tlas = shader_resource_tlas->tlas;
+    if (!cgpu_resolve_tlas(tlas, &itlas)) {
+      return CGPU_FAIL_INVALID_HANDLE;
+    }
+
+    VkWriteDescriptorSetAccelerationStructureKHR* descriptor_as_info = &descriptor_as_infos[i];
+    descriptor_as_info->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+    descriptor_as_info->pNext = NULL;
+    descriptor_as_info->accelerationStructureCount = 1;
+    descriptor_as_info->pAccelerationStructures = &itlas->as;
+
+    VkWriteDescriptorSet* write_descriptor_set =
+      &write_descriptor_sets[write_desc_set_count];
+    write_descriptor_set->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set->pNext = descriptor_as_info;
+    write_descriptor_set->dstSet = ipipeline->descriptor_set;
+    write_descriptor_set->dstBinding = shader_resource_tlas->binding;
+    write_descriptor_set->dstArrayElement = 0;
+    write_descriptor_set->descriptorCount = 1;
+    write_descriptor_set->descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    write_descriptor_set->pImageInfo = NULL;
+    write_descriptor_set->pBufferInfo = NULL;
+    write_descriptor_set->pTexelBufferView = NULL;
+    write_desc_set_count++;
+  }
+
+  idevice->table.vkUpdateDescriptorSets(
+    idevice->logical_device,
+    write_desc_set_count,
+    write_descriptor_sets,
+    0,
+    NULL
+  );
+
+  uint32_t specialization_buffer_size = 0;
+
+  for (uint32_t i = 0; i < specialization_constant_count; ++i)
+  {
+    VkSpecializationMapEntry* vk_spec_const = &job->map_entries[i];
+    const cgpu_specialization_constant* spec_const = &specialization_constants[i];
+
+    if (specialization_buffer_size + spec_const->size > MAX_SPECIALIZATION_BUFFER_SIZE) {
+      return CGPU_FAIL_MAX_SPECIALIZATION_BUFFER_SIZE_REACHED;
+    }
+
+    vk_spec_const->constantID = spec_const->constant_id;
+    vk_spec_const->offset = specialization_buffer_size;
+    vk_spec_const->size = spec_const->size;
+    memcpy(
+      (void*)(&job->specialization_data[specialization_buffer_size]),
+      spec_const->p_data,
+      spec_const->size
     );
-    idevice->table.vkDestroyPipeline(
+    specialization_buffer_size += spec_const->size;
+  }
+
+  job->specialization_info.mapEntryCount = specialization_constant_count;
+  job->specialization_info.pMapEntries = job->map_entries;
+  job->specialization_info.dataSize = specialization_buffer_size;
+  job->specialization_info.pData = job->specialization_data;
+
+  VkPipelineShaderStageCreateInfo pipeline_shader_stage_create_info;
+  pipeline_shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_shader_stage_create_info.pNext = NULL;
+  pipeline_shader_stage_create_info.flags = 0;
+  pipeline_shader_stage_create_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_shader_stage_create_info.module = ishader->module;
+  pipeline_shader_stage_create_info.pName = p_create_info->p_shader_entry_point;
+  pipeline_shader_stage_create_info.pSpecializationInfo =
+    (specialization_constant_count > 0) ? &job->specialization_info : NULL;
+
+  job->idevice = idevice;
+  job->create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  job->create_info.pNext = NULL;
+  job->create_info.flags = VK_PIPELINE_CREATE_DISPATCH_BASE;
+  job->create_info.stage = pipeline_shader_stage_create_info;
+  job->create_info.layout = ipipeline->layout;
+  job->create_info.basePipelineHandle = VK_NULL_HANDLE;
+  job->create_info.basePipelineIndex = 0;
+  job->pipeline = VK_NULL_HANDLE;
+  job->result = VK_NOT_READY;
+
+  return CGPU_OK;
+}
+
+static void cgpu_run_pipeline_worker(
+  void* data)
+{
+  const cgpu_pipeline_worker* worker = (const cgpu_pipeline_worker*) data;
+
+  for (uint32_t i = worker->first_job; i < worker->job_count; i += worker->job_stride)
+  {
+    cgpu_pipeline_job* job = &worker->jobs[i];
+    cgpu_idevice* idevice = job->idevice;
+
+    /* Pipeline caches are synchronized internally. */
+    job->result = idevice->table.vkCreateComputePipelines(
       idevice->logical_device,
-      ipipeline->pipeline,
-      NULL
+      idevice->pipeline_cache,
+      1,
+      &job->create_info,
+      NULL,
+      &job->pipeline
     );
-    idevice->table.vkDestroyPipelineLayout(
-      idevice->logical_device,
-      ipipeline->layout,
-      NULL
+  }
+}
+
+/* Shader compilation usually dominates pipeline creation, and drivers don't
+   necessarily parallelize it. Jobs are therefore distributed over worker
+   threads, with the calling thread taking the first share. */
+static void cgpu_run_pipeline_jobs(
+  uint32_t job_count,
+  cgpu_pipeline_job* jobs)
+{
+  uint32_t thread_count = cgpu_thread_hardware_concurrency();
+
+  if (thread_count > job_count) {
+    thread_count = job_count;
+  }
+  if (thread_count > MAX_PIPELINE_THREADS) {
+    thread_count = MAX_PIPELINE_THREADS;
+  }
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+
+  cgpu_pipeline_worker workers[MAX_PIPELINE_THREADS];
+  cgpu_thread* threads[MAX_PIPELINE_THREADS];
+  bool is_running[MAX_PIPELINE_THREADS];
+
+  for (uint32_t i = 0; i < thread_count; ++i)
+  {
+    workers[i].jobs = jobs;
+    workers[i].job_count = job_count;
+    workers[i].first_job = i;
+    workers[i].job_stride = thread_count;
+    is_running[i] = false;
+  }
+
+  for (uint32_t i = 1; i < thread_count; ++i) {
+    is_running[i] = cgpu_thread_create(cgpu_run_pipeline_worker, &workers[i], &threads[i]);
+  }
+
+  /* Shares of threads which couldn't be started are processed here. */
+  for (uint32_t i = 0; i < thread_count; ++i)
+  {
+    if (!is_running[i]) {
+      cgpu_run_pipeline_worker(&workers[i]);
+    }
+  }
+
+  for (uint32_t i = 1; i < thread_count; ++i)
+  {
+    if (is_running[i]) {
+      cgpu_thread_join(threads[i]);
+    }
+  }
+}
+
+CgpuResult cgpu_create_pipelines(
+  cgpu_device device,
+  uint32_t pipeline_count,
+  const cgpu_pipeline_create_info* p_create_infos,
+  cgpu_pipeline* p_pipelines)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  cgpu_pipeline_job* jobs = malloc(pipeline_count * sizeof(cgpu_pipeline_job));
+
+  CgpuResult c_result = CGPU_OK;
+  uint32_t created_count = 0;
+
+  for (; created_count < pipeline_count; ++created_count)
+  {
+    cgpu_pipeline* p_pipeline = &p_pipelines[created_count];
+    p_pipeline->handle = resource_store_create_handle(&ipipeline_store);
+
+    cgpu_ipipeline* ipipeline;
+    if (!cgpu_resolve_pipeline(*p_pipeline, &ipipeline))
+    {
+      c_result = CGPU_FAIL_INVALID_HANDLE;
+      break;
+    }
+
+    ipipeline->pipeline = VK_NULL_HANDLE;
+    ipipeline->layout = VK_NULL_HANDLE;
+    ipipeline->descriptor_set_layout = VK_NULL_HANDLE;
+    ipipeline->descriptor_set = VK_NULL_HANDLE;
+    ipipeline->descriptor_pool = VK_NULL_HANDLE;
+
+    c_result = cgpu_prepare_ipipeline(
+      idevice,
+      &p_create_infos[created_count],
+      ipipeline,
+      &jobs[created_count]
     );
-    idevice->table.vkDestroyDescriptorSetLayout(
-      idevice->logical_device,
-      ipipeline->descriptor_set_layout,
-      NULL
+
+    if (c_result != CGPU_OK)
+    {
+      cgpu_destroy_ipipeline(idevice, ipipeline);
+      resource_store_free_handle(&ipipeline_store, p_pipeline->handle);
+      break;
+    }
+  }
+
+  if (c_result == CGPU_OK) {
+    cgpu_run_pipeline_jobs(pipeline_count, jobs);
+  }
+
+  for (uint32_t i = 0; i < created_count; ++i)
+  {
+    if (jobs[i].result != VK_SUCCESS && c_result == CGPU_OK) {
+      c_result = CGPU_FAIL_UNABLE_TO_CREATE_COMPUTE_PIPELINE;
+    }
+  }
+
+  for (uint32_t i = 0; i < created_count; ++i)
+  {
+    cgpu_ipipeline* ipipeline;
+    if (!cgpu_resolve_pipeline(p_pipelines[i], &ipipeline)) {
+      continue;
+    }
+
+    if (jobs[i].result == VK_SUCCESS) {
+      ipipeline->pipeline = jobs[i].pipeline;
+    }
+
+    /* Either all pipelines are created, or none. */
+    if (c_result != CGPU_OK)
+    {
+      cgpu_destroy_ipipeline(idevice, ipipeline);
+      resource_store_free_handle(&ipipeline_store, p_pipelines[i].handle);
+    }
+  }
+
+  free(jobs);
+
+  return c_result;
+}
+
+CgpuResult cgpu_create_pipeline(
+  cgpu_device device,
+  uint32_t buffer_resource_count,
+  const cgpu_shader_resource_buffer* p_buffer_resources,
+  uint32_t shader_resource_count,
+  const cgpu_shader_resource_image* p_image_resources,
+  uint32_t tlas_resource_count,
+  const cgpu_shader_resource_tlas* p_tlas_resources,
+  cgpu_shader shader,
+  const char* p_shader_entry_point,
+  uint32_t specialization_constant_count,
+  const cgpu_specialization_constant* specialization_constants,
+  uint32_t push_constants_size,
+  cgpu_pipeline* p_pipeline)
+{
+  const cgpu_pipeline_create_info create_info = {
+    .buffer_resource_count         = buffer_resource_count,
+    .p_buffer_resources            = p_buffer_resources,
+    .image_resource_count          = shader_resource_count,
+    .p_image_resources             = p_image_resources,
+    .tlas_resource_count           = tlas_resource_count,
+    .p_tlas_resources              = p_tlas_resources,
+    .shader                        = shader,
+    .p_shader_entry_point          = p_shader_entry_point,
+    .specialization_constant_count = specialization_constant_count,
+    .p_specialization_constants    = specialization_constants,
+    .push_constants_size           = push_constants_size
+  };
+
+  return cgpu_create_pipelines(device, 1, &create_info, p_pipeline);
+}
+
+CgpuResult cgpu_destroy_pipeline(
+  cgpu_device device,
+  cgpu_pipeline pipeline)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ipipeline* ipipeline;
+  if (!cgpu_resolve_pipeline(pipeline, &ipipeline)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  cgpu_destroy_ipipeline(idevice, ipipeline);
+
+  resource_store_free_handle(&ipipeline_store, pipeline.handle);
+
+  return CGPU_OK;
+}
+
+static uint64_t cgpu_get_buffer_device_address(
+  cgpu_idevice* idevice,
+  VkBuffer buffer)
+{
+  VkBufferDeviceAddressInfoKHR address_info;
+  address_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+  address_info.pNext = NULL;
+  address_info.buffer = buffer;
+
+  return idevice->table.vkGetBufferDeviceAddressKHR(
+    idevice->logical_device,
+    &address_info
+  );
+}
+
+/* Builds an acceleration structure from a single geometry and waits for the
+   build to finish, so that the scratch memory can be released right away.
+   Scene geometry is static, hence we trade build time for trace speed and
+   don't allow updates. */
+static CgpuResult cgpu_build_acceleration_structure(
+  cgpu_idevice* idevice,
+  VkAccelerationStructureTypeKHR type,
+  const VkAccelerationStructureGeometryKHR* geometry,
+  uint32_t primitive_count,
+  VkAccelerationStructureKHR* p_as,
+  cgpu_ibuffer* p_buffer)
+{
+  VkAccelerationStructureBuildGeometryInfoKHR build_info;
+  build_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+  build_info.pNext = NULL;
+  build_info.type = type;
+  build_info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+  build_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+  build_info.srcAccelerationStructure = VK_NULL_HANDLE;
+  build_info.dstAccelerationStructure = VK_NULL_HANDLE;
+  build_info.geometryCount = 1;
+  build_info.pGeometries = geometry;
+  build_info.ppGeometries = NULL;
+  build_info.scratchData.deviceAddress = 0;
+
+  VkAccelerationStructureBuildSizesInfoKHR build_sizes;
+  build_sizes.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+  build_sizes.pNext = NULL;
+
+  idevice->table.vkGetAccelerationStructureBuildSizesKHR(
+    idevice->logical_device,
+    VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+    &build_info,
+    &primitive_count,
+    &build_sizes
+  );
+
+  CgpuResult c_result = cgpu_create_ibuffer(
+    idevice,
+    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    ALLOCATOR_STRATEGY_BUDDY,
+    build_sizes.accelerationStructureSize,
+    p_buffer
+  );
+  if (c_result != CGPU_OK) {
+    return c_result;
+  }
+
+  VkAccelerationStructureCreateInfoKHR as_create_info;
+  as_create_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+  as_create_info.pNext = NULL;
+  as_create_info.createFlags = 0;
+  as_create_info.buffer = p_buffer->buffer;
+  as_create_info.offset = 0;
+  as_create_info.size = build_sizes.accelerationStructureSize;
+  as_create_info.type = type;
+  as_create_info.deviceAddress = 0;
+
+  VkResult result = idevice->table.vkCreateAccelerationStructureKHR(
+    idevice->logical_device,
+    &as_create_info,
+    NULL,
+    p_as
+  );
+  if (result != VK_SUCCESS) {
+    cgpu_destroy_ibuffer(idevice, p_buffer);
+    return CGPU_FAIL_UNABLE_TO_CREATE_ACCELERATION_STRUCTURE;
+  }
+
+  /* The scratch address has to be aligned, which buffer creation alone
+     doesn't guarantee. We over-allocate and round it up instead. */
+  const uint64_t scratch_alignment = idevice->min_scratch_offset_alignment;
+
+  cgpu_ibuffer iscratch_buffer;
+  c_result = cgpu_create_ibuffer(
+    idevice,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    ALLOCATOR_STRATEGY_LINEAR,
+    build_sizes.buildScratchSize + scratch_alignment,
+    &iscratch_buffer
+  );
+  if (c_result != CGPU_OK)
+  {
+    idevice->table.vkDestroyAccelerationStructureKHR(idevice->logical_device, *p_as, NULL);
+    cgpu_destroy_ibuffer(idevice, p_buffer);
+    return c_result;
+  }
+
+  uint64_t scratch_address = cgpu_get_buffer_device_address(idevice, iscratch_buffer.buffer);
+
+  if (scratch_alignment > 0) {
+    scratch_address = ((scratch_address + scratch_alignment - 1) / scratch_alignment) * scratch_alignment;
+  }
+
+  build_info.dstAccelerationStructure = *p_as;
+  build_info.scratchData.deviceAddress = scratch_address;
+
+  VkAccelerationStructureBuildRangeInfoKHR build_range_info;
+  build_range_info.primitiveCount = primitive_count;
+  build_range_info.primitiveOffset = 0;
+  build_range_info.firstVertex = 0;
+  build_range_info.transformOffset = 0;
+
+  const VkAccelerationStructureBuildRangeInfoKHR* p_build_range_info = &build_range_info;
+
+  VkCommandBufferAllocateInfo cmdbuf_alloc_info;
+  cmdbuf_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  cmdbuf_alloc_info.pNext = NULL;
+  cmdbuf_alloc_info.commandPool = idevice->command_pool;
+  cmdbuf_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  cmdbuf_alloc_info.commandBufferCount = 1;
+
+  VkCommandBuffer command_buffer;
+  result = idevice->table.vkAllocateCommandBuffers(
+    idevice->logical_device,
+    &cmdbuf_alloc_info,
+    &command_buffer
+  );
+  if (result != VK_SUCCESS)
+  {
+    cgpu_destroy_ibuffer(idevice, &iscratch_buffer);
+    idevice->table.vkDestroyAccelerationStructureKHR(idevice->logical_device, *p_as, NULL);
+    cgpu_destroy_ibuffer(idevice, p_buffer);
+    return CGPU_FAIL_UNABLE_TO_ALLOCATE_COMMAND_BUFFER;
+  }
+
+  VkCommandBufferBeginInfo begin_info;
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = NULL;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = NULL;
+
+  idevice->table.vkBeginCommandBuffer(command_buffer, &begin_info);
+
+  idevice->table.vkCmdBuildAccelerationStructuresKHR(
+    command_buffer,
+    1,
+    &build_info,
+    &p_build_range_info
+  );
+
+  idevice->table.vkEndCommandBuffer(command_buffer);
+
+  VkFenceCreateInfo fence_info;
+  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fence_info.pNext = NULL;
+  fence_info.flags = 0;
+
+  VkFence fence;
+  result = idevice->table.vkCreateFence(
+    idevice->logical_device,
+    &fence_info,
+    NULL,
+    &fence
+  );
+
+  if (result == VK_SUCCESS)
+  {
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = NULL;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = NULL;
+    submit_info.pWaitDstStageMask = NULL;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = NULL;
+
+    result = idevice->table.vkQueueSubmit(
+      idevice->compute_queue,
+      1,
+      &submit_info,
+      fence
     );
-    return CGPU_FAIL_UNABLE_TO_ALLOCATE_DESCRIPTOR_SET;
+
+    if (result == VK_SUCCESS)
+    {
+      result = idevice->table.vkWaitForFences(
+        idevice->logical_device,
+        1,
+        &fence,
+        VK_TRUE,
+        UINT64_MAX
+      );
+    }
+
+    idevice->table.vkDestroyFence(idevice->logical_device, fence, NULL);
+  }
+
+  idevice->table.vkFreeCommandBuffers(
+    idevice->logical_device,
+    idevice->command_pool,
+    1,
+    &command_buffer
+  );
+
+  cgpu_destroy_ibuffer(idevice, &iscratch_buffer);
+
+  if (result != VK_SUCCESS)
+  {
+    idevice->table.vkDestroyAccelerationStructureKHR(idevice->logical_device, *p_as, NULL);
+    cgpu_destroy_ibuffer(idevice, p_buffer);
+    return CGPU_FAIL_UNABLE_TO_CREATE_ACCELERATION_STRUCTURE;
+  }
+
+  return CGPU_OK;
+}
+
+/* Both buffers need the shader device address and acceleration structure
+   build input usage flags. Vertex positions are three floats at the start
+   of each vertex, indices are 32-bit triples. */
+CgpuResult cgpu_create_blas(
+  cgpu_device device,
+  cgpu_buffer vertex_buffer,
+  uint64_t vertex_offset,
+  uint32_t vertex_count,
+  uint64_t vertex_stride,
+  cgpu_buffer index_buffer,
+  uint64_t index_offset,
+  uint32_t triangle_count,
+  cgpu_blas* p_blas)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ivertex_buffer;
+  if (!cgpu_resolve_buffer(vertex_buffer, &ivertex_buffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* iindex_buffer;
+  if (!cgpu_resolve_buffer(index_buffer, &iindex_buffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  if (!idevice->limits.rayQuery) {
+    return CGPU_FAIL_FEATURE_REQUIREMENTS_NOT_MET;
+  }
+
+  p_blas->handle = resource_store_create_handle(&iblas_store);
+
+  cgpu_iblas* iblas;
+  if (!cgpu_resolve_blas(*p_blas, &iblas)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  VkAccelerationStructureGeometryTrianglesDataKHR triangles_data;
+  triangles_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+  triangles_data.pNext = NULL;
+  triangles_data.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+  triangles_data.vertexData.deviceAddress =
+    cgpu_get_buffer_device_address(idevice, ivertex_buffer->buffer) + vertex_offset;
+  triangles_data.vertexStride = vertex_stride;
+  triangles_data.maxVertex = vertex_count - 1;
+  triangles_data.indexType = VK_INDEX_TYPE_UINT32;
+  triangles_data.indexData.deviceAddress =
+    cgpu_get_buffer_device_address(idevice, iindex_buffer->buffer) + index_offset;
+  triangles_data.transformData.deviceAddress = 0;
+
+  VkAccelerationStructureGeometryKHR geometry;
+  geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+  geometry.pNext = NULL;
+  geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+  geometry.geometry.triangles = triangles_data;
+  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+
+  const CgpuResult result = cgpu_build_acceleration_structure(
+    idevice,
+    VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+    &geometry,
+    triangle_count,
+    &iblas->as,
+    &iblas->buffer
+  );
+
+  if (result != CGPU_OK) {
+    resource_store_free_handle(&iblas_store, p_blas->handle);
+    return result;
+  }
+
+  VkAccelerationStructureDeviceAddressInfoKHR address_info;
+  address_info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+  address_info.pNext = NULL;
+  address_info.accelerationStructure = iblas->as;
+
+  iblas->address = idevice->table.vkGetAccelerationStructureDeviceAddressKHR(
+    idevice->logical_device,
+    &address_info
+  );
+
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_destroy_blas(
+  cgpu_device device,
+  cgpu_blas blas)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_iblas* iblas;
+  if (!cgpu_resolve_blas(blas, &iblas)) {
+    return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  VkDescriptorBufferInfo descriptor_buffer_infos[MAX_DESCRIPTOR_BUFFER_INFOS];
-  VkDescriptorImageInfo descriptor_image_infos[MAX_DESCRIPTOR_IMAGE_INFOS];
-  VkWriteDescriptorSet write_descriptor_sets[MAX_WRITE_DESCRIPTOR_SETS];
+  idevice->table.vkDestroyAccelerationStructureKHR(
+    idevice->logical_device,
+    iblas->as,
+    NULL
+  );
+  cgpu_destroy_ibuffer(idevice, &iblas->buffer);
 
-  uint32_t write_desc_set_count = 0;
+  resource_store_free_handle(&iblas_store, blas.handle);
 
-  for (uint32_t i = 0; i < buffer_resource_count; ++i)
-  {
-    const cgpu_shader_resource_buffer* shader_resource_buffer = &p_buffer_resources[i];
+  return CGPU_OK;
+}
 
-    cgpu_ibuffer* ibuffer;
-    const cgpu_buffer buffer = shader_resource_buffer->buffer;
-    if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
-      return CGPU_FAIL_INVALID_HANDLE;
-    }
+/* Instance transforms are row-major and map from object to world space.
+   Back face culling is disabled, since surfaces are two-sided. */
+CgpuResult cgpu_create_tlas(
+  cgpu_device device,
+  uint32_t instance_count,
+  const cgpu_blas_instance* p_instances,
+  cgpu_tlas* p_tlas)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
 
-    if ((shader_resource_buffer->offset % idevice->limits.minStorageBufferOffsetAlignment) != 0) {
-      return CGPU_FAIL_BUFFER_OFFSET_NOT_ALIGNED;
-    }
+  if (!idevice->limits.rayQuery) {
+    return CGPU_FAIL_FEATURE_REQUIREMENTS_NOT_MET;
+  }
 
-    VkDescriptorBufferInfo* descriptor_buffer_info = &descriptor_buffer_infos[i];
-    descriptor_buffer_info->buffer = ibuffer->buffer;
-    descriptor_buffer_info->offset = shader_resource_buffer->offset;
-    descriptor_buffer_info->range =
-      (shader_resource_buffer->size == CGPU_WHOLE_SIZE) ?
-        ibuffer->size - shader_resource_buffer->offset :
-        shader_resource_buffer->size;
+  p_tlas->handle = resource_store_create_handle(&itlas_store);
 
-    VkWriteDescriptorSet* write_descriptor_set = &write_descriptor_sets[write_desc_set_count];
-    write_descriptor_set->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_descriptor_set->pNext = NULL;
-    write_descriptor_set->dstSet = ipipeline->descriptor_set;
-    write_descriptor_set->dstBinding = shader_resource_buffer->binding;
-    write_descriptor_set->dstArrayElement = 0;
-    write_descriptor_set->descriptorCount = 1;
-    write_descriptor_set->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    write_descriptor_set->pImageInfo = NULL;
-    write_descriptor_set->pBufferInfo = descriptor_buffer_info;
-    write_descriptor_set->pTexelBufferView = NULL;
-    write_desc_set_count++;
+  cgpu_itlas* itlas;
+  if (!cgpu_resolve_tlas(*p_tlas, &itlas)) {
+    return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  for (uint32_t i = 0; i < shader_resource_count; ++i)
+  cgpu_ibuffer iinstance_buffer;
+  CgpuResult c_result = cgpu_create_ibuffer(
+    idevice,
+    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    ALLOCATOR_STRATEGY_LINEAR,
+    instance_count * sizeof(VkAccelerationStructureInstanceKHR),
+    &iinstance_buffer
+  );
+  if (c_result != CGPU_OK) {
+    resource_store_free_handle(&itlas_store, p_tlas->handle);
+    return c_result;
+  }
+
+  VkAccelerationStructureInstanceKHR* vk_instances;
+  VkResult result = cgpu_map_allocation(
+    idevice,
+    &iinstance_buffer.allocation,
+    0,
+    iinstance_buffer.size,
+    (void**) &vk_instances
+  );
+  if (result != VK_SUCCESS)
   {
-    const cgpu_shader_resource_image* shader_resource_image = &p_image_resources[i];
+    cgpu_destroy_ibuffer(idevice, &iinstance_buffer);
+    resource_store_free_handle(&itlas_store, p_tlas->handle);
+    return CGPU_FAIL_UNABLE_TO_MAP_MEMORY;
+  }
 
-    cgpu_iimage* iimage;
-    const cgpu_image image = shader_resource_image->image;
-    if (!cgpu_resolve_image(image, &iimage)) {
+  for (uint32_t i = 0; i < instance_count; ++i)
+  {
+    const cgpu_blas_instance* instance = &p_instances[i];
+
+    cgpu_iblas* iblas;
+    if (!cgpu_resolve_blas(instance->blas, &iblas))
+    {
+      cgpu_unmap_allocation(idevice, &iinstance_buffer.allocation);
+      cgpu_destroy_ibuffer(idevice, &iinstance_buffer);
+      resource_store_free_handle(&itlas_store, p_tlas->handle);
       return CGPU_FAIL_INVALID_HANDLE;
     }
 
-    VkDescriptorImageInfo* descriptor_image_info = &descriptor_image_infos[i];
-    descriptor_image_info->sampler = idevice->sampler;
-    descriptor_image_info->imageView = iimage->image_view;
-    descriptor_image_info->imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAccelerationStructureInstanceKHR* vk_instance = &vk_instances[i];
+    memcpy(vk_instance->transform.matrix, instance->transform, sizeof(float) * 12);
+    vk_instance->instanceCustomIndex = instance->instance_custom_index;
+    vk_instance->mask = 0xFF;
+    vk_instance->instanceShaderBindingTableRecordOffset = 0;
+    vk_instance->flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+    vk_instance->accelerationStructureReference = iblas->address;
+  }
+
+  cgpu_unmap_allocation(idevice, &iinstance_buffer.allocation);
+
+  VkAccelerationStructureGeometryInstancesDataKHR instances_data;
+  instances_data.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+  instances_data.pNext = NULL;
+  instances_data.arrayOfPointers = VK_FALSE;
+  instances_data.data.deviceAddress =
+    cgpu_get_buffer_device_address(idevice, iinstance_buffer.buffer);
+
+  VkAccelerationStructureGeometryKHR geometry;
+  geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+  geometry.pNext = NULL;
+  geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+  geometry.geometry.instances = instances_data;
+  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+
+  c_result = cgpu_build_acceleration_structure(
+    idevice,
+    VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+    &geometry,
+    instance_count,
+    &itlas->as,
+    &itlas->buffer
+  );
 
-    VkWriteDescriptorSet* write_descriptor_set =
-      &write_descriptor_sets[write_desc_set_count];
-    write_descriptor_set->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write_descriptor_set->pNext = NULL;
-    write_descriptor_set->dstSet = ipipeline->descriptor_set;
-    write_descriptor_set->dstBinding = shader_resource_image->binding;
-    write_descriptor_set->dstArrayElement = 0;
-    write_descriptor_set->descriptorCount = 1;
-    write_descriptor_set->descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-    write_descriptor_set->pImageInfo = descriptor_image_info;
-    write_descriptor_set->pBufferInfo = NULL;
-    write_descriptor_set->pTexelBufferView = NULL;
-    write_desc_set_count++;
-  }
+  cgpu_destroy_ibuffer(idevice, &iinstance_buffer);
 
-  idevice->table.vkUpdateDescriptorSets(
-    idevice->logical_device,
-    write_desc_set_count,
-    write_descriptor_sets,
-    0,
-    NULL
-  );
+  if (c_result != CGPU_OK) {
+    resource_store_free_handle(&itlas_store, p_tlas->handle);
+    return c_result;
+  }
 
   return CGPU_OK;
 }
 
-CgpuResult cgpu_destroy_pipeline(
+CgpuResult cgpu_destroy_tlas(
   cgpu_device device,
-  cgpu_pipeline pipeline)
+  cgpu_tlas tlas)
 {
   cgpu_idevice* idevice;
   if (!cgpu_resolve_device(device, &idevice)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
-  cgpu_ipipeline* ipipeline;
-  if (!cgpu_resolve_pipeline(pipeline, &ipipeline)) {
+  cgpu_itlas* itlas;
+  if (!cgpu_resolve_tlas(tlas, &itlas)) {
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
-  idevice->table.vkDestroyDescriptorPool(
-    idevice->logical_device,
-    ipipeline->descriptor_pool,
-    NULL
-  );
-  idevice->table.vkDestroyPipeline(
-    idevice->logical_device,
-    ipipeline->pipeline,
-    NULL
-  );
-  idevice->table.vkDestroyPipelineLayout(
-    idevice->logical_device,
-    ipipeline->layout,
-    NULL
-  );
-  idevice->table.vkDestroyDescriptorSetLayout(
+  idevice->table.vkDestroyAccelerationStructureKHR(
     idevice->logical_device,
-    ipipeline->descriptor_set_layout,
+    itlas->as,
     NULL
   );
+  cgpu_destroy_ibuffer(idevice, &itlas->buffer);
 
-  resource_store_free_handle(&ipipeline_store, pipeline.handle);
+  resource_store_free_handle(&itlas_store, tlas.handle);
 
   return CGPU_OK;
 }
@@ -2500,6 +3594,39 @@ CgpuResult cgpu_cmd_copy_buffer(
   return CGPU_OK;
 }
 
+/* Sets the range to repeated copies of a 32-bit word. The offset and size must
+ * be multiples of four, or the size must be CGPU_WHOLE_SIZE. */
+CgpuResult cgpu_cmd_fill_buffer(
+  cgpu_command_buffer command_buffer,
+  cgpu_buffer buffer,
+  uint64_t offset,
+  uint64_t size,
+  uint32_t data)
+{
+  cgpu_icommand_buffer* icommand_buffer;
+  if (!cgpu_resolve_command_buffer(command_buffer, &icommand_buffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(icommand_buffer->device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  idevice->table.vkCmdFillBuffer(
+    icommand_buffer->command_buffer,
+    ibuffer->buffer,
+    offset,
+    (size == CGPU_WHOLE_SIZE) ? VK_WHOLE_SIZE : size,
+    data
+  );
+
+  return CGPU_OK;
+}
+
 CgpuResult cgpu_cmd_push_constants(
   cgpu_command_buffer command_buffer,
   cgpu_pipeline pipeline,
@@ -2552,6 +3679,31 @@ CgpuResult cgpu_cmd_dispatch(
   return CGPU_OK;
 }
 
+CgpuResult cgpu_cmd_dispatch_indirect(
+  cgpu_command_buffer command_buffer,
+  cgpu_buffer buffer,
+  uint64_t offset)
+{
+  cgpu_icommand_buffer* icommand_buffer;
+  if (!cgpu_resolve_command_buffer(command_buffer, &icommand_buffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(icommand_buffer->device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  cgpu_ibuffer* ibuffer;
+  if (!cgpu_resolve_buffer(buffer, &ibuffer)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+  idevice->table.vkCmdDispatchIndirect(
+    icommand_buffer->command_buffer,
+    ibuffer->buffer,
+    offset
+  );
+  return CGPU_OK;
+}
+
 CgpuResult cgpu_cmd_pipeline_barrier(
   cgpu_command_buffer command_buffer,
   uint32_t barrier_count,
@@ -2570,6 +3722,10 @@ CgpuResult cgpu_cmd_pipeline_barrier(
     return CGPU_FAIL_INVALID_HANDLE;
   }
 
+  /* Host accesses additionally require the host stage. */
+  VkAccessFlags src_access_mask = 0;
+  VkAccessFlags dst_access_mask = 0;
+
   VkMemoryBarrier vk_memory_barriers[MAX_MEMORY_BARRIERS];
 
   for (uint32_t i = 0; i < barrier_count; ++i)
@@ -2580,6 +3736,8 @@ CgpuResult cgpu_cmd_pipeline_barrier(
     b_vk->pNext = NULL;
     b_vk->srcAccessMask = cgpu_translate_access_flags(b_cgpu->src_access_flags);
     b_vk->dstAccessMask = cgpu_translate_access_flags(b_cgpu->dst_access_flags);
+    src_access_mask |= b_vk->srcAccessMask;
+    dst_access_mask |= b_vk->dstAccessMask;
   }
 
   VkBufferMemoryBarrier vk_buffer_memory_barriers[MAX_BUFFER_MEMORY_BARRIERS];
@@ -2599,6 +3757,8 @@ CgpuResult cgpu_cmd_pipeline_barrier(
     b_vk->pNext = NULL;
     b_vk->srcAccessMask = cgpu_translate_access_flags(b_cgpu->src_access_flags);
     b_vk->dstAccessMask = cgpu_translate_access_flags(b_cgpu->dst_access_flags);
+    src_access_mask |= b_vk->srcAccessMask;
+    dst_access_mask |= b_vk->dstAccessMask;
     b_vk->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     b_vk->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     b_vk->buffer = ibuffer->buffer;
@@ -2620,6 +3780,8 @@ CgpuResult cgpu_cmd_pipeline_barrier(
     b_vk->pNext = NULL;
     b_vk->srcAccessMask = cgpu_translate_access_flags(b_cgpu->src_access_flags);
     b_vk->dstAccessMask = cgpu_translate_access_flags(b_cgpu->dst_access_flags);
+    src_access_mask |= b_vk->srcAccessMask;
+    dst_access_mask |= b_vk->dstAccessMask;
     b_vk->oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     b_vk->newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     b_vk->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -2632,12 +3794,27 @@ CgpuResult cgpu_cmd_pipeline_barrier(
     b_vk->subresourceRange.layerCount = 1;
   }
 
-  idevice->table.vkCmdPipelineBarrier(
-    icommand_buffer->command_buffer,
+  const VkAccessFlags host_access_mask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_HOST_WRITE_BIT;
+
+  VkPipelineStageFlags src_stage_mask =
     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
-      VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT;
+  VkPipelineStageFlags dst_stage_mask =
     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
-      VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT |
+    VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+
+  if (src_access_mask & host_access_mask) {
+    src_stage_mask |= VK_PIPELINE_STAGE_HOST_BIT;
+  }
+  if (dst_access_mask & host_access_mask) {
+    dst_stage_mask |= VK_PIPELINE_STAGE_HOST_BIT;
+  }
+
+  idevice->table.vkCmdPipelineBarrier(
+    icommand_buffer->command_buffer,
+    src_stage_mask,
+    dst_stage_mask,
     0,
     barrier_count,
     vk_memory_barriers,
@@ -2655,6 +3832,10 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_reset_timestamps(
   uint32_t offset,
   uint32_t count)
 {
+  if ((offset + count) > MAX_TIMESTAMP_QUERIES) {
+    return CGPU_FAIL_MAX_TIMESTAMP_QUERY_INDEX_REACHED;
+  }
+
   cgpu_icommand_buffer* icommand_buffer;
   if (!cgpu_resolve_command_buffer(command_buffer, &icommand_buffer)) {
     return CGPU_FAIL_INVALID_HANDLE;
@@ -2678,6 +3859,10 @@ CGPU_API CgpuResult CGPU_CDECL cgpu_cmd_write_timestamp(
   cgpu_command_buffer command_buffer,
   uint32_t timestamp_index)
 {
+  if (timestamp_index >= MAX_TIMESTAMP_QUERIES) {
+    return CGPU_FAIL_MAX_TIMESTAMP_QUERY_INDEX_REACHED;
+  }
+
   cgpu_icommand_buffer* icommand_buffer;
   if (!cgpu_resolve_command_buffer(command_buffer, &icommand_buffer)) {
     return CGPU_FAIL_INVALID_HANDLE;
@@ -2896,6 +4081,40 @@ CgpuResult cgpu_submit_command_buffer(
   return CGPU_OK;
 }
 
+/* Flushed and invalidated ranges have to be aligned to the non-coherent
+   atom size. Suballocations are placed at multiples of it, so rounding the
+   range outwards stays within the resource's own part of the block. */
+static void cgpu_get_mapped_memory_range(
+  cgpu_idevice* idevice,
+  const cgpu_ibuffer* ibuffer,
+  uint64_t offset,
+  uint64_t size,
+  VkMappedMemoryRange* p_range)
+{
+  const uint64_t atom_size = idevice->limits.nonCoherentAtomSize;
+  const allocator_allocation* allocation = &ibuffer->allocation;
+
+  const uint64_t begin = allocation->offset + offset;
+  const uint64_t end = allocation->offset +
+    ((size == CGPU_WHOLE_SIZE) ? ibuffer->size : (offset + size));
+
+  const uint64_t aligned_begin = begin / atom_size * atom_size;
+  const uint64_t aligned_end = (end + atom_size - 1) / atom_size * atom_size;
+
+  p_range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  p_range->pNext = NULL;
+  p_range->memory = allocation->memory;
+  p_range->offset = aligned_begin;
+  p_range->size = aligned_end - aligned_begin;
+
+  /* Dedicated allocations aren't padded, but may be flushed to their end. */
+  if (allocation->block_index == ALLOCATOR_DEDICATED_BLOCK &&
+      aligned_end > allocation->size)
+  {
+    p_range->size = VK_WHOLE_SIZE;
+  }
+}
+
 CgpuResult cgpu_flush_mapped_memory(
   cgpu_device device,
   cgpu_buffer buffer,
@@ -2912,12 +4131,7 @@ CgpuResult cgpu_flush_mapped_memory(
   }
 
   VkMappedMemoryRange memory_range;
-  memory_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-  memory_range.pNext = NULL;
-  memory_range.memory = ibuffer->memory;
-  memory_range.offset = offset;
-  memory_range.size =
-    (size == CGPU_WHOLE_SIZE) ? ibuffer->size : size;
+  cgpu_get_mapped_memory_range(idevice, ibuffer, offset, size, &memory_range);
 
   const VkResult result = idevice->table.vkFlushMappedMemoryRanges(
     idevice->logical_device,
@@ -2947,12 +4161,7 @@ CgpuResult cgpu_invalidate_mapped_memory(
   }
 
   VkMappedMemoryRange memory_range;
-  memory_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-  memory_range.pNext = NULL;
-  memory_range.memory = ibuffer->memory;
-  memory_range.offset = offset;
-  memory_range.size =
-    (size == CGPU_WHOLE_SIZE) ? ibuffer->size : size;
+  cgpu_get_mapped_memory_range(idevice, ibuffer, offset, size, &memory_range);
 
   const VkResult result = idevice->table.vkInvalidateMappedMemoryRanges(
     idevice->logical_device,
@@ -2966,6 +4175,133 @@ CgpuResult cgpu_invalidate_mapped_memory(
   return CGPU_OK;
 }
 
+/* Pipeline cache data starts with a header identifying the device it was
+   created on [Vulkan spec, vkGetPipelineCacheData]. Data of other devices
+   or drivers is rejected without being passed to the driver. */
+#define PIPELINE_CACHE_HEADER_SIZE (16 + VK_UUID_SIZE)
+
+CgpuResult cgpu_load_pipeline_cache(
+  cgpu_device device,
+  uint64_t size,
+  const void* p_data)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  if (size < PIPELINE_CACHE_HEADER_SIZE) {
+    return CGPU_FAIL_INCOMPATIBLE_PIPELINE_CACHE;
+  }
+
+  const uint8_t* data = (const uint8_t*) p_data;
+
+  uint32_t header[4];
+  memcpy(header, data, sizeof(header));
+
+  const bool is_compatible =
+    header[0] >= PIPELINE_CACHE_HEADER_SIZE &&
+    header[0] <= size &&
+    header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+    header[2] == idevice->limits.vendorID &&
+    header[3] == idevice->limits.deviceID &&
+    memcmp(&data[16], idevice->limits.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+  if (!is_compatible) {
+    return CGPU_FAIL_INCOMPATIBLE_PIPELINE_CACHE;
+  }
+
+  VkPipelineCacheCreateInfo pipeline_cache_info;
+  pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_info.pNext = NULL;
+  pipeline_cache_info.flags = 0;
+  pipeline_cache_info.initialDataSize = (size_t) size;
+  pipeline_cache_info.pInitialData = p_data;
+
+  VkPipelineCache loaded_cache;
+  VkResult result = idevice->table.vkCreatePipelineCache(
+    idevice->logical_device,
+    &pipeline_cache_info,
+    NULL,
+    &loaded_cache
+  );
+  if (result != VK_SUCCESS) {
+    return CGPU_FAIL_UNABLE_TO_CREATE_PIPELINE_CACHE;
+  }
+
+  result = idevice->table.vkMergePipelineCaches(
+    idevice->logical_device,
+    idevice->pipeline_cache,
+    1,
+    &loaded_cache
+  );
+
+  idevice->table.vkDestroyPipelineCache(
+    idevice->logical_device,
+    loaded_cache,
+    NULL
+  );
+
+  if (result != VK_SUCCESS) {
+    return CGPU_FAIL_UNABLE_TO_CREATE_PIPELINE_CACHE;
+  }
+
+  return CGPU_OK;
+}
+
+/* Follows the Vulkan convention: if p_data is NULL, only the size is
+   returned. Otherwise, p_size holds the capacity of p_data. */
+CgpuResult cgpu_get_pipeline_cache_data(
+  cgpu_device device,
+  uint64_t* p_size,
+  void* p_data)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  size_t size = (size_t) *p_size;
+
+  const VkResult result = idevice->table.vkGetPipelineCacheData(
+    idevice->logical_device,
+    idevice->pipeline_cache,
+    &size,
+    p_data
+  );
+
+  *p_size = size;
+
+  if (result != VK_SUCCESS) {
+    return CGPU_FAIL_UNABLE_TO_GET_PIPELINE_CACHE_DATA;
+  }
+
+  return CGPU_OK;
+}
+
+CgpuResult cgpu_get_memory_stats(
+  cgpu_device device,
+  cgpu_memory_stats* p_stats)
+{
+  cgpu_idevice* idevice;
+  if (!cgpu_resolve_device(device, &idevice)) {
+    return CGPU_FAIL_INVALID_HANDLE;
+  }
+
+  allocator_stats stats;
+  allocator_get_stats(&idevice->allocator, &stats);
+
+  p_stats->block_count = stats.block_count;
+  p_stats->dedicated_allocation_count = stats.dedicated_allocation_count;
+  p_stats->allocation_count = stats.allocation_count;
+  p_stats->allocated_size = stats.allocated_size;
+  p_stats->used_size = stats.used_size;
+  p_stats->device_local_allocated_size = stats.device_local_allocated_size;
+  p_stats->device_local_used_size = stats.device_local_used_size;
+
+  return CGPU_OK;
+}
+
 CgpuResult cgpu_get_physical_device_limits(
   cgpu_device device,
   cgpu_physical_device_limits* p_limits)
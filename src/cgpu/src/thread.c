@@ -0,0 +1,98 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef struct cgpu_thread {
+  cgpu_thread_func func;
+  void*            data;
+#if defined(_WIN32)
+  HANDLE           handle;
+#else
+  pthread_t        handle;
+#endif
+} cgpu_thread;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI cgpu_thread_entry(LPVOID param)
+{
+  cgpu_thread* thread = (cgpu_thread*) param;
+  thread->func(thread->data);
+  return 0;
+}
+
+bool cgpu_thread_create(cgpu_thread_func func, void* data, cgpu_thread** thread)
+{
+  cgpu_thread* new_thread = (cgpu_thread*) malloc(sizeof(cgpu_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+  new_thread->handle = CreateThread(NULL, 0, cgpu_thread_entry, new_thread, 0, NULL);
+
+  if (new_thread->handle == NULL) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void cgpu_thread_join(cgpu_thread* thread)
+{
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  free(thread);
+}
+
+uint32_t cgpu_thread_hardware_concurrency(void)
+{
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return (uint32_t) system_info.dwNumberOfProcessors;
+}
+
+#else
+
+static void* cgpu_thread_entry(void* param)
+{
+  cgpu_thread* thread = (cgpu_thread*) param;
+  thread->func(thread->data);
+  return NULL;
+}
+
+bool cgpu_thread_create(cgpu_thread_func func, void* data, cgpu_thread** thread)
+{
+  cgpu_thread* new_thread = (cgpu_thread*) malloc(sizeof(cgpu_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+
+  if (pthread_create(&new_thread->handle, NULL, cgpu_thread_entry, new_thread) != 0) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void cgpu_thread_join(cgpu_thread* thread)
+{
+  pthread_join(thread->handle, NULL);
+  free(thread);
+}
+
+uint32_t cgpu_thread_hardware_concurrency(void)
+{
+  const long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (processor_count > 0) ? (uint32_t) processor_count : 1;
+}
+
+#endif
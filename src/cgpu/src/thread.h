@@ -0,0 +1,21 @@
+#ifndef CGPU_THREAD_H
+#define CGPU_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct cgpu_thread cgpu_thread;
+
+typedef void (*cgpu_thread_func)(void* data);
+
+bool cgpu_thread_create(
+  cgpu_thread_func func,
+  void* data,
+  cgpu_thread** thread
+);
+
+void cgpu_thread_join(cgpu_thread* thread);
+
+uint32_t cgpu_thread_hardware_concurrency(void);
+
+#endif
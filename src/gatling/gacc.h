@@ -0,0 +1,43 @@
+#ifndef GATLING_GACC_H
+#define GATLING_GACC_H
+
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * Layout of the accumulation files written by gatling if the output file has the
+ * .gacc extension. The header is followed by the sums of the samples
+ * [sample_offset, sample_offset + sample_count) of every pixel, with the number of
+ * samples in alpha, as four floats per pixel in scanline order. Since the random
+ * numbers of a sample only depend on its pixel and its index, files of disjoint
+ * sample ranges can be added up to the same image as a single render. This requires
+ * the same scene, settings and sampler, which are identified by a fingerprint and
+ * the sampler id.
+ *
+ * The version must be incremented whenever the layout changes.
+ */
+
+#define GATLING_GACC_MAGIC 0x43434147 /* "GACC" */
+#define GATLING_GACC_VERSION 4
+#define GATLING_GACC_EXTENSION ".gacc"
+
+typedef struct gatling_gacc_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t image_width;
+  uint32_t image_height;
+  uint32_t sample_offset;
+  uint32_t sample_count;
+  /* Hash of the scene file, camera and the settings that affect the samples. */
+  uint64_t fingerprint;
+  /* Samples of different samplers can't be told apart by their index. */
+  uint32_t sampler;
+  /* Heatmaps are encoded differently when merged files are saved as images. */
+  uint32_t traversal_stats;
+  uint32_t padding[2];
+} gatling_gacc_header;
+
+static_assert(sizeof(gatling_gacc_header) == 48,
+  "Accumulation file header should keep the pixel data aligned.");
+
+#endif
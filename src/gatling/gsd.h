@@ -0,0 +1,78 @@
+#ifndef GATLING_GSD_H
+#define GATLING_GSD_H
+
+#include <stdint.h>
+#include <assert.h>
+
+/*
+ * Layout of the scene files written by gp. The file starts with a fixed-size header
+ * containing a section table. Every section starts at a multiple of the section
+ * alignment, which is the largest value Vulkan allows for minStorageBufferOffsetAlignment.
+ * Everything before the texture page section can therefore be copied to a device buffer
+ * at once and each section can be bound at its file offset. Texture pages are loaded on
+ * demand instead. They are stored last and, like the file size, start at a multiple of
+ * the file alignment, which covers the host pointer alignment of common drivers, so that
+ * the mapped file can be imported as device-visible host memory (VK_EXT_external_memory_host).
+ *
+ * The version must be incremented whenever the layout of the header or of any section
+ * changes. Readers reject files of other versions.
+ */
+
+#define GATLING_GSD_MAGIC 0x44534747 /* "GGSD" */
+#define GATLING_GSD_VERSION 6
+#define GATLING_GSD_SECTION_ALIGNMENT 256
+#define GATLING_GSD_FILE_ALIGNMENT 65536
+#define GATLING_GSD_MAX_SECTION_COUNT 16
+/* Texture pages are square and hold BC1 blocks of 4x4 texels in row-major order. */
+#define GATLING_GSD_TEXTURE_PAGE_SIZE 128
+#define GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE ((GATLING_GSD_TEXTURE_PAGE_SIZE / 4) * (GATLING_GSD_TEXTURE_PAGE_SIZE / 4) * 8)
+
+typedef enum GatlingGsdSectionType {
+  GATLING_GSD_SECTION_TYPE_NODES      = 1,
+  GATLING_GSD_SECTION_TYPE_FACES      = 2,
+  GATLING_GSD_SECTION_TYPE_VERTICES   = 3,
+  GATLING_GSD_SECTION_TYPE_MATERIALS  = 4,
+  GATLING_GSD_SECTION_TYPE_INSTANCES  = 5,
+  /* Build parameters as "key=value" lines of text. */
+  GATLING_GSD_SECTION_TYPE_BUILD_INFO = 6,
+  /* Emissive faces with an alias table for power-proportional sampling. */
+  GATLING_GSD_SECTION_TYPE_LIGHTS     = 7,
+  /* Intersection data of the faces, in the same order. */
+  GATLING_GSD_SECTION_TYPE_TRIANGLES  = 8,
+  /* Size and first page of every texture. */
+  GATLING_GSD_SECTION_TYPE_TEXTURES   = 9,
+  /* The pages of all mip levels of all textures. Must be the last section. */
+  GATLING_GSD_SECTION_TYPE_TEXTURE_PAGES = 10
+} GatlingGsdSectionType;
+
+typedef enum GatlingGsdFlagBits {
+  /* Vertices hold an octahedral normal and half-precision UVs, but no position. */
+  GATLING_GSD_FLAG_COMPRESSED_VERTICES = 1
+} GatlingGsdFlagBits;
+
+typedef struct gatling_gsd_section {
+  uint32_t type;
+  uint32_t padding;
+  uint64_t offset;
+  uint64_t size;
+} gatling_gsd_section;
+
+typedef struct gatling_gsd_header {
+  uint32_t            magic;
+  uint32_t            version;
+  uint64_t            file_size;
+  float               aabb_min[3];
+  float               aabb_max[3];
+  uint32_t            section_count;
+  uint32_t            padding1;
+  gatling_gsd_section sections[GATLING_GSD_MAX_SECTION_COUNT];
+  /* Sum of the emitted power of all lights. */
+  float               light_power;
+  uint32_t            flags;
+  uint8_t             padding2[72];
+} gatling_gsd_header;
+
+static_assert(sizeof(gatling_gsd_header) == GATLING_GSD_SECTION_ALIGNMENT * 2,
+  "Scene file header should fill exactly two section alignment units.");
+
+#endif
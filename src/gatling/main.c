@@ -4,6 +4,9 @@
 #include <cgpu.h>
 
 #include "mmap.h"
+#include "gsd.h"
+#include "gacc.h"
+#include "thread.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -12,9 +15,31 @@ static uint32_t DEFAULT_IMAGE_WIDTH = 1200;
 static uint32_t DEFAULT_IMAGE_HEIGHT = 1200;
 static uint32_t DEFAULT_SPP = 256;
 static uint32_t DEFAULT_BOUNCES = 4;
+static uint32_t DEFAULT_SPP_PER_PASS = 8;
+static uint32_t DEFAULT_TILE_SIZE = 0;
+static float DEFAULT_ERROR_THRESHOLD = 0.0f;
 static float DEFAULT_CAMERA_ORIGIN[3] = { 0.0f, 1.0f, 3.1f };
 static float DEFAULT_CAMERA_TARGET[3] = { 0.0f, 1.0f, 0.0f };
 static float DEFAULT_CAMERA_FOV = 1.0f;
+static uint32_t DEFAULT_DEVICE_COUNT = 1;
+static uint32_t DEFAULT_SAMPLE_OFFSET = 0;
+static const char* DEFAULT_SAMPLER = "independent";
+static uint32_t DEFAULT_TEXTURE_CACHE_SIZE = 256;
+static uint64_t UPLOAD_CHUNK_SIZE = 32 * 1024 * 1024;
+static uint32_t RAY_BATCH_SIZE = 2;
+/* Vulkan doesn't expose the number of compute units, so this is chosen to
+ * keep all subgroups of a mid-range GPU resident. */
+static uint32_t PERSISTENT_WORKGROUP_COUNT = 1024;
+/* cgpu has 4096 timestamp queries. Two measure the frame, the others are shared
+ * by the two command buffers for timing each kernel with --stats. */
+static const uint32_t PROFILE_QUERY_COUNT = 2047;
+/* Words of BufferStats in wavefront.glsl, rounded up to a multiple of 64 bits. */
+static const uint32_t STATS_COUNTER_COUNT = 12;
+/* Must match wavefront.glsl. */
+static const float HEATMAP_MAX_COST = 1024.0f;
+/* Texture pages are streamed in over several chunks, so that the first ones don't stall. */
+static const uint32_t MAX_TEXTURE_PAGE_UPLOADS = 256;
+static const uint32_t NO_TEXTURE_PAGE = UINT32_MAX;
 
 typedef struct program_options {
   const char* input_file;
@@ -23,11 +48,35 @@ typedef struct program_options {
   uint32_t image_height;
   uint32_t spp;
   uint32_t bounces;
+  uint32_t spp_per_pass;
+  uint32_t tile_size;
+  float error_threshold;
   float camera_origin[3];
   float camera_target[3];
   float camera_fov;
+  const char* camera_path;
+  const char* cache_dir;
+  uint32_t device_count;
+  uint32_t sample_offset;
+  uint32_t sampler;
+  const char* stats_file;
+  uint32_t traversal_stats;
+  uint32_t texture_cache_size;
 } program_options;
 
+/* Must match common.glsl. */
+typedef enum GatlingSampler {
+  GATLING_SAMPLER_INDEPENDENT = 0,
+  GATLING_SAMPLER_SOBOL       = 1
+} GatlingSampler;
+
+/* Must match wavefront.glsl. */
+typedef enum GatlingTraversalStats {
+  GATLING_TRAVERSAL_STATS_OFF     = 0,
+  GATLING_TRAVERSAL_STATS_COUNT   = 1,
+  GATLING_TRAVERSAL_STATS_HEATMAP = 2
+} GatlingTraversalStats;
+
 #define gatling_fail(msg)                                                         \
   do {                                                                            \
     printf("Gatling encountered a fatal error at line %d: %s\n", __LINE__, msg);  \
@@ -62,19 +111,9 @@ static void gatling_save_img_wfunc(void *context, void *data, int size)
 }
 
 static void gatling_save_img(
-  const float* data,
-  size_t float_count,
+  const uint8_t* data,
   const program_options* options)
 {
-  uint8_t* temp_data = malloc(float_count);
-  const float gamma = 1.0f / 2.2f;
-
-  for (size_t i = 0; i < float_count; ++i)
-  {
-    const float value = fmaxf(0.0f, fminf(1.0f, data[i]));
-    temp_data[i] = (uint8_t) (powf(value, gamma) * 255.0f + 0.5f);
-  }
-
   stbi_flip_vertically_on_write(true);
 
   const uint32_t component_count = 4;
@@ -85,12 +124,10 @@ static void gatling_save_img(
     options->image_width,
     options->image_height,
     component_count,
-    temp_data,
+    data,
     (int) (options->image_width * component_count)
   );
 
-  free(temp_data);
-
   if (!result) {
     gatling_fail("Unable to save image.");
   }
@@ -121,13 +158,17 @@ static void gatling_get_parent_directory(
 
 static void gatling_print_usage_and_exit()
 {
-  printf("Usage: gatling <scene.gsd> <output.png> [options]\n");
+  printf("Usage: gatling <scene.gsd> <output.png|output.gacc> [options]\n");
+  printf("       gatling --merge <output.png|output.gacc> <input.gacc>...\n");
   printf("\n");
   printf("Options:\n");
   printf("--image-width   [default: %u]\n", DEFAULT_IMAGE_WIDTH);
   printf("--image-height  [default: %u]\n", DEFAULT_IMAGE_HEIGHT);
   printf("--spp           [default: %u]\n", DEFAULT_SPP);
   printf("--bounces       [default: %u]\n", DEFAULT_BOUNCES);
+  printf("--spp-per-pass  [default: %u]\n", DEFAULT_SPP_PER_PASS);
+  printf("--tile-size     [default: %u, whole image]\n", DEFAULT_TILE_SIZE);
+  printf("--error-threshold [default: %.3f, disabled]\n", DEFAULT_ERROR_THRESHOLD);
   printf("--camera-origin [default: %.3f,%.3f,%.3f]\n",
     DEFAULT_CAMERA_ORIGIN[0],
     DEFAULT_CAMERA_ORIGIN[1],
@@ -139,6 +180,14 @@ static void gatling_print_usage_and_exit()
     DEFAULT_CAMERA_TARGET[2]
   );
   printf("--camera-fov    [default: %.5f]\n", DEFAULT_CAMERA_FOV);
+  printf("--camera-path   File with a camera per line, rendered as numbered frames\n");
+  printf("--cache-dir     Directory for reusing compiled pipelines between runs\n");
+  printf("--device-count  [default: %u, 0 uses all devices]\n", DEFAULT_DEVICE_COUNT);
+  printf("--sample-offset [default: %u]\n", DEFAULT_SAMPLE_OFFSET);
+  printf("--sampler       [default: %s, or sobol]\n", DEFAULT_SAMPLER);
+  printf("--stats         JSON file for kernel timings and ray throughput\n");
+  printf("--traversal-stats [default: off, count or heatmap]\n");
+  printf("--texture-cache-size [default: %u, in MiB]\n", DEFAULT_TEXTURE_CACHE_SIZE);
   exit(EXIT_FAILURE);
 }
 
@@ -154,9 +203,20 @@ static void gatling_parse_args(int argc, const char* argv[], program_options* op
   options->image_height = DEFAULT_IMAGE_HEIGHT;
   options->spp = DEFAULT_SPP;
   options->bounces = DEFAULT_BOUNCES;
+  options->spp_per_pass = DEFAULT_SPP_PER_PASS;
+  options->tile_size = DEFAULT_TILE_SIZE;
+  options->error_threshold = DEFAULT_ERROR_THRESHOLD;
   memcpy(&options->camera_origin, &DEFAULT_CAMERA_ORIGIN, 12);
   memcpy(&options->camera_target, &DEFAULT_CAMERA_TARGET, 12);
   options->camera_fov = DEFAULT_CAMERA_FOV;
+  options->camera_path = NULL;
+  options->cache_dir = NULL;
+  options->device_count = DEFAULT_DEVICE_COUNT;
+  options->sample_offset = DEFAULT_SAMPLE_OFFSET;
+  options->sampler = GATLING_SAMPLER_INDEPENDENT;
+  options->stats_file = NULL;
+  options->traversal_stats = GATLING_TRAVERSAL_STATS_OFF;
+  options->texture_cache_size = DEFAULT_TEXTURE_CACHE_SIZE;
 
   for (int i = 3; i < argc; ++i)
   {
@@ -196,6 +256,24 @@ static void gatling_parse_args(int argc, const char* argv[], program_options* op
       options->bounces = strtol(value, &endptr, 10);
       fail = (endptr == value);
     }
+    else if (strstr(arg, "--spp-per-pass=") == arg)
+    {
+      char* endptr = NULL;
+      options->spp_per_pass = strtol(value, &endptr, 10);
+      fail = (endptr == value) || (options->spp_per_pass == 0);
+    }
+    else if (strstr(arg, "--tile-size=") == arg)
+    {
+      char* endptr = NULL;
+      options->tile_size = strtol(value, &endptr, 10);
+      fail = (endptr == value);
+    }
+    else if (strstr(arg, "--error-threshold=") == arg)
+    {
+      char* endptr = NULL;
+      options->error_threshold = strtof(value, &endptr);
+      fail = (endptr == value) || (options->error_threshold < 0.0f);
+    }
     else if (strstr(arg, "--camera-origin=") == arg)
     {
       const int scan_res = sscanf(
@@ -224,456 +302,3091 @@ static void gatling_parse_args(int argc, const char* argv[], program_options* op
       options->camera_fov = strtof(value, &endptr);
       fail = (endptr == value);
     }
+    else if (strstr(arg, "--camera-path=") == arg)
+    {
+      options->camera_path = value;
+      fail = (value[0] == '\0');
+    }
+    else if (strstr(arg, "--cache-dir=") == arg)
+    {
+      options->cache_dir = value;
+      fail = (value[0] == '\0');
+    }
+    else if (strstr(arg, "--device-count=") == arg)
+    {
+      char* endptr = NULL;
+      options->device_count = strtol(value, &endptr, 10);
+      fail = (endptr == value);
+    }
+    else if (strstr(arg, "--sample-offset=") == arg)
+    {
+      char* endptr = NULL;
+      options->sample_offset = strtol(value, &endptr, 10);
+      fail = (endptr == value);
+    }
+    else if (strstr(arg, "--stats=") == arg)
+    {
+      options->stats_file = value;
+      fail = (value[0] == '\0');
+    }
+    else if (strstr(arg, "--sampler=") == arg)
+    {
+      fail = false;
+      if (strcmp(value, "independent") == 0) {
+        options->sampler = GATLING_SAMPLER_INDEPENDENT;
+      } else if (strcmp(value, "sobol") == 0) {
+        options->sampler = GATLING_SAMPLER_SOBOL;
+      } else {
+        fail = true;
+      }
+    }
+    else if (strstr(arg, "--traversal-stats=") == arg)
+    {
+      fail = false;
+      if (strcmp(value, "off") == 0) {
+        options->traversal_stats = GATLING_TRAVERSAL_STATS_OFF;
+      } else if (strcmp(value, "count") == 0) {
+        options->traversal_stats = GATLING_TRAVERSAL_STATS_COUNT;
+      } else if (strcmp(value, "heatmap") == 0) {
+        options->traversal_stats = GATLING_TRAVERSAL_STATS_HEATMAP;
+      } else {
+        fail = true;
+      }
+    }
+    else if (strstr(arg, "--texture-cache-size=") == arg)
+    {
+      char* endptr = NULL;
+      options->texture_cache_size = strtol(value, &endptr, 10);
+      fail = (endptr == value) || (options->texture_cache_size == 0);
+    }
 
     if (fail) {
       gatling_print_usage_and_exit();
     }
   }
+
+  /* The sample range has to be representable in accumulation files. */
+  if (options->spp > (UINT32_MAX - options->sample_offset)) {
+    gatling_print_usage_and_exit();
+  }
 }
 
-static uint64_t gatling_align_buffer(
-  uint64_t offset_alignment,
-  uint64_t buffer_size,
-  uint64_t* total_size)
+static bool gatling_has_extension(const char* path, const char* extension)
 {
-  const uint64_t offset =
-    ((*total_size) + offset_alignment - 1) / offset_alignment
-    * offset_alignment;
-
-  (*total_size) = offset + buffer_size;
+  const size_t path_length = strlen(path);
+  const size_t extension_length = strlen(extension);
 
-  return offset;
+  return path_length >= extension_length &&
+         strcmp(&path[path_length - extension_length], extension) == 0;
 }
 
-int main(int argc, const char* argv[])
-{
-  program_options options;
-  gatling_parse_args(argc, argv, &options);
+typedef struct gatling_camera {
+  float origin[3];
+  float target[3];
+  float fov;
+} gatling_camera;
 
-  /* Set up instance and device. */
-  CgpuResult c_result = cgpu_initialize(
-    "gatling",
-    GATLING_VERSION_MAJOR,
-    GATLING_VERSION_MINOR,
-    GATLING_VERSION_PATCH
-  );
-  if (c_result != CGPU_OK) {
-    gatling_fail("Unable to initialize cgpu.");
+/* Camera paths are text files with one frame per line, in the format of the
+ * camera options: "origin_x,origin_y,origin_z target_x,target_y,target_z fov".
+ * Empty lines and lines starting with '#' are skipped. */
+static gatling_camera* gatling_load_camera_path(const char* file_path, uint32_t* frame_count)
+{
+  FILE* file = fopen(file_path, "r");
+  if (!file) {
+    gatling_fail("Unable to read camera path.");
   }
 
-  uint32_t device_count;
-  c_result = cgpu_get_device_count(&device_count);
-  if (c_result != CGPU_OK || device_count == 0) {
-    gatling_fail("Unable to find device.");
+  uint32_t capacity = 64;
+  uint32_t count = 0;
+  gatling_camera* cameras = (gatling_camera*) malloc(capacity * sizeof(gatling_camera));
+
+  char line[1024];
+  uint32_t line_number = 0;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    line_number++;
+
+    const char* entry = line + strspn(line, " \t");
+
+    if (entry[0] == '\0' || entry[0] == '\n' || entry[0] == '\r' || entry[0] == '#') {
+      continue;
+    }
+
+    if (count == capacity)
+    {
+      capacity *= 2;
+      cameras = (gatling_camera*) realloc(cameras, capacity * sizeof(gatling_camera));
+    }
+
+    gatling_camera* camera = &cameras[count];
+
+    const int scan_res = sscanf(
+      entry,
+      "%f,%f,%f %f,%f,%f %f",
+      &camera->origin[0],
+      &camera->origin[1],
+      &camera->origin[2],
+      &camera->target[0],
+      &camera->target[1],
+      &camera->target[2],
+      &camera->fov
+    );
+
+    if (scan_res != 7)
+    {
+      printf("Invalid camera on line %u\n", line_number);
+      gatling_fail("Camera path is invalid.");
+    }
+
+    count++;
   }
 
-  cgpu_device device;
-  c_result = cgpu_create_device(0, &device);
-  if (c_result != CGPU_OK) {
-    gatling_fail("Unable to create device.");
+  fclose(file);
+
+  if (count == 0) {
+    gatling_fail("Camera path is empty.");
   }
 
-  cgpu_physical_device_limits device_limits;
-  c_result = cgpu_get_physical_device_limits(device, &device_limits);
-  gatling_cgpu_ensure(c_result);
+  *frame_count = count;
+  return cameras;
+}
 
-  /* Map scene file for copying. */
-  gatling_file* scene_file;
-  const bool ok = gatling_file_open(options.input_file, GATLING_FILE_USAGE_READ, &scene_file);
-  if (!ok) {
-    gatling_fail("Unable to read scene file.");
+/* Inserts the frame number before the file extension, e.g. "out_0007.png". */
+static void gatling_make_frame_path(const char* file_path, uint32_t frame, char* frame_path, size_t frame_path_size)
+{
+  const char* extension = strrchr(file_path, '.');
+
+  if (extension == NULL || strchr(extension, '/') || strchr(extension, '\\')) {
+    extension = file_path + strlen(file_path);
   }
 
-  uint64_t scene_data_size = gatling_file_size(scene_file);
+  snprintf(frame_path, frame_path_size, "%.*s_%04u%s", (int) (extension - file_path), file_path, frame, extension);
+}
 
-  uint8_t* mapped_scene_data = (uint8_t*) gatling_mmap(
-    scene_file,
-    0,
-    scene_data_size
-  );
+#define GATLING_FNV_OFFSET_BASIS 0xCBF29CE484222325ull
+#define GATLING_FNV_PRIME 0x100000001B3ull
 
-  if (!mapped_scene_data) {
-    gatling_fail("Unable to map scene file.");
+/* 64-bit FNV-1a. */
+static uint64_t gatling_hash_bytes(uint64_t hash, const void* data, uint64_t size)
+{
+  const uint8_t* bytes = (const uint8_t*) data;
+
+  for (uint64_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= GATLING_FNV_PRIME;
   }
 
-  /* Create input and output buffers. */
-  const struct file_header {
-    uint64_t node_buf_offset;
-    uint64_t node_buf_size;
-    uint64_t face_buf_offset;
-    uint64_t face_buf_size;
-    uint64_t vertex_buf_offset;
-    uint64_t vertex_buf_size;
-    uint64_t material_buf_offset;
-    uint64_t material_buf_size;
-  } file_header = *((struct file_header*) &mapped_scene_data[0]);
-
-  uint64_t device_buf_size = 0;
-  const uint64_t offset_align = device_limits.minStorageBufferOffsetAlignment;
-
-  const uint64_t new_node_buf_offset = gatling_align_buffer(offset_align, file_header.node_buf_size, &device_buf_size);
-  const uint64_t new_face_buf_offset = gatling_align_buffer(offset_align, file_header.face_buf_size, &device_buf_size);
-  const uint64_t new_vertex_buf_offset = gatling_align_buffer(offset_align, file_header.vertex_buf_size, &device_buf_size);
-  const uint64_t new_material_buf_offset = gatling_align_buffer(offset_align, file_header.material_buf_size, &device_buf_size);
-
-  const uint64_t output_buffer_size = options.image_width * options.image_height * sizeof(float) * 4;
-  const uint64_t staging_buffer_size = output_buffer_size > device_buf_size ? output_buffer_size : device_buf_size;
-
-  cgpu_buffer input_buffer;
-  cgpu_buffer staging_buffer;
-  cgpu_buffer output_buffer;
-  cgpu_buffer timestamp_buffer;
+  return hash;
+}
 
-  c_result = cgpu_create_buffer(
-    device,
-    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
-      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
-    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
-    device_buf_size,
-    &input_buffer
-  );
-  gatling_cgpu_ensure(c_result);
+/* Scenes can be large, so they are hashed eight bytes at a time. */
+static uint64_t gatling_hash_scene(const uint8_t* scene_data, uint64_t scene_data_size)
+{
+  uint64_t hash = GATLING_FNV_OFFSET_BASIS;
+  uint64_t i = 0;
 
-  c_result = cgpu_create_buffer(
-    device,
-    CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC |
-      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
-    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
-    CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
-    CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
-    staging_buffer_size,
-    &staging_buffer
-  );
-  gatling_cgpu_ensure(c_result);
+  for (; (i + sizeof(uint64_t)) <= scene_data_size; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, &scene_data[i], sizeof(word));
+    hash ^= word;
+    hash *= GATLING_FNV_PRIME;
+    hash ^= hash >> 32;
+  }
 
-  c_result = cgpu_create_buffer(
-    device,
-    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
-      CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC,
-    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
-    output_buffer_size,
-    &output_buffer
-  );
-  gatling_cgpu_ensure(c_result);
+  return gatling_hash_bytes(hash, &scene_data[i], scene_data_size - i);
+}
 
-  c_result = cgpu_create_buffer(
-    device,
-    CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
-    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
-      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
-      CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
-    32 * sizeof(uint64_t),
-    &timestamp_buffer
-  );
-  gatling_cgpu_ensure(c_result);
+/* Identifies the renders whose accumulation files may be merged. Besides the
+ * scene and the image size, which is stored separately, only the camera and
+ * the settings which change the samples themselves are included. */
+static uint64_t gatling_make_fingerprint(
+  uint64_t scene_hash,
+  const program_options* options,
+  const gatling_camera* camera)
+{
+  uint64_t hash = scene_hash;
+  hash = gatling_hash_bytes(hash, camera->origin, sizeof(camera->origin));
+  hash = gatling_hash_bytes(hash, camera->target, sizeof(camera->target));
+  hash = gatling_hash_bytes(hash, &camera->fov, sizeof(camera->fov));
+  hash = gatling_hash_bytes(hash, &options->bounces, sizeof(options->bounces));
+  hash = gatling_hash_bytes(hash, &options->error_threshold, sizeof(options->error_threshold));
+  hash = gatling_hash_bytes(hash, &options->traversal_stats, sizeof(options->traversal_stats));
+  return hash;
+}
 
-  uint8_t* mapped_staging_mem;
-  c_result = cgpu_map_buffer(
-    device,
-    staging_buffer,
-    0,
-    device_buf_size,
-    (void*)&mapped_staging_mem
-  );
-  gatling_cgpu_ensure(c_result);
+/* Accumulation files keep the sums of samples, so that renders of other sample
+ * ranges can be added later. Images are divided by the sample count instead.
+ * This is only needed for merged data, otherwise the device encodes the image. */
+static void gatling_save_output(
+  const float* accumulated_data,
+  uint32_t sample_offset,
+  uint32_t sample_count,
+  uint64_t fingerprint,
+  const program_options* options)
+{
+  const uint64_t pixel_count = (uint64_t) options->image_width * options->image_height;
+  const uint64_t data_size = pixel_count * sizeof(float) * 4;
 
-  memcpy(&mapped_staging_mem[new_node_buf_offset],
-         &mapped_scene_data[file_header.node_buf_offset], file_header.node_buf_size);
-  memcpy(&mapped_staging_mem[new_face_buf_offset],
-         &mapped_scene_data[file_header.face_buf_offset], file_header.face_buf_size);
-  memcpy(&mapped_staging_mem[new_vertex_buf_offset],
-         &mapped_scene_data[file_header.vertex_buf_offset], file_header.vertex_buf_size);
-  memcpy(&mapped_staging_mem[new_material_buf_offset],
-         &mapped_scene_data[file_header.material_buf_offset], file_header.material_buf_size);
+  if (gatling_has_extension(options->output_file, GATLING_GACC_EXTENSION))
+  {
+    gatling_gacc_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GATLING_GACC_MAGIC;
+    header.version = GATLING_GACC_VERSION;
+    header.image_width = options->image_width;
+    header.image_height = options->image_height;
+    header.sample_offset = sample_offset;
+    header.sample_count = sample_count;
+    header.fingerprint = fingerprint;
+    header.sampler = options->sampler;
+    header.traversal_stats = options->traversal_stats;
+
+    const uint64_t file_size = sizeof(header) + data_size;
 
-  c_result = cgpu_unmap_buffer(
-    device,
-    staging_buffer
-  );
-  gatling_cgpu_ensure(c_result);
+    gatling_file* file;
+    if (!gatling_file_create(options->output_file, file_size, &file)) {
+      gatling_fail("Unable to open output file.");
+    }
 
-  cgpu_command_buffer command_buffer;
-  c_result = cgpu_create_command_buffer(device, &command_buffer);
-  gatling_cgpu_ensure(c_result);
+    uint8_t* mapped_mem = (uint8_t*) gatling_mmap(file, 0, file_size);
+    if (!mapped_mem) {
+      gatling_fail("Unable to map output file.");
+    }
 
-  gatling_munmap(scene_file, mapped_scene_data);
+    memcpy(mapped_mem, &header, sizeof(header));
+    memcpy(&mapped_mem[sizeof(header)], accumulated_data, data_size);
 
-  gatling_file_close(scene_file);
+    gatling_munmap(file, mapped_mem);
+    gatling_file_close(file);
+    return;
+  }
+
+  /* Same encoding as tonemap.comp. */
+  uint8_t* image_data = malloc(pixel_count * 4);
+  const float gamma = 1.0f / 2.2f;
 
-  /* Set up pipeline. */
-  cgpu_pipeline pipeline;
+  for (uint64_t i = 0; i < pixel_count; ++i)
   {
-    /* Map and create shader. */
-    char dir_path[1024];
-    gatling_get_parent_directory(argv[0], dir_path);
+    const float pixel_sample_count = accumulated_data[i * 4 + 3];
+    const float inv_sample_count = (pixel_sample_count > 0.0f) ? (1.0f / pixel_sample_count) : 0.0f;
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+      float value;
+
+      if (options->traversal_stats == GATLING_TRAVERSAL_STATS_HEATMAP)
+      {
+        const float t = fmaxf(0.0f, fminf(1.0f, accumulated_data[i * 4] * inv_sample_count / HEATMAP_MAX_COST));
+        value = fmaxf(0.0f, fminf(1.0f, 1.5f - fabsf(4.0f * t - (3.0f - c))));
+      }
+      else
+      {
+        value = powf(fmaxf(0.0f, fminf(1.0f, accumulated_data[i * 4 + c] * inv_sample_count)), gamma);
+      }
+
+      image_data[i * 4 + c] = (uint8_t) (value * 255.0f + 0.5f);
+    }
+    image_data[i * 4 + 3] = 255;
+  }
+
+  gatling_save_img(image_data, options);
+
+  free(image_data);
+}
+
+/* Adds up the accumulation files of renders which were split across machines.
+ * Each sample may only be contained once. */
+static void gatling_merge(int argc, const char* argv[])
+{
+  if (argc < 4) {
+    gatling_print_usage_and_exit();
+  }
+
+  program_options options;
+  memset(&options, 0, sizeof(options));
+  options.output_file = argv[2];
+
+  const uint32_t input_count = (uint32_t) (argc - 3);
+  gatling_gacc_header* headers = (gatling_gacc_header*) malloc(input_count * sizeof(gatling_gacc_header));
+  float* accumulated_data = NULL;
+  uint64_t pixel_count = 0;
 
-    char shader_path[2048];
-    snprintf(shader_path, 2048, "%s/shaders/main.comp.spv", dir_path);
+  uint32_t sample_begin = UINT32_MAX;
+  uint32_t sample_end = 0;
+  uint32_t sample_count = 0;
 
+  for (uint32_t i = 0; i < input_count; ++i)
+  {
     gatling_file* file;
-    if (!gatling_file_open(shader_path, GATLING_FILE_USAGE_READ, &file)) {
-      gatling_fail("Unable to open shader file.");
+    if (!gatling_file_open(argv[3 + i], GATLING_FILE_USAGE_READ, &file)) {
+      gatling_fail("Unable to read accumulation file.");
     }
 
     const uint64_t file_size = gatling_file_size(file);
 
-    uint32_t* data = (uint32_t*) gatling_mmap(file, 0, file_size);
+    if (file_size < sizeof(gatling_gacc_header)) {
+      gatling_fail("Accumulation file is invalid.");
+    }
+
+    const uint8_t* mapped_data = (const uint8_t*) gatling_mmap(file, 0, file_size);
 
-    if (!data) {
-      gatling_fail("Unable to map shader file.");
+    if (!mapped_data) {
+      gatling_fail("Unable to map accumulation file.");
     }
 
-    cgpu_shader shader;
-    c_result = cgpu_create_shader(
-      device,
-      file_size,
-      data,
-      &shader
-    );
+    gatling_gacc_header* header = &headers[i];
+    memcpy(header, mapped_data, sizeof(gatling_gacc_header));
 
-    gatling_munmap(file, data);
+    if (header->magic != GATLING_GACC_MAGIC) {
+      gatling_fail("Accumulation file is invalid.");
+    }
+    if (header->version != GATLING_GACC_VERSION) {
+      gatling_fail("Accumulation file version is not supported.");
+    }
+
+    if (i == 0)
+    {
+      options.image_width = header->image_width;
+      options.image_height = header->image_height;
+      options.sampler = header->sampler;
+      options.traversal_stats = header->traversal_stats;
+      pixel_count = (uint64_t) header->image_width * header->image_height;
+      accumulated_data = calloc(pixel_count * 4, sizeof(float));
+    }
+    else if (header->image_width != options.image_width ||
+             header->image_height != options.image_height)
+    {
+      gatling_fail("Accumulation files differ in image size.");
+    }
+    else if (header->fingerprint != headers[0].fingerprint)
+    {
+      gatling_fail("Accumulation files differ in scene or settings.");
+    }
+    else if (header->sampler != options.sampler)
+    {
+      gatling_fail("Accumulation files differ in sampler.");
+    }
+
+    if (file_size != sizeof(gatling_gacc_header) + pixel_count * sizeof(float) * 4 ||
+        header->sample_count > (UINT32_MAX - header->sample_offset)) {
+      gatling_fail("Accumulation file is corrupt.");
+    }
+
+    const uint32_t header_sample_end = header->sample_offset + header->sample_count;
 
+    for (uint32_t j = 0; j < i; ++j)
+    {
+      if (header->sample_offset < (headers[j].sample_offset + headers[j].sample_count) &&
+          headers[j].sample_offset < header_sample_end)
+      {
+        gatling_fail("Sample ranges of accumulation files overlap.");
+      }
+    }
+
+    sample_begin = header->sample_offset < sample_begin ? header->sample_offset : sample_begin;
+    sample_end = header_sample_end > sample_end ? header_sample_end : sample_end;
+    sample_count += header->sample_count;
+
+    const float* file_data = (const float*) &mapped_data[sizeof(gatling_gacc_header)];
+    for (uint64_t k = 0; k < pixel_count * 4; ++k) {
+      accumulated_data[k] += file_data[k];
+    }
+
+    gatling_munmap(file, (void*) mapped_data);
     gatling_file_close(file);
+  }
+
+  /* The header can only describe a single range. */
+  if (gatling_has_extension(options.output_file, GATLING_GACC_EXTENSION) &&
+      (sample_end - sample_begin) != sample_count)
+  {
+    gatling_fail("Merged sample ranges are not contiguous.");
+  }
+
+  printf("Merged %u samples of %u files\n", sample_count, input_count);
+
+  gatling_save_output(accumulated_data, sample_begin, sample_count, headers[0].fingerprint, &options);
+
+  free(accumulated_data);
+  free(headers);
+}
+
+static uint32_t gatling_texture_level_page_count(uint32_t width, uint32_t height, uint32_t level)
+{
+  const uint32_t level_width = (width >> level) > 0 ? (width >> level) : 1;
+  const uint32_t level_height = (height >> level) > 0 ? (height >> level) : 1;
+  const uint32_t page_count_x = (level_width + GATLING_GSD_TEXTURE_PAGE_SIZE - 1) / GATLING_GSD_TEXTURE_PAGE_SIZE;
+  const uint32_t page_count_y = (level_height + GATLING_GSD_TEXTURE_PAGE_SIZE - 1) / GATLING_GSD_TEXTURE_PAGE_SIZE;
+  return page_count_x * page_count_y;
+}
+
+static const gatling_gsd_section* gatling_find_scene_section(
+  const gatling_gsd_header* header,
+  GatlingGsdSectionType type)
+{
+  for (uint32_t i = 0; i < header->section_count; ++i)
+  {
+    const gatling_gsd_section* section = &header->sections[i];
 
-    if (c_result != CGPU_OK) {
-      gatling_fail("Unable to create shader.");
+    if (section->type != type) {
+      continue;
     }
 
-    /* Set up pipeline. */
-    const uint32_t shader_resources_buffer_count = 5;
-    cgpu_shader_resource_buffer shader_resources_buffers[] = {
-      { 0,       output_buffer,                       0,               CGPU_WHOLE_SIZE },
-      { 1,        input_buffer,     new_node_buf_offset,     file_header.node_buf_size },
-      { 2,        input_buffer,     new_face_buf_offset,     file_header.face_buf_size },
-      { 3,        input_buffer,   new_vertex_buf_offset,   file_header.vertex_buf_size },
-      { 4,        input_buffer, new_material_buf_offset, file_header.material_buf_size },
-    };
+    const bool is_valid =
+      (section->offset % GATLING_GSD_SECTION_ALIGNMENT) == 0 &&
+      section->offset >= sizeof(gatling_gsd_header) &&
+      section->offset <= header->file_size &&
+      section->size <= (header->file_size - section->offset);
 
-    const uint32_t node_size = 80;
-    const uint32_t node_count = file_header.node_buf_size / node_size;
-    const uint32_t traversal_stack_size = (log(node_count) / log(8)) * 2;
-
-    const cgpu_specialization_constant speccs[] = {
-      { .constant_id =  0, .p_data = (void*) &device_limits.subgroupSize, .size = 4 },
-      { .constant_id =  1, .p_data = (void*) &device_limits.subgroupSize, .size = 4 },
-      { .constant_id =  2, .p_data = (void*) &options.image_width,        .size = 4 },
-      { .constant_id =  3, .p_data = (void*) &options.image_height,       .size = 4 },
-      { .constant_id =  4, .p_data = (void*) &options.spp,                .size = 4 },
-      { .constant_id =  5, .p_data = (void*) &options.bounces,            .size = 4 },
-      { .constant_id =  6, .p_data = (void*) &traversal_stack_size,       .size = 4 },
-      { .constant_id =  7, .p_data = (void*) &options.camera_origin[0],   .size = 4 },
-      { .constant_id =  8, .p_data = (void*) &options.camera_origin[1],   .size = 4 },
-      { .constant_id =  9, .p_data = (void*) &options.camera_origin[2],   .size = 4 },
-      { .constant_id = 10, .p_data = (void*) &options.camera_target[0],   .size = 4 },
-      { .constant_id = 11, .p_data = (void*) &options.camera_target[1],   .size = 4 },
-      { .constant_id = 12, .p_data = (void*) &options.camera_target[2],   .size = 4 },
-      { .constant_id = 13, .p_data = (void*) &options.camera_fov,         .size = 4 }
-    };
-    const uint32_t specc_count = 14;
+    if (!is_valid) {
+      gatling_fail("Scene file is corrupt.");
+    }
+
+    return section;
+  }
+
+  gatling_fail("Scene file is missing a section.");
+  return NULL;
+}
+
+/* Copies the scene data to the device-local input buffer. If the device is able to
+ * import host memory, the file mapping is wrapped as a buffer and read by the copy
+ * engine directly. Otherwise, the data is streamed through two halves of the staging
+ * buffer in fixed-size chunks: the CPU fills one half while the GPU copies the other. */
+static void gatling_upload_scene(
+  cgpu_device device,
+  const cgpu_physical_device_limits* device_limits,
+  uint8_t* scene_data,
+  uint64_t scene_data_size,
+  cgpu_buffer staging_buffer,
+  cgpu_buffer input_buffer)
+{
+  CgpuResult c_result;
+
+  const uint64_t import_alignment = device_limits->minImportedHostPointerAlignment;
 
-    c_result = cgpu_create_pipeline(
+  if (import_alignment > 0 &&
+      import_alignment <= GATLING_GSD_FILE_ALIGNMENT &&
+      (scene_data_size % import_alignment) == 0)
+  {
+    cgpu_buffer host_buffer;
+    c_result = cgpu_create_buffer_from_host_memory(
       device,
-      shader_resources_buffer_count,
-      shader_resources_buffers,
-      0,
-      NULL,
-      shader,
-      "main",
-      specc_count,
-      speccs,
-      0,
-      &pipeline
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC,
+      scene_data,
+      scene_data_size,
+      &host_buffer
     );
-    gatling_cgpu_ensure(c_result);
 
-    c_result = cgpu_destroy_shader(device, shader);
-    gatling_cgpu_ensure(c_result);
-  }
+    /* Importing can still fail, e.g. for some kinds of file mappings. */
+    if (c_result == CGPU_OK)
+    {
+      cgpu_command_buffer command_buffer;
+      c_result = cgpu_create_command_buffer(device, &command_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_begin_command_buffer(command_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_cmd_copy_buffer(
+        command_buffer,
+        host_buffer,
+        0,
+        input_buffer,
+        0,
+        scene_data_size
+      );
+      gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_begin_command_buffer(command_buffer);
-  gatling_cgpu_ensure(c_result);
+      c_result = cgpu_end_command_buffer(command_buffer);
+      gatling_cgpu_ensure(c_result);
 
-  /* Write start timestamp. */
-  c_result = cgpu_cmd_reset_timestamps(
-    command_buffer,
+      cgpu_fence fence;
+      c_result = cgpu_create_fence(device, &fence);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_reset_fence(device, fence);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_submit_command_buffer(device, command_buffer, fence);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_wait_for_fence(device, fence);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_destroy_fence(device, fence);
+      gatling_cgpu_ensure(c_result);
+      c_result = cgpu_destroy_command_buffer(device, command_buffer);
+      gatling_cgpu_ensure(c_result);
+      c_result = cgpu_destroy_buffer(device, host_buffer);
+      gatling_cgpu_ensure(c_result);
+      return;
+    }
+  }
+
+  uint8_t* mapped_staging_mem;
+  c_result = cgpu_map_buffer(
+    device,
+    staging_buffer,
     0,
-    32
+    UPLOAD_CHUNK_SIZE * 2,
+    (void**) &mapped_staging_mem
   );
   gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_cmd_write_timestamp(command_buffer, 0);
-  gatling_cgpu_ensure(c_result);
+  cgpu_command_buffer command_buffers[2];
+  cgpu_fence fences[2];
+  bool is_pending[2] = { false, false };
 
-  /* Copy staging buffer to input buffer. */
-  c_result = cgpu_cmd_copy_buffer(
-    command_buffer,
-    staging_buffer,
-    0,
-    input_buffer,
-    0,
-    device_buf_size
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    c_result = cgpu_create_command_buffer(device, &command_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+    c_result = cgpu_create_fence(device, &fences[i]);
+    gatling_cgpu_ensure(c_result);
+  }
+
+  for (uint64_t offset = 0, chunk = 0; offset < scene_data_size; offset += UPLOAD_CHUNK_SIZE, ++chunk)
+  {
+    const uint32_t slot = chunk % 2;
+    const uint64_t staging_offset = slot * UPLOAD_CHUNK_SIZE;
+    const uint64_t remaining_size = scene_data_size - offset;
+    const uint64_t chunk_size = remaining_size < UPLOAD_CHUNK_SIZE ? remaining_size : UPLOAD_CHUNK_SIZE;
+
+    /* Wait until the GPU has finished reading this half of the staging buffer. */
+    if (is_pending[slot])
+    {
+      c_result = cgpu_wait_for_fence(device, fences[slot]);
+      gatling_cgpu_ensure(c_result);
+    }
+
+    memcpy(&mapped_staging_mem[staging_offset], &scene_data[offset], chunk_size);
+
+    c_result = cgpu_begin_command_buffer(command_buffers[slot]);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_cmd_copy_buffer(
+      command_buffers[slot],
+      staging_buffer,
+      staging_offset,
+      input_buffer,
+      offset,
+      chunk_size
+    );
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_end_command_buffer(command_buffers[slot]);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_reset_fence(device, fences[slot]);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_submit_command_buffer(device, command_buffers[slot], fences[slot]);
+    gatling_cgpu_ensure(c_result);
+
+    is_pending[slot] = true;
+  }
+
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    if (is_pending[i])
+    {
+      c_result = cgpu_wait_for_fence(device, fences[i]);
+      gatling_cgpu_ensure(c_result);
+    }
+    c_result = cgpu_destroy_fence(device, fences[i]);
+    gatling_cgpu_ensure(c_result);
+    c_result = cgpu_destroy_command_buffer(device, command_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+  }
+
+  c_result = cgpu_unmap_buffer(device, staging_buffer);
+  gatling_cgpu_ensure(c_result);
+}
+
+typedef struct gatling_push_constants {
+  uint32_t sample_index;
+  uint32_t bounce;
+  uint32_t tile_offset[2];
+  uint32_t tile_size[2];
+  uint32_t pixel_list_offset;
+  uint32_t pixel_list_size;
+  float camera_origin[3];
+  float camera_fov;
+  float camera_target[3];
+  float padding;
+} gatling_push_constants;
+
+static uint64_t gatling_align(uint64_t offset, uint64_t alignment)
+{
+  return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+/* Layout of the instance section, see gp.h. */
+typedef struct gatling_instance {
+  float    world_to_object[3][4];
+  uint32_t node_index;
+  uint32_t face_offset;
+  uint32_t face_count;
+  uint32_t padding;
+} gatling_instance;
+
+/* Inverts a row-major affine transform. Instances with singular
+ * transforms are skipped by gp, so the determinant is never zero. */
+static void gatling_invert_transform(const float m[3][4], float inv[3][4])
+{
+  const float det =
+    m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+    m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+    m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+  const float inv_det = 1.0f / det;
+
+  inv[0][0] =  (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+  inv[0][1] = -(m[0][1] * m[2][2] - m[0][2] * m[2][1]) * inv_det;
+  inv[0][2] =  (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+  inv[1][0] = -(m[1][0] * m[2][2] - m[1][2] * m[2][0]) * inv_det;
+  inv[1][1] =  (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+  inv[1][2] = -(m[0][0] * m[1][2] - m[0][2] * m[1][0]) * inv_det;
+  inv[2][0] =  (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+  inv[2][1] = -(m[0][0] * m[2][1] - m[0][1] * m[2][0]) * inv_det;
+  inv[2][2] =  (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+  }
+}
+
+/* Builds the hardware acceleration structures: one BLAS per mesh, covering
+ * its faces in leaf order so that primitive indices map to the face buffer,
+ * and a TLAS with one entry per instance. Spatial splits may have duplicated
+ * some faces, which doesn't affect the results. Vertices don't necessarily
+ * contain positions, so they are reconstructed from the triangles instead.
+ * The build inputs are only needed until the structures are built. */
+static void gatling_create_acceleration_structures(
+  cgpu_device device,
+  const uint8_t* scene_data,
+  const gatling_gsd_section* triangle_section,
+  const gatling_gsd_section* instance_section,
+  uint32_t* p_blas_count,
+  cgpu_blas** p_blases,
+  cgpu_tlas* p_tlas)
+{
+  const uint32_t triangle_size = 48;
+  const uint32_t vertex_size = 3 * sizeof(float);
+  const uint32_t face_count = (uint32_t) (triangle_section->size / triangle_size);
+  const uint32_t vertex_count = face_count * 3;
+  const uint32_t instance_count = (uint32_t) (instance_section->size / sizeof(gatling_instance));
+
+  const uint64_t index_offset = gatling_align((uint64_t) vertex_count * vertex_size, 16);
+  const uint64_t index_size = (uint64_t) vertex_count * sizeof(uint32_t);
+
+  cgpu_buffer build_input_buffer;
+  CgpuResult c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_SHADER_DEVICE_ADDRESS |
+      CGPU_BUFFER_USAGE_FLAG_ACCELERATION_STRUCTURE_BUILD_INPUT,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT,
+    index_offset + index_size,
+    &build_input_buffer
   );
   gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_cmd_pipeline_barrier(
-    command_buffer,
-    0, NULL,
-    1, &(cgpu_buffer_memory_barrier) {
-      .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
-      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ,
-      .buffer = input_buffer,
-      .offset = 0,
-      .size = CGPU_WHOLE_SIZE
-    },
-    0, NULL
+  uint8_t* mapped_build_input;
+  c_result = cgpu_map_buffer(
+    device,
+    build_input_buffer,
+    0,
+    index_offset + index_size,
+    (void**) &mapped_build_input
   );
   gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_cmd_bind_pipeline(command_buffer, pipeline);
+  float* positions = (float*) mapped_build_input;
+  uint32_t* indices = (uint32_t*) &mapped_build_input[index_offset];
+
+  for (uint32_t i = 0; i < face_count; ++i)
+  {
+    /* v_0, e_1 and e_2, each padded to four floats. */
+    float triangle[12];
+    memcpy(triangle, &scene_data[triangle_section->offset + (uint64_t) i * triangle_size], sizeof(triangle));
+
+    for (uint32_t k = 0; k < 3; ++k)
+    {
+      positions[i * 9 + 0 + k] = triangle[k];
+      positions[i * 9 + 3 + k] = triangle[k] + triangle[4 + k];
+      positions[i * 9 + 6 + k] = triangle[k] + triangle[8 + k];
+    }
+
+    indices[i * 3 + 0] = i * 3 + 0;
+    indices[i * 3 + 1] = i * 3 + 1;
+    indices[i * 3 + 2] = i * 3 + 2;
+  }
+
+  c_result = cgpu_unmap_buffer(device, build_input_buffer);
   gatling_cgpu_ensure(c_result);
 
-  /* Trace rays. */
-  c_result = cgpu_cmd_dispatch(
-    command_buffer,
-    (options.image_width / device_limits.subgroupSize) + 1,
-    (options.image_height / device_limits.subgroupSize) + 1,
-    1
+  gatling_instance* instances = (gatling_instance*) malloc(instance_section->size);
+  memcpy(instances, &scene_data[instance_section->offset], instance_section->size);
+
+  /* Instances of the same mesh share its face range, so BLASes are looked up
+     by the first face. Empty meshes may start one past the last face. */
+  uint32_t* face_blas_indices = (uint32_t*) malloc(((uint64_t) face_count + 1) * sizeof(uint32_t));
+  memset(face_blas_indices, 0xFF, ((uint64_t) face_count + 1) * sizeof(uint32_t));
+
+  cgpu_blas* blases = (cgpu_blas*) malloc(instance_count * sizeof(cgpu_blas));
+  cgpu_blas_instance* blas_instances = (cgpu_blas_instance*) malloc(instance_count * sizeof(cgpu_blas_instance));
+  uint32_t blas_count = 0;
+
+  for (uint32_t i = 0; i < instance_count; ++i)
+  {
+    const gatling_instance* instance = &instances[i];
+
+    if ((uint64_t) instance->face_offset + instance->face_count > face_count) {
+      gatling_fail("Scene file is corrupt.");
+    }
+
+    uint32_t blas_index = face_blas_indices[instance->face_offset];
+
+    if (blas_index == UINT32_MAX)
+    {
+      blas_index = blas_count;
+
+      c_result = cgpu_create_blas(
+        device,
+        build_input_buffer,
+        0,
+        vertex_count,
+        vertex_size,
+        build_input_buffer,
+        index_offset + (uint64_t) instance->face_offset * 3 * sizeof(uint32_t),
+        instance->face_count,
+        &blases[blas_count]
+      );
+      gatling_cgpu_ensure(c_result);
+
+      face_blas_indices[instance->face_offset] = blas_index;
+      blas_count++;
+    }
+
+    cgpu_blas_instance* blas_instance = &blas_instances[i];
+    blas_instance->blas = blases[blas_index];
+    blas_instance->instance_custom_index = i;
+    gatling_invert_transform(instance->world_to_object, blas_instance->transform);
+  }
+
+  c_result = cgpu_create_tlas(device, instance_count, blas_instances, p_tlas);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_destroy_buffer(device, build_input_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  free(blas_instances);
+  free(face_blas_indices);
+  free(instances);
+
+  *p_blas_count = blas_count;
+  *p_blases = blases;
+}
+
+static void gatling_create_shader(
+  cgpu_device device,
+  const char* dir_path,
+  const char* shader_name,
+  cgpu_shader* p_shader)
+{
+  char shader_path[2048];
+  snprintf(shader_path, 2048, "%s/shaders/%s.spv", dir_path, shader_name);
+
+  gatling_file* file;
+  if (!gatling_file_open(shader_path, GATLING_FILE_USAGE_READ, &file)) {
+    gatling_fail("Unable to open shader file.");
+  }
+
+  const uint64_t file_size = gatling_file_size(file);
+
+  uint32_t* data = (uint32_t*) gatling_mmap(file, 0, file_size);
+
+  if (!data) {
+    gatling_fail("Unable to map shader file.");
+  }
+
+  const CgpuResult c_result = cgpu_create_shader(
+    device,
+    file_size,
+    data,
+    p_shader
   );
+
+  gatling_munmap(file, data);
+
+  gatling_file_close(file);
+
+  if (c_result != CGPU_OK) {
+    gatling_fail("Unable to create shader.");
+  }
+}
+
+/* Pipeline caches are only valid for the device and driver that created them.
+ * Both are part of the file name, so that machines with different GPUs can
+ * share a cache directory. */
+static void gatling_make_pipeline_cache_path(
+  const char* cache_dir,
+  const cgpu_physical_device_limits* device_limits,
+  char* path)
+{
+  char uuid[33];
+  for (uint32_t i = 0; i < 16; ++i) {
+    snprintf(&uuid[i * 2], 3, "%02x", device_limits->pipelineCacheUUID[i]);
+  }
+
+  snprintf(path, 2048, "%s/pipelines_%s_%08x.bin", cache_dir, uuid, device_limits->driverVersion);
+}
+
+/* Returns the size of the loaded data, or zero if there is no usable cache. */
+static uint64_t gatling_load_pipeline_cache(
+  cgpu_device device,
+  const char* path)
+{
+  gatling_file* file;
+  if (!gatling_file_open(path, GATLING_FILE_USAGE_READ, &file)) {
+    return 0;
+  }
+
+  const uint64_t file_size = gatling_file_size(file);
+  void* data = (file_size > 0) ? gatling_mmap(file, 0, file_size) : NULL;
+
+  CgpuResult c_result = CGPU_FAIL_INCOMPATIBLE_PIPELINE_CACHE;
+
+  if (data)
+  {
+    c_result = cgpu_load_pipeline_cache(device, file_size, data);
+    gatling_munmap(file, data);
+  }
+
+  gatling_file_close(file);
+
+  if (c_result != CGPU_OK)
+  {
+    printf("Ignoring unusable pipeline cache %s\n", path);
+    return 0;
+  }
+
+  return file_size;
+}
+
+/* Only written if compilation added to the cache. Many jobs may start at the
+ * same time, so the data is written to a temporary file which then replaces
+ * the cache in one step. */
+static void gatling_store_pipeline_cache(
+  cgpu_device device,
+  const char* path,
+  uint64_t loaded_size)
+{
+  uint64_t size = 0;
+  CgpuResult c_result = cgpu_get_pipeline_cache_data(device, &size, NULL);
   gatling_cgpu_ensure(c_result);
 
-  /* Copy output buffer to staging buffer. */
-  c_result = cgpu_cmd_pipeline_barrier(
+  if (size == 0 || size == loaded_size) {
+    return;
+  }
+
+  void* data = malloc(size);
+  if (!data) {
+    gatling_fail("Unable to allocate memory.");
+  }
+
+  c_result = cgpu_get_pipeline_cache_data(device, &size, data);
+  gatling_cgpu_ensure(c_result);
+
+  char temp_path[2048];
+  gatling_file_make_temp_path(path, temp_path, 2048);
+
+  gatling_file* file;
+  bool stored = gatling_file_create(temp_path, size, &file);
+
+  if (stored)
+  {
+    void* mapped_mem = gatling_mmap(file, 0, size);
+    stored = (mapped_mem != NULL);
+
+    if (stored)
+    {
+      memcpy(mapped_mem, data, size);
+      stored = gatling_munmap(file, mapped_mem);
+    }
+
+    stored = gatling_file_close(file) && stored;
+  }
+
+  stored = stored && gatling_file_replace(temp_path, path);
+
+  if (!stored)
+  {
+    remove(temp_path);
+    printf("Unable to store pipeline cache %s\n", path);
+  }
+
+  free(data);
+}
+
+/* Makes the results of a kernel visible to the next one, including
+ * the arguments of indirect dispatches. */
+static void gatling_cmd_kernel_barrier(cgpu_command_buffer command_buffer)
+{
+  const CgpuResult c_result = cgpu_cmd_pipeline_barrier(
     command_buffer,
-    0, NULL,
-    1, &(cgpu_buffer_memory_barrier) {
+    1, &(cgpu_memory_barrier) {
       .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE,
-      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_READ,
-      .buffer = output_buffer,
-      .offset = 0,
-      .size = CGPU_WHOLE_SIZE
+      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ |
+                          CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE |
+                          CGPU_MEMORY_ACCESS_FLAG_INDIRECT_COMMAND_READ
     },
+    0, NULL,
     0, NULL
   );
   gatling_cgpu_ensure(c_result);
+}
 
-  c_result = cgpu_cmd_copy_buffer(
+/* Makes the results of the command buffer visible to host reads of mapped
+ * buffers, once its fence has been signaled. */
+static void gatling_cmd_host_read_barrier(cgpu_command_buffer command_buffer)
+{
+  const CgpuResult c_result = cgpu_cmd_pipeline_barrier(
     command_buffer,
-    output_buffer,
-    0,
-    staging_buffer,
-    0,
-    output_buffer_size
+    1, &(cgpu_memory_barrier) {
+      .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE |
+                          CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_HOST_READ
+    },
+    0, NULL,
+    0, NULL
   );
   gatling_cgpu_ensure(c_result);
+}
 
-  /* Write end timestamp and copy timestamps. */
-  c_result = cgpu_cmd_write_timestamp(command_buffer, 1);
+static void gatling_cmd_dispatch_kernel(
+  cgpu_command_buffer command_buffer,
+  cgpu_pipeline pipeline,
+  const gatling_push_constants* push_constants,
+  const cgpu_buffer* p_indirect_buffer,
+  uint64_t indirect_offset,
+  uint32_t dim_x,
+  uint32_t dim_y)
+{
+  CgpuResult c_result = cgpu_cmd_bind_pipeline(command_buffer, pipeline);
   gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_cmd_copy_timestamps(
+  c_result = cgpu_cmd_push_constants(
     command_buffer,
-    timestamp_buffer,
-    0,
-    2,
-    true
+    pipeline,
+    sizeof(gatling_push_constants),
+    push_constants
   );
   gatling_cgpu_ensure(c_result);
 
-  /* End and submit command buffer. */
-  c_result = cgpu_end_command_buffer(command_buffer);
+  if (p_indirect_buffer) {
+    c_result = cgpu_cmd_dispatch_indirect(command_buffer, *p_indirect_buffer, indirect_offset);
+  } else {
+    c_result = cgpu_cmd_dispatch(command_buffer, dim_x, dim_y, 1);
+  }
   gatling_cgpu_ensure(c_result);
 
-  cgpu_fence fence;
-  c_result = cgpu_create_fence(device, &fence);
-  gatling_cgpu_ensure(c_result);
+  gatling_cmd_kernel_barrier(command_buffer);
+}
 
-  c_result = cgpu_reset_fence(device, fence);
-  gatling_cgpu_ensure(c_result);
+/* Direction numbers of the first four Sobol dimensions, from the primitive
+ * polynomials and initial numbers of Joe and Kuo [2008]. The first dimension
+ * is the van der Corput sequence. */
+static void gatling_make_sobol_matrices(uint32_t matrices[4][32])
+{
+  static const uint32_t degrees[3] = { 1, 2, 3 };
+  static const uint32_t coefficients[3] = { 0, 1, 1 };
+  static const uint32_t initial_numbers[3][3] = { { 1 }, { 1, 3 }, { 1, 3, 1 } };
 
-  printf("Rendering...\n");
+  for (uint32_t k = 0; k < 32; ++k) {
+    matrices[0][k] = 1u << (31 - k);
+  }
 
-  c_result = cgpu_submit_command_buffer(
-    device,
-    command_buffer,
-    fence
-  );
-  gatling_cgpu_ensure(c_result);
+  for (uint32_t d = 1; d < 4; ++d)
+  {
+    uint32_t* v = matrices[d];
+    const uint32_t s = degrees[d - 1];
+    const uint32_t a = coefficients[d - 1];
 
-  c_result = cgpu_wait_for_fence(device, fence);
-  gatling_cgpu_ensure(c_result);
+    for (uint32_t k = 0; k < s; ++k) {
+      v[k] = initial_numbers[d - 1][k] << (31 - k);
+    }
 
-  /* Read timestamps. */
-  uint64_t* timestamps;
+    for (uint32_t k = s; k < 32; ++k)
+    {
+      v[k] = v[k - s] ^ (v[k - s] >> s);
 
-  c_result = cgpu_map_buffer(
-    device,
-    timestamp_buffer,
-    0,
-    CGPU_WHOLE_SIZE,
-    (void**) &timestamps
-  );
-  gatling_cgpu_ensure(c_result);
+      for (uint32_t i = 1; i < s; ++i) {
+        v[k] ^= ((a >> (s - 1 - i)) & 1) * v[k - i];
+      }
+    }
+  }
+}
 
-  const uint64_t timestamp_start = timestamps[0];
-  const uint64_t timestamp_end = timestamps[1];
+/* Kernels which are timed with --stats. */
+typedef enum GatlingKernel {
+  GATLING_KERNEL_GENERATE = 0,
+  GATLING_KERNEL_ADVANCE  = 1,
+  GATLING_KERNEL_EXTEND   = 2,
+  GATLING_KERNEL_SHADE    = 3,
+  GATLING_KERNEL_CONNECT  = 4,
+  GATLING_KERNEL_COUNT    = 5
+} GatlingKernel;
+
+static const char* GATLING_KERNEL_NAMES[GATLING_KERNEL_COUNT] = {
+  "generate",
+  "advance",
+  "extend",
+  "shade",
+  "connect"
+};
+
+/* Scene file contents which are shared by all devices. */
+typedef struct gatling_scene {
+  uint8_t*                   data;
+  /* Everything but the texture pages, which are streamed on demand. */
+  uint64_t                   resident_size;
+  const gatling_gsd_section* node_section;
+  const gatling_gsd_section* face_section;
+  const gatling_gsd_section* vertex_section;
+  const gatling_gsd_section* material_section;
+  const gatling_gsd_section* instance_section;
+  const gatling_gsd_section* light_binding_section;
+  const gatling_gsd_section* triangle_section;
+  const gatling_gsd_section* texture_binding_section;
+  uint32_t                   light_count;
+  float                      light_power;
+  uint32_t                   compressed_vertices;
+  uint32_t                   texture_count;
+  uint32_t                   texture_page_count;
+  const uint8_t*             texture_pages;
+  /* The page of the last mip level of every texture. */
+  uint32_t*                  coarsest_texture_pages;
+} gatling_scene;
+
+/* Everything needed to render on one device. Each device holds its own copy
+ * of the scene and adds its samples to its own accumulation buffer. */
+typedef struct gatling_device {
+  uint32_t                    index;
+  cgpu_device                 device;
+  cgpu_physical_device_limits limits;
+  bool                        use_ray_query;
+  cgpu_buffer                 input_buffer;
+  cgpu_buffer                 staging_buffer;
+  cgpu_buffer                 output_buffer;
+  cgpu_buffer                 timestamp_buffer;
+  cgpu_buffer                 path_buffer;
+  cgpu_buffer                 queue_state_buffer;
+  cgpu_buffer                 adaptive_buffer;
+  cgpu_buffer                 active_pixel_count_buffer;
+  cgpu_buffer                 sobol_buffer;
+  cgpu_buffer                 image_buffer;
+  cgpu_buffer                 stats_buffer;
+  uint32_t                    blas_count;
+  cgpu_blas*                  blases;
+  cgpu_tlas                   tlas;
+  cgpu_pipeline               generate_pipeline;
+  cgpu_pipeline               advance_pipeline;
+  cgpu_pipeline               extend_pipeline;
+  cgpu_pipeline               shade_pipeline;
+  cgpu_pipeline               connect_pipeline;
+  cgpu_pipeline               converge_pipeline;
+  cgpu_pipeline               tonemap_pipeline;
+  cgpu_command_buffer         command_buffers[2];
+  cgpu_fence                  fences[2];
+  bool                        is_pending[2];
+  uint32_t                    submission_index;
+  uint32_t                    chunk_count;
+  /* Totals of all frames. */
+  float                       rendering_time;
+  uint64_t                    ray_count;
+  uint64_t                    shadow_ray_count;
+  /* With --traversal-stats, the work of the software traversal. */
+  uint32_t                    traversal_stack_size;
+  uint64_t                    node_visit_count;
+  uint64_t                    face_test_count;
+  uint64_t                    stack_push_count;
+  uint32_t                    max_stack_size;
+  /* Texture pages are streamed into a fixed number of cache slots, see
+     gatling_update_texture_cache. The first slots hold the last mip level
+     of every texture and are never evicted. */
+  const gatling_scene*        scene;
+  cgpu_buffer                 page_table_buffer;
+  cgpu_buffer                 texture_cache_buffer;
+  cgpu_buffer                 texture_feedback_buffer;
+  cgpu_buffer                 texture_upload_buffers[2];
+  uint32_t                    texture_slot_count;
+  uint32_t*                   page_slots;
+  uint32_t*                   slot_pages;
+  uint32_t                    clock_hand;
+  bool                        is_texture_cache_initialized;
+  bool                        is_texture_cache_full;
+  uint64_t                    texture_upload_count;
+  /* With --stats, a timestamp is written after every kernel. The results of a
+     command buffer are added up once its fence has been waited for. */
+  bool                        is_profiling;
+  cgpu_buffer                 profile_buffers[2];
+  uint8_t*                    profile_kernels[2];
+  uint32_t                    profile_timestamp_counts[2];
+  double                      kernel_times[GATLING_KERNEL_COUNT];
+  uint64_t                    kernel_dispatch_counts[GATLING_KERNEL_COUNT];
+} gatling_device;
+
+/* Offsets into the queue state buffer. */
+static const uint64_t EXTEND_DISPATCH_OFFSET = 0;
+static const uint64_t SHADE_DISPATCH_OFFSET = 3 * sizeof(uint32_t);
+
+static void gatling_setup_device(
+  gatling_device* gdev,
+  const program_options* options,
+  const gatling_scene* scene,
+  const char* dir_path)
+{
+  const cgpu_device device = gdev->device;
+  const cgpu_physical_device_limits* device_limits = &gdev->limits;
 
-  c_result = cgpu_unmap_buffer(device, timestamp_buffer);
-  gatling_cgpu_ensure(c_result);
+  if (device_limits->minStorageBufferOffsetAlignment > GATLING_GSD_SECTION_ALIGNMENT) {
+    gatling_fail("Scene file sections are not sufficiently aligned for device.");
+  }
 
-  const float elapsed_nanoseconds  = (float) (timestamp_end - timestamp_start) * device_limits.timestampPeriod;
-  const float elapsed_microseconds = elapsed_nanoseconds / 1000.0f;
-  const float elapsed_milliseconds = elapsed_microseconds / 1000.0f;
-  printf("Total rendering time: %.2fms\n", elapsed_milliseconds);
+  /* Create input and output buffers. */
+  const uint64_t device_buf_size = scene->resident_size;
+  const uint64_t output_buffer_size = options->image_width * options->image_height * sizeof(float) * 4;
+  const uint64_t upload_buffer_size = UPLOAD_CHUNK_SIZE * 2;
+  const uint64_t staging_buffer_size = output_buffer_size > upload_buffer_size ? output_buffer_size : upload_buffer_size;
 
-  /* Read data from gpu and save image. */
-  float* image_data = malloc(output_buffer_size);
+  CgpuResult c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    device_buf_size,
+    &gdev->input_buffer
+  );
+  gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_map_buffer(
+  c_result = cgpu_create_buffer(
     device,
-    staging_buffer,
-    0,
-    output_buffer_size,
-    (void**) &mapped_staging_mem
+    CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
+    staging_buffer_size,
+    &gdev->staging_buffer
   );
   gatling_cgpu_ensure(c_result);
 
-  memcpy(
-    image_data,
-    mapped_staging_mem,
-    output_buffer_size
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    output_buffer_size,
+    &gdev->output_buffer
   );
+  gatling_cgpu_ensure(c_result);
 
-  c_result = cgpu_unmap_buffer(
+  c_result = cgpu_create_buffer(
     device,
-    staging_buffer
+    CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
+    32 * sizeof(uint64_t),
+    &gdev->timestamp_buffer
   );
   gatling_cgpu_ensure(c_result);
 
-  gatling_save_img(
-    image_data,
-    output_buffer_size / 4,
-    &options
+  gatling_upload_scene(
+    device,
+    device_limits,
+    scene->data,
+    scene->resident_size,
+    gdev->staging_buffer,
+    gdev->input_buffer
   );
 
-  free(image_data);
+  /* Use the hardware traversal units if there are any. Otherwise, the
+   * compressed BVH of the scene file is traversed in software. Only the
+   * latter can be instrumented for --traversal-stats. */
+  gdev->use_ray_query = device_limits->rayQuery &&
+    (options->traversal_stats == GATLING_TRAVERSAL_STATS_OFF);
 
-  /* Clean up. */
-  c_result = cgpu_destroy_fence(device, fence);
+  gdev->blas_count = 0;
+  gdev->blases = NULL;
+  gdev->tlas = (cgpu_tlas) { 0 };
+
+  if (gdev->use_ray_query)
+  {
+    gatling_create_acceleration_structures(
+      device,
+      scene->data,
+      scene->triangle_section,
+      scene->instance_section,
+      &gdev->blas_count,
+      &gdev->blases,
+      &gdev->tlas
+    );
+  }
+
+  printf("Device %u: using %s ray traversal\n", gdev->index, gdev->use_ray_query ? "hardware" : "software");
+
+  /* Create the wavefront queues. Each array is bound as a separate range. */
+  const uint64_t queue_capacity = (uint64_t) options->image_width * options->image_height;
+  const uint64_t ray_queue_size = queue_capacity * 2 * sizeof(float) * 4;
+  const uint64_t hit_queue_size = queue_capacity * sizeof(uint32_t) * 4;
+  const uint64_t hit_distances_size = queue_capacity * sizeof(float);
+  const uint64_t shadow_ray_queue_size = queue_capacity * sizeof(float) * 4;
+
+  const uint64_t path_alignment = device_limits->minStorageBufferOffsetAlignment;
+  const uint64_t ray_origins_offset = 0;
+  const uint64_t ray_directions_offset = gatling_align(ray_origins_offset + ray_queue_size, path_alignment);
+  const uint64_t path_throughputs_offset = gatling_align(ray_directions_offset + ray_queue_size, path_alignment);
+  const uint64_t hits_offset = gatling_align(path_throughputs_offset + ray_queue_size, path_alignment);
+  const uint64_t hit_distances_offset = gatling_align(hits_offset + hit_queue_size, path_alignment);
+  const uint64_t shadow_ray_origins_offset = gatling_align(hit_distances_offset + hit_distances_size, path_alignment);
+  const uint64_t shadow_ray_directions_offset = gatling_align(shadow_ray_origins_offset + shadow_ray_queue_size, path_alignment);
+  const uint64_t shadow_radiances_offset = gatling_align(shadow_ray_directions_offset + shadow_ray_queue_size, path_alignment);
+  const uint64_t path_buffer_size = shadow_radiances_offset + shadow_ray_queue_size;
+
+  /* Indirect dispatch arguments, the two ray counters, the ray pool index
+   * and the shadow ray counter. */
+  const uint64_t queue_state_buffer_size = 10 * sizeof(uint32_t);
+
+  /* Adaptive sampling state: a second accumulation buffer for even samples only,
+   * the list of pixels which have not converged yet, and its length. */
+  const uint64_t pixel_count = (uint64_t) options->image_width * options->image_height;
+  const uint64_t half_output_size = pixel_count * sizeof(float) * 4;
+  const uint64_t active_pixels_offset = gatling_align(half_output_size, path_alignment);
+  const uint64_t active_pixels_size = pixel_count * sizeof(uint32_t);
+  const uint64_t adaptive_buffer_size = active_pixels_offset + active_pixels_size;
+
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    path_buffer_size,
+    &gdev->path_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_INDIRECT_BUFFER,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    queue_state_buffer_size,
+    &gdev->queue_state_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    adaptive_buffer_size,
+    &gdev->adaptive_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  /* Read back after every pass to decide whether to stop early. */
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT,
+    sizeof(uint32_t),
+    &gdev->active_pixel_count_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  /* Only a few hundred bytes, so the shaders read it from host memory. */
+  const uint64_t sobol_buffer_size = 4 * 32 * sizeof(uint32_t);
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT,
+    sobol_buffer_size,
+    &gdev->sobol_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  uint32_t (*mapped_sobol_matrices)[32];
+  c_result = cgpu_map_buffer(device, gdev->sobol_buffer, 0, CGPU_WHOLE_SIZE, (void**) &mapped_sobol_matrices);
+  gatling_cgpu_ensure(c_result);
+  gatling_make_sobol_matrices(mapped_sobol_matrices);
+  c_result = cgpu_unmap_buffer(device, gdev->sobol_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  /* RGBA8 version of the output, written by the tonemap kernel. */
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    pixel_count * sizeof(uint32_t),
+    &gdev->image_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  /* Ray and traversal counters, cleared at the start of every frame. */
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT,
+    STATS_COUNTER_COUNT * sizeof(uint32_t),
+    &gdev->stats_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  /* The page table maps texture pages to cache slots. Kernels set a bit for
+   * every page they would have liked to sample, and the bits are cleared at
+   * the start of every frame. All buffers are created even without textures,
+   * as bindings can't be left empty. */
+  const uint64_t texture_cache_capacity =
+    (uint64_t) options->texture_cache_size * 1024 * 1024 / GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE;
+  gdev->texture_slot_count = (uint32_t) (texture_cache_capacity < scene->texture_page_count ?
+    texture_cache_capacity : scene->texture_page_count);
+
+  if (gdev->texture_slot_count < scene->texture_count) {
+    gatling_fail("Texture cache is too small for the scene, please increase --texture-cache-size.");
+  }
+
+  const uint32_t page_table_size = (scene->texture_page_count > 0) ? scene->texture_page_count : 1;
+  const uint32_t slot_count = (gdev->texture_slot_count > 0) ? gdev->texture_slot_count : 1;
+  const uint32_t texture_upload_capacity = MAX_TEXTURE_PAGE_UPLOADS + scene->texture_count;
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    page_table_size * sizeof(uint32_t),
+    &gdev->page_table_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_DEVICE_LOCAL,
+    (uint64_t) slot_count * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE,
+    &gdev->texture_cache_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_create_buffer(
+    device,
+    CGPU_BUFFER_USAGE_FLAG_STORAGE_BUFFER |
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+    CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
+    ((page_table_size + 31) / 32) * sizeof(uint32_t),
+    &gdev->texture_feedback_buffer
+  );
+  gatling_cgpu_ensure(c_result);
+
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    c_result = cgpu_create_buffer(
+      device,
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_SRC,
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+        CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT,
+      (uint64_t) texture_upload_capacity * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE,
+      &gdev->texture_upload_buffers[i]
+    );
+    gatling_cgpu_ensure(c_result);
+  }
+
+  gdev->page_slots = (uint32_t*) malloc(page_table_size * sizeof(uint32_t));
+  gdev->slot_pages = (uint32_t*) malloc(slot_count * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < page_table_size; ++i) {
+    gdev->page_slots[i] = NO_TEXTURE_PAGE;
+  }
+  for (uint32_t i = 0; i < slot_count; ++i) {
+    gdev->slot_pages[i] = NO_TEXTURE_PAGE;
+  }
+
+  gdev->scene = scene;
+  gdev->clock_hand = 0;
+  gdev->is_texture_cache_initialized = false;
+  gdev->is_texture_cache_full = false;
+  gdev->texture_upload_count = 0;
+
+  if (scene->texture_page_count > 0)
+  {
+    printf("Device %u: caching %u of %u texture pages (%.1f MiB)\n",
+      gdev->index,
+      gdev->texture_slot_count,
+      scene->texture_page_count,
+      (double) gdev->texture_slot_count * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE / (1024.0 * 1024.0));
+  }
+
+  gdev->is_profiling = (options->stats_file != NULL);
+
+  for (uint32_t i = 0; i < 2 && gdev->is_profiling; ++i)
+  {
+    c_result = cgpu_create_buffer(
+      device,
+      CGPU_BUFFER_USAGE_FLAG_TRANSFER_DST,
+      CGPU_MEMORY_PROPERTY_FLAG_HOST_VISIBLE |
+        CGPU_MEMORY_PROPERTY_FLAG_HOST_COHERENT |
+        CGPU_MEMORY_PROPERTY_FLAG_HOST_CACHED,
+      PROFILE_QUERY_COUNT * sizeof(uint64_t),
+      &gdev->profile_buffers[i]
+    );
+    gatling_cgpu_ensure(c_result);
+
+    gdev->profile_kernels[i] = (uint8_t*) malloc(PROFILE_QUERY_COUNT);
+    gdev->profile_timestamp_counts[i] = 0;
+  }
+
+  for (uint32_t i = 0; i < GATLING_KERNEL_COUNT; ++i)
+  {
+    gdev->kernel_times[i] = 0.0;
+    gdev->kernel_dispatch_counts[i] = 0;
+  }
+
+  /* Set up pipelines. All kernels share the same resources and constants. */
+  cgpu_shader_resource_buffer shader_resources_buffers[] = {
+    {  0,             gdev->output_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    {  1,              gdev->input_buffer,           scene->node_section->offset,           scene->node_section->size },
+    {  2,              gdev->input_buffer,           scene->face_section->offset,           scene->face_section->size },
+    {  3,              gdev->input_buffer,         scene->vertex_section->offset,         scene->vertex_section->size },
+    {  4,              gdev->input_buffer,       scene->material_section->offset,       scene->material_section->size },
+    {  5,              gdev->input_buffer,       scene->instance_section->offset,       scene->instance_section->size },
+    {  6,               gdev->path_buffer,                    ray_origins_offset,                      ray_queue_size },
+    {  7,               gdev->path_buffer,                 ray_directions_offset,                      ray_queue_size },
+    {  8,               gdev->path_buffer,               path_throughputs_offset,                      ray_queue_size },
+    {  9,               gdev->path_buffer,                           hits_offset,                      hit_queue_size },
+    { 10,               gdev->path_buffer,                  hit_distances_offset,                  hit_distances_size },
+    { 11,        gdev->queue_state_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 12,           gdev->adaptive_buffer,                                     0,                    half_output_size },
+    { 13,           gdev->adaptive_buffer,                  active_pixels_offset,                  active_pixels_size },
+    { 14, gdev->active_pixel_count_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 15,              gdev->input_buffer,  scene->light_binding_section->offset,  scene->light_binding_section->size },
+    { 16,               gdev->path_buffer,             shadow_ray_origins_offset,               shadow_ray_queue_size },
+    { 17,               gdev->path_buffer,          shadow_ray_directions_offset,               shadow_ray_queue_size },
+    { 18,               gdev->path_buffer,               shadow_radiances_offset,               shadow_ray_queue_size },
+    { 20,              gdev->input_buffer,       scene->triangle_section->offset,       scene->triangle_section->size },
+    { 21,              gdev->sobol_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 22,              gdev->image_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 23,              gdev->stats_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 24,              gdev->input_buffer, scene->texture_binding_section->offset, scene->texture_binding_section->size },
+    { 25,         gdev->page_table_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 26,      gdev->texture_cache_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+    { 27,   gdev->texture_feedback_buffer,                                     0,                     CGPU_WHOLE_SIZE },
+  };
+  const uint32_t shader_resources_buffer_count = sizeof(shader_resources_buffers) / sizeof(shader_resources_buffers[0]);
+
+  const uint32_t node_size = 80;
+  const uint32_t node_count = scene->node_section->size / node_size;
+  gdev->traversal_stack_size = (log(node_count) / log(8)) * 2;
+
+  /* The camera is passed as push constants instead, so that the pipelines can
+     be reused for all frames of a camera path. */
+  const cgpu_specialization_constant speccs[] = {
+    { .constant_id =  0, .p_data = (void*) &device_limits->subgroupSize,         .size = 4 },
+    { .constant_id =  1, .p_data = (void*) &device_limits->subgroupSize,         .size = 4 },
+    { .constant_id =  2, .p_data = (void*) &options->image_width,                .size = 4 },
+    { .constant_id =  3, .p_data = (void*) &options->image_height,               .size = 4 },
+    { .constant_id =  4, .p_data = (void*) &options->spp,                        .size = 4 },
+    { .constant_id =  5, .p_data = (void*) &options->bounces,                    .size = 4 },
+    { .constant_id =  6, .p_data = (void*) &gdev->traversal_stack_size,          .size = 4 },
+    { .constant_id = 14, .p_data = (void*) &RAY_BATCH_SIZE,                      .size = 4 },
+    { .constant_id = 15, .p_data = (void*) &PERSISTENT_WORKGROUP_COUNT,          .size = 4 },
+    { .constant_id = 16, .p_data = (void*) &options->error_threshold,            .size = 4 },
+    { .constant_id = 17, .p_data = (void*) &scene->light_count,                  .size = 4 },
+    { .constant_id = 18, .p_data = (void*) &scene->light_power,                  .size = 4 },
+    { .constant_id = 19, .p_data = (void*) &scene->compressed_vertices,          .size = 4 },
+    { .constant_id = 20, .p_data = (void*) &options->sample_offset,              .size = 4 },
+    { .constant_id = 21, .p_data = (void*) &options->sampler,                    .size = 4 },
+    { .constant_id = 22, .p_data = (void*) &options->traversal_stats,            .size = 4 }
+  };
+  const uint32_t specc_count = sizeof(speccs) / sizeof(speccs[0]);
+
+  const uint32_t shader_resources_tlas_count = gdev->use_ray_query ? 1 : 0;
+  const cgpu_shader_resource_tlas shader_resources_tlas[] = {
+    { 19, gdev->tlas }
+  };
+
+  const char* shader_names[] = {
+    "generate.comp",
+    "advance.comp",
+    gdev->use_ray_query ? "extend_rq.comp" : "extend.comp",
+    "shade.comp",
+    gdev->use_ray_query ? "connect_rq.comp" : "connect.comp",
+    "converge.comp",
+    "tonemap.comp"
+  };
+  const bool uses_tlas[] = { false, false, true, false, true, false, false };
+  const uint32_t pipeline_count = 7;
+
+  cgpu_shader shaders[7];
+  cgpu_pipeline_create_info pipeline_infos[7];
+
+  for (uint32_t i = 0; i < pipeline_count; ++i)
+  {
+    gatling_create_shader(device, dir_path, shader_names[i], &shaders[i]);
+
+    pipeline_infos[i] = (cgpu_pipeline_create_info) {
+      .buffer_resource_count = shader_resources_buffer_count,
+      .p_buffer_resources = shader_resources_buffers,
+      .image_resource_count = 0,
+      .p_image_resources = NULL,
+      .tlas_resource_count = uses_tlas[i] ? shader_resources_tlas_count : 0,
+      .p_tlas_resources = shader_resources_tlas,
+      .shader = shaders[i],
+      .p_shader_entry_point = "main",
+      .specialization_constant_count = specc_count,
+      .p_specialization_constants = speccs,
+      .push_constants_size = sizeof(gatling_push_constants)
+    };
+  }
+
+  char pipeline_cache_path[2048];
+  uint64_t loaded_pipeline_cache_size = 0;
+
+  if (options->cache_dir)
+  {
+    gatling_make_pipeline_cache_path(options->cache_dir, device_limits, pipeline_cache_path);
+    loaded_pipeline_cache_size = gatling_load_pipeline_cache(device, pipeline_cache_path);
+  }
+
+  /* Compiled in parallel by the driver. */
+  cgpu_pipeline pipelines[7];
+  c_result = cgpu_create_pipelines(device, pipeline_count, pipeline_infos, pipelines);
+  gatling_cgpu_ensure(c_result);
+
+  for (uint32_t i = 0; i < pipeline_count; ++i)
+  {
+    c_result = cgpu_destroy_shader(device, shaders[i]);
+    gatling_cgpu_ensure(c_result);
+  }
+
+  if (options->cache_dir) {
+    gatling_store_pipeline_cache(device, pipeline_cache_path, loaded_pipeline_cache_size);
+  }
+
+  gdev->generate_pipeline = pipelines[0];
+  gdev->advance_pipeline = pipelines[1];
+  gdev->extend_pipeline = pipelines[2];
+  gdev->shade_pipeline = pipelines[3];
+  gdev->connect_pipeline = pipelines[4];
+  gdev->converge_pipeline = pipelines[5];
+  gdev->tonemap_pipeline = pipelines[6];
+
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    c_result = cgpu_create_command_buffer(device, &gdev->command_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+    c_result = cgpu_create_fence(device, &gdev->fences[i]);
+    gatling_cgpu_ensure(c_result);
+    gdev->is_pending[i] = false;
+  }
+
+  gdev->submission_index = 0;
+  gdev->chunk_count = 0;
+  gdev->rendering_time = 0.0f;
+  gdev->ray_count = 0;
+  gdev->shadow_ray_count = 0;
+  gdev->node_visit_count = 0;
+  gdev->face_test_count = 0;
+  gdev->stack_push_count = 0;
+  gdev->max_stack_size = 0;
+
+  cgpu_memory_stats memory_stats;
+  c_result = cgpu_get_memory_stats(device, &memory_stats);
+  gatling_cgpu_ensure(c_result);
+
+  printf("Device %u: %.1f MiB used of %.1f MiB allocated (%u blocks, %u dedicated allocations)\n",
+    gdev->index,
+    memory_stats.device_local_used_size / (1024.0 * 1024.0),
+    memory_stats.device_local_allocated_size / (1024.0 * 1024.0),
+    memory_stats.block_count,
+    memory_stats.dedicated_allocation_count);
+}
+
+static void gatling_destroy_device(gatling_device* gdev)
+{
+  const cgpu_device device = gdev->device;
+
+  CgpuResult c_result;
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    c_result = cgpu_destroy_fence(device, gdev->fences[i]);
+    gatling_cgpu_ensure(c_result);
+    c_result = cgpu_destroy_command_buffer(device, gdev->command_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+  }
+  c_result = cgpu_destroy_pipeline(device, gdev->generate_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->advance_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->extend_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->shade_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->connect_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->converge_pipeline);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_pipeline(device, gdev->tonemap_pipeline);
+  gatling_cgpu_ensure(c_result);
+  if (gdev->use_ray_query)
+  {
+    c_result = cgpu_destroy_tlas(device, gdev->tlas);
+    gatling_cgpu_ensure(c_result);
+
+    for (uint32_t i = 0; i < gdev->blas_count; ++i)
+    {
+      c_result = cgpu_destroy_blas(device, gdev->blases[i]);
+      gatling_cgpu_ensure(c_result);
+    }
+
+    free(gdev->blases);
+  }
+  c_result = cgpu_destroy_buffer(device, gdev->input_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->path_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->queue_state_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->adaptive_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->active_pixel_count_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->sobol_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->image_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_command_buffer(device, command_buffer);
+  c_result = cgpu_destroy_buffer(device, gdev->stats_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_pipeline(device, pipeline);
+  c_result = cgpu_destroy_buffer(device, gdev->page_table_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_buffer(device, input_buffer);
+  c_result = cgpu_destroy_buffer(device, gdev->texture_cache_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_buffer(device, staging_buffer);
+  c_result = cgpu_destroy_buffer(device, gdev->texture_feedback_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_buffer(device, output_buffer);
+  for (uint32_t i = 0; i < 2; ++i)
+  {
+    c_result = cgpu_destroy_buffer(device, gdev->texture_upload_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+  }
+  free(gdev->page_slots);
+  free(gdev->slot_pages);
+  for (uint32_t i = 0; i < 2 && gdev->is_profiling; ++i)
+  {
+    c_result = cgpu_destroy_buffer(device, gdev->profile_buffers[i]);
+    gatling_cgpu_ensure(c_result);
+    free(gdev->profile_kernels[i]);
+  }
+  c_result = cgpu_destroy_buffer(device, gdev->staging_buffer);
   gatling_cgpu_ensure(c_result);
-  c_result = cgpu_destroy_buffer(device, timestamp_buffer);
+  c_result = cgpu_destroy_buffer(device, gdev->output_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_destroy_buffer(device, gdev->timestamp_buffer);
   gatling_cgpu_ensure(c_result);
   c_result = cgpu_destroy_device(device);
   gatling_cgpu_ensure(c_result);
+}
+
+static void gatling_wait_for_slot(gatling_device* gdev, uint32_t slot)
+{
+  if (!gdev->is_pending[slot]) {
+    return;
+  }
+
+  CgpuResult c_result = cgpu_wait_for_fence(gdev->device, gdev->fences[slot]);
+  gatling_cgpu_ensure(c_result);
+
+  gdev->is_pending[slot] = false;
+
+  const uint32_t timestamp_count = gdev->profile_timestamp_counts[slot];
+
+  if (!gdev->is_profiling || timestamp_count == 0) {
+    return;
+  }
+
+  const uint64_t* timestamps;
+  c_result = cgpu_map_buffer(gdev->device, gdev->profile_buffers[slot], 0, CGPU_WHOLE_SIZE, (void**) &timestamps);
+  gatling_cgpu_ensure(c_result);
+
+  /* Kernels run one after the other, so each one ends at its own timestamp
+     and starts at the previous one. */
+  for (uint32_t i = 1; i < timestamp_count; ++i)
+  {
+    const uint8_t kernel = gdev->profile_kernels[slot][i];
+    gdev->kernel_times[kernel] += (double) (timestamps[i] - timestamps[i - 1]) * gdev->limits.timestampPeriod;
+    gdev->kernel_dispatch_counts[kernel]++;
+  }
+
+  c_result = cgpu_unmap_buffer(gdev->device, gdev->profile_buffers[slot]);
+  gatling_cgpu_ensure(c_result);
+
+  gdev->profile_timestamp_counts[slot] = 0;
+}
+
+static void gatling_cmd_profile_kernel(
+  gatling_device* gdev,
+  uint32_t slot,
+  cgpu_command_buffer command_buffer,
+  GatlingKernel kernel)
+{
+  if (!gdev->is_profiling) {
+    return;
+  }
+
+  const uint32_t timestamp_index = gdev->profile_timestamp_counts[slot];
+
+  if (timestamp_index >= PROFILE_QUERY_COUNT) {
+    gatling_fail("Too many kernels per pass for --stats. Please lower --spp-per-pass.");
+  }
+
+  const CgpuResult c_result = cgpu_cmd_write_timestamp(command_buffer, 2 + slot * PROFILE_QUERY_COUNT + timestamp_index);
+  gatling_cgpu_ensure(c_result);
+
+  gdev->profile_kernels[slot][timestamp_index] = (uint8_t) kernel;
+  gdev->profile_timestamp_counts[slot]++;
+}
+
+static void gatling_wait_for_device(gatling_device* gdev)
+{
+  for (uint32_t i = 0; i < 2; ++i) {
+    gatling_wait_for_slot(gdev, i);
+  }
+}
+
+/* Fills in the image region of a tile. */
+static void gatling_get_tile(
+  const program_options* options,
+  uint32_t tile_size,
+  uint32_t tile_count_x,
+  uint32_t tile_index,
+  gatling_push_constants* push_constants)
+{
+  const uint32_t tile_x = tile_index % tile_count_x;
+  const uint32_t tile_y = tile_index / tile_count_x;
+
+  memset(push_constants, 0, sizeof(gatling_push_constants));
+  push_constants->tile_offset[0] = tile_x * tile_size;
+  push_constants->tile_offset[1] = tile_y * tile_size;
+  push_constants->tile_size[0] = options->image_width - push_constants->tile_offset[0];
+  push_constants->tile_size[1] = options->image_height - push_constants->tile_offset[1];
+  push_constants->tile_size[0] = push_constants->tile_size[0] < tile_size ? push_constants->tile_size[0] : tile_size;
+  push_constants->tile_size[1] = push_constants->tile_size[1] < tile_size ? push_constants->tile_size[1] : tile_size;
+}
+
+/* Copies a page from the scene into a cache slot through the upload buffer and
+ * points the page table at it. */
+static void gatling_cmd_upload_texture_page(
+  gatling_device* gdev,
+  cgpu_command_buffer command_buffer,
+  cgpu_buffer upload_buffer,
+  uint8_t* upload_data,
+  uint32_t upload_index,
+  uint32_t page,
+  uint32_t cache_slot)
+{
+  const uint64_t page_size = GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE;
+
+  memcpy(&upload_data[upload_index * page_size], &gdev->scene->texture_pages[page * page_size], page_size);
+
+  CgpuResult c_result = cgpu_cmd_copy_buffer(
+    command_buffer,
+    upload_buffer,
+    upload_index * page_size,
+    gdev->texture_cache_buffer,
+    cache_slot * page_size,
+    page_size
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_cmd_fill_buffer(command_buffer, gdev->page_table_buffer, page * sizeof(uint32_t), sizeof(uint32_t), cache_slot);
+  gatling_cgpu_ensure(c_result);
+
+  gdev->page_slots[page] = cache_slot;
+  gdev->slot_pages[cache_slot] = page;
+  gdev->texture_upload_count++;
+}
+
+/* Returns a free cache slot, or the next one in clock order whose page hasn't
+ * been requested in the current frame. */
+static uint32_t gatling_find_texture_slot(gatling_device* gdev, const uint32_t* requested_pages)
+{
+  const uint32_t pinned_slot_count = gdev->scene->texture_count;
+  const uint32_t evictable_slot_count = gdev->texture_slot_count - pinned_slot_count;
+
+  for (uint32_t i = 0; i < evictable_slot_count; ++i)
+  {
+    const uint32_t slot = pinned_slot_count + gdev->clock_hand;
+    gdev->clock_hand = (gdev->clock_hand + 1) % evictable_slot_count;
+
+    const uint32_t page = gdev->slot_pages[slot];
+
+    if (page == NO_TEXTURE_PAGE || (requested_pages[page / 32] & (1u << (page % 32))) == 0) {
+      return slot;
+    }
+  }
+
+  return NO_TEXTURE_PAGE;
+}
+
+/* Makes the texture pages which the kernels have requested resident, before the
+ * kernels of this chunk run. Requests are read while other chunks may still be
+ * adding to them, which only delays some pages to the next chunk. Until a page
+ * has arrived, lookups fall back to coarser levels, down to the last one, which
+ * is loaded first and never evicted. */
+static void gatling_update_texture_cache(
+  gatling_device* gdev,
+  uint32_t slot,
+  cgpu_command_buffer command_buffer)
+{
+  const gatling_scene* scene = gdev->scene;
+
+  if (scene->texture_page_count == 0) {
+    return;
+  }
+
+  const cgpu_device device = gdev->device;
+  const cgpu_buffer upload_buffer = gdev->texture_upload_buffers[slot];
+
+  const uint32_t* requested_pages;
+  CgpuResult c_result = cgpu_map_buffer(device, gdev->texture_feedback_buffer, 0, CGPU_WHOLE_SIZE, (void**) &requested_pages);
+  gatling_cgpu_ensure(c_result);
+
+  uint8_t* upload_data;
+  c_result = cgpu_map_buffer(device, upload_buffer, 0, CGPU_WHOLE_SIZE, (void**) &upload_data);
+  gatling_cgpu_ensure(c_result);
+
+  /* Slots and page table entries may still be read by the kernels of the previous chunk. */
+  const cgpu_memory_barrier upload_barrier = {
+    .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ,
+    .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE
+  };
+
+  uint32_t upload_count = 0;
+
+  if (!gdev->is_texture_cache_initialized)
+  {
+    c_result = cgpu_cmd_pipeline_barrier(command_buffer, 1, &upload_barrier, 0, NULL, 0, NULL);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_cmd_fill_buffer(command_buffer, gdev->page_table_buffer, 0, CGPU_WHOLE_SIZE, NO_TEXTURE_PAGE);
+    gatling_cgpu_ensure(c_result);
+
+    const cgpu_memory_barrier fill_barrier = {
+      .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE
+    };
+
+    c_result = cgpu_cmd_pipeline_barrier(command_buffer, 1, &fill_barrier, 0, NULL, 0, NULL);
+    gatling_cgpu_ensure(c_result);
+
+    for (uint32_t t = 0; t < scene->texture_count; ++t, ++upload_count)
+    {
+      gatling_cmd_upload_texture_page(
+        gdev, command_buffer, upload_buffer, upload_data, upload_count, scene->coarsest_texture_pages[t], t
+      );
+    }
+
+    gdev->is_texture_cache_initialized = true;
+  }
+
+  const uint32_t pinned_upload_count = upload_count;
+  const uint32_t word_count = (scene->texture_page_count + 31) / 32;
+  bool is_cache_full = false;
+
+  for (uint32_t w = 0; w < word_count && !is_cache_full && upload_count - pinned_upload_count < MAX_TEXTURE_PAGE_UPLOADS; ++w)
+  {
+    const uint32_t bits = requested_pages[w];
+
+    for (uint32_t b = 0; b < 32 && bits != 0; ++b)
+    {
+      const uint32_t page = w * 32 + b;
+
+      if ((bits & (1u << b)) == 0 || gdev->page_slots[page] != NO_TEXTURE_PAGE) {
+        continue;
+      }
+
+      if (upload_count - pinned_upload_count == MAX_TEXTURE_PAGE_UPLOADS) {
+        break;
+      }
+
+      const uint32_t cache_slot = gatling_find_texture_slot(gdev, requested_pages);
+
+      if (cache_slot == NO_TEXTURE_PAGE)
+      {
+        is_cache_full = true;
+        break;
+      }
+
+      if (upload_count == 0)
+      {
+        c_result = cgpu_cmd_pipeline_barrier(command_buffer, 1, &upload_barrier, 0, NULL, 0, NULL);
+        gatling_cgpu_ensure(c_result);
+      }
+
+      /* Lookups of the evicted page fall back to a coarser level instead. */
+      const uint32_t evicted_page = gdev->slot_pages[cache_slot];
+
+      if (evicted_page != NO_TEXTURE_PAGE)
+      {
+        c_result = cgpu_cmd_fill_buffer(
+          command_buffer, gdev->page_table_buffer, evicted_page * sizeof(uint32_t), sizeof(uint32_t), NO_TEXTURE_PAGE
+        );
+        gatling_cgpu_ensure(c_result);
+
+        gdev->page_slots[evicted_page] = NO_TEXTURE_PAGE;
+      }
+
+      gatling_cmd_upload_texture_page(
+        gdev, command_buffer, upload_buffer, upload_data, upload_count, page, cache_slot
+      );
+      upload_count++;
+    }
+  }
+
+  if (is_cache_full && !gdev->is_texture_cache_full)
+  {
+    printf("Warning: device %u: texture cache is full, consider increasing --texture-cache-size\n", gdev->index);
+    gdev->is_texture_cache_full = true;
+  }
+
+  c_result = cgpu_unmap_buffer(device, upload_buffer);
+  gatling_cgpu_ensure(c_result);
+  c_result = cgpu_unmap_buffer(device, gdev->texture_feedback_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  if (upload_count == 0) {
+    return;
+  }
+
+  const cgpu_memory_barrier shader_barrier = {
+    .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+    .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ
+  };
+
+  c_result = cgpu_cmd_pipeline_barrier(command_buffer, 1, &shader_barrier, 0, NULL, 0, NULL);
+  gatling_cgpu_ensure(c_result);
+}
+
+/* Records and submits the samples [sample_begin, sample_end) of one chunk. A chunk
+ * is either a tile or, if pixel_list_size is set, a range of the list of pixels
+ * which have not converged yet. Two command buffers are used in turn, so that the
+ * next submission is recorded while the GPU is busy. The first submission of a
+ * frame clears the accumulation buffer. */
+static void gatling_submit_chunk(
+  gatling_device* gdev,
+  const program_options* options,
+  const gatling_camera* camera,
+  uint32_t light_count,
+  uint32_t sample_begin,
+  uint32_t sample_end,
+  const gatling_push_constants* chunk_constants)
+{
+  const cgpu_device device = gdev->device;
+  const uint32_t slot = gdev->submission_index % 2;
+  const cgpu_command_buffer command_buffer = gdev->command_buffers[slot];
+  const uint32_t subgroup_size = gdev->limits.subgroupSize;
+
+  gatling_wait_for_slot(gdev, slot);
+
+  gatling_push_constants push_constants = *chunk_constants;
+  memcpy(push_constants.camera_origin, camera->origin, sizeof(camera->origin));
+  memcpy(push_constants.camera_target, camera->target, sizeof(camera->target));
+  push_constants.camera_fov = camera->fov;
+
+  uint32_t generate_dim_x;
+  uint32_t generate_dim_y;
+
+  if (push_constants.pixel_list_size > 0)
+  {
+    const uint32_t workgroup_size = subgroup_size * subgroup_size;
+    generate_dim_x = (push_constants.pixel_list_size + workgroup_size - 1) / workgroup_size;
+    generate_dim_y = 1;
+  }
+  else
+  {
+    generate_dim_x = (push_constants.tile_size[0] / subgroup_size) + 1;
+    generate_dim_y = (push_constants.tile_size[1] / subgroup_size) + 1;
+  }
+
+  CgpuResult c_result = cgpu_begin_command_buffer(command_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  if (gdev->submission_index == 0)
+  {
+    /* Write start timestamp. */
+    c_result = cgpu_cmd_reset_timestamps(
+      command_buffer,
+      0,
+      2
+    );
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_cmd_write_timestamp(command_buffer, 0);
+    gatling_cgpu_ensure(c_result);
+
+    /* Samples of a tile can be spread over several devices, so pixels may be
+       accumulated without the first sample having been traced on this device. */
+    c_result = cgpu_cmd_fill_buffer(command_buffer, gdev->output_buffer, 0, CGPU_WHOLE_SIZE, 0);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_cmd_fill_buffer(command_buffer, gdev->stats_buffer, 0, CGPU_WHOLE_SIZE, 0);
+    gatling_cgpu_ensure(c_result);
+
+    c_result = cgpu_cmd_fill_buffer(command_buffer, gdev->texture_feedback_buffer, 0, CGPU_WHOLE_SIZE, 0);
+    gatling_cgpu_ensure(c_result);
+
+    /* Make the uploaded scene data and the cleared buffers visible to the shader.
+       The barrier also covers the copies submitted before this command buffer. */
+    const cgpu_buffer_memory_barrier buffer_barriers[] = {
+      {
+        .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+        .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ,
+        .buffer = gdev->input_buffer,
+        .offset = 0,
+        .size = CGPU_WHOLE_SIZE
+      },
+      {
+        .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+        .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ | CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE,
+        .buffer = gdev->output_buffer,
+        .offset = 0,
+        .size = CGPU_WHOLE_SIZE
+      },
+      {
+        .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+        .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ | CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE,
+        .buffer = gdev->stats_buffer,
+        .offset = 0,
+        .size = CGPU_WHOLE_SIZE
+      },
+      {
+        .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_WRITE,
+        .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_READ | CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE,
+        .buffer = gdev->texture_feedback_buffer,
+        .offset = 0,
+        .size = CGPU_WHOLE_SIZE
+      }
+    };
+
+    c_result = cgpu_cmd_pipeline_barrier(
+      command_buffer,
+      0, NULL,
+      4, buffer_barriers,
+      0, NULL
+    );
+    gatling_cgpu_ensure(c_result);
+  }
+
+  gatling_update_texture_cache(gdev, slot, command_buffer);
+
+  const uint32_t profile_query_offset = 2 + slot * PROFILE_QUERY_COUNT;
+
+  if (gdev->is_profiling)
+  {
+    c_result = cgpu_cmd_reset_timestamps(command_buffer, profile_query_offset, PROFILE_QUERY_COUNT);
+    gatling_cgpu_ensure(c_result);
+
+    /* The first timestamp marks the start of the first kernel. */
+    gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_COUNT);
+  }
+
+  /* Trace rays. One wavefront of paths is processed per sample. */
+  for (uint32_t s = sample_begin; s < sample_end; ++s)
+  {
+    push_constants.sample_index = s;
+    push_constants.bounce = 0;
+
+    gatling_cmd_dispatch_kernel(
+      command_buffer,
+      gdev->generate_pipeline,
+      &push_constants,
+      NULL,
+      0,
+      generate_dim_x,
+      generate_dim_y
+    );
+    gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_GENERATE);
+
+    for (uint32_t b = 0; b <= options->bounces; ++b)
+    {
+      push_constants.bounce = b;
+
+      gatling_cmd_dispatch_kernel(command_buffer, gdev->advance_pipeline, &push_constants, NULL, 0, 1, 1);
+      gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_ADVANCE);
+      gatling_cmd_dispatch_kernel(command_buffer, gdev->extend_pipeline, &push_constants, &gdev->queue_state_buffer,
+                                  gdev->use_ray_query ? SHADE_DISPATCH_OFFSET : EXTEND_DISPATCH_OFFSET, 0, 0);
+      gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_EXTEND);
+      gatling_cmd_dispatch_kernel(command_buffer, gdev->shade_pipeline, &push_constants, &gdev->queue_state_buffer,
+                                  SHADE_DISPATCH_OFFSET, 0, 0);
+      gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_SHADE);
+
+      /* No shadow rays are emitted at the last bounce. */
+      if (light_count > 0 && b < options->bounces) {
+        gatling_cmd_dispatch_kernel(command_buffer, gdev->connect_pipeline, &push_constants, &gdev->queue_state_buffer,
+                                    SHADE_DISPATCH_OFFSET, 0, 0);
+        gatling_cmd_profile_kernel(gdev, slot, command_buffer, GATLING_KERNEL_CONNECT);
+      }
+    }
+  }
+
+  if (gdev->is_profiling)
+  {
+    c_result = cgpu_cmd_copy_timestamps(
+      command_buffer,
+      gdev->profile_buffers[slot],
+      profile_query_offset,
+      gdev->profile_timestamp_counts[slot],
+      true
+    );
+    gatling_cgpu_ensure(c_result);
+  }
+
+  /* Texture requests and kernel timings are read once the slot is reused. */
+  if (gdev->is_profiling || gdev->scene->texture_page_count > 0) {
+    gatling_cmd_host_read_barrier(command_buffer);
+  }
+
+  /* End and submit command buffer. */
+  c_result = cgpu_end_command_buffer(command_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_reset_fence(device, gdev->fences[slot]);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_submit_command_buffer(
+    device,
+    command_buffer,
+    gdev->fences[slot]
+  );
+  gatling_cgpu_ensure(c_result);
+
+  gdev->is_pending[slot] = true;
+  gdev->submission_index++;
+  gdev->chunk_count++;
+}
+
+/* Hands out the tiles of all passes in order. Devices take the next tile whenever
+ * one of their command buffers becomes free, so faster devices render more of them.
+ * Random numbers only depend on the pixel and the sample index, so the same
+ * samples are taken no matter how the tiles were distributed. */
+typedef struct gatling_work_queue {
+  gatling_mutex* mutex;
+  uint32_t       next_item;
+  uint32_t       item_count;
+  uint32_t       tile_size;
+  uint32_t       tile_count_x;
+  uint32_t       tile_count;
+} gatling_work_queue;
+
+typedef struct gatling_render_job {
+  gatling_device*        gdev;
+  gatling_work_queue*    queue;
+  const program_options* options;
+  const gatling_camera*  camera;
+  uint32_t               light_count;
+} gatling_render_job;
+
+static void gatling_render_tiles(void* data)
+{
+  const gatling_render_job* job = (const gatling_render_job*) data;
+  gatling_work_queue* queue = job->queue;
+  const program_options* options = job->options;
+  const uint32_t pass_count = queue->item_count / queue->tile_count;
+
+  while (true)
+  {
+    gatling_wait_for_slot(job->gdev, job->gdev->submission_index % 2);
+
+    gatling_mutex_lock(queue->mutex);
+    const uint32_t item = queue->next_item;
+    if (item < queue->item_count) {
+      queue->next_item++;
+    }
+    gatling_mutex_unlock(queue->mutex);
+
+    if (item >= queue->item_count) {
+      break;
+    }
+
+    const uint32_t pass = item / queue->tile_count;
+    const uint32_t tile = item % queue->tile_count;
+
+    const uint32_t sample_begin = pass * options->spp_per_pass;
+    const uint32_t sample_end = (sample_begin + options->spp_per_pass) < options->spp ?
+      (sample_begin + options->spp_per_pass) : options->spp;
+
+    gatling_push_constants chunk_constants;
+    gatling_get_tile(options, queue->tile_size, queue->tile_count_x, tile, &chunk_constants);
+
+    gatling_submit_chunk(job->gdev, options, job->camera, job->light_count, sample_begin, sample_end, &chunk_constants);
+
+    if (tile == (queue->tile_count - 1)) {
+      printf("Submitted pass %u/%u\n", pass + 1, pass_count);
+    }
+  }
+
+  gatling_wait_for_device(job->gdev);
+}
+
+/* Copies the output to the staging buffer and returns the rendering time of the
+ * device in milliseconds. If encode is set, the image is resolved and encoded as
+ * RGBA8 by the tonemap kernel first, otherwise the accumulated sums are copied.
+ * The time and the ray counts of the frame are added to the device totals. */
+static float gatling_read_back(
+  gatling_device* gdev,
+  const program_options* options,
+  bool encode)
+{
+  const cgpu_device device = gdev->device;
+  const cgpu_command_buffer command_buffer = gdev->command_buffers[0];
+  const uint64_t pixel_count = (uint64_t) options->image_width * options->image_height;
+
+  gatling_wait_for_device(gdev);
+
+  /* Copy output buffer to staging buffer and write end timestamp. */
+  CgpuResult c_result = cgpu_begin_command_buffer(command_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  cgpu_buffer copy_buffer = gdev->output_buffer;
+  uint64_t copy_size = pixel_count * sizeof(float) * 4;
+
+  if (encode)
+  {
+    gatling_push_constants push_constants;
+    memset(&push_constants, 0, sizeof(push_constants));
+
+    gatling_cmd_kernel_barrier(command_buffer);
+
+    gatling_cmd_dispatch_kernel(
+      command_buffer,
+      gdev->tonemap_pipeline,
+      &push_constants,
+      NULL,
+      0,
+      (options->image_width / gdev->limits.subgroupSize) + 1,
+      (options->image_height / gdev->limits.subgroupSize) + 1
+    );
+
+    copy_buffer = gdev->image_buffer;
+    copy_size = pixel_count * sizeof(uint32_t);
+  }
+
+  c_result = cgpu_cmd_pipeline_barrier(
+    command_buffer,
+    0, NULL,
+    1, &(cgpu_buffer_memory_barrier) {
+      .src_access_flags = CGPU_MEMORY_ACCESS_FLAG_SHADER_WRITE,
+      .dst_access_flags = CGPU_MEMORY_ACCESS_FLAG_TRANSFER_READ,
+      .buffer = copy_buffer,
+      .offset = 0,
+      .size = CGPU_WHOLE_SIZE
+    },
+    0, NULL
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_cmd_copy_buffer(
+    command_buffer,
+    copy_buffer,
+    0,
+    gdev->staging_buffer,
+    0,
+    copy_size
+  );
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_cmd_write_timestamp(command_buffer, 1);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_cmd_copy_timestamps(
+    command_buffer,
+    gdev->timestamp_buffer,
+    0,
+    2,
+    true
+  );
+  gatling_cgpu_ensure(c_result);
+
+  /* Covers the pixels, timestamps and statistics. */
+  gatling_cmd_host_read_barrier(command_buffer);
+
+  c_result = cgpu_end_command_buffer(command_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_reset_fence(device, gdev->fences[0]);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_submit_command_buffer(device, command_buffer, gdev->fences[0]);
+  gatling_cgpu_ensure(c_result);
+
+  c_result = cgpu_wait_for_fence(device, gdev->fences[0]);
+  gatling_cgpu_ensure(c_result);
+
+  /* Read timestamps. */
+  uint64_t* timestamps;
+
+  c_result = cgpu_map_buffer(
+    device,
+    gdev->timestamp_buffer,
+    0,
+    CGPU_WHOLE_SIZE,
+    (void**) &timestamps
+  );
+  gatling_cgpu_ensure(c_result);
+
+  const uint64_t timestamp_start = timestamps[0];
+  const uint64_t timestamp_end = timestamps[1];
+
+  c_result = cgpu_unmap_buffer(device, gdev->timestamp_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  const uint32_t* counters;
+  c_result = cgpu_map_buffer(device, gdev->stats_buffer, 0, CGPU_WHOLE_SIZE, (void**) &counters);
+  gatling_cgpu_ensure(c_result);
+
+  gdev->ray_count += ((uint64_t) counters[1] << 32) | counters[0];
+  gdev->shadow_ray_count += ((uint64_t) counters[3] << 32) | counters[2];
+  gdev->node_visit_count += ((uint64_t) counters[5] << 32) | counters[4];
+  gdev->face_test_count += ((uint64_t) counters[7] << 32) | counters[6];
+  gdev->stack_push_count += ((uint64_t) counters[9] << 32) | counters[8];
+  gdev->max_stack_size = counters[10] > gdev->max_stack_size ? counters[10] : gdev->max_stack_size;
+
+  c_result = cgpu_unmap_buffer(device, gdev->stats_buffer);
+  gatling_cgpu_ensure(c_result);
+
+  const float elapsed_nanoseconds  = (float) (timestamp_end - timestamp_start) * gdev->limits.timestampPeriod;
+  const float elapsed_microseconds = elapsed_nanoseconds / 1000.0f;
+  const float elapsed_milliseconds = elapsed_microseconds / 1000.0f;
+
+  gdev->rendering_time += elapsed_milliseconds;
+
+  return elapsed_milliseconds;
+}
+
+static void gatling_print_traversal_stats(const gatling_device* gdevs, uint32_t device_count)
+{
+  for (uint32_t i = 0; i < device_count; ++i)
+  {
+    const gatling_device* gdev = &gdevs[i];
+
+    const uint64_t traced_count = gdev->ray_count + gdev->shadow_ray_count;
+    const double inv_traced_count = (traced_count > 0) ? (1.0 / traced_count) : 0.0;
+
+    printf("Device %u: %.1f nodes, %.1f triangles and %.1f stack pushes per ray, deepest stack %u of %u\n",
+      gdev->index,
+      gdev->node_visit_count * inv_traced_count,
+      gdev->face_test_count * inv_traced_count,
+      gdev->stack_push_count * inv_traced_count,
+      gdev->max_stack_size,
+      gdev->traversal_stack_size);
+
+    /* The stack is only sized by an estimate of the BVH depth. */
+    if (gdev->max_stack_size > gdev->traversal_stack_size) {
+      printf("Device %u: traversal stack overflowed, the image may be incorrect\n", gdev->index);
+    }
+  }
+}
+
+/* Writes the totals of all frames. Times are in milliseconds. */
+static void gatling_write_stats(
+  const gatling_device* gdevs,
+  uint32_t device_count,
+  const program_options* options,
+  uint32_t frame_count,
+  float rendering_time)
+{
+  FILE* file = fopen(options->stats_file, "w");
+  if (!file) {
+    gatling_fail("Unable to open stats file.");
+  }
+
+  uint64_t ray_count = 0;
+  uint64_t shadow_ray_count = 0;
+
+  for (uint32_t i = 0; i < device_count; ++i)
+  {
+    ray_count += gdevs[i].ray_count;
+    shadow_ray_count += gdevs[i].shadow_ray_count;
+  }
+
+  const double seconds = rendering_time / 1000.0;
+  const double rays_per_second = (seconds > 0.0) ? ((ray_count + shadow_ray_count) / seconds) : 0.0;
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"image_width\": %u,\n", options->image_width);
+  fprintf(file, "  \"image_height\": %u,\n", options->image_height);
+  fprintf(file, "  \"spp\": %u,\n", options->spp);
+  fprintf(file, "  \"bounces\": %u,\n", options->bounces);
+  fprintf(file, "  \"frame_count\": %u,\n", frame_count);
+  fprintf(file, "  \"rendering_time\": %.3f,\n", rendering_time);
+  fprintf(file, "  \"ray_count\": %llu,\n", (unsigned long long) ray_count);
+  fprintf(file, "  \"shadow_ray_count\": %llu,\n", (unsigned long long) shadow_ray_count);
+  fprintf(file, "  \"rays_per_second\": %.0f,\n", rays_per_second);
+  fprintf(file, "  \"devices\": [\n");
+
+  for (uint32_t i = 0; i < device_count; ++i)
+  {
+    const gatling_device* gdev = &gdevs[i];
+
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"index\": %u,\n", gdev->index);
+    fprintf(file, "      \"ray_query\": %s,\n", gdev->use_ray_query ? "true" : "false");
+    fprintf(file, "      \"rendering_time\": %.3f,\n", gdev->rendering_time);
+    fprintf(file, "      \"ray_count\": %llu,\n", (unsigned long long) gdev->ray_count);
+    fprintf(file, "      \"shadow_ray_count\": %llu,\n", (unsigned long long) gdev->shadow_ray_count);
+    fprintf(file, "      \"texture_cache_slot_count\": %u,\n", gdev->texture_slot_count);
+    fprintf(file, "      \"texture_page_upload_count\": %llu,\n", (unsigned long long) gdev->texture_upload_count);
+
+    if (options->traversal_stats != GATLING_TRAVERSAL_STATS_OFF)
+    {
+      const uint64_t traced_count = gdev->ray_count + gdev->shadow_ray_count;
+      const double inv_traced_count = (traced_count > 0) ? (1.0 / traced_count) : 0.0;
+
+      fprintf(file, "      \"traversal\": {\n");
+      fprintf(file, "        \"node_visit_count\": %llu,\n", (unsigned long long) gdev->node_visit_count);
+      fprintf(file, "        \"face_test_count\": %llu,\n", (unsigned long long) gdev->face_test_count);
+      fprintf(file, "        \"stack_push_count\": %llu,\n", (unsigned long long) gdev->stack_push_count);
+      fprintf(file, "        \"nodes_per_ray\": %.3f,\n", gdev->node_visit_count * inv_traced_count);
+      fprintf(file, "        \"faces_per_ray\": %.3f,\n", gdev->face_test_count * inv_traced_count);
+      fprintf(file, "        \"stack_pushes_per_ray\": %.3f,\n", gdev->stack_push_count * inv_traced_count);
+      fprintf(file, "        \"max_stack_size\": %u,\n", gdev->max_stack_size);
+      fprintf(file, "        \"stack_capacity\": %u\n", gdev->traversal_stack_size);
+      fprintf(file, "      },\n");
+    }
+
+    fprintf(file, "      \"kernels\": {\n");
+
+    for (uint32_t k = 0; k < GATLING_KERNEL_COUNT; ++k)
+    {
+      fprintf(file, "        \"%s\": { \"time\": %.3f, \"dispatch_count\": %llu }%s\n",
+        GATLING_KERNEL_NAMES[k],
+        gdev->kernel_times[k] / 1000000.0,
+        (unsigned long long) gdev->kernel_dispatch_counts[k],
+        (k < GATLING_KERNEL_COUNT - 1) ? "," : "");
+    }
+
+    fprintf(file, "      }\n");
+    fprintf(file, "    }%s\n", (i < device_count - 1) ? "," : "");
+  }
+
+  fprintf(file, "  ]\n");
+  fprintf(file, "}\n");
+
+  if (fclose(file) != 0) {
+    gatling_fail("Unable to write stats file.");
+  }
+}
+
+/* Frames are written to disk on another thread while the next one is rendered. */
+typedef struct gatling_frame_output {
+  program_options options;
+  char            file_path[1024];
+  /* Either the image encoded by the device or the merged sums of samples. */
+  const uint8_t*  image_data;
+  const float*    accumulated_data;
+  uint64_t        fingerprint;
+} gatling_frame_output;
+
+static void gatling_write_frame(void* data)
+{
+  const gatling_frame_output* frame_output = (const gatling_frame_output*) data;
+
+  if (frame_output->image_data)
+  {
+    gatling_save_img(frame_output->image_data, &frame_output->options);
+  }
+  else
+  {
+    gatling_save_output(
+      frame_output->accumulated_data,
+      frame_output->options.sample_offset,
+      frame_output->options.spp,
+      frame_output->fingerprint,
+      &frame_output->options
+    );
+  }
+}
+
+/* Renders progressively. Each submission traces a pass of up to spp_per_pass samples
+ * for one tile and adds them to the accumulation buffer of its device.
+ *
+ * With adaptive sampling, the pixels which have not converged after a pass are
+ * gathered in a list. Later passes only trace these, in chunks of a tile's size. */
+static void gatling_render_frame(
+  gatling_device* gdevs,
+  uint32_t device_count,
+  const program_options* options,
+  const gatling_camera* camera,
+  uint32_t light_count)
+{
+  for (uint32_t i = 0; i < device_count; ++i)
+  {
+    gdevs[i].submission_index = 0;
+    gdevs[i].chunk_count = 0;
+  }
+
+  const uint64_t pixel_count = (uint64_t) options->image_width * options->image_height;
+  const uint32_t tile_size = (options->tile_size > 0) ? options->tile_size :
+    (options->image_width > options->image_height ? options->image_width : options->image_height);
+  const uint32_t tile_count_x = (options->image_width + tile_size - 1) / tile_size;
+  const uint32_t tile_count_y = (options->image_height + tile_size - 1) / tile_size;
+  const uint32_t tile_count = tile_count_x * tile_count_y;
+  const uint32_t pass_count = (options->spp + options->spp_per_pass - 1) / options->spp_per_pass;
+  const uint64_t max_chunk_size = (uint64_t) tile_size * tile_size;
+  const uint32_t chunk_size = (uint32_t) (max_chunk_size < pixel_count ? max_chunk_size : pixel_count);
+
+  if (options->error_threshold <= 0.0f)
+  {
+    gatling_work_queue queue;
+    queue.next_item = 0;
+    queue.item_count = pass_count * tile_count;
+    queue.tile_size = tile_size;
+    queue.tile_count_x = tile_count_x;
+    queue.tile_count = tile_count;
+
+    if (!gatling_mutex_create(&queue.mutex)) {
+      gatling_fail("Unable to create mutex.");
+    }
+
+    gatling_render_job* jobs = (gatling_render_job*) malloc(device_count * sizeof(gatling_render_job));
+    gatling_thread** threads = (gatling_thread**) malloc(device_count * sizeof(gatling_thread*));
+
+    for (uint32_t i = 0; i < device_count; ++i)
+    {
+      jobs[i].gdev = &gdevs[i];
+      jobs[i].queue = &queue;
+      jobs[i].options = options;
+      jobs[i].camera = camera;
+      jobs[i].light_count = light_count;
+    }
+
+    /* The first device is fed by the main thread. */
+    for (uint32_t i = 1; i < device_count; ++i)
+    {
+      if (!gatling_thread_create(gatling_render_tiles, &jobs[i], &threads[i])) {
+        gatling_fail("Unable to create thread.");
+      }
+    }
+
+    gatling_render_tiles(&jobs[0]);
+
+    for (uint32_t i = 1; i < device_count; ++i) {
+      gatling_thread_join(threads[i]);
+    }
+
+    free(threads);
+    free(jobs);
+    gatling_mutex_destroy(queue.mutex);
+  }
+  else
+  {
+    gatling_device* gdev = &gdevs[0];
+    const cgpu_device device = gdev->device;
+    CgpuResult c_result;
+
+    uint32_t active_pixel_count = (uint32_t) pixel_count;
+    uint64_t traced_sample_count = 0;
+
+    for (uint32_t pass = 0; pass < pass_count; ++pass)
+    {
+      const bool use_pixel_list = (pass > 0);
+      const uint32_t chunk_count = use_pixel_list ?
+        (active_pixel_count + chunk_size - 1) / chunk_size : tile_count;
+
+      const uint32_t sample_begin = pass * options->spp_per_pass;
+      const uint32_t sample_end = (sample_begin + options->spp_per_pass) < options->spp ?
+        (sample_begin + options->spp_per_pass) : options->spp;
+
+      for (uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+      {
+        gatling_push_constants chunk_constants;
+
+        if (use_pixel_list)
+        {
+          const uint32_t remaining_count = active_pixel_count - chunk * chunk_size;
+          memset(&chunk_constants, 0, sizeof(chunk_constants));
+          chunk_constants.pixel_list_offset = chunk * chunk_size;
+          chunk_constants.pixel_list_size = remaining_count < chunk_size ? remaining_count : chunk_size;
+        }
+        else
+        {
+          gatling_get_tile(options, tile_size, tile_count_x, chunk, &chunk_constants);
+        }
+
+        gatling_submit_chunk(gdev, options, camera, light_count, sample_begin, sample_end, &chunk_constants);
+      }
+
+      traced_sample_count += (uint64_t) active_pixel_count * (sample_end - sample_begin);
+
+      printf("Submitted pass %u/%u\n", pass + 1, pass_count);
+
+      if (pass == (pass_count - 1)) {
+        continue;
+      }
+
+      /* Gather the pixels which have not converged yet. */
+      gatling_wait_for_device(gdev);
+
+      uint32_t* mapped_active_pixel_count;
+      c_result = cgpu_map_buffer(device, gdev->active_pixel_count_buffer, 0, CGPU_WHOLE_SIZE, (void**) &mapped_active_pixel_count);
+      gatling_cgpu_ensure(c_result);
+      *mapped_active_pixel_count = 0;
+      c_result = cgpu_unmap_buffer(device, gdev->active_pixel_count_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      const cgpu_command_buffer command_buffer = gdev->command_buffers[0];
+
+      c_result = cgpu_begin_command_buffer(command_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      gatling_push_constants push_constants;
+      memset(&push_constants, 0, sizeof(push_constants));
+
+      gatling_cmd_dispatch_kernel(
+        command_buffer,
+        gdev->converge_pipeline,
+        &push_constants,
+        NULL,
+        0,
+        (options->image_width / gdev->limits.subgroupSize) + 1,
+        (options->image_height / gdev->limits.subgroupSize) + 1
+      );
+
+      gatling_cmd_host_read_barrier(command_buffer);
+
+      c_result = cgpu_end_command_buffer(command_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_reset_fence(device, gdev->fences[0]);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_submit_command_buffer(device, command_buffer, gdev->fences[0]);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_wait_for_fence(device, gdev->fences[0]);
+      gatling_cgpu_ensure(c_result);
+
+      c_result = cgpu_map_buffer(device, gdev->active_pixel_count_buffer, 0, CGPU_WHOLE_SIZE, (void**) &mapped_active_pixel_count);
+      gatling_cgpu_ensure(c_result);
+      active_pixel_count = *mapped_active_pixel_count;
+      c_result = cgpu_unmap_buffer(device, gdev->active_pixel_count_buffer);
+      gatling_cgpu_ensure(c_result);
+
+      printf("%u pixels have not converged\n", active_pixel_count);
+
+      if (active_pixel_count == 0) {
+        break;
+      }
+    }
+
+    const uint64_t max_sample_count = pixel_count * options->spp;
+    printf("Traced %.1f%% of the maximum sample count\n", 100.0 * traced_sample_count / max_sample_count);
+  }
+}
+
+int main(int argc, const char* argv[])
+{
+  if (argc > 1 && strcmp(argv[1], "--merge") == 0)
+  {
+    gatling_merge(argc, argv);
+    return EXIT_SUCCESS;
+  }
+
+  program_options options;
+  gatling_parse_args(argc, argv, &options);
+
+  /* Without a camera path, a single frame is rendered with the camera options. */
+  uint32_t frame_count = 1;
+  gatling_camera* cameras;
+
+  if (options.camera_path)
+  {
+    cameras = gatling_load_camera_path(options.camera_path, &frame_count);
+  }
+  else
+  {
+    cameras = (gatling_camera*) malloc(sizeof(gatling_camera));
+    memcpy(cameras[0].origin, options.camera_origin, sizeof(cameras[0].origin));
+    memcpy(cameras[0].target, options.camera_target, sizeof(cameras[0].target));
+    cameras[0].fov = options.camera_fov;
+  }
+
+  /* Set up instance and devices. */
+  CgpuResult c_result = cgpu_initialize(
+    "gatling",
+    GATLING_VERSION_MAJOR,
+    GATLING_VERSION_MINOR,
+    GATLING_VERSION_PATCH
+  );
+  if (c_result != CGPU_OK) {
+    gatling_fail("Unable to initialize cgpu.");
+  }
+
+  uint32_t available_device_count;
+  c_result = cgpu_get_device_count(&available_device_count);
+  if (c_result != CGPU_OK || available_device_count == 0) {
+    gatling_fail("Unable to find device.");
+  }
+
+  const bool is_adaptive = (options.error_threshold > 0.0f);
+
+  uint32_t max_device_count = (options.device_count > 0) ? options.device_count : available_device_count;
+
+  if (max_device_count > available_device_count) {
+    gatling_fail("Not enough devices.");
+  }
+
+  /* The convergence test needs all samples of a pixel on the same device. */
+  if (is_adaptive && max_device_count > 1)
+  {
+    printf("Adaptive sampling only uses the first device\n");
+    max_device_count = 1;
+  }
+
+  gatling_device* gdevs = (gatling_device*) malloc(max_device_count * sizeof(gatling_device));
+  uint32_t device_count = 0;
+
+  for (uint32_t i = 0; i < available_device_count && device_count < max_device_count; ++i)
+  {
+    gatling_device* gdev = &gdevs[device_count];
+    gdev->index = i;
+
+    c_result = cgpu_create_device(i, &gdev->device);
+
+    if (c_result != CGPU_OK && options.device_count > 0) {
+      gatling_fail("Unable to create device.");
+    }
+    if (c_result != CGPU_OK)
+    {
+      printf("Skipping unsupported device %u\n", i);
+      continue;
+    }
+
+    c_result = cgpu_get_physical_device_limits(gdev->device, &gdev->limits);
+    gatling_cgpu_ensure(c_result);
+
+    device_count++;
+  }
+
+  if (device_count == 0) {
+    gatling_fail("Unable to create device.");
+  }
+
+  /* Map scene file for copying. */
+  gatling_file* scene_file;
+  const bool ok = gatling_file_open(options.input_file, GATLING_FILE_USAGE_READ, &scene_file);
+  if (!ok) {
+    gatling_fail("Unable to read scene file.");
+  }
+
+  uint64_t scene_data_size = gatling_file_size(scene_file);
+
+  uint8_t* mapped_scene_data = (uint8_t*) gatling_mmap(
+    scene_file,
+    0,
+    scene_data_size
+  );
+
+  if (!mapped_scene_data) {
+    gatling_fail("Unable to map scene file.");
+  }
+
+  /* Validate the header. Sections are aligned conservatively, so no repacking is needed. */
+  if (scene_data_size < sizeof(gatling_gsd_header)) {
+    gatling_fail("Scene file is invalid.");
+  }
+
+  gatling_gsd_header file_header;
+  memcpy(&file_header, mapped_scene_data, sizeof(gatling_gsd_header));
+
+  if (file_header.magic != GATLING_GSD_MAGIC) {
+    gatling_fail("Scene file is invalid.");
+  }
+  if (file_header.version != GATLING_GSD_VERSION) {
+    gatling_fail("Scene file version is not supported. Please rebuild it with gp.");
+  }
+  if (file_header.file_size != scene_data_size ||
+      file_header.section_count > GATLING_GSD_MAX_SECTION_COUNT) {
+    gatling_fail("Scene file is corrupt.");
+  }
+
+  const gatling_gsd_section* texture_page_section =
+    gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_TEXTURE_PAGES);
+
+  if ((texture_page_section->offset % GATLING_GSD_FILE_ALIGNMENT) != 0) {
+    gatling_fail("Scene file is corrupt.");
+  }
+
+  gatling_scene scene;
+  scene.data = mapped_scene_data;
+  scene.resident_size = texture_page_section->offset;
+  scene.node_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_NODES);
+  scene.face_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_FACES);
+  scene.vertex_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_VERTICES);
+  scene.material_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_MATERIALS);
+  scene.instance_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_INSTANCES);
+  scene.triangle_section = gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_TRIANGLES);
+
+  const gatling_gsd_section* light_section =
+    gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_LIGHTS);
+
+  const uint32_t light_size = 64;
+  scene.light_count = (uint32_t) (light_section->size / light_size);
+  scene.light_power = file_header.light_power;
+  scene.compressed_vertices = (file_header.flags & GATLING_GSD_FLAG_COMPRESSED_VERTICES) ? 1 : 0;
+
+  /* Ranges can't be empty. Without lights, the light buffer isn't accessed. */
+  scene.light_binding_section = (scene.light_count > 0) ? light_section : scene.material_section;
+
+  const gatling_gsd_section* texture_section =
+    gatling_find_scene_section(&file_header, GATLING_GSD_SECTION_TYPE_TEXTURES);
+
+  const uint32_t texture_size = 16;
+  scene.texture_count = (uint32_t) (texture_section->size / texture_size);
+  scene.texture_page_count = (uint32_t) (texture_page_section->size / GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE);
+  scene.texture_pages = &mapped_scene_data[texture_page_section->offset];
+  scene.texture_binding_section = (scene.texture_count > 0) ? texture_section : scene.material_section;
+  scene.coarsest_texture_pages = (uint32_t*) malloc((scene.texture_count + 1) * sizeof(uint32_t));
+
+  /* Kernels don't check page indices, so the textures are validated here. */
+  for (uint32_t i = 0; i < scene.texture_count; ++i)
+  {
+    uint32_t texture[4];
+    memcpy(texture, &mapped_scene_data[texture_section->offset + i * texture_size], texture_size);
+
+    const uint32_t width = texture[0];
+    const uint32_t height = texture[1];
+    const uint32_t level_count = texture[2];
+    uint64_t page = texture[3];
+
+    if (width == 0 || height == 0 || level_count == 0 || level_count > 32) {
+      gatling_fail("Scene file is corrupt.");
+    }
+
+    for (uint32_t l = 0; l + 1 < level_count; ++l) {
+      page += gatling_texture_level_page_count(width, height, l);
+    }
+
+    if (page >= scene.texture_page_count) {
+      gatling_fail("Scene file is corrupt.");
+    }
+
+    scene.coarsest_texture_pages[i] = (uint32_t) page;
+  }
+
+  const uint32_t material_size = 32;
+  const uint32_t material_count = (uint32_t) (scene.material_section->size / material_size);
+
+  for (uint32_t i = 0; i < material_count; ++i)
+  {
+    uint32_t albedo_texture;
+    memcpy(&albedo_texture, &mapped_scene_data[scene.material_section->offset + i * material_size + 12], sizeof(uint32_t));
+
+    if (albedo_texture != UINT32_MAX && albedo_texture >= scene.texture_count) {
+      gatling_fail("Scene file is corrupt.");
+    }
+  }
+
+  /* Upload the scene and create the pipelines on every device. */
+  char dir_path[1024];
+  gatling_get_parent_directory(argv[0], dir_path);
+
+  for (uint32_t i = 0; i < device_count; ++i) {
+    gatling_setup_device(&gdevs[i], &options, &scene, dir_path);
+  }
+
+  /* Samples are added up on the host if there are several devices, or if the
+   * sums are to be stored. Otherwise the device encodes the image itself. */
+  const uint64_t pixel_count = (uint64_t) options.image_width * options.image_height;
+  const uint64_t output_buffer_size = pixel_count * sizeof(float) * 4;
+  const bool encode_on_device = (device_count == 1) &&
+    !gatling_has_extension(options.output_file, GATLING_GACC_EXTENSION);
+
+  float* accumulated_data = encode_on_device ? NULL : (float*) malloc(output_buffer_size);
+  const uint8_t* mapped_image_data = NULL;
+
+  /* Only needed to tell accumulation files apart. */
+  const uint64_t scene_hash = gatling_has_extension(options.output_file, GATLING_GACC_EXTENSION) ?
+    gatling_hash_scene(mapped_scene_data, scene_data_size) : 0;
+
+  gatling_frame_output frame_output;
+  gatling_thread* output_thread = NULL;
+
+  float total_milliseconds = 0.0f;
+
+  for (uint32_t frame = 0; frame < frame_count; ++frame)
+  {
+    if (frame_count > 1) {
+      printf("Rendering frame %u/%u...\n", frame + 1, frame_count);
+    } else {
+      printf("Rendering...\n");
+    }
+
+    gatling_render_frame(gdevs, device_count, &options, &cameras[frame], scene.light_count);
+
+    /* The previous frame was written while this one was rendered. Wait for it
+       before its data is overwritten. */
+    if (output_thread)
+    {
+      gatling_thread_join(output_thread);
+      output_thread = NULL;
+    }
+
+    if (mapped_image_data)
+    {
+      c_result = cgpu_unmap_buffer(gdevs[0].device, gdevs[0].staging_buffer);
+      gatling_cgpu_ensure(c_result);
+      mapped_image_data = NULL;
+    }
+
+    /* Devices render concurrently, so the slowest one determines the total time. */
+    float elapsed_milliseconds = 0.0f;
+    uint64_t frame_ray_count = 0;
+
+    for (uint32_t i = 0; i < device_count; ++i)
+    {
+      const uint64_t previous_ray_count = gdevs[i].ray_count + gdevs[i].shadow_ray_count;
+
+      const float device_milliseconds = gatling_read_back(&gdevs[i], &options, encode_on_device);
+
+      if (device_count > 1) {
+        printf("Device %u: rendered %u chunks in %.2fms\n", gdevs[i].index, gdevs[i].chunk_count, device_milliseconds);
+      }
+
+      elapsed_milliseconds = device_milliseconds > elapsed_milliseconds ? device_milliseconds : elapsed_milliseconds;
+      frame_ray_count += gdevs[i].ray_count + gdevs[i].shadow_ray_count - previous_ray_count;
+    }
+
+    printf("Total rendering time: %.2fms (%.1fM rays/s)\n", elapsed_milliseconds,
+      (elapsed_milliseconds > 0.0f) ? (frame_ray_count / (elapsed_milliseconds * 1000.0f)) : 0.0f);
+
+    total_milliseconds += elapsed_milliseconds;
+
+    frame_output.options = options;
+    frame_output.image_data = NULL;
+    frame_output.accumulated_data = NULL;
+    frame_output.fingerprint = gatling_make_fingerprint(scene_hash, &options, &cameras[frame]);
+
+    if (frame_count > 1)
+    {
+      gatling_make_frame_path(options.output_file, frame, frame_output.file_path, sizeof(frame_output.file_path));
+      frame_output.options.output_file = frame_output.file_path;
+    }
+
+    if (encode_on_device)
+    {
+      /* The encoded image is passed to the PNG writer without another copy. */
+      c_result = cgpu_map_buffer(
+        gdevs[0].device,
+        gdevs[0].staging_buffer,
+        0,
+        pixel_count * sizeof(uint32_t),
+        (void**) &mapped_image_data
+      );
+      gatling_cgpu_ensure(c_result);
+
+      frame_output.image_data = mapped_image_data;
+    }
+    else
+    {
+      /* The accumulation buffers hold sums of samples, with the sample count in
+       * alpha, so they are merged by adding them up. */
+      memset(accumulated_data, 0, output_buffer_size);
+
+      for (uint32_t d = 0; d < device_count; ++d)
+      {
+        const float* mapped_staging_mem;
+        c_result = cgpu_map_buffer(
+          gdevs[d].device,
+          gdevs[d].staging_buffer,
+          0,
+          output_buffer_size,
+          (void**) &mapped_staging_mem
+        );
+        gatling_cgpu_ensure(c_result);
+
+        for (uint64_t i = 0; i < pixel_count * 4; ++i) {
+          accumulated_data[i] += mapped_staging_mem[i];
+        }
+
+        c_result = cgpu_unmap_buffer(
+          gdevs[d].device,
+          gdevs[d].staging_buffer
+        );
+        gatling_cgpu_ensure(c_result);
+      }
+
+      frame_output.accumulated_data = accumulated_data;
+    }
+
+    /* The last frame is written on the main thread. */
+    if (frame == (frame_count - 1))
+    {
+      gatling_write_frame(&frame_output);
+    }
+    else if (!gatling_thread_create(gatling_write_frame, &frame_output, &output_thread))
+    {
+      gatling_fail("Unable to create thread.");
+    }
+  }
+
+  if (mapped_image_data)
+  {
+    c_result = cgpu_unmap_buffer(gdevs[0].device, gdevs[0].staging_buffer);
+    gatling_cgpu_ensure(c_result);
+  }
+
+  free(accumulated_data);
+  free(cameras);
+
+  if (options.traversal_stats != GATLING_TRAVERSAL_STATS_OFF) {
+    gatling_print_traversal_stats(gdevs, device_count);
+  }
+
+  if (options.stats_file) {
+    gatling_write_stats(gdevs, device_count, &options, frame_count, total_milliseconds);
+  }
+
+  /* Clean up. */
+  for (uint32_t i = 0; i < device_count; ++i) {
+    gatling_destroy_device(&gdevs[i]);
+  }
+
+  free(gdevs);
+
+  /* Texture pages are read from the mapping until the end. */
+  free(scene.coarsest_texture_pages);
+
+  gatling_munmap(scene_file, mapped_scene_data);
+
+  gatling_file_close(scene_file);
+
   c_result = cgpu_destroy();
   gatling_cgpu_ensure(c_result);
 
@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <inttypes.h>
 
 #if defined (_WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -35,6 +38,21 @@ typedef struct gatling_file {
 #endif
 } gatling_file;
 
+static void gatling_format_temp_path(const char* path, uint32_t process_id, char* temp_path, uint64_t size)
+{
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+
+  /* Mix the timestamp (splitmix64 finalizer), so that the names of
+   * files created in quick succession differ in all digits. */
+  uint64_t value = (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+  value = value ^ (value >> 31);
+
+  snprintf(temp_path, (size_t) size, "%s.%" PRIu32 ".%016" PRIx64 ".tmp", path, process_id, value);
+}
+
 #if defined (_WIN32)
 
 bool gatling_file_create(const char* path, uint64_t size, gatling_file** file)
@@ -215,6 +233,16 @@ bool gatling_munmap(gatling_file* file, void* addr)
   return UnmapViewOfFile(addr);
 }
 
+void gatling_file_make_temp_path(const char* path, char* temp_path, uint64_t size)
+{
+  gatling_format_temp_path(path, (uint32_t) GetCurrentProcessId(), temp_path, size);
+}
+
+bool gatling_file_replace(const char* src_path, const char* dst_path)
+{
+  return MoveFileExA(src_path, dst_path, MOVEFILE_REPLACE_EXISTING);
+}
+
 #else
 
 bool gatling_file_create(const char* path, uint64_t size, gatling_file** file)
@@ -230,13 +258,16 @@ bool gatling_file_create(const char* path, uint64_t size, gatling_file** file)
 
   const bool trunc_error = ftruncate(file_descriptor, size);
 
-  if (trunc_error) {
+  if (trunc_error)
+  {
+    close(file_descriptor);
     return false;
   }
 
   (*file) = malloc(sizeof(gatling_file));
   (*file)->usage = GATLING_FILE_USAGE_WRITE;
   (*file)->file_descriptor = file_descriptor;
+  (*file)->size = size;
   memset((*file)->mapped_ranges, 0, MAX_MAPPED_MEM_RANGES * sizeof(gatling_mapped_posix_range));
 
   return true;
@@ -362,4 +393,14 @@ bool gatling_munmap(gatling_file* file, void* addr)
   return false;
 }
 
+void gatling_file_make_temp_path(const char* path, char* temp_path, uint64_t size)
+{
+  gatling_format_temp_path(path, (uint32_t) getpid(), temp_path, size);
+}
+
+bool gatling_file_replace(const char* src_path, const char* dst_path)
+{
+  return !rename(src_path, dst_path);
+}
+
 #endif
@@ -38,4 +38,20 @@ bool gatling_munmap(
   void* addr
 );
 
+/* Files are written to a temporary path next to their destination and then
+ * moved into place, so that readers never see partially written data. The
+ * path consists of the process id and a mixed timestamp, so that concurrent
+ * processes don't write to the same file. */
+void gatling_file_make_temp_path(
+  const char* path,
+  char* temp_path,
+  uint64_t size
+);
+
+/* Atomically replaces the destination, which may exist. */
+bool gatling_file_replace(
+  const char* src_path,
+  const char* dst_path
+);
+
 #endif
@@ -1,4 +1,23 @@
-/* Möller-Trumbore triangle intersection. */
+/* Work of the current ray, only counted with TRAVERSAL_STATS. Otherwise the
+ * specialization constant folds all uses of these away, so that the normal
+ * traversal is unchanged. Each push could spill the stack from registers to
+ * local memory, and the deepest stack shows whether MAX_STACK_SIZE suffices. */
+uint ray_node_visits = 0;
+uint ray_face_tests = 0;
+uint ray_stack_pushes = 0;
+uint ray_max_stack_size = 0;
+
+void count_stack_push(in const uint stack_size)
+{
+    if (TRAVERSAL_STATS != TRAVERSAL_STATS_OFF)
+    {
+        ray_stack_pushes++;
+        ray_max_stack_size = max(ray_max_stack_size, stack_size);
+    }
+}
+
+/* Möller-Trumbore triangle intersection. Reads a single precomputed
+ * triangle, the face and its vertices are only needed for shading. */
 bool test_face(
     in const vec3 ray_origin,
     in const vec3 ray_dir,
@@ -7,12 +26,14 @@ bool test_face(
     out float t,
     out vec2 bc)
 {
-    const face f = faces[face_index];
-    const vec3 p0 = vertices[f.v_0].field1.xyz;
-    const vec3 p1 = vertices[f.v_1].field1.xyz;
-    const vec3 p2 = vertices[f.v_2].field1.xyz;
-    const vec3 e1 = p1 - p0;
-    const vec3 e2 = p2 - p0;
+    if (TRAVERSAL_STATS != TRAVERSAL_STATS_OFF) {
+        ray_face_tests++;
+    }
+
+    const triangle tri = triangles[face_index];
+    const vec3 p0 = tri.v_0;
+    const vec3 e1 = tri.e_1;
+    const vec3 e2 = tri.e_2;
 
     const vec3 p = cross(ray_dir, e2);
     const float det = dot(e1, p);
@@ -56,18 +77,121 @@ uint extract_byte(uint num, uint byte_idx)
     return (num >> (byte_idx * 8)) & 0xFF;
 }
 
-bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, out hit_info hit)
+/* Intersects the children of a node. Returns the group of hit inner
+ * child nodes and writes the group of hit leaf faces. */
+uvec2 intersect_node(
+    in const uint node_index,
+    in const vec3 ray_origin,
+    in const vec3 inv_dir,
+    in const uint oct_inv4,
+    in const float t_max,
+    out uvec2 face_group)
 {
-    float t_max = FLOAT_MAX;
-    float t_min = 0.0;
-    const vec3 inv_dir = 1.0 / ray_dir;
+    const float t_min = 0.0;
+
+    if (TRAVERSAL_STATS != TRAVERSAL_STATS_OFF) {
+        ray_node_visits++;
+    }
+
+    const bvh_node node = bvh_nodes[node_index];
+
+    face_group = uvec2(node.face_index, 0);
+
+    const vec3 local_inv_dir = uintBitsToFloat(uvec3(node.e) << 23) * inv_dir;
+    const vec3 local_orig = (node.p - ray_origin) * inv_dir;
 
+    uint hitmask = 0;
+
+    [[unroll, dependency_infinite]]
+    for (uint passIdx = 0; passIdx < 2; ++passIdx)
+    {
+        const uint meta4 = node.meta[passIdx];
+        const uint is_inner4 = (meta4 & (meta4 << 1)) & 0x10101010;
+        const uint inner_mask4 = sign_to_byte_mask4(is_inner4 << 3);
+        const uint bit_index4 = (meta4 ^ (oct_inv4 & inner_mask4)) & 0x1F1F1F1F;
+        const uint child_bits4 = (meta4 >> 5) & 0x07070707;
+
+        const vec4 x_gt_0 = vec4(inv_dir.x < 0.0);
+        const vec4 y_gt_0 = vec4(inv_dir.y < 0.0);
+        const vec4 z_gt_0 = vec4(inv_dir.z < 0.0);
+
+        const u8vec4 q_lo_x = node.q_lo_x[passIdx];
+        const u8vec4 q_hi_x = node.q_hi_x[passIdx];
+        const u8vec4 q_lo_y = node.q_lo_y[passIdx];
+        const u8vec4 q_hi_y = node.q_hi_y[passIdx];
+        const u8vec4 q_lo_z = node.q_lo_z[passIdx];
+        const u8vec4 q_hi_z = node.q_hi_z[passIdx];
+
+        const vec4 s_q_lo_x = mix(q_lo_x, q_hi_x, x_gt_0);
+        const vec4 s_q_hi_x = mix(q_hi_x, q_lo_x, x_gt_0);
+        const vec4 s_q_lo_y = mix(q_lo_y, q_hi_y, y_gt_0);
+        const vec4 s_q_hi_y = mix(q_hi_y, q_lo_y, y_gt_0);
+        const vec4 s_q_lo_z = mix(q_lo_z, q_hi_z, z_gt_0);
+        const vec4 s_q_hi_z = mix(q_hi_z, q_lo_z, z_gt_0);
+
+        const vec4 t_min_x = local_inv_dir.x * s_q_lo_x + local_orig.x;
+        const vec4 t_max_x = local_inv_dir.x * s_q_hi_x + local_orig.x;
+        const vec4 t_min_y = local_inv_dir.y * s_q_lo_y + local_orig.y;
+        const vec4 t_max_y = local_inv_dir.y * s_q_hi_y + local_orig.y;
+        const vec4 t_min_z = local_inv_dir.z * s_q_lo_z + local_orig.z;
+        const vec4 t_max_z = local_inv_dir.z * s_q_hi_z + local_orig.z;
+
+        [[unroll, dependency_infinite]]
+        for (uint child_idx = 0; child_idx < 4; ++child_idx)
+        {
+            const float bmin = max(max(t_min_x[child_idx], t_min_y[child_idx]), max(t_min_z[child_idx], t_min));
+            const float bmax = min(min(t_max_x[child_idx], t_max_y[child_idx]), min(t_max_z[child_idx], t_max));
+
+            const bool is_intersected = bmin <= bmax;
+
+            if (!is_intersected) {
+                continue;
+            }
+
+            const uint child_bits = extract_byte(child_bits4, child_idx);
+            const uint bit_index = extract_byte(bit_index4, child_idx);
+            hitmask |= (child_bits << bit_index);
+        }
+    }
+
+    face_group.y = (hitmask & 0x00FFFFFF);
+
+    return uvec2(node.child_index, (hitmask & 0xFF000000) | node.imask);
+}
+
+/* Returns the index of the next child node of a group and removes it. */
+uint pop_child_node(inout uvec2 node_group, in const uint oct_inv4)
+{
+    const uint child_bit_idx = findMSB(node_group.y);
+    const uint slot_index = (child_bit_idx - 24) ^ (oct_inv4 & 0xFF);
+    const uint rel_idx = bitCount(node_group.y & ~(0xFFFFFFFF << slot_index));
+
+    node_group.y &= ~(1 << child_bit_idx);
+
+    return node_group.x + rel_idx;
+}
+
+uint calc_oct_inv4(in const vec3 ray_dir)
+{
     const uvec3 oct_inv = mix(uvec3(0), uvec3(4, 2, 1), greaterThanEqual(ray_dir, vec3(0.0)));
-    const uint oct_inv4 = (oct_inv.x | oct_inv.y | oct_inv.z) * 0x01010101;
+    return (oct_inv.x | oct_inv.y | oct_inv.z) * 0x01010101;
+}
+
+/* Traverses the BVH of a single mesh in object space. The direction is not
+ * normalized so that distances are the same as in world space. */
+bool traverse_blas(
+    in const vec3 ray_origin,
+    in const vec3 ray_dir,
+    in const uint root_index,
+    inout float t_max,
+    inout hit_info hit)
+{
+    const vec3 inv_dir = 1.0 / ray_dir;
+    const uint oct_inv4 = calc_oct_inv4(ray_dir);
 
-    float temp_t;
+    bool found_hit = false;
 
-    uvec2 node_group = uvec2(0, 0x80000000);
+    uvec2 node_group = uvec2(root_index, 0x80000000);
 
     uvec2 stack[MAX_STACK_SIZE];
     uint stack_size = 0;
@@ -83,83 +207,16 @@ bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, out hit_info hit)
         }
         else
         {
-            const uint child_bit_idx = findMSB(node_group.y);
-            const uint slot_index = (child_bit_idx - 24) ^ (oct_inv4 & 0xFF);
-            const uint rel_idx = bitCount(node_group.y & ~(0xFFFFFFFF << slot_index));
-            const uint child_node_idx = node_group.x + rel_idx;
-
-            node_group.y &= ~(1 << child_bit_idx);
+            const uint child_node_idx = pop_child_node(node_group, oct_inv4);
 
             if (node_group.y > 0x00FFFFFF)
             {
                 stack[stack_size] = node_group;
                 stack_size++;
+                count_stack_push(stack_size);
             }
 
-            const bvh_node node = bvh_nodes[child_node_idx];
-
-            node_group.x = node.child_index;
-            face_group = uvec2(node.face_index, 0);
-
-            const vec3 local_inv_dir = uintBitsToFloat(uvec3(node.e) << 23) * inv_dir;
-            const vec3 local_orig = (node.p - ray_origin) * inv_dir;
-
-            uint hitmask = 0;
-
-            [[unroll, dependency_infinite]]
-            for (uint passIdx = 0; passIdx < 2; ++passIdx)
-            {
-                const uint meta4 = node.meta[passIdx];
-                const uint is_inner4 = (meta4 & (meta4 << 1)) & 0x10101010;
-                const uint inner_mask4 = sign_to_byte_mask4(is_inner4 << 3);
-                const uint bit_index4 = (meta4 ^ (oct_inv4 & inner_mask4)) & 0x1F1F1F1F;
-                const uint child_bits4 = (meta4 >> 5) & 0x07070707;
-
-                const vec4 x_gt_0 = vec4(inv_dir.x < 0.0);
-                const vec4 y_gt_0 = vec4(inv_dir.y < 0.0);
-                const vec4 z_gt_0 = vec4(inv_dir.z < 0.0);
-
-                const u8vec4 q_lo_x = node.q_lo_x[passIdx];
-                const u8vec4 q_hi_x = node.q_hi_x[passIdx];
-                const u8vec4 q_lo_y = node.q_lo_y[passIdx];
-                const u8vec4 q_hi_y = node.q_hi_y[passIdx];
-                const u8vec4 q_lo_z = node.q_lo_z[passIdx];
-                const u8vec4 q_hi_z = node.q_hi_z[passIdx];
-
-                const vec4 s_q_lo_x = mix(q_lo_x, q_hi_x, x_gt_0);
-                const vec4 s_q_hi_x = mix(q_hi_x, q_lo_x, x_gt_0);
-                const vec4 s_q_lo_y = mix(q_lo_y, q_hi_y, y_gt_0);
-                const vec4 s_q_hi_y = mix(q_hi_y, q_lo_y, y_gt_0);
-                const vec4 s_q_lo_z = mix(q_lo_z, q_hi_z, z_gt_0);
-                const vec4 s_q_hi_z = mix(q_hi_z, q_lo_z, z_gt_0);
-
-                const vec4 t_min_x = local_inv_dir.x * s_q_lo_x + local_orig.x;
-                const vec4 t_max_x = local_inv_dir.x * s_q_hi_x + local_orig.x;
-                const vec4 t_min_y = local_inv_dir.y * s_q_lo_y + local_orig.y;
-                const vec4 t_max_y = local_inv_dir.y * s_q_hi_y + local_orig.y;
-                const vec4 t_min_z = local_inv_dir.z * s_q_lo_z + local_orig.z;
-                const vec4 t_max_z = local_inv_dir.z * s_q_hi_z + local_orig.z;
-
-                [[unroll, dependency_infinite]]
-                for (uint child_idx = 0; child_idx < 4; ++child_idx)
-                {
-                    const float bmin = max(max(t_min_x[child_idx], t_min_y[child_idx]), max(t_min_z[child_idx], t_min));
-                    const float bmax = min(min(t_max_x[child_idx], t_max_y[child_idx]), min(t_max_z[child_idx], t_max));
-
-                    const bool is_intersected = bmin <= bmax;
-
-                    if (!is_intersected) {
-                        continue;
-                    }
-
-                    const uint child_bits = extract_byte(child_bits4, child_idx);
-                    const uint bit_index = extract_byte(bit_index4, child_idx);
-                    hitmask |= (child_bits << bit_index);
-                }
-            }
-
-            node_group.y = (hitmask & 0xFF000000) | node.imask;
-            face_group.y = (hitmask & 0x00FFFFFF);
+            node_group = intersect_node(child_node_idx, ray_origin, inv_dir, oct_inv4, t_max, face_group);
         }
 
         const uint active_inv_count1 = subgroupBallotBitCount(subgroupBallot(true));
@@ -175,6 +232,7 @@ bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, out hit_info hit)
             {
                 stack[stack_size] = face_group;
                 stack_size++;
+                count_stack_push(stack_size);
                 break;
             }
 
@@ -201,6 +259,7 @@ bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, out hit_info hit)
                 t_max = temp_t;
                 hit.bc = temp_bc;
                 hit.face_index = face_index;
+                found_hit = true;
             }
         }
 
@@ -215,12 +274,273 @@ bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, out hit_info hit)
             continue;
         }
 
-        if (t_max != FLOAT_MAX)
+        return found_hit;
+    }
+}
+
+/* Traverses the top-level BVH, whose leaves are instances. At each
+ * instance, the ray is transformed into object space. Only hits closer
+ * than t_max are reported. */
+bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, in float t_max, out hit_info hit)
+{
+    bool found_hit = false;
+    const vec3 inv_dir = 1.0 / ray_dir;
+    const uint oct_inv4 = calc_oct_inv4(ray_dir);
+
+    uvec2 node_group = uvec2(0, 0x80000000);
+
+    uvec2 stack[MAX_STACK_SIZE];
+    uint stack_size = 0;
+
+    while (true)
+    {
+        uvec2 instance_group = uvec2(0, 0);
+
+        if (node_group.y <= 0x00FFFFFF)
+        {
+            instance_group = node_group;
+            node_group = uvec2(0, 0);
+        }
+        else
+        {
+            const uint child_node_idx = pop_child_node(node_group, oct_inv4);
+
+            if (node_group.y > 0x00FFFFFF)
+            {
+                stack[stack_size] = node_group;
+                stack_size++;
+                count_stack_push(stack_size);
+            }
+
+            node_group = intersect_node(child_node_idx, ray_origin, inv_dir, oct_inv4, t_max, instance_group);
+        }
+
+        while (instance_group.y != 0)
+        {
+            const uint instance_rel_index = findMSB(instance_group.y);
+
+            instance_group.y &= ~(1 << instance_rel_index);
+
+            const uint instance_index = instance_group.x + instance_rel_index;
+            const instance inst = instances[instance_index];
+
+            const vec3 object_ray_origin = vec4(ray_origin, 1.0) * inst.world_to_object;
+            vec3 object_ray_dir = vec4(ray_dir, 0.0) * inst.world_to_object;
+
+            /* See the note on zero direction components in generate.comp. */
+            object_ray_dir += vec3(equal(object_ray_dir, vec3(0.0))) * FLOAT_MIN;
+
+            if (traverse_blas(object_ray_origin, object_ray_dir, inst.node_index, t_max, hit))
+            {
+                hit.instance_index = instance_index;
+                found_hit = true;
+            }
+        }
+
+        if (node_group.y > 0x00FFFFFF) {
+            continue;
+        }
+
+        if (stack_size > 0)
+        {
+            stack_size--;
+            node_group = stack[stack_size];
+            continue;
+        }
+
+        if (found_hit)
         {
             hit.pos = ray_origin + ray_dir * t_max;
+            hit.t = t_max;
             return true;
         }
 
         return false;
     }
 }
+
+/* Like traverse_blas, but returns as soon as any face closer than t_max is hit.
+ * Faces are tested immediately, since the first hit ends the traversal. */
+bool occluded_blas(
+    in const vec3 ray_origin,
+    in const vec3 ray_dir,
+    in const uint root_index,
+    in const float t_max)
+{
+    const vec3 inv_dir = 1.0 / ray_dir;
+    const uint oct_inv4 = calc_oct_inv4(ray_dir);
+
+    uvec2 node_group = uvec2(root_index, 0x80000000);
+
+    uvec2 stack[MAX_STACK_SIZE];
+    uint stack_size = 0;
+
+    while (true)
+    {
+        uvec2 face_group = uvec2(0, 0);
+
+        if (node_group.y <= 0x00FFFFFF)
+        {
+            face_group = node_group;
+            node_group = uvec2(0, 0);
+        }
+        else
+        {
+            const uint child_node_idx = pop_child_node(node_group, oct_inv4);
+
+            if (node_group.y > 0x00FFFFFF)
+            {
+                stack[stack_size] = node_group;
+                stack_size++;
+                count_stack_push(stack_size);
+            }
+
+            node_group = intersect_node(child_node_idx, ray_origin, inv_dir, oct_inv4, t_max, face_group);
+        }
+
+        while (face_group.y != 0)
+        {
+            const uint face_rel_index = findMSB(face_group.y);
+
+            face_group.y &= ~(1 << face_rel_index);
+
+            const uint face_index = face_group.x + face_rel_index;
+
+            float temp_t;
+            vec2 temp_bc;
+
+            if (test_face(ray_origin, ray_dir, t_max, face_index, temp_t, temp_bc)) {
+                return true;
+            }
+        }
+
+        if (node_group.y > 0x00FFFFFF) {
+            continue;
+        }
+
+        if (stack_size > 0)
+        {
+            stack_size--;
+            node_group = stack[stack_size];
+            continue;
+        }
+
+        return false;
+    }
+}
+
+/* Visibility query for shadow rays. Unlike traverse_bvh, it doesn't search
+ * for the closest hit and keeps no hit information. */
+bool occluded(in vec3 ray_origin, in vec3 ray_dir, in float t_max)
+{
+    const vec3 inv_dir = 1.0 / ray_dir;
+    const uint oct_inv4 = calc_oct_inv4(ray_dir);
+
+    uvec2 node_group = uvec2(0, 0x80000000);
+
+    uvec2 stack[MAX_STACK_SIZE];
+    uint stack_size = 0;
+
+    while (true)
+    {
+        uvec2 instance_group = uvec2(0, 0);
+
+        if (node_group.y <= 0x00FFFFFF)
+        {
+            instance_group = node_group;
+            node_group = uvec2(0, 0);
+        }
+        else
+        {
+            const uint child_node_idx = pop_child_node(node_group, oct_inv4);
+
+            if (node_group.y > 0x00FFFFFF)
+            {
+                stack[stack_size] = node_group;
+                stack_size++;
+                count_stack_push(stack_size);
+            }
+
+            node_group = intersect_node(child_node_idx, ray_origin, inv_dir, oct_inv4, t_max, instance_group);
+        }
+
+        while (instance_group.y != 0)
+        {
+            const uint instance_rel_index = findMSB(instance_group.y);
+
+            instance_group.y &= ~(1 << instance_rel_index);
+
+            const uint instance_index = instance_group.x + instance_rel_index;
+            const instance inst = instances[instance_index];
+
+            const vec3 object_ray_origin = vec4(ray_origin, 1.0) * inst.world_to_object;
+            vec3 object_ray_dir = vec4(ray_dir, 0.0) * inst.world_to_object;
+
+            /* See the note on zero direction components in generate.comp. */
+            object_ray_dir += vec3(equal(object_ray_dir, vec3(0.0))) * FLOAT_MIN;
+
+            if (occluded_blas(object_ray_origin, object_ray_dir, inst.node_index, t_max)) {
+                return true;
+            }
+        }
+
+        if (node_group.y > 0x00FFFFFF) {
+            continue;
+        }
+
+        if (stack_size > 0)
+        {
+            stack_size--;
+            node_group = stack[stack_size];
+            continue;
+        }
+
+        return false;
+    }
+}
+
+/* Adds the counters of the current ray to the totals, with one atomic operation
+ * per subgroup, and resets them for the next ray. In heatmap mode, the cost is
+ * also added to the pixel of the path. */
+void add_traversal_counter(in const uint index, in const uint value)
+{
+    const uint low = atomicAdd(traversal_counters[index * 2], value);
+
+    /* Exactly one addition wraps the low word per carry. */
+    if (low + value < low) {
+        atomicAdd(traversal_counters[index * 2 + 1], 1);
+    }
+}
+
+void record_traversal_stats(in const uint pixel_index)
+{
+    const uint node_visits = subgroupAdd(ray_node_visits);
+    const uint face_tests = subgroupAdd(ray_face_tests);
+    const uint stack_pushes = subgroupAdd(ray_stack_pushes);
+    const uint max_stack_size = subgroupMax(ray_max_stack_size);
+
+    if (subgroupElect())
+    {
+        add_traversal_counter(0, node_visits);
+        add_traversal_counter(1, face_tests);
+        add_traversal_counter(2, stack_pushes);
+        atomicMax(max_traversal_stack_size, max_stack_size);
+    }
+
+    if (TRAVERSAL_STATS == TRAVERSAL_STATS_HEATMAP)
+    {
+        /* Only one path per pixel is in flight, so there are no write conflicts. */
+        const float cost = float(ray_node_visits + ray_face_tests);
+
+        pixels[pixel_index].r += cost;
+
+        if (ERROR_THRESHOLD > 0.0 && (pc.sample_index % 2) == 0) {
+            half_pixels[pixel_index].r += cost;
+        }
+    }
+
+    ray_node_visits = 0;
+    ray_face_tests = 0;
+    ray_stack_pushes = 0;
+    ray_max_stack_size = 0;
+}
@@ -4,13 +4,14 @@ const float PI = 3.1415926535897932384626433832795;
 const float TRI_EPS = 0.0000001;
 const float RAY_OFFSET_EPS = 0.00001;
 
-struct vertex
-{
-    /* pos.{x, y, z}, tex.u */
-    vec4 field1;
-    /* norm.{x, y, z}, tex.v */
-    vec4 field2;
-};
+/* Selects the vertex layout, see vertex_data below. */
+layout(constant_id = 19) const bool COMPRESSED_VERTICES = false;
+
+const uint SAMPLER_INDEPENDENT = 0;
+const uint SAMPLER_SOBOL = 1;
+
+/* Source of the sample dimensions, see sample_dimensions below. */
+layout(constant_id = 21) const uint SAMPLER = SAMPLER_INDEPENDENT;
 
 struct face
 {
@@ -20,9 +21,22 @@ struct face
     uint mat_index;
 };
 
+/* Precomputed for the intersection test, in the same order as the faces. */
+struct triangle
+{
+    vec3 v_0;
+    float padding1;
+    vec3 e_1;
+    float padding2;
+    vec3 e_2;
+    float padding3;
+};
+
 struct material
 {
-    vec4 albedo;
+    vec3 albedo;
+    /* Multiplies the albedo, or NO_TEXTURE. */
+    uint albedo_texture;
     vec3 emission;
     float padding;
 };
@@ -46,12 +60,38 @@ struct bvh_node
     u8vec4 q_hi_z[2];        /*  8 bytes */
 };
 
+struct instance
+{
+    /* Row-major affine transform from world to object space. */
+    mat3x4 world_to_object;
+    uint node_index;
+    /* Range of the mesh faces in leaf order. */
+    uint face_offset;
+    uint face_count;
+    uint padding;
+};
+
+/* An emissive face in world space, with an alias table entry for
+ * selecting lights in proportion to their power. */
+struct light
+{
+    vec3 v_0;
+    float alias_prob;
+    vec3 v_1;
+    uint alias_index;
+    vec3 v_2;
+    float padding1;
+    vec3 emission;
+    float padding2;
+};
+
 struct hit_info
 {
     vec3 pos;
     uint face_index;
     vec2 bc;
-    vec2 padding;
+    uint instance_index;
+    float t;
 };
 
 layout(set=0, binding=0) buffer BufferOutput
@@ -71,7 +111,9 @@ layout(set=0, binding=2) readonly buffer BufferFaces
 
 layout(set=0, binding=3) readonly buffer BufferVertices
 {
-    vertex vertices[];
+    /* Either eight words per vertex: pos.{x, y, z}, tex.u, norm.{x, y, z}, tex.v,
+     * or two if compressed: the octahedral normal and tex.{u, v} as halfs. */
+    uint vertex_data[];
 };
 
 layout(set=0, binding=4) readonly buffer BufferMaterials
@@ -79,14 +121,76 @@ layout(set=0, binding=4) readonly buffer BufferMaterials
     material materials[];
 };
 
-uint wang_hash(uint seed)
+layout(set=0, binding=5) readonly buffer BufferInstances
+{
+    instance instances[];
+};
+
+layout(set=0, binding=15) readonly buffer BufferLights
+{
+    light lights[];
+};
+
+layout(set=0, binding=20) readonly buffer BufferTriangles
+{
+    triangle triangles[];
+};
+
+layout(set=0, binding=21) readonly buffer BufferSobolMatrices
+{
+    /* 32 direction numbers for each of the four dimensions. */
+    uint sobol_matrices[];
+};
+
+/* Inverse of the octahedral mapping [Cigolle et al. 2014]. */
+vec3 decode_octahedral_normal(uint packed_normal)
+{
+    const vec2 e = unpackSnorm2x16(packed_normal);
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * mix(vec2(-1.0), vec2(1.0), greaterThanEqual(n.xy, vec2(0.0)));
+    }
+
+    return normalize(n);
+}
+
+vec3 vertex_normal(uint vertex_index)
+{
+    if (COMPRESSED_VERTICES) {
+        return decode_octahedral_normal(vertex_data[vertex_index * 2]);
+    }
+
+    const uint base = vertex_index * 8;
+    return uintBitsToFloat(uvec3(vertex_data[base + 4], vertex_data[base + 5], vertex_data[base + 6]));
+}
+
+vec2 vertex_uv(uint vertex_index)
 {
-    seed = (seed ^ 61) ^ (seed >> 16);
-    seed *= 9;
-    seed = seed ^ (seed >> 4);
-    seed *= 0x27d4eb2d;
-    seed = seed ^ (seed >> 15);
-    return seed;
+    if (COMPRESSED_VERTICES) {
+        return unpackHalf2x16(vertex_data[vertex_index * 2 + 1]);
+    }
+
+    const uint base = vertex_index * 8;
+    return uintBitsToFloat(uvec2(vertex_data[base + 3], vertex_data[base + 7]));
+}
+
+/* PCG-based integer hash [Jarzynski and Olano 2020]. */
+uint pcg_hash(uint seed)
+{
+    const uint state = seed * 747796405u + 2891336453u;
+    const uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+/* The random numbers of a path only depend on its pixel and its absolute sample
+ * index. Renders of disjoint sample ranges therefore add up to exactly the same
+ * image as a single render of all samples. The state must not be zero, since
+ * xorshift would never leave it. */
+uint path_rng_seed(uint pixel_index, uint sample_index)
+{
+    const uint seed = pcg_hash(pixel_index + pcg_hash(sample_index));
+    return (seed != 0) ? seed : 1;
 }
 
 float random_float_between_0_and_1(inout uint seed)
@@ -96,3 +200,64 @@ float random_float_between_0_and_1(inout uint seed)
     seed ^= seed << 5;
     return float(seed) * (1.0 / 4294967296.0);
 }
+
+uint hash_combine(uint seed, uint value)
+{
+    return seed ^ (value + (seed << 6) + (seed >> 2));
+}
+
+/* Nested uniform scrambling of the bits of x, in base 2 [Burley 2020]. */
+uint owen_scramble(uint x, uint seed)
+{
+    x = bitfieldReverse(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return bitfieldReverse(x);
+}
+
+uint sobol(uint index, uint dimension)
+{
+    uint x = 0;
+    for (uint bit = 0; index != 0; ++bit, index >>= 1)
+    {
+        if ((index & 1) != 0) {
+            x ^= sobol_matrices[dimension * 32 + bit];
+        }
+    }
+    return x;
+}
+
+/* Four dimensions of an Owen-scrambled Sobol sequence. The sample index is
+ * shuffled per pixel and dimension set, which decorrelates pixels as well as
+ * sets [Burley 2020]. The upper 24 bits are used, so that results are below one. */
+vec4 sobol_owen_4d(uint pixel_index, uint sample_index, uint dimension_set)
+{
+    const uint seed = pcg_hash(hash_combine(pcg_hash(pixel_index), dimension_set));
+    const uint index = owen_scramble(sample_index, seed);
+
+    uvec4 x;
+    for (uint i = 0; i < 4; ++i) {
+        x[i] = owen_scramble(sobol(index, i), hash_combine(seed, i));
+    }
+
+    return vec4(x >> 8) * (1.0 / 16777216.0);
+}
+
+/* Returns four sample dimensions. Every use within a path has its own dimension
+ * set, so that low-discrepancy samplers stratify each decision separately. The
+ * independent sampler advances the path's random state instead. */
+vec4 sample_dimensions(uint pixel_index, uint sample_index, uint dimension_set, inout uint rng_state)
+{
+    if (SAMPLER == SAMPLER_SOBOL) {
+        return sobol_owen_4d(pixel_index, sample_index, dimension_set);
+    }
+
+    const float r1 = random_float_between_0_and_1(rng_state);
+    const float r2 = random_float_between_0_and_1(rng_state);
+    const float r3 = random_float_between_0_and_1(rng_state);
+    const float r4 = random_float_between_0_and_1(rng_state);
+    return vec4(r1, r2, r3, r4);
+}
@@ -0,0 +1,65 @@
+/*
+ * Hardware accelerated replacements for the traversal functions of bvh.glsl,
+ * using the top-level acceleration structure built by cgpu. Each instance
+ * refers to the faces of its mesh in leaf order, so that primitive indices
+ * can be mapped back to the face buffer.
+ */
+
+layout(set=0, binding=19) uniform accelerationStructureEXT scene_as;
+
+bool traverse_bvh(in vec3 ray_origin, in vec3 ray_dir, in float t_max, out hit_info hit)
+{
+    rayQueryEXT ray_query;
+
+    rayQueryInitializeEXT(
+        ray_query,
+        scene_as,
+        gl_RayFlagsOpaqueEXT,
+        0xFF,
+        ray_origin,
+        0.0,
+        ray_dir,
+        t_max
+    );
+
+    while (rayQueryProceedEXT(ray_query))
+    {
+    }
+
+    if (rayQueryGetIntersectionTypeEXT(ray_query, true) == gl_RayQueryCommittedIntersectionNoneEXT) {
+        return false;
+    }
+
+    const uint instance_index = rayQueryGetIntersectionInstanceCustomIndexEXT(ray_query, true);
+    const uint primitive_index = rayQueryGetIntersectionPrimitiveIndexEXT(ray_query, true);
+
+    hit.t = rayQueryGetIntersectionTEXT(ray_query, true);
+    hit.pos = ray_origin + ray_dir * hit.t;
+    hit.bc = rayQueryGetIntersectionBarycentricsEXT(ray_query, true);
+    hit.instance_index = instance_index;
+    hit.face_index = instances[instance_index].face_offset + primitive_index;
+
+    return true;
+}
+
+bool occluded(in vec3 ray_origin, in vec3 ray_dir, in float t_max)
+{
+    rayQueryEXT ray_query;
+
+    rayQueryInitializeEXT(
+        ray_query,
+        scene_as,
+        gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT,
+        0xFF,
+        ray_origin,
+        0.0,
+        ray_dir,
+        t_max
+    );
+
+    while (rayQueryProceedEXT(ray_query))
+    {
+    }
+
+    return rayQueryGetIntersectionTypeEXT(ray_query, true) != gl_RayQueryCommittedIntersectionNoneEXT;
+}
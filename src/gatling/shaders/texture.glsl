@@ -0,0 +1,141 @@
+/* Textures are split into pages of BC1 blocks (see gsd.h), which the host streams
+ * into a fixed number of cache slots. Every lookup marks its page as requested,
+ * so that missing pages are loaded and used ones are kept. */
+
+const uint NO_TEXTURE = 0xFFFFFFFF;
+const uint TEXTURE_PAGE_SIZE = 128;
+const uint TEXTURE_PAGE_BLOCK_COUNT = TEXTURE_PAGE_SIZE / 4;
+
+struct texture_info
+{
+    uint width;
+    uint height;
+    uint level_count;
+    /* First page of level 0. Each level's pages follow those of the previous one. */
+    uint page_offset;
+};
+
+layout(set=0, binding=24) readonly buffer BufferTextures
+{
+    texture_info textures[];
+};
+
+layout(set=0, binding=25) readonly buffer BufferPageTable
+{
+    /* Cache slot of every page, or NO_TEXTURE if it isn't resident. */
+    uint page_slots[];
+};
+
+layout(set=0, binding=26) readonly buffer BufferTextureCache
+{
+    /* Blocks of the cached pages, in row-major order. */
+    uvec2 texture_cache[];
+};
+
+layout(set=0, binding=27) buffer BufferTextureFeedback
+{
+    /* A bit for every page which was looked up in the current frame. */
+    uint requested_pages[];
+};
+
+uvec2 texture_level_size(texture_info t, uint level)
+{
+    return max(uvec2(t.width, t.height) >> level, uvec2(1));
+}
+
+uint texture_level_page_count(uvec2 level_size)
+{
+    const uvec2 page_count = (level_size + TEXTURE_PAGE_SIZE - 1) / TEXTURE_PAGE_SIZE;
+    return page_count.x * page_count.y;
+}
+
+vec3 srgb_to_linear(vec3 c)
+{
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), greaterThan(c, vec3(0.04045)));
+}
+
+vec3 unpack_rgb565(uint c)
+{
+    return vec3((c >> 11) & 0x1F, (c >> 5) & 0x3F, c & 0x1F) / vec3(31.0, 63.0, 31.0);
+}
+
+/* Textures are opaque, so the transparent entry of the three-color mode is black. */
+vec3 decode_bc1(uvec2 block, uvec2 texel)
+{
+    const uint c0 = block.x & 0xFFFF;
+    const uint c1 = block.x >> 16;
+    const vec3 e0 = unpack_rgb565(c0);
+    const vec3 e1 = unpack_rgb565(c1);
+    const uint index = (block.y >> ((texel.y * 4 + texel.x) * 2)) & 3;
+
+    if (index == 0) {
+        return e0;
+    } else if (index == 1) {
+        return e1;
+    } else if (c0 > c1) {
+        return (index == 2) ? ((2.0 * e0 + e1) / 3.0) : ((e0 + 2.0 * e1) / 3.0);
+    }
+
+    return (index == 2) ? ((e0 + e1) * 0.5) : vec3(0.0);
+}
+
+/* Returns the cache slot of the page, or NO_TEXTURE. Most pages have already
+ * been requested by other lookups, so the bit is read before it is set. */
+uint lookup_texture_page(uint page)
+{
+    const uint word = page / 32;
+    const uint mask = 1u << (page % 32);
+
+    if ((requested_pages[word] & mask) == 0) {
+        atomicOr(requested_pages[word], mask);
+    }
+
+    return page_slots[page];
+}
+
+/* Stochastic texture filtering [Pharr et al. 2024]: instead of blending eight
+ * texels, a single one is selected with a probability equal to its trilinear
+ * weight. A uniform jitter of half a texel turns the nearest texel into a
+ * bilinear lookup on average, and rounding the LOD up or down at random blends
+ * the two levels. The footprint is given as a log2 of its width in UV space,
+ * and wrapping repeats. If a page is missing, the texel is taken from the next
+ * coarser level instead. */
+vec3 sample_texture(uint texture_index, vec2 uv, float uv_lod, vec3 u)
+{
+    const texture_info t = textures[texture_index];
+
+    const float lod = uv_lod + 0.5 * log2(float(t.width) * float(t.height));
+    uint level = uint(clamp(floor(lod + u.z), 0.0, float(t.level_count - 1)));
+
+    uint level_page_offset = t.page_offset;
+    for (uint l = 0; l < level; ++l) {
+        level_page_offset += texture_level_page_count(texture_level_size(t, l));
+    }
+
+    for (; level < t.level_count; ++level)
+    {
+        const uvec2 size = texture_level_size(t, level);
+        const vec2 pos = fract(uv) * vec2(size) + (u.xy - 0.5);
+        const uvec2 texel = uvec2(ivec2(floor(pos)) + ivec2(size)) % size;
+
+        const uvec2 page_pos = texel / TEXTURE_PAGE_SIZE;
+        const uint page_count_x = (size.x + TEXTURE_PAGE_SIZE - 1) / TEXTURE_PAGE_SIZE;
+        const uint page = level_page_offset + page_pos.y * page_count_x + page_pos.x;
+
+        const uint slot = lookup_texture_page(page);
+
+        /* The last level is always resident. */
+        if (slot != NO_TEXTURE)
+        {
+            const uvec2 page_texel = texel % TEXTURE_PAGE_SIZE;
+            const uvec2 block_pos = page_texel / 4;
+            const uint block_index = (slot * TEXTURE_PAGE_BLOCK_COUNT + block_pos.y) * TEXTURE_PAGE_BLOCK_COUNT + block_pos.x;
+
+            return srgb_to_linear(decode_bc1(texture_cache[block_index], page_texel % 4));
+        }
+
+        level_page_offset += texture_level_page_count(size);
+    }
+
+    return vec3(1.0);
+}
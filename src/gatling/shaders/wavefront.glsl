@@ -0,0 +1,164 @@
+/*
+ * Shared state of the wavefront kernels. A path is generated per pixel and sample,
+ * then the extend and shade kernels are run once for each bounce. Paths which are
+ * still alive after shading are appended to the next ray queue, which keeps the
+ * queues compact so that no invocations are wasted on terminated paths [Laine et al. 2013].
+ *
+ * Light sampling is done in a separate connect kernel, which traces the shadow
+ * rays emitted by the shade kernel.
+ *
+ * Path state is stored as structure of arrays. Each array holds two queues of
+ * QUEUE_CAPACITY entries, the one being read and the one being filled, which
+ * swap roles after every bounce.
+ */
+
+layout(constant_id = 2) const uint IMAGE_WIDTH = 1920;
+layout(constant_id = 3) const uint IMAGE_HEIGHT = 1080;
+layout(constant_id = 4) const uint SAMPLE_COUNT = 4;
+layout(constant_id = 5) const uint BOUNCES = 4;
+layout(constant_id = 6) const uint MAX_STACK_SIZE = 6;
+/* Rays fetched per invocation each time a subgroup of the extend kernel runs dry. */
+layout(constant_id = 14) const uint RAY_BATCH_SIZE = 2;
+/* Upper bound for the number of extend workgroups, chosen to just fill the device. */
+layout(constant_id = 15) const uint PERSISTENT_WORKGROUP_COUNT = 1024;
+/* Adaptive sampling is disabled if the threshold is zero. */
+layout(constant_id = 16) const float ERROR_THRESHOLD = 0.0;
+/* Next event estimation is disabled if the scene contains no lights. */
+layout(constant_id = 17) const uint LIGHT_COUNT = 0;
+/* Sum of the power of all lights, which normalizes light selection probabilities. */
+layout(constant_id = 18) const float LIGHT_POWER = 1.0;
+/* Absolute index of the first sample, for renders which are split across machines. */
+layout(constant_id = 20) const uint SAMPLE_OFFSET = 0;
+
+const uint TRAVERSAL_STATS_OFF = 0;
+const uint TRAVERSAL_STATS_COUNT = 1;
+const uint TRAVERSAL_STATS_HEATMAP = 2;
+
+/* Instrumentation of the software traversal, see bvh.glsl. In heatmap mode,
+ * pixels accumulate the traversal cost of their paths instead of radiance. */
+layout(constant_id = 22) const uint TRAVERSAL_STATS = TRAVERSAL_STATS_OFF;
+
+/* Node visits plus triangle tests per path which map to the top of the heatmap. */
+const float HEATMAP_MAX_COST = 1024.0;
+
+const uint QUEUE_CAPACITY = IMAGE_WIDTH * IMAGE_HEIGHT;
+const uint NO_HIT = 0xFFFFFFFF;
+
+/* Rendering is progressive: each submission traces a few samples of one tile,
+ * or of a range of the active pixel list if pixel_list_size is not zero. The
+ * camera can change between frames, so it isn't a specialization constant. */
+layout(push_constant) uniform PushConstants
+{
+    uint sample_index;
+    uint bounce;
+    uvec2 tile_offset;
+    uvec2 tile_size;
+    uint pixel_list_offset;
+    uint pixel_list_size;
+    vec3 camera_origin;
+    float camera_fov;
+    vec3 camera_target;
+    float padding;
+} pc;
+
+layout(set=0, binding=6) buffer BufferRayOrigins
+{
+    /* origin.{x, y, z}, pixel index */
+    vec4 ray_origins[];
+};
+
+layout(set=0, binding=7) buffer BufferRayDirections
+{
+    /* direction.{x, y, z}, rng state */
+    vec4 ray_directions[];
+};
+
+layout(set=0, binding=8) buffer BufferPathThroughputs
+{
+    /* throughput.{r, g, b}, PDF of the sampled direction */
+    vec4 path_throughputs[];
+};
+
+layout(set=0, binding=9) buffer BufferHits
+{
+    /* face index, instance index, barycentrics.{u, v} */
+    uvec4 hits[];
+};
+
+layout(set=0, binding=10) buffer BufferHitDistances
+{
+    float hit_distances[];
+};
+
+layout(set=0, binding=11) buffer BufferQueueState
+{
+    /* Arguments of the next indirect extend and shade dispatches. */
+    uint extend_dispatch_size_x;
+    uint extend_dispatch_size_y;
+    uint extend_dispatch_size_z;
+    uint shade_dispatch_size_x;
+    uint shade_dispatch_size_y;
+    uint shade_dispatch_size_z;
+    uint ray_counts[2];
+    /* Index of the next ray to be fetched by the persistent extend kernel. */
+    uint ray_pool_next;
+    uint shadow_ray_count;
+};
+
+/* Like the output buffer, but only accumulates samples with an even index. */
+layout(set=0, binding=12) buffer BufferHalfOutput
+{
+    vec4 half_pixels[];
+};
+
+/* Pixels which have not converged yet. */
+layout(set=0, binding=13) buffer BufferActivePixels
+{
+    uint active_pixels[];
+};
+
+layout(set=0, binding=14) buffer BufferActivePixelCount
+{
+    uint active_pixel_count;
+};
+
+/* Shadow rays of the current bounce. A single queue suffices, since they
+ * are traced before the next bounce is shaded. */
+layout(set=0, binding=16) buffer BufferShadowRayOrigins
+{
+    /* origin.{x, y, z}, pixel index */
+    vec4 shadow_ray_origins[];
+};
+
+layout(set=0, binding=17) buffer BufferShadowRayDirections
+{
+    /* direction.{x, y, z}, distance to the light */
+    vec4 shadow_ray_directions[];
+};
+
+layout(set=0, binding=18) buffer BufferShadowRadiances
+{
+    /* Radiance to be added to the pixel if the light is visible. */
+    vec4 shadow_radiances[];
+};
+
+/* Rays traced since the start of the frame, as 64-bit counters in two words,
+ * lowest first. The host reads them to report the ray throughput. */
+layout(set=0, binding=23) buffer BufferStats
+{
+    uvec2 traced_ray_count;
+    uvec2 traced_shadow_ray_count;
+    /* 64-bit totals of the traversal counters, as low and high words. */
+    uint traversal_counters[6];
+    uint max_traversal_stack_size;
+};
+
+uint input_queue_index()
+{
+    return pc.bounce % 2;
+}
+
+uint output_queue_index()
+{
+    return (pc.bounce + 1) % 2;
+}
@@ -0,0 +1,145 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+typedef struct gatling_thread {
+  gatling_thread_func func;
+  void*               data;
+#if defined(_WIN32)
+  HANDLE              handle;
+#else
+  pthread_t           handle;
+#endif
+} gatling_thread;
+
+typedef struct gatling_mutex {
+#if defined(_WIN32)
+  CRITICAL_SECTION critical_section;
+#else
+  pthread_mutex_t  handle;
+#endif
+} gatling_mutex;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI gatling_thread_entry(LPVOID param)
+{
+  gatling_thread* thread = (gatling_thread*) param;
+  thread->func(thread->data);
+  return 0;
+}
+
+bool gatling_thread_create(gatling_thread_func func, void* data, gatling_thread** thread)
+{
+  gatling_thread* new_thread = (gatling_thread*) malloc(sizeof(gatling_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+  new_thread->handle = CreateThread(NULL, 0, gatling_thread_entry, new_thread, 0, NULL);
+
+  if (new_thread->handle == NULL) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void gatling_thread_join(gatling_thread* thread)
+{
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  free(thread);
+}
+
+bool gatling_mutex_create(gatling_mutex** mutex)
+{
+  gatling_mutex* new_mutex = (gatling_mutex*) malloc(sizeof(gatling_mutex));
+  InitializeCriticalSection(&new_mutex->critical_section);
+  *mutex = new_mutex;
+  return true;
+}
+
+void gatling_mutex_destroy(gatling_mutex* mutex)
+{
+  DeleteCriticalSection(&mutex->critical_section);
+  free(mutex);
+}
+
+void gatling_mutex_lock(gatling_mutex* mutex)
+{
+  EnterCriticalSection(&mutex->critical_section);
+}
+
+void gatling_mutex_unlock(gatling_mutex* mutex)
+{
+  LeaveCriticalSection(&mutex->critical_section);
+}
+
+#else
+
+static void* gatling_thread_entry(void* param)
+{
+  gatling_thread* thread = (gatling_thread*) param;
+  thread->func(thread->data);
+  return NULL;
+}
+
+bool gatling_thread_create(gatling_thread_func func, void* data, gatling_thread** thread)
+{
+  gatling_thread* new_thread = (gatling_thread*) malloc(sizeof(gatling_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+
+  if (pthread_create(&new_thread->handle, NULL, gatling_thread_entry, new_thread) != 0) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void gatling_thread_join(gatling_thread* thread)
+{
+  pthread_join(thread->handle, NULL);
+  free(thread);
+}
+
+bool gatling_mutex_create(gatling_mutex** mutex)
+{
+  gatling_mutex* new_mutex = (gatling_mutex*) malloc(sizeof(gatling_mutex));
+
+  if (pthread_mutex_init(&new_mutex->handle, NULL) != 0) {
+    free(new_mutex);
+    return false;
+  }
+
+  *mutex = new_mutex;
+  return true;
+}
+
+void gatling_mutex_destroy(gatling_mutex* mutex)
+{
+  pthread_mutex_destroy(&mutex->handle);
+  free(mutex);
+}
+
+void gatling_mutex_lock(gatling_mutex* mutex)
+{
+  pthread_mutex_lock(&mutex->handle);
+}
+
+void gatling_mutex_unlock(gatling_mutex* mutex)
+{
+  pthread_mutex_unlock(&mutex->handle);
+}
+
+#endif
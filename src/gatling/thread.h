@@ -0,0 +1,28 @@
+#ifndef GATLING_THREAD_H
+#define GATLING_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct gatling_thread gatling_thread;
+typedef struct gatling_mutex gatling_mutex;
+
+typedef void (*gatling_thread_func)(void* data);
+
+bool gatling_thread_create(
+  gatling_thread_func func,
+  void* data,
+  gatling_thread** thread
+);
+
+void gatling_thread_join(gatling_thread* thread);
+
+bool gatling_mutex_create(gatling_mutex** mutex);
+
+void gatling_mutex_destroy(gatling_mutex* mutex);
+
+void gatling_mutex_lock(gatling_mutex* mutex);
+
+void gatling_mutex_unlock(gatling_mutex* mutex);
+
+#endif
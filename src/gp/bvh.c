@@ -5,6 +5,9 @@
 #include <math.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
+
+#include "thread.h"
 
 /*
  * This builder produces a binary BVH using the Surface Area Heuristic (SAH).
@@ -18,6 +21,13 @@
  * reach the leaf layer. To accommodate for face duplications, we grow the child
  * ranges inwards from the bounds of the parent range. A reserve buffer is used to
  * allow spatial splitting for ranges with no free space left.
+ * Because ranges are disjunct, they can be processed in parallel. Each thread
+ * owns a job deque: it pops the most recently pushed job (depth-first, like a
+ * serial builder would) and steals the oldest, and therefore largest, job from
+ * other threads once its own deque runs dry. Node and face slots are allocated
+ * using atomic counters. Ranges near the root are too large to wait for subtree
+ * parallelism, so for these, binning and partitioning are split into chunks
+ * which idle threads help to process.
  *
  *   ┌───────────────────────────────────────────────────────────────────┐
  *   │█████████████████████████████████                                  │
@@ -86,15 +96,6 @@ typedef struct gp_bvh_split_spatial {
   uint32_t right_face_count;
 } gp_bvh_split_spatial;
 
-typedef struct gp_bvh_thread_data {
-  const gp_bvh_build_params* params;
-  float root_half_area;
-  void* reused_bins;
-  gp_aabb* reused_aabbs;
-  gp_bvh_face_ref* reserve_buffer;
-  int32_t* reserve_buffer_capacity;
-} gp_bvh_thread_data ;
-
 typedef struct gp_bvh_work_range {
   gp_bvh_face_ref* stack;
   int32_t stack_dir;
@@ -109,29 +110,66 @@ typedef struct gp_bvh_work_job {
   uint32_t node_index;
 } gp_bvh_work_job;
 
-#define GP_BVH_GEN_SORT_CMP_FUNC(AXIS)                                            \
-  GP_INLINE static int gp_bvh_sort_comp_func_##AXIS(                              \
-    const void* a, const void* b)                                                 \
-  {                                                                               \
-    const gp_bvh_face_ref* ref_1 = (gp_bvh_face_ref*) a;                          \
-    const gp_bvh_face_ref* ref_2 = (gp_bvh_face_ref*) b;                          \
-    const float aabb_dcentroid_1 = ref_1->aabb.min[AXIS] + ref_1->aabb.max[AXIS]; \
-    const float aabb_dcentroid_2 = ref_2->aabb.min[AXIS] + ref_2->aabb.max[AXIS]; \
-                                                                                  \
-    if      (aabb_dcentroid_1 > aabb_dcentroid_2) { return  1; }                  \
-    else if (aabb_dcentroid_1 < aabb_dcentroid_2) { return -1; }                  \
-    else if (ref_1->index > ref_2->index)         { return  1; }                  \
-    else if (ref_1->index < ref_2->index)         { return -1; }                  \
-    else {                                                                        \
-      return 0;                                                                   \
-    }                                                                             \
-  }
+typedef struct gp_bvh_job_deque {
+  gp_mutex* mutex;
+  gp_bvh_work_job* jobs;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t tail;
+} gp_bvh_job_deque;
+
+typedef void (*gp_bvh_chunk_func)(void* data, uint32_t chunk_index);
+
+typedef struct gp_bvh_parallel_task {
+  gp_bvh_chunk_func func;
+  void* data;
+  uint32_t chunk_count;
+  _Atomic uint32_t next_chunk;
+  _Atomic uint32_t helper_count;
+  _Atomic bool is_open;
+} gp_bvh_parallel_task;
+
+typedef struct gp_bvh_build_context {
+  const gp_bvh_build_params* params;
+  gp_bvh* bvh;
+  uint32_t thread_count;
+  gp_bvh_job_deque* job_deques;
+  gp_bvh_parallel_task* tasks;
+  _Atomic uint32_t node_count;
+  _Atomic uint32_t face_count;
+  _Atomic uint32_t pending_job_count;
+} gp_bvh_build_context;
+
+/* Scratch memory of the full sweep, which is sized by the largest range a thread
+ * has swept. This is usually far less than the mesh, as large ranges are binned. */
+typedef struct gp_bvh_sweep_memory {
+  uint32_t capacity;
+  gp_aabb* right_aabbs;
+  uint32_t* sort_data;
+  float* areas;
+} gp_bvh_sweep_memory;
+
+typedef struct gp_bvh_thread_data {
+  const gp_bvh_build_params* params;
+  gp_bvh_build_context* context;
+  uint32_t thread_index;
+  gp_bvh_parallel_task* task;
+  float root_half_area;
+  void* reused_bins;
+  gp_aabb* reused_aabbs;
+  gp_bvh_sweep_memory* sweep_memory;
+  gp_bvh_face_ref* reserve_buffer;
+  _Atomic int32_t* reserve_buffer_capacity;
+} gp_bvh_thread_data;
 
-GP_BVH_GEN_SORT_CMP_FUNC(0)
-GP_BVH_GEN_SORT_CMP_FUNC(1)
-GP_BVH_GEN_SORT_CMP_FUNC(2)
+#define GP_BVH_CHUNKS_PER_THREAD 4
+#define GP_BVH_BINNING_BATCH_SIZE 4
+#define GP_BVH_RADIX_SORT_THRESHOLD 64
+#define GP_BVH_RADIX_BITS 8
+#define GP_BVH_RADIX_BUCKET_COUNT (1 << GP_BVH_RADIX_BITS)
 
 GP_INLINE static int32_t imax(int32_t a, int32_t b) { return (a > b) ? a : b; }
+GP_INLINE static uint32_t imin(uint32_t a, uint32_t b) { return (a < b) ? a : b; }
 GP_INLINE static int32_t iclamp(int32_t a, int32_t min, int32_t max) {
     return (a < min) ? min : ((a > max) ? max : a);
 }
@@ -145,6 +183,117 @@ GP_INLINE static float gp_bvh_calc_face_intersection_cost(
   return rounded_to_batch_size * base_cost;
 }
 
+/* Maps a float to an unsigned integer with the same ordering. */
+GP_INLINE static uint32_t gp_bvh_float_to_radix_key(float f)
+{
+  /* Negative and positive zero compare equal, so map both to the same key. */
+  f += 0.0f;
+
+  uint32_t u;
+  memcpy(&u, &f, sizeof(uint32_t));
+  return (u & 0x80000000) ? ~u : (u | 0x80000000);
+}
+
+/* Stable sort of key-value pairs. The sorted pairs end up in the first two arrays. */
+static void gp_bvh_sort_pairs(
+  uint32_t count,
+  uint32_t* keys,
+  uint32_t* values,
+  uint32_t* tmp_keys,
+  uint32_t* tmp_values)
+{
+  /* Insertion sort is faster for small inputs. */
+  if (count <= GP_BVH_RADIX_SORT_THRESHOLD)
+  {
+    for (uint32_t i = 1; i < count; ++i)
+    {
+      const uint32_t key = keys[i];
+      const uint32_t value = values[i];
+
+      uint32_t j = i;
+      for (; j > 0 && keys[j - 1] > key; --j)
+      {
+        keys[j] = keys[j - 1];
+        values[j] = values[j - 1];
+      }
+
+      keys[j] = key;
+      values[j] = value;
+    }
+    return;
+  }
+
+  uint32_t* src_keys = keys;
+  uint32_t* src_values = values;
+  uint32_t* dst_keys = tmp_keys;
+  uint32_t* dst_values = tmp_values;
+
+  for (uint32_t shift = 0; shift < 32; shift += GP_BVH_RADIX_BITS)
+  {
+    uint32_t offsets[GP_BVH_RADIX_BUCKET_COUNT] = { 0 };
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      offsets[(src_keys[i] >> shift) & (GP_BVH_RADIX_BUCKET_COUNT - 1)]++;
+    }
+
+    /* Skip this digit if all keys share it. This is common for the high bits. */
+    if (offsets[(src_keys[0] >> shift) & (GP_BVH_RADIX_BUCKET_COUNT - 1)] == count)
+    {
+      continue;
+    }
+
+    uint32_t offset = 0;
+    for (uint32_t b = 0; b < GP_BVH_RADIX_BUCKET_COUNT; ++b)
+    {
+      const uint32_t bucket_size = offsets[b];
+      offsets[b] = offset;
+      offset += bucket_size;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const uint32_t dst_index = offsets[(src_keys[i] >> shift) & (GP_BVH_RADIX_BUCKET_COUNT - 1)]++;
+      dst_keys[dst_index] = src_keys[i];
+      dst_values[dst_index] = src_values[i];
+    }
+
+    uint32_t* tmp = src_keys;
+    src_keys = dst_keys;
+    dst_keys = tmp;
+    tmp = src_values;
+    src_values = dst_values;
+    dst_values = tmp;
+  }
+
+  if (src_keys != keys)
+  {
+    memcpy(keys, src_keys, count * sizeof(uint32_t));
+    memcpy(values, src_values, count * sizeof(uint32_t));
+  }
+}
+
+static void gp_bvh_reserve_sweep_memory(gp_bvh_sweep_memory* memory, uint32_t face_count)
+{
+  if (face_count <= memory->capacity)
+  {
+    return;
+  }
+
+  /* Grow geometrically, as ranges are swept in no particular order. The
+   * contents don't need to be kept. */
+  const uint32_t capacity = (face_count > memory->capacity * 2) ? face_count : (memory->capacity * 2);
+
+  free(memory->right_aabbs);
+  free(memory->sort_data);
+  free(memory->areas);
+
+  memory->capacity = capacity;
+  memory->right_aabbs = (gp_aabb*) malloc(capacity * sizeof(gp_aabb));
+  memory->sort_data = (uint32_t*) malloc(capacity * 5 * sizeof(uint32_t));
+  memory->areas = (float*) malloc(capacity * 2 * sizeof(float));
+}
+
 static void gp_bvh_find_split_object(
   const gp_bvh_thread_data* thread_data,
   const gp_bvh_work_range* range,
@@ -156,62 +305,93 @@ static void gp_bvh_find_split_object(
   gp_aabb left_accum;
   gp_aabb right_accum;
 
-  gp_bvh_face_ref* range_stack_left =
+  const uint32_t face_count = range->stack_size;
+
+  const gp_bvh_face_ref* range_stack_left =
     (range->stack_dir == 1) ? range->stack : (range->stack - (range->stack_size - 1));
 
+  gp_bvh_sweep_memory* memory = thread_data->sweep_memory;
+  gp_bvh_reserve_sweep_memory(memory, face_count);
+
+  /* Instead of reordering the references themselves, we sort arrays of
+   * 32-bit keys and reference positions. */
+  uint32_t* index_order = &memory->sort_data[face_count * 0];
+  uint32_t* keys        = &memory->sort_data[face_count * 1];
+  uint32_t* order       = &memory->sort_data[face_count * 2];
+  uint32_t* tmp_keys    = &memory->sort_data[face_count * 3];
+  uint32_t* tmp_order   = &memory->sort_data[face_count * 4];
+
+  gp_aabb* right_aabbs = memory->right_aabbs;
+  float* costs         = &memory->areas[0];
+  float* right_areas   = &memory->areas[face_count];
+
+  /* Order by face index first. Sorting stably by centroid afterwards
+   * gives us the same tie-breaking as a (centroid, index) comparison. */
+  for (uint32_t i = 0; i < face_count; ++i)
+  {
+    keys[i] = range_stack_left[i].index;
+    index_order[i] = i;
+  }
+
+  gp_bvh_sort_pairs(face_count, keys, index_order, tmp_keys, tmp_order);
+
   /* Test each axis and sort faces along it. */
   for (uint32_t axis = 0; axis < 3; ++axis)
   {
-    switch (axis)
+    for (uint32_t i = 0; i < face_count; ++i)
     {
-      case 0:
-        qsort(range_stack_left, range->stack_size, sizeof(gp_bvh_face_ref), gp_bvh_sort_comp_func_0);
-        break;
-      case 1:
-        qsort(range_stack_left, range->stack_size, sizeof(gp_bvh_face_ref), gp_bvh_sort_comp_func_1);
-        break;
-      case 2:
-        qsort(range_stack_left, range->stack_size, sizeof(gp_bvh_face_ref), gp_bvh_sort_comp_func_2);
-        break;
-      default:
-        assert(false);
+      const gp_bvh_face_ref* ref = &range_stack_left[index_order[i]];
+      keys[i] = gp_bvh_float_to_radix_key(ref->aabb.min[axis] + ref->aabb.max[axis]);
+      order[i] = index_order[i];
     }
 
+    gp_bvh_sort_pairs(face_count, keys, order, tmp_keys, tmp_order);
+
     /* Sweep from right to left. */
     gp_aabb_make_smallest(&right_accum);
 
-    for (int32_t r = range->stack_size - 1; r > 0; --r)
+    for (int32_t r = face_count - 1; r > 0; --r)
     {
-      const gp_bvh_face_ref* ref = &range_stack_left[r];
+      const gp_bvh_face_ref* ref = &range_stack_left[order[r]];
       gp_aabb_merge(&right_accum, &ref->aabb, &right_accum);
-      thread_data->reused_aabbs[r - 1] = right_accum;
+      right_aabbs[r - 1] = right_accum;
+      right_areas[r - 1] = gp_aabb_half_area(&right_accum);
     }
 
     /* Sweep from left to right. */
     gp_aabb_make_smallest(&left_accum);
 
-    for (uint32_t l = 1; l < range->stack_size; ++l)
+    for (uint32_t l = 1; l < face_count; ++l)
     {
-      const gp_bvh_face_ref* ref = &range_stack_left[(int32_t)l - 1];
+      const gp_bvh_face_ref* ref = &range_stack_left[order[l - 1]];
       gp_aabb_merge(&left_accum, &ref->aabb, &left_accum);
+      costs[l - 1] = gp_aabb_half_area(&left_accum);
+    }
 
-      const uint32_t r = range->stack_size - l;
-
-      /* Calculate SAH cost. */
-      const float area_l = gp_aabb_half_area(&left_accum);
-      const float area_r = gp_aabb_half_area(&thread_data->reused_aabbs[l - 1]);
+    /* Calculate SAH costs in a branch-free pass over contiguous arrays. */
+    for (uint32_t l = 1; l < face_count; ++l)
+    {
+      const uint32_t r = face_count - l;
 
-      const float sah_cost =
+      costs[l - 1] =
         gp_bvh_calc_face_intersection_cost(
           thread_data->params->face_intersection_cost,
           thread_data->params->face_batch_size,
           l
-        ) * area_l +
+        ) * costs[l - 1] +
         gp_bvh_calc_face_intersection_cost(
           thread_data->params->face_intersection_cost,
           thread_data->params->face_batch_size,
           r
-        ) * area_r;
+        ) * right_areas[l - 1];
+    }
+
+    uint32_t best_l = 0;
+
+    for (uint32_t l = 1; l < face_count; ++l)
+    {
+      const uint32_t r = face_count - l;
+      const float sah_cost = costs[l - 1];
 
       /* Abort if cost is higher than best split. */
       if (sah_cost > best_sah_cost)
@@ -227,24 +407,259 @@ static void gp_bvh_find_split_object(
         continue;
       }
 
-      /* Set new best split candidate. */
-      const float dcentroid = ref->aabb.min[axis] + ref->aabb.max[axis];
+      best_sah_cost = sah_cost;
+      best_tie_break = tie_break;
+      best_l = l;
+    }
 
-      gp_aabb overlap_aabb;
-      gp_aabb_intersect(&left_accum, &thread_data->reused_aabbs[l - 1], &overlap_aabb);
+    if (best_l == 0)
+    {
+      continue;
+    }
 
-      split->sah_cost = sah_cost;
-      split->axis = axis;
-      split->dcentroid = dcentroid;
-      split->face_index = ref->index;
-      split->overlap_half_area = gp_aabb_half_area(&overlap_aabb);
+    /* Set new best split candidate. The left AABB was not kept, so recompute it. */
+    gp_aabb_make_smallest(&left_accum);
 
-      best_sah_cost = sah_cost;
-      best_tie_break = tie_break;
+    for (uint32_t i = 0; i < best_l; ++i)
+    {
+      gp_aabb_merge(&left_accum, &range_stack_left[order[i]].aabb, &left_accum);
     }
+
+    const gp_bvh_face_ref* ref = &range_stack_left[order[best_l - 1]];
+    const float dcentroid = ref->aabb.min[axis] + ref->aabb.max[axis];
+
+    gp_aabb overlap_aabb;
+    gp_aabb_intersect(&left_accum, &right_aabbs[best_l - 1], &overlap_aabb);
+
+    split->sah_cost = best_sah_cost;
+    split->axis = axis;
+    split->dcentroid = dcentroid;
+    split->face_index = ref->index;
+    split->overlap_half_area = gp_aabb_half_area(&overlap_aabb);
   }
 }
 
+GP_INLINE static uint32_t gp_bvh_calc_object_bin_count(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range)
+{
+  if (thread_data->params->object_binning_mode == GP_BVH_BINNING_MODE_ADAPTIVE) {
+    return iclamp((int32_t) (range->stack_size * 0.05f + 4.0f), 0,
+                  (int32_t) thread_data->params->object_bin_count);
+  }
+  return thread_data->params->object_bin_count;
+}
+
+GP_INLINE static bool gp_bvh_is_parallel_range(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range)
+{
+  return thread_data->context->thread_count > 1 &&
+         range->stack_size > thread_data->params->parallel_binning_threshold;
+}
+
+GP_INLINE static uint32_t gp_bvh_calc_chunk_size(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range)
+{
+  const uint32_t chunk_count = thread_data->context->thread_count * GP_BVH_CHUNKS_PER_THREAD;
+  return (range->stack_size + chunk_count - 1) / chunk_count;
+}
+
+static void gp_bvh_run_parallel_task(gp_bvh_parallel_task* task)
+{
+  uint32_t chunk_index;
+  while ((chunk_index = atomic_fetch_add(&task->next_chunk, 1)) < task->chunk_count)
+  {
+    task->func(task->data, chunk_index);
+  }
+}
+
+static void gp_bvh_parallel_for(
+  const gp_bvh_thread_data* thread_data,
+  uint32_t chunk_count,
+  gp_bvh_chunk_func func,
+  void* data)
+{
+  /* Publish the task so that idle threads can help out, process chunks
+   * ourselves and wait for the helpers to finish their last chunks. */
+  gp_bvh_parallel_task* task = thread_data->task;
+  task->func = func;
+  task->data = data;
+  task->chunk_count = chunk_count;
+  atomic_store(&task->next_chunk, 0);
+  atomic_store(&task->is_open, true);
+
+  gp_bvh_run_parallel_task(task);
+
+  atomic_store(&task->is_open, false);
+
+  while (atomic_load(&task->helper_count) > 0)
+  {
+    gp_thread_yield();
+  }
+}
+
+static bool gp_bvh_help_parallel_task(
+  gp_bvh_build_context* context)
+{
+  for (uint32_t i = 0; i < context->thread_count; ++i)
+  {
+    gp_bvh_parallel_task* task = &context->tasks[i];
+
+    if (!atomic_load(&task->is_open)) {
+      continue;
+    }
+
+    /* Register first, then check again: the owner only returns once
+     * all registered helpers are gone. */
+    atomic_fetch_add(&task->helper_count, 1);
+
+    const bool is_open = atomic_load(&task->is_open);
+
+    if (is_open) {
+      gp_bvh_run_parallel_task(task);
+    }
+
+    atomic_fetch_sub(&task->helper_count, 1);
+
+    if (is_open) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void gp_bvh_bin_objects(
+  const gp_bvh_work_range* range,
+  uint32_t bin_count,
+  uint32_t face_begin,
+  uint32_t face_end,
+  gp_bvh_object_bin* bins)
+{
+  gp_vec3 axis_lengths;
+  gp_vec3_sub(range->centroid_bounds.max, range->centroid_bounds.min, axis_lengths);
+
+  /* Clear object bins. */
+  for (uint32_t i = 0; i < bin_count * 3; ++i)
+  {
+    gp_bvh_object_bin* bin = &bins[i];
+    gp_aabb_make_smallest(&bin->aabb);
+    bin->face_count = 0;
+  }
+
+  gp_vec3 k1;
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    k1[axis] = (axis_lengths[axis] > 0.0f) ? (bin_count / axis_lengths[axis]) : 0.0f;
+  }
+
+  /* Project faces to bins. Faces are processed in batches: bin indices
+   * do not depend on each other and are calculated up front, before the
+   * dependent bin updates are done. */
+  uint32_t i = face_begin;
+
+  while (i < face_end)
+  {
+    const uint32_t batch_size = imin(GP_BVH_BINNING_BATCH_SIZE, face_end - i);
+
+    const gp_bvh_face_ref* refs[GP_BVH_BINNING_BATCH_SIZE];
+    uint32_t bin_indices[GP_BVH_BINNING_BATCH_SIZE][3];
+
+    for (uint32_t b = 0; b < batch_size; ++b)
+    {
+      const gp_bvh_face_ref* ref = &range->stack[(int32_t)(i + b) * range->stack_dir];
+      refs[b] = ref;
+
+      for (uint32_t axis = 0; axis < 3; ++axis)
+      {
+        const float centroid = (ref->aabb.min[axis] + ref->aabb.max[axis]) * 0.5f;
+
+        bin_indices[b][axis] = (uint32_t) iclamp(
+          (int32_t) (k1[axis] * (centroid - range->centroid_bounds.min[axis])),
+          0,
+          (int32_t) (bin_count - 1)
+        );
+      }
+    }
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+      if (axis_lengths[axis] <= 0.0f) {
+        continue;
+      }
+
+      for (uint32_t b = 0; b < batch_size; ++b)
+      {
+        gp_bvh_object_bin* bin = &bins[axis * bin_count + bin_indices[b][axis]];
+        bin->face_count++;
+
+        gp_aabb_merge(&bin->aabb, &refs[b]->aabb, &bin->aabb);
+      }
+    }
+
+    i += batch_size;
+  }
+}
+
+typedef struct gp_bvh_object_binning_task {
+  const gp_bvh_work_range* range;
+  uint32_t bin_count;
+  uint32_t chunk_size;
+  gp_bvh_object_bin* chunk_bins;
+} gp_bvh_object_binning_task;
+
+static void gp_bvh_bin_objects_chunk(void* data, uint32_t chunk_index)
+{
+  const gp_bvh_object_binning_task* task = (const gp_bvh_object_binning_task*) data;
+  const uint32_t stack_size = task->range->stack_size;
+  const uint32_t face_begin = imin(chunk_index * task->chunk_size, stack_size);
+  const uint32_t face_end = imin(face_begin + task->chunk_size, stack_size);
+
+  gp_bvh_bin_objects(
+    task->range,
+    task->bin_count,
+    face_begin,
+    face_end,
+    &task->chunk_bins[chunk_index * task->bin_count * 3]
+  );
+}
+
+static void gp_bvh_bin_objects_parallel(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range,
+  uint32_t bin_count,
+  gp_bvh_object_bin* bins)
+{
+  const uint32_t chunk_count = thread_data->context->thread_count * GP_BVH_CHUNKS_PER_THREAD;
+
+  gp_bvh_object_binning_task task;
+  task.range = range;
+  task.bin_count = bin_count;
+  task.chunk_size = gp_bvh_calc_chunk_size(thread_data, range);
+  task.chunk_bins = (gp_bvh_object_bin*) malloc(chunk_count * bin_count * 3 * sizeof(gp_bvh_object_bin));
+
+  gp_bvh_parallel_for(thread_data, chunk_count, gp_bvh_bin_objects_chunk, &task);
+
+  /* Reduce private bins. Merging is exact, so the result does not
+   * differ from serial binning. */
+  for (uint32_t i = 0; i < bin_count * 3; ++i)
+  {
+    gp_bvh_object_bin* bin = &bins[i];
+    *bin = task.chunk_bins[i];
+
+    for (uint32_t c = 1; c < chunk_count; ++c)
+    {
+      const gp_bvh_object_bin* chunk_bin = &task.chunk_bins[c * bin_count * 3 + i];
+      gp_aabb_merge(&bin->aabb, &chunk_bin->aabb, &bin->aabb);
+      bin->face_count += chunk_bin->face_count;
+    }
+  }
+
+  free(task.chunk_bins);
+}
+
 static void gp_bvh_find_split_object_binned(
   const gp_bvh_thread_data* thread_data,
   const gp_bvh_work_range* range,
@@ -259,18 +674,21 @@ static void gp_bvh_find_split_object_binned(
   gp_vec3 axis_lengths;
   gp_vec3_sub(range->centroid_bounds.max, range->centroid_bounds.min, axis_lengths);
 
-  uint32_t bin_count;
-  if (thread_data->params->object_binning_mode == GP_BVH_BINNING_MODE_ADAPTIVE) {
-    bin_count = iclamp((int32_t) (range->stack_size * 0.05f + 4.0f), 0,
-                       (int32_t) thread_data->params->object_bin_count);
-  }
-  else {
-    bin_count = thread_data->params->object_bin_count;
-  }
+  const uint32_t bin_count = gp_bvh_calc_object_bin_count(thread_data, range);
 
-  gp_bvh_object_bin* bins = (gp_bvh_object_bin*) thread_data->reused_bins;
+  gp_bvh_object_bin* all_bins = (gp_bvh_object_bin*) thread_data->reused_bins;
   gp_aabb* reused_aabbs = (gp_aabb*) thread_data->reused_aabbs;
 
+  /* Project faces to the bins of all axes at once. */
+  if (gp_bvh_is_parallel_range(thread_data, range))
+  {
+    gp_bvh_bin_objects_parallel(thread_data, range, bin_count, all_bins);
+  }
+  else
+  {
+    gp_bvh_bin_objects(range, bin_count, 0, range->stack_size, all_bins);
+  }
+
   /* Test each axis. */
   for (uint32_t axis = 0; axis < 3; ++axis)
   {
@@ -280,34 +698,7 @@ static void gp_bvh_find_split_object_binned(
       continue;
     }
 
-    const float k1 = bin_count / axis_length;
-
-    /* Clear object bins. */
-    for (uint32_t i = 0; i < bin_count; ++i)
-    {
-      gp_bvh_object_bin* bin = &bins[i];
-      gp_aabb_make_smallest(&bin->aabb);
-      bin->face_count = 0;
-    }
-
-    /* Project faces to bins. */
-    for (uint32_t i = 0; i < range->stack_size; ++i)
-    {
-      const gp_bvh_face_ref* ref = &range->stack[(int32_t)i * range->stack_dir];
-
-      const float centroid = (ref->aabb.min[axis] + ref->aabb.max[axis]) * 0.5f;
-
-      const uint32_t bin_index = (uint32_t) iclamp(
-        (int32_t) (k1 * (centroid - range->centroid_bounds.min[axis])),
-        0,
-        (int32_t) (bin_count - 1)
-      );
-
-      gp_bvh_object_bin* bin = &bins[bin_index];
-      bin->face_count++;
-
-      gp_aabb_merge(&bin->aabb, &ref->aabb, &bin->aabb);
-    }
+    const gp_bvh_object_bin* bins = &all_bins[axis * bin_count];
 
     /* Sweep from right to left. */
     gp_aabb_make_smallest(&right_accum);
@@ -377,12 +768,13 @@ static void gp_bvh_find_split_object_binned(
   }
 }
 
-static void gp_bvh_find_split_spatial(
+static void gp_bvh_bin_spatial(
   const gp_bvh_thread_data* thread_data,
   const gp_bvh_work_range* range,
-  gp_bvh_split_spatial* split)
+  uint32_t face_begin,
+  uint32_t face_end,
+  gp_bvh_spatial_bin* bins)
 {
-  gp_bvh_spatial_bin* bins = (gp_bvh_spatial_bin*) thread_data->reused_bins;
   const gp_vertex* vertices = thread_data->params->vertices;
   const gp_face* faces = thread_data->params->faces;
   const uint32_t bin_count = thread_data->params->spatial_bin_count;
@@ -402,10 +794,20 @@ static void gp_bvh_find_split_spatial(
     gp_aabb_make_smallest(&bin->aabb);
   }
 
-  /* Fill spatial bins. */
-  for (uint32_t f = 0; f < range->stack_size; ++f)
+  /* Fill spatial bins. Faces are processed in batches. We first update the
+   * entry and exit counters, which only depend on the reference AABBs. */
+  uint32_t f = face_begin;
+
+  while (f < face_end)
   {
-    const gp_bvh_face_ref* ref = &range->stack[(int32_t) f * range->stack_dir];
+    const uint32_t batch_size = imin(GP_BVH_BINNING_BATCH_SIZE, face_end - f);
+
+    const gp_bvh_face_ref* refs[GP_BVH_BINNING_BATCH_SIZE];
+
+    for (uint32_t b = 0; b < batch_size; ++b)
+    {
+      refs[b] = &range->stack[(int32_t) (f + b) * range->stack_dir];
+    }
 
     for (uint32_t axis = 0; axis < 3; ++axis)
     {
@@ -415,167 +817,606 @@ static void gp_bvh_find_split_spatial(
 
       const float bin_size = bin_sizes[axis];
 
+      int32_t start_bin_indices[GP_BVH_BINNING_BATCH_SIZE];
+      int32_t end_bin_indices[GP_BVH_BINNING_BATCH_SIZE];
+
+      for (uint32_t b = 0; b < batch_size; ++b)
+      {
+        start_bin_indices[b] = (int32_t) ((refs[b]->aabb.min[axis] - range_aabb->min[axis]) / bin_size);
+        end_bin_indices[b] = (int32_t) ((refs[b]->aabb.max[axis] - range_aabb->min[axis]) / bin_size);
+        start_bin_indices[b] = iclamp(start_bin_indices[b], 0, bin_count - 1);
+        end_bin_indices[b] = iclamp(end_bin_indices[b], 0, bin_count - 1);
+      }
+
+      for (uint32_t b = 0; b < batch_size; ++b)
+      {
+        bins[axis * bin_count + start_bin_indices[b]].entry_count++;
+        bins[axis * bin_count + end_bin_indices[b]].exit_count++;
+      }
+    }
+
+    for (uint32_t b = 0; b < batch_size; ++b)
+    {
+      const gp_bvh_face_ref* ref = refs[b];
       const gp_aabb* ref_aabb = &ref->aabb;
       const gp_face* face = &faces[ref->index];
 
-      gp_vec3 v_0;
-      gp_vec3_assign(vertices[face->v_i[2]].pos, v_0);
+      /* Fetch vertices once for all axes. */
+      gp_vec3 positions[3];
+      gp_vec3_assign(vertices[face->v_i[0]].pos, positions[0]);
+      gp_vec3_assign(vertices[face->v_i[1]].pos, positions[1]);
+      gp_vec3_assign(vertices[face->v_i[2]].pos, positions[2]);
 
-      /* Insert all three edges into bin AABBs. */
-      for (uint32_t e = 0; e < 3; ++e)
+      for (uint32_t axis = 0; axis < 3; ++axis)
       {
-        gp_vec3 v_1, v_start, v_end;
-        gp_vec3_assign(vertices[face->v_i[e]].pos, v_1);
-        gp_vec3_assign(v_0[axis] <= v_1[axis] ? v_0 : v_1, v_start);
-        gp_vec3_assign(v_0[axis] <= v_1[axis] ? v_1 : v_0, v_end);
-        gp_vec3_assign(v_1, v_0);
-
-        if (v_start[axis] > range->aabb_bounds.max[axis] ||
-            v_end[axis] < range->aabb_bounds.min[axis]) {
+        if (axis_lengths[axis] <= 0.0f) {
           continue;
         }
 
-        if (v_start[axis] < ref_aabb->min[axis])
-        {
-          const float edge_length = v_end[axis] - v_start[axis];
-          const float t_plane_rel = (ref_aabb->min[axis] - v_start[axis]) / edge_length;
-          gp_vec3_lerp(v_start, v_end, t_plane_rel, v_start);
-          v_start[axis] = ref_aabb->min[axis];
-        }
-        if (v_end[axis] > ref_aabb->max[axis])
+        const float bin_size = bin_sizes[axis];
+
+        gp_vec3 v_0;
+        gp_vec3_assign(positions[2], v_0);
+
+        /* Insert all three edges into bin AABBs. */
+        for (uint32_t e = 0; e < 3; ++e)
         {
-          const float edge_length = v_end[axis] - v_start[axis];
-          const float t_plane_rel = (ref_aabb->max[axis] - v_start[axis]) / edge_length;
-          gp_vec3_lerp(v_start, v_end, t_plane_rel, v_end);
-          v_end[axis] = ref_aabb->max[axis];
+          gp_vec3 v_1, v_start, v_end;
+          gp_vec3_assign(positions[e], v_1);
+          gp_vec3_assign(v_0[axis] <= v_1[axis] ? v_0 : v_1, v_start);
+          gp_vec3_assign(v_0[axis] <= v_1[axis] ? v_1 : v_0, v_end);
+          gp_vec3_assign(v_1, v_0);
+
+          if (v_start[axis] > range->aabb_bounds.max[axis] ||
+              v_end[axis] < range->aabb_bounds.min[axis]) {
+            continue;
+          }
+
+          if (v_start[axis] < ref_aabb->min[axis])
+          {
+            const float edge_length = v_end[axis] - v_start[axis];
+            const float t_plane_rel = (ref_aabb->min[axis] - v_start[axis]) / edge_length;
+            gp_vec3_lerp(v_start, v_end, t_plane_rel, v_start);
+            v_start[axis] = ref_aabb->min[axis];
+          }
+          if (v_end[axis] > ref_aabb->max[axis])
+          {
+            const float edge_length = v_end[axis] - v_start[axis];
+            const float t_plane_rel = (ref_aabb->max[axis] - v_start[axis]) / edge_length;
+            gp_vec3_lerp(v_start, v_end, t_plane_rel, v_end);
+            v_end[axis] = ref_aabb->max[axis];
+          }
+
+          int32_t start_bin_index = (int32_t) ((v_start[axis] - range_aabb->min[axis]) / bin_size);
+          int32_t end_bin_index = (int32_t) ((v_end[axis] - range_aabb->min[axis]) / bin_size);
+          start_bin_index = iclamp(start_bin_index, 0, bin_count - 1);
+          end_bin_index = iclamp(end_bin_index, 0, bin_count - 1);
+
+          gp_aabb* start_bin_aabb = &bins[axis * bin_count + start_bin_index].aabb;
+          gp_aabb* end_bin_aabb = &bins[axis * bin_count + end_bin_index].aabb;
+          gp_aabb_include(start_bin_aabb, v_start, start_bin_aabb);
+          gp_aabb_include(end_bin_aabb, v_end, end_bin_aabb);
+
+          if (start_bin_index == end_bin_index) {
+            continue;
+          }
+
+          /* Include bin plane intersection points in both bin AABBs. */
+          for (int32_t bin_index = start_bin_index; bin_index < end_bin_index; ++bin_index)
+          {
+            const float t_bin_end_plane = range_aabb->min[axis] + (float) (bin_index + 1) * bin_size;
+
+            gp_vec3 v_i;
+            const float edge_length = v_end[axis] - v_start[axis];
+            const float t_plane_rel = (t_bin_end_plane - v_start[axis]) / edge_length;
+            gp_vec3_lerp(v_start, v_end, t_plane_rel, v_i);
+            v_i[axis] = t_bin_end_plane;
+
+            gp_bvh_spatial_bin* this_bin = &bins[axis * bin_count + bin_index + 0];
+            gp_bvh_spatial_bin* next_bin = &bins[axis * bin_count + bin_index + 1];
+            gp_aabb_include(&this_bin->aabb, v_i, &this_bin->aabb);
+            gp_aabb_include(&next_bin->aabb, v_i, &next_bin->aabb);
+          }
         }
+      }
+    }
 
-        int32_t start_bin_index = (int32_t) ((v_start[axis] - range_aabb->min[axis]) / bin_size);
-        int32_t end_bin_index = (int32_t) ((v_end[axis] - range_aabb->min[axis]) / bin_size);
-        start_bin_index = iclamp(start_bin_index, 0, bin_count - 1);
-        end_bin_index = iclamp(end_bin_index, 0, bin_count - 1);
+    f += batch_size;
+  }
+}
 
-        gp_aabb* start_bin_aabb = &bins[axis * bin_count + start_bin_index].aabb;
-        gp_aabb* end_bin_aabb = &bins[axis * bin_count + end_bin_index].aabb;
-        gp_aabb_include(start_bin_aabb, v_start, start_bin_aabb);
-        gp_aabb_include(end_bin_aabb, v_end, end_bin_aabb);
+typedef struct gp_bvh_spatial_binning_task {
+  const gp_bvh_thread_data* thread_data;
+  const gp_bvh_work_range* range;
+  uint32_t chunk_size;
+  gp_bvh_spatial_bin* chunk_bins;
+} gp_bvh_spatial_binning_task;
 
-        if (start_bin_index == end_bin_index) {
-          continue;
-        }
+static void gp_bvh_bin_spatial_chunk(void* data, uint32_t chunk_index)
+{
+  const gp_bvh_spatial_binning_task* task = (const gp_bvh_spatial_binning_task*) data;
+  const uint32_t bin_count = task->thread_data->params->spatial_bin_count;
+  const uint32_t stack_size = task->range->stack_size;
+  const uint32_t face_begin = imin(chunk_index * task->chunk_size, stack_size);
+  const uint32_t face_end = imin(face_begin + task->chunk_size, stack_size);
+
+  gp_bvh_bin_spatial(
+    task->thread_data,
+    task->range,
+    face_begin,
+    face_end,
+    &task->chunk_bins[chunk_index * bin_count * 3]
+  );
+}
 
-        /* Include bin plane intersection points in both bin AABBs. */
-        for (int32_t bin_index = start_bin_index; bin_index < end_bin_index; ++bin_index)
-        {
-          const float t_bin_end_plane = range_aabb->min[axis] + (float) (bin_index + 1) * bin_size;
-
-          gp_vec3 v_i;
-          const float edge_length = v_end[axis] - v_start[axis];
-          const float t_plane_rel = (t_bin_end_plane - v_start[axis]) / edge_length;
-          gp_vec3_lerp(v_start, v_end, t_plane_rel, v_i);
-          v_i[axis] = t_bin_end_plane;
-
-          gp_bvh_spatial_bin* this_bin = &bins[axis * bin_count + bin_index + 0];
-          gp_bvh_spatial_bin* next_bin = &bins[axis * bin_count + bin_index + 1];
-          gp_aabb_include(&this_bin->aabb, v_i, &this_bin->aabb);
-          gp_aabb_include(&next_bin->aabb, v_i, &next_bin->aabb);
-        }
+static void gp_bvh_bin_spatial_parallel(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range,
+  gp_bvh_spatial_bin* bins)
+{
+  const uint32_t bin_count = thread_data->params->spatial_bin_count;
+  const uint32_t chunk_count = thread_data->context->thread_count * GP_BVH_CHUNKS_PER_THREAD;
+
+  gp_bvh_spatial_binning_task task;
+  task.thread_data = thread_data;
+  task.range = range;
+  task.chunk_size = gp_bvh_calc_chunk_size(thread_data, range);
+  task.chunk_bins = (gp_bvh_spatial_bin*) malloc(chunk_count * bin_count * 3 * sizeof(gp_bvh_spatial_bin));
+
+  gp_bvh_parallel_for(thread_data, chunk_count, gp_bvh_bin_spatial_chunk, &task);
+
+  /* Reduce private bins. */
+  for (uint32_t i = 0; i < bin_count * 3; ++i)
+  {
+    gp_bvh_spatial_bin* bin = &bins[i];
+    *bin = task.chunk_bins[i];
+
+    for (uint32_t c = 1; c < chunk_count; ++c)
+    {
+      const gp_bvh_spatial_bin* chunk_bin = &task.chunk_bins[c * bin_count * 3 + i];
+      gp_aabb_merge(&bin->aabb, &chunk_bin->aabb, &bin->aabb);
+      bin->entry_count += chunk_bin->entry_count;
+      bin->exit_count += chunk_bin->exit_count;
+    }
+  }
+
+  free(task.chunk_bins);
+}
+
+static void gp_bvh_find_split_spatial(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_range* range,
+  gp_bvh_split_spatial* split)
+{
+  gp_bvh_spatial_bin* bins = (gp_bvh_spatial_bin*) thread_data->reused_bins;
+  const uint32_t bin_count = thread_data->params->spatial_bin_count;
+
+  gp_vec3 axis_lengths;
+  gp_aabb_size(&range->aabb_bounds, axis_lengths);
+
+  if (gp_bvh_is_parallel_range(thread_data, range))
+  {
+    gp_bvh_bin_spatial_parallel(thread_data, range, bins);
+  }
+  else
+  {
+    gp_bvh_bin_spatial(thread_data, range, 0, range->stack_size, bins);
+  }
+
+  /* Evaluate split planes. */
+  float best_sah_cost = INFINITY;
+  float best_tie_break = INFINITY;
+
+  gp_aabb left_accum;
+  gp_aabb right_accum;
+
+  for (uint32_t axis = 0; axis < 3; ++axis)
+  {
+    if (axis_lengths[axis] <= 0.0f) {
+      continue;
+    }
+
+    /* Sweep from right to left. */
+    gp_aabb_make_smallest(&right_accum);
+
+    for (int32_t r = bin_count - 1; r > 0; --r)
+    {
+      const gp_bvh_spatial_bin* bin = &bins[axis * bin_count + r];
+      gp_aabb_merge(&right_accum, &bin->aabb, &right_accum);
+      thread_data->reused_aabbs[r - 1] = right_accum;
+    }
+
+    /* Sweep from left to right. */
+    gp_aabb_make_smallest(&left_accum);
+
+    uint32_t left_face_count = 0;
+    uint32_t right_face_count = range->stack_size;
+
+    for (uint32_t l = 1; l < bin_count; ++l)
+    {
+      const gp_bvh_spatial_bin* bin = &bins[axis * bin_count + l - 1];
+      gp_aabb_merge(&left_accum, &bin->aabb, &left_accum);
+
+      left_face_count += bin->entry_count;
+      right_face_count -= bin->exit_count;
+
+      /* Ignore invalid splits. */
+      if (left_face_count == 0 || right_face_count == 0) {
+        continue;
       }
 
-      /* Increment entry and exit counters. */
-      int32_t start_bin_index = (int32_t) ((ref->aabb.min[axis] - range_aabb->min[axis]) / bin_size);
-      int32_t end_bin_index = (int32_t) ((ref->aabb.max[axis] - range_aabb->min[axis]) / bin_size);
-      start_bin_index = iclamp(start_bin_index, 0, bin_count - 1);
-      end_bin_index = iclamp(end_bin_index, 0, bin_count - 1);
+      /* Calculate SAH cost. */
+      const float area_l = gp_aabb_half_area(&left_accum);
+      const float area_r = gp_aabb_half_area(&thread_data->reused_aabbs[l - 1]);
+
+      const float sah_cost =
+        gp_bvh_calc_face_intersection_cost(
+          thread_data->params->face_intersection_cost,
+          thread_data->params->face_batch_size,
+          left_face_count
+        ) * area_l +
+        gp_bvh_calc_face_intersection_cost(
+          thread_data->params->face_intersection_cost,
+          thread_data->params->face_batch_size,
+          right_face_count
+        ) * area_r;
+
+      /* Abort if cost is higher than best split. */
+      if (sah_cost > best_sah_cost)
+      {
+        continue;
+      }
+
+      /* When SAH is equal, prefer equal face distribution. */
+      const float tie_break = sqrtf((float)left_face_count) + sqrtf((float)right_face_count);
+
+      if (sah_cost == best_sah_cost && tie_break > best_tie_break)
+      {
+        continue;
+      }
+
+      /* Set new best split candidate. */
+      split->sah_cost = sah_cost;
+      split->axis = axis;
+      split->bin_index = l;
+      split->left_face_count = left_face_count;
+      split->right_face_count = right_face_count;
+
+      best_sah_cost = sah_cost;
+      best_tie_break = tie_break;
+    }
+  }
+}
+
+
+static void gp_bvh_chop_ref_spatial(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_split_spatial* split,
+  const gp_bvh_work_range* range,
+  float bin_size,
+  const gp_bvh_face_ref* ref,
+  gp_aabb* left_aabb,
+  gp_aabb* right_aabb)
+{
+  const gp_vertex* vertices = thread_data->params->vertices;
+  const gp_face* faces = thread_data->params->faces;
+  const uint32_t axis = split->axis;
+
+  const gp_aabb* ref_aabb = &ref->aabb;
+  const gp_face* face = &faces[ref->index];
+
+  /* Split all edges on the split plane and get AABBs for both sides. */
+
+  gp_aabb_make_smallest(left_aabb);
+  gp_aabb_make_smallest(right_aabb);
+
+  gp_vec3 v_0;
+  gp_vec3_assign(vertices[face->v_i[2]].pos, v_0);
+
+  for (uint32_t e = 0; e < 3; ++e)
+  {
+    gp_vec3 v_1, v_start, v_end;
+    gp_vec3_assign(vertices[face->v_i[e]].pos, v_1);
+    gp_vec3_assign(v_0[split->axis] <= v_1[split->axis] ? v_0 : v_1, v_start);
+    gp_vec3_assign(v_0[split->axis] <= v_1[split->axis] ? v_1 : v_0, v_end);
+    gp_vec3_assign(v_1, v_0);
+
+    /* Cull and chop edge. */
+
+    if (v_start[split->axis] > range->aabb_bounds.max[split->axis] ||
+        v_end[split->axis] < range->aabb_bounds.min[split->axis]) {
+      continue;
+    }
+
+    if (v_start[axis] < ref_aabb->min[axis])
+    {
+      const float edge_length = v_end[axis] - v_start[axis];
+      const float t_plane_rel = (ref_aabb->min[axis] - v_start[axis]) / edge_length;
+      gp_vec3_lerp(v_start, v_end, t_plane_rel, v_start);
+      v_start[axis] = ref_aabb->min[axis];
+    }
+    if (v_end[axis] > ref_aabb->max[axis])
+    {
+      const float edge_length = v_end[axis] - v_start[axis];
+      const float t_plane_rel = (ref_aabb->max[axis] - v_start[axis]) / edge_length;
+      gp_vec3_lerp(v_start, v_end, t_plane_rel, v_end);
+      v_end[axis] = ref_aabb->max[axis];
+    }
+
+    /* Fill left and right AABBs. */
+
+    const float t_plane = range->aabb_bounds.min[axis] + split->bin_index * bin_size;
+
+    if (v_start[axis] <= t_plane) { gp_aabb_include(left_aabb, v_start, left_aabb); }
+    if (v_start[axis] >= t_plane) { gp_aabb_include(right_aabb, v_start, right_aabb); }
+    if (v_end[axis] <= t_plane) { gp_aabb_include(left_aabb, v_end, left_aabb); }
+    if (v_end[axis] >= t_plane) { gp_aabb_include(right_aabb, v_end, right_aabb); }
+
+    /* Continue if there is no plane intersection. */
+    if (t_plane < v_start[axis] || t_plane > v_end[axis] ||
+        (t_plane == v_start[axis] && t_plane == v_end[axis])) {
+      continue;
+    }
+
+    /* Otherwise, split into two halves. */
+
+    const float edge_length = v_end[axis] - v_start[axis];
+    const float t_plane_abs = t_plane - v_start[axis];
+    const float t_plane_rel = (t_plane_abs / edge_length);
+
+    gp_vec3 v_i;
+    gp_vec3_lerp(v_start, v_end, t_plane_rel, v_i);
+    v_i[axis] = t_plane;
+
+    gp_aabb_include(left_aabb, v_i, left_aabb);
+    gp_aabb_include(right_aabb, v_i, right_aabb);
+  }
+
+  gp_aabb_intersect(left_aabb, &ref->aabb, left_aabb);
+  gp_aabb_intersect(right_aabb, &ref->aabb, right_aabb);
+}
+
+GP_INLINE static void gp_bvh_classify_ref_spatial(
+  const gp_bvh_split_spatial* split,
+  const gp_bvh_work_range* range,
+  uint32_t bin_count,
+  float bin_size,
+  const gp_bvh_face_ref* ref,
+  bool* is_in_left,
+  bool* is_in_right)
+{
+  const uint32_t axis = split->axis;
+
+  int32_t start_bin_index = (int32_t) ((ref->aabb.min[axis] - range->aabb_bounds.min[axis]) / bin_size);
+  int32_t end_bin_index = (int32_t) ((ref->aabb.max[axis] - range->aabb_bounds.min[axis]) / bin_size);
+  start_bin_index = iclamp(start_bin_index, 0, bin_count - 1);
+  end_bin_index = iclamp(end_bin_index, 0, bin_count - 1);
+
+  *is_in_left = start_bin_index < split->bin_index;
+  *is_in_right = end_bin_index >= split->bin_index;
+}
+
+GP_INLINE static bool gp_bvh_classify_ref_object_binned(
+  const gp_bvh_split_object_binned* split,
+  const gp_bvh_work_range* range,
+  uint32_t bin_count,
+  float k1,
+  const gp_vec3 centroid)
+{
+  const uint32_t bin_index = (uint32_t) iclamp(
+    (int32_t) (k1 * (centroid[split->axis] - range->centroid_bounds.min[split->axis])),
+    0,
+    (int32_t) (bin_count - 1)
+  );
+
+  return bin_index < split->bin_index;
+}
+
+/*
+ * Large ranges are partitioned in parallel. In contrast to the serial
+ * in-place partitioning, references are first copied out of the range
+ * and counted per chunk. After a prefix sum, each chunk scatters its
+ * references back to the inwards-growing child ranges. Both splitting
+ * functions share this code; exactly one of the split pointers is set.
+ */
+typedef struct gp_bvh_partition_task {
+  const gp_bvh_thread_data* thread_data;
+  const gp_bvh_work_range* range;
+  const gp_bvh_split_object_binned* split_object_binned;
+  const gp_bvh_split_spatial* split_spatial;
+  uint32_t bin_count;
+  float bin_scale;
+  uint32_t chunk_size;
+  gp_bvh_face_ref* refs;
+  /* Per chunk: left and right reference counts or offsets. */
+  uint32_t* chunk_offsets;
+  /* Per chunk: AABB and centroid bounds of the left and right child. */
+  gp_aabb* chunk_bounds;
+} gp_bvh_partition_task;
+
+GP_INLINE static void gp_bvh_classify_ref(
+  const gp_bvh_partition_task* task,
+  const gp_bvh_face_ref* ref,
+  bool* is_in_left,
+  bool* is_in_right)
+{
+  if (task->split_spatial)
+  {
+    gp_bvh_classify_ref_spatial(
+      task->split_spatial, task->range, task->bin_count, task->bin_scale, ref, is_in_left, is_in_right);
+    return;
+  }
+
+  gp_vec3 centroid;
+  gp_vec3_add(ref->aabb.min, ref->aabb.max, centroid);
+  gp_vec3_muls(centroid, 0.5f, centroid);
+
+  *is_in_left = gp_bvh_classify_ref_object_binned(
+    task->split_object_binned, task->range, task->bin_count, task->bin_scale, centroid);
+  *is_in_right = !*is_in_left;
+}
+
+static void gp_bvh_partition_count_chunk(void* data, uint32_t chunk_index)
+{
+  const gp_bvh_partition_task* task = (const gp_bvh_partition_task*) data;
+  const gp_bvh_work_range* range = task->range;
+  const uint32_t face_begin = imin(chunk_index * task->chunk_size, range->stack_size);
+  const uint32_t face_end = imin(face_begin + task->chunk_size, range->stack_size);
+
+  uint32_t left_count = 0;
+  uint32_t right_count = 0;
+
+  for (uint32_t i = face_begin; i < face_end; ++i)
+  {
+    const gp_bvh_face_ref* ref = &range->stack[(int32_t)i * range->stack_dir];
+    task->refs[i] = *ref;
+
+    bool is_in_left, is_in_right;
+    gp_bvh_classify_ref(task, ref, &is_in_left, &is_in_right);
 
-      bins[axis * bin_count + start_bin_index].entry_count++;
-      bins[axis * bin_count + end_bin_index].exit_count++;
-    }
+    left_count += is_in_left ? 1 : 0;
+    right_count += is_in_right ? 1 : 0;
   }
 
-  /* Evaluate split planes. */
-  float best_sah_cost = INFINITY;
-  float best_tie_break = INFINITY;
+  task->chunk_offsets[chunk_index * 2 + 0] = left_count;
+  task->chunk_offsets[chunk_index * 2 + 1] = right_count;
+}
 
-  gp_aabb left_accum;
-  gp_aabb right_accum;
+GP_INLINE static void gp_bvh_partition_emit_ref(
+  gp_bvh_face_ref* dst_ref,
+  uint32_t index,
+  const gp_aabb* aabb,
+  gp_aabb* aabb_bounds,
+  gp_aabb* centroid_bounds)
+{
+  dst_ref->index = index;
+  dst_ref->aabb = *aabb;
 
-  for (uint32_t axis = 0; axis < 3; ++axis)
+  gp_aabb_merge(aabb_bounds, aabb, aabb_bounds);
+
+  gp_vec3 centroid;
+  gp_vec3_add(aabb->min, aabb->max, centroid);
+  gp_vec3_muls(centroid, 0.5f, centroid);
+  gp_aabb_include(centroid_bounds, centroid, centroid_bounds);
+}
+
+static void gp_bvh_partition_scatter_chunk(void* data, uint32_t chunk_index)
+{
+  const gp_bvh_partition_task* task = (const gp_bvh_partition_task*) data;
+  const gp_bvh_work_range* range = task->range;
+  const uint32_t face_begin = imin(chunk_index * task->chunk_size, range->stack_size);
+  const uint32_t face_end = imin(face_begin + task->chunk_size, range->stack_size);
+
+  /* Left references grow from the origin of the parent stack,
+   * right references from its limit. */
+  uint32_t left_offset = task->chunk_offsets[chunk_index * 2 + 0];
+  uint32_t right_offset = task->chunk_offsets[chunk_index * 2 + 1];
+
+  gp_aabb* bounds = &task->chunk_bounds[chunk_index * 4];
+  for (uint32_t i = 0; i < 4; ++i) {
+    gp_aabb_make_smallest(&bounds[i]);
+  }
+
+  for (uint32_t i = face_begin; i < face_end; ++i)
   {
-    if (axis_lengths[axis] <= 0.0f) {
-      continue;
-    }
+    const gp_bvh_face_ref* ref = &task->refs[i];
 
-    /* Sweep from right to left. */
-    gp_aabb_make_smallest(&right_accum);
+    bool is_in_left, is_in_right;
+    gp_bvh_classify_ref(task, ref, &is_in_left, &is_in_right);
 
-    for (int32_t r = bin_count - 1; r > 0; --r)
+    gp_aabb left_aabb = ref->aabb;
+    gp_aabb right_aabb = ref->aabb;
+
+    if (task->split_spatial)
     {
-      const gp_bvh_spatial_bin* bin = &bins[axis * bin_count + r];
-      gp_aabb_merge(&right_accum, &bin->aabb, &right_accum);
-      thread_data->reused_aabbs[r - 1] = right_accum;
+      gp_bvh_chop_ref_spatial(
+        task->thread_data, task->split_spatial, range, task->bin_scale, ref, &left_aabb, &right_aabb);
     }
 
-    /* Sweep from left to right. */
-    gp_aabb_make_smallest(&left_accum);
+    if (is_in_left)
+    {
+      gp_bvh_face_ref* dst_ref = &range->stack[(int32_t) left_offset * range->stack_dir];
+      gp_bvh_partition_emit_ref(dst_ref, ref->index, &left_aabb, &bounds[0], &bounds[1]);
+      left_offset++;
+    }
+    if (is_in_right)
+    {
+      const int32_t dst_index = (int32_t) (range->stack_size_limit - 1 - right_offset);
+      gp_bvh_face_ref* dst_ref = &range->stack[dst_index * range->stack_dir];
+      gp_bvh_partition_emit_ref(dst_ref, ref->index, &right_aabb, &bounds[2], &bounds[3]);
+      right_offset++;
+    }
+  }
+}
 
-    uint32_t left_face_count = 0;
-    uint32_t right_face_count = range->stack_size;
+static void gp_bvh_partition_parallel(
+  gp_bvh_partition_task* task,
+  gp_bvh_work_range* range_left,
+  gp_bvh_work_range* range_right)
+{
+  const gp_bvh_thread_data* thread_data = task->thread_data;
+  const gp_bvh_work_range* range = task->range;
+  const uint32_t chunk_count = thread_data->context->thread_count * GP_BVH_CHUNKS_PER_THREAD;
 
-    for (uint32_t l = 1; l < bin_count; ++l)
-    {
-      const gp_bvh_spatial_bin* bin = &bins[axis * bin_count + l - 1];
-      gp_aabb_merge(&left_accum, &bin->aabb, &left_accum);
+  task->chunk_size = gp_bvh_calc_chunk_size(thread_data, range);
+  task->refs = (gp_bvh_face_ref*) malloc(range->stack_size * sizeof(gp_bvh_face_ref));
+  task->chunk_offsets = (uint32_t*) malloc(chunk_count * 2 * sizeof(uint32_t));
+  task->chunk_bounds = (gp_aabb*) malloc(chunk_count * 4 * sizeof(gp_aabb));
 
-      left_face_count += bin->entry_count;
-      right_face_count -= bin->exit_count;
+  gp_bvh_parallel_for(thread_data, chunk_count, gp_bvh_partition_count_chunk, task);
 
-      /* Ignore invalid splits. */
-      if (left_face_count == 0 || right_face_count == 0) {
-        continue;
-      }
+  /* Turn counts into offsets. */
+  uint32_t left_count = 0;
+  uint32_t right_count = 0;
 
-      /* Calculate SAH cost. */
-      const float area_l = gp_aabb_half_area(&left_accum);
-      const float area_r = gp_aabb_half_area(&thread_data->reused_aabbs[l - 1]);
+  for (uint32_t c = 0; c < chunk_count; ++c)
+  {
+    const uint32_t chunk_left_count = task->chunk_offsets[c * 2 + 0];
+    const uint32_t chunk_right_count = task->chunk_offsets[c * 2 + 1];
+    task->chunk_offsets[c * 2 + 0] = left_count;
+    task->chunk_offsets[c * 2 + 1] = right_count;
+    left_count += chunk_left_count;
+    right_count += chunk_right_count;
+  }
 
-      const float sah_cost =
-        gp_bvh_calc_face_intersection_cost(
-          thread_data->params->face_intersection_cost,
-          thread_data->params->face_batch_size,
-          left_face_count
-        ) * area_l +
-        gp_bvh_calc_face_intersection_cost(
-          thread_data->params->face_intersection_cost,
-          thread_data->params->face_batch_size,
-          right_face_count
-        ) * area_r;
+  assert((left_count + right_count) <= range->stack_size_limit);
 
-      /* Abort if cost is higher than best split. */
-      if (sah_cost > best_sah_cost)
-      {
-        continue;
-      }
+  gp_bvh_parallel_for(thread_data, chunk_count, gp_bvh_partition_scatter_chunk, task);
 
-      /* When SAH is equal, prefer equal face distribution. */
-      const float tie_break = sqrtf((float)left_face_count) + sqrtf((float)right_face_count);
+  /* Set up child ranges. Unlike in the serial partitioning, the left child
+   * always occupies the side close to the origin of the parent stack. */
 
-      if (sah_cost == best_sah_cost && tie_break > best_tie_break)
-      {
-        continue;
-      }
+  range_left->stack_dir = range->stack_dir;
+  range_left->stack = range->stack;
+  range_left->stack_size = left_count;
+  gp_aabb_make_smallest(&range_left->aabb_bounds);
+  gp_aabb_make_smallest(&range_left->centroid_bounds);
 
-      /* Set new best split candidate. */
-      split->sah_cost = sah_cost;
-      split->axis = axis;
-      split->bin_index = l;
-      split->left_face_count = left_face_count;
-      split->right_face_count = right_face_count;
+  range_right->stack_dir = range->stack_dir * -1;
+  range_right->stack = range->stack + range->stack_dir * ((int32_t) range->stack_size_limit - 1);
+  range_right->stack_size = right_count;
+  gp_aabb_make_smallest(&range_right->aabb_bounds);
+  gp_aabb_make_smallest(&range_right->centroid_bounds);
 
-      best_sah_cost = sah_cost;
-      best_tie_break = tie_break;
-    }
+  for (uint32_t c = 0; c < chunk_count; ++c)
+  {
+    const gp_aabb* bounds = &task->chunk_bounds[c * 4];
+    gp_aabb_merge(&range_left->aabb_bounds, &bounds[0], &range_left->aabb_bounds);
+    gp_aabb_merge(&range_left->centroid_bounds, &bounds[1], &range_left->centroid_bounds);
+    gp_aabb_merge(&range_right->aabb_bounds, &bounds[2], &range_right->aabb_bounds);
+    gp_aabb_merge(&range_right->centroid_bounds, &bounds[3], &range_right->centroid_bounds);
   }
+
+  /* Assign stack limits. */
+
+  const int32_t free_face_count = range->stack_size_limit - (left_count + right_count);
+  const int32_t half_free_face_count = free_face_count / 2;
+  range_left->stack_size_limit = range_left->stack_size + half_free_face_count;
+  range_right->stack_size_limit = range_right->stack_size + (free_face_count - half_free_face_count);
+
+  free(task->refs);
+  free(task->chunk_offsets);
+  free(task->chunk_bounds);
 }
 
 static void gp_bvh_do_split_spatial(
@@ -589,14 +1430,27 @@ static void gp_bvh_do_split_spatial(
   const float axis_length = range->aabb_bounds.max[split->axis] - range->aabb_bounds.min[split->axis];
   const float bin_size = axis_length / bin_count;
 
-  const gp_vertex* vertices = thread_data->params->vertices;
-  const gp_face* faces = thread_data->params->faces;
-  const uint32_t axis = split->axis;
-
   const int32_t split_face_count = split->left_face_count + split->right_face_count;
   const int32_t free_face_count = range->stack_size_limit - split_face_count;
   assert(free_face_count >= 0);
 
+  if (gp_bvh_is_parallel_range(thread_data, range))
+  {
+    gp_bvh_partition_task task;
+    task.thread_data = thread_data;
+    task.range = range;
+    task.split_object_binned = NULL;
+    task.split_spatial = split;
+    task.bin_count = bin_count;
+    task.bin_scale = bin_size;
+
+    gp_bvh_partition_parallel(&task, range_left, range_right);
+
+    assert(range_left->stack_size == split->left_face_count);
+    assert(range_right->stack_size == split->right_face_count);
+    return;
+  }
+
   gp_bvh_work_range* range1 = range->stack_dir == 1 ? range_left : range_right;
   gp_bvh_work_range* range2 = range->stack_dir == 1 ? range_right : range_left;
 
@@ -621,90 +1475,14 @@ static void gp_bvh_do_split_spatial(
     /* Note that this reference is not const! It will be changed. */
     gp_bvh_face_ref* ref = &range->stack[range1_index_start * range->stack_dir];
 
-    const gp_aabb* ref_aabb = &ref->aabb;
-    const gp_face* face = &faces[ref->index];
-
-    /* Split all edges on the split plane and get AABBs for both sides. */
-
     gp_aabb left_aabb;
     gp_aabb right_aabb;
-    gp_aabb_make_smallest(&left_aabb);
-    gp_aabb_make_smallest(&right_aabb);
-
-    gp_vec3 v_0;
-    gp_vec3_assign(vertices[face->v_i[2]].pos, v_0);
-
-    for (uint32_t e = 0; e < 3; ++e)
-    {
-      gp_vec3 v_1, v_start, v_end;
-      gp_vec3_assign(vertices[face->v_i[e]].pos, v_1);
-      gp_vec3_assign(v_0[split->axis] <= v_1[split->axis] ? v_0 : v_1, v_start);
-      gp_vec3_assign(v_0[split->axis] <= v_1[split->axis] ? v_1 : v_0, v_end);
-      gp_vec3_assign(v_1, v_0);
-
-      /* Cull and chop edge. */
-
-      if (v_start[split->axis] > range->aabb_bounds.max[split->axis] ||
-          v_end[split->axis] < range->aabb_bounds.min[split->axis]) {
-        continue;
-      }
-
-      if (v_start[axis] < ref_aabb->min[axis])
-      {
-        const float edge_length = v_end[axis] - v_start[axis];
-        const float t_plane_rel = (ref_aabb->min[axis] - v_start[axis]) / edge_length;
-        gp_vec3_lerp(v_start, v_end, t_plane_rel, v_start);
-        v_start[axis] = ref_aabb->min[axis];
-      }
-      if (v_end[axis] > ref_aabb->max[axis])
-      {
-        const float edge_length = v_end[axis] - v_start[axis];
-        const float t_plane_rel = (ref_aabb->max[axis] - v_start[axis]) / edge_length;
-        gp_vec3_lerp(v_start, v_end, t_plane_rel, v_end);
-        v_end[axis] = ref_aabb->max[axis];
-      }
-
-      /* Fill left and right AABBs. */
-
-      const float t_plane = range->aabb_bounds.min[axis] + split->bin_index * bin_size;
-
-      if (v_start[axis] <= t_plane) { gp_aabb_include(&left_aabb, v_start, &left_aabb); }
-      if (v_start[axis] >= t_plane) { gp_aabb_include(&right_aabb, v_start, &right_aabb); }
-      if (v_end[axis] <= t_plane) { gp_aabb_include(&left_aabb, v_end, &left_aabb); }
-      if (v_end[axis] >= t_plane) { gp_aabb_include(&right_aabb, v_end, &right_aabb); }
-
-      /* Continue if there is no plane intersection. */
-      if (t_plane < v_start[axis] || t_plane > v_end[axis] ||
-          (t_plane == v_start[axis] && t_plane == v_end[axis])) {
-        continue;
-      }
-
-      /* Otherwise, split into two halves. */
-
-      const float edge_length = v_end[axis] - v_start[axis];
-      const float t_plane_abs = t_plane - v_start[axis];
-      const float t_plane_rel = (t_plane_abs / edge_length);
-
-      gp_vec3 v_i;
-      gp_vec3_lerp(v_start, v_end, t_plane_rel, v_i);
-      v_i[axis] = t_plane;
-
-      gp_aabb_include(&left_aabb, v_i, &left_aabb);
-      gp_aabb_include(&right_aabb, v_i, &right_aabb);
-    }
-
-    gp_aabb_intersect(&left_aabb, &ref->aabb, &left_aabb);
-    gp_aabb_intersect(&right_aabb, &ref->aabb, &right_aabb);
+    gp_bvh_chop_ref_spatial(thread_data, split, range, bin_size, ref, &left_aabb, &right_aabb);
 
     /* Now that we have both side AABBs, we do the actual partitioning. */
 
-    int32_t start_bin_index = (int32_t) ((ref->aabb.min[axis] - range->aabb_bounds.min[axis]) / bin_size);
-    int32_t end_bin_index = (int32_t) ((ref->aabb.max[axis] - range->aabb_bounds.min[axis]) / bin_size);
-    start_bin_index = iclamp(start_bin_index, 0, bin_count - 1);
-    end_bin_index = iclamp(end_bin_index, 0, bin_count - 1);
-
-    const bool is_in_left = start_bin_index < split->bin_index;
-    const bool is_in_right = end_bin_index >= split->bin_index;
+    bool is_in_left, is_in_right;
+    gp_bvh_classify_ref_spatial(split, range, bin_count, bin_size, ref, &is_in_left, &is_in_right);
 
     const bool is_in_range1 = (range->stack_dir == 1 && is_in_left) || (range->stack_dir == -1 && is_in_right);
     const bool is_in_range2 = (range->stack_dir == 1 && is_in_right) || (range->stack_dir == -1 && is_in_left);
@@ -909,6 +1687,30 @@ static void gp_bvh_do_split_object_binned(
 {
   /* See non-binned object splitting for a general algorithm description. */
 
+  const uint32_t bin_count = gp_bvh_calc_object_bin_count(thread_data, range);
+
+  const float axis_length =
+    range->centroid_bounds.max[split->axis] - range->centroid_bounds.min[split->axis];
+
+  const float k1 = bin_count / axis_length;
+
+  if (gp_bvh_is_parallel_range(thread_data, range))
+  {
+    gp_bvh_partition_task task;
+    task.thread_data = thread_data;
+    task.range = range;
+    task.split_object_binned = split;
+    task.split_spatial = NULL;
+    task.bin_count = bin_count;
+    task.bin_scale = k1;
+
+    gp_bvh_partition_parallel(&task, range_left, range_right);
+
+    assert(range_left->stack_size > 0);
+    assert(range_right->stack_size > 0);
+    return;
+  }
+
   gp_bvh_work_range* range1 = range->stack_dir == 1 ? range_left : range_right;
   gp_bvh_work_range* range2 = range->stack_dir == 1 ? range_right : range_left;
 
@@ -930,22 +1732,6 @@ static void gp_bvh_do_split_object_binned(
   gp_aabb_make_smallest(&range2->aabb_bounds);
   gp_aabb_make_smallest(&range2->centroid_bounds);
 
-  /* Precalculate values. */
-
-  const float axis_length =
-    range->centroid_bounds.max[split->axis] - range->centroid_bounds.min[split->axis];
-
-  uint32_t bin_count;
-  if (thread_data->params->object_binning_mode == GP_BVH_BINNING_MODE_ADAPTIVE) {
-    bin_count = iclamp((int32_t) (range->stack_size * 0.05f + 4.0f), 0,
-                       (int32_t) thread_data->params->object_bin_count);
-  }
-  else {
-    bin_count = thread_data->params->object_bin_count;
-  }
-
-  const float k1 = bin_count / axis_length;
-
   const bool stack_dir_pos = range->stack_dir == +1;
   const bool stack_dir_neg = range->stack_dir == -1;
 
@@ -965,15 +1751,11 @@ static void gp_bvh_do_split_object_binned(
     gp_vec3_add(ref->aabb.min, ref->aabb.max, centroid);
     gp_vec3_muls(centroid, 0.5f, centroid);
 
-    const uint32_t bin_index = (uint32_t) iclamp(
-      (int32_t) (k1 * (centroid[split->axis] - range->centroid_bounds.min[split->axis])),
-      0,
-      (int32_t) (bin_count - 1)
-    );
+    const bool is_in_left =
+      gp_bvh_classify_ref_object_binned(split, range, bin_count, k1, centroid);
 
     const bool is_in_range1 =
-      (stack_dir_pos && bin_index < split->bin_index) ||
-      (stack_dir_neg && bin_index >= split->bin_index);
+      (stack_dir_pos && is_in_left) || (stack_dir_neg && !is_in_left);
 
     /* Handle face being in the close range. This partitioning algorithm
      * is essentially the same as in the non-binned object split. */
@@ -1156,12 +1938,18 @@ static bool gp_bvh_build_work_range(
 
     /* Fall back to reserve buffer if no space is left in range. This is usually only the case
      * for ranges with few faces. Therefore it does not make sense to allocate more than needed. */
-    free_face_count = *thread_data->reserve_buffer_capacity;
+    free_face_count = atomic_load(thread_data->reserve_buffer_capacity);
 
-    if (free_face_count >= split_face_count)
+    while (free_face_count >= split_face_count &&
+           !atomic_compare_exchange_weak(thread_data->reserve_buffer_capacity,
+                                         &free_face_count,
+                                         free_face_count - split_face_count))
     {
-      *thread_data->reserve_buffer_capacity -= split_face_count;
+      /* Another thread claimed reserve memory in the meantime, retry. */
+    }
 
+    if (free_face_count >= split_face_count)
+    {
       gp_bvh_work_range reserve_range;
       reserve_range.stack = &thread_data->reserve_buffer[free_face_count - split_face_count];
       reserve_range.stack_dir = 1;
@@ -1210,6 +1998,178 @@ static bool gp_bvh_build_work_range(
   return true;
 }
 
+static void gp_bvh_push_job(
+  gp_bvh_job_deque* deque,
+  const gp_bvh_work_job* job)
+{
+  gp_mutex_lock(deque->mutex);
+
+  if (deque->tail == deque->capacity)
+  {
+    /* Reclaim stolen slots at the front first, grow otherwise. */
+    if (deque->head > 0)
+    {
+      memmove(
+        deque->jobs,
+        &deque->jobs[deque->head],
+        (deque->tail - deque->head) * sizeof(gp_bvh_work_job)
+      );
+      deque->tail -= deque->head;
+      deque->head = 0;
+    }
+    else
+    {
+      deque->capacity *= 2;
+      deque->jobs = (gp_bvh_work_job*) realloc(deque->jobs, deque->capacity * sizeof(gp_bvh_work_job));
+    }
+  }
+
+  deque->jobs[deque->tail] = *job;
+  deque->tail++;
+
+  gp_mutex_unlock(deque->mutex);
+}
+
+static bool gp_bvh_pop_job(
+  gp_bvh_job_deque* deque,
+  bool steal,
+  gp_bvh_work_job* job)
+{
+  gp_mutex_lock(deque->mutex);
+
+  const bool is_empty = (deque->head == deque->tail);
+
+  if (!is_empty)
+  {
+    if (steal)
+    {
+      *job = deque->jobs[deque->head];
+      deque->head++;
+    }
+    else
+    {
+      deque->tail--;
+      *job = deque->jobs[deque->tail];
+    }
+
+    if (deque->head == deque->tail)
+    {
+      deque->head = 0;
+      deque->tail = 0;
+    }
+  }
+
+  gp_mutex_unlock(deque->mutex);
+
+  return !is_empty;
+}
+
+static void gp_bvh_process_job(
+  const gp_bvh_thread_data* thread_data,
+  const gp_bvh_work_job* job)
+{
+  gp_bvh_build_context* context = thread_data->context;
+  const gp_bvh_build_params* params = thread_data->params;
+  gp_bvh* bvh = context->bvh;
+
+  gp_bvh_work_range left_range;
+  gp_bvh_work_range right_range;
+
+  const bool make_leaf = !gp_bvh_build_work_range(
+    thread_data,
+    &job->range,
+    &left_range,
+    &right_range
+  );
+
+  gp_bvh_node* node = &bvh->nodes[job->node_index];
+
+  node->aabb = job->range.aabb_bounds;
+
+  /* We did not split the range, make a leaf instead. */
+  if (make_leaf)
+  {
+    const uint32_t face_offset = atomic_fetch_add(&context->face_count, job->range.stack_size);
+
+    node->field1 = face_offset;
+    node->field2 = 0x80000000 | job->range.stack_size;
+
+    /* Resolve face references and write them into the bvh. */
+    for (uint32_t i = 0; i < job->range.stack_size; ++i)
+    {
+      const gp_bvh_face_ref* ref = &job->range.stack[(int32_t)i * job->range.stack_dir];
+      const gp_face* face = &params->faces[ref->index];
+      bvh->faces[face_offset + i] = *face;
+    }
+
+    return;
+  }
+
+  /* Otherwise, create two new nodes. */
+  const uint32_t child_index = atomic_fetch_add(&context->node_count, 2);
+  node->field1 = child_index + 0;
+  node->field2 = child_index + 1;
+
+  /* Enqueue new subranges. Both are accounted for before the
+   * current job is retired, so that no thread exits early. */
+  atomic_fetch_add(&context->pending_job_count, 2);
+
+  gp_bvh_job_deque* deque = &context->job_deques[thread_data->thread_index];
+
+  gp_bvh_work_job left_job;
+  left_job.node_index = node->field1;
+  left_job.range = left_range;
+  gp_bvh_push_job(deque, &left_job);
+
+  gp_bvh_work_job right_job;
+  right_job.node_index = node->field2;
+  right_job.range = right_range;
+  gp_bvh_push_job(deque, &right_job);
+}
+
+static void gp_bvh_build_thread(void* data)
+{
+  const gp_bvh_thread_data* thread_data = (const gp_bvh_thread_data*) data;
+  gp_bvh_build_context* context = thread_data->context;
+
+  /* Perform work until all jobs are retired. */
+
+  while (atomic_load(&context->pending_job_count) > 0)
+  {
+    gp_bvh_work_job job;
+
+    bool has_job = gp_bvh_pop_job(
+      &context->job_deques[thread_data->thread_index],
+      false,
+      &job
+    );
+
+    /* Our own deque is empty, try to take work from the others. */
+    for (uint32_t i = 1; !has_job && i < context->thread_count; ++i)
+    {
+      const uint32_t victim_index = (thread_data->thread_index + i) % context->thread_count;
+
+      has_job = gp_bvh_pop_job(
+        &context->job_deques[victim_index],
+        true,
+        &job
+      );
+    }
+
+    if (!has_job)
+    {
+      if (!gp_bvh_help_parallel_task(context)) {
+        gp_thread_yield();
+      }
+      continue;
+    }
+
+    gp_bvh_process_job(thread_data, &job);
+
+    atomic_fetch_sub(&context->pending_job_count, 1);
+  }
+}
+
 void gp_bvh_build(
   const gp_bvh_build_params* params,
   gp_bvh* bvh)
@@ -1275,21 +2235,6 @@ void gp_bvh_build(
 
   const float root_half_area = gp_aabb_half_area(&root_aabb_bounds);
 
-  const uint32_t max_job_stack_size = params->face_count;
-
-  gp_bvh_work_job* job_stack = (gp_bvh_work_job*)
-    malloc(max_job_stack_size * sizeof(gp_bvh_work_job));
-
-  job_stack[0].range.stack            = root_stack;
-  job_stack[0].range.stack_dir        = 1;
-  job_stack[0].range.stack_size       = root_stack_size;
-  job_stack[0].range.stack_size_limit = root_stack_size_limit;
-  job_stack[0].range.aabb_bounds      = root_aabb_bounds;
-  job_stack[0].range.centroid_bounds  = root_centroid_bounds;
-  job_stack[0].node_index             = 0;
-
-  int32_t job_stack_size = 1;
-
   /* Set up bvh. */
 
   const uint32_t max_face_count = (params->spatial_split_alpha < 1.0f) ?
@@ -1297,93 +2242,129 @@ void gp_bvh_build(
   const uint32_t max_node_count = max_face_count * 2;
 
   bvh->aabb = root_aabb_bounds;
-  bvh->face_count = 0;
   bvh->faces = malloc(max_face_count * sizeof(gp_face));
-  bvh->node_count = 1;
   bvh->nodes = malloc(max_node_count * sizeof(gp_bvh_node));
 
+  /* Set up job deques. */
+
+  const uint32_t thread_count = (params->thread_count > 0) ?
+    params->thread_count : gp_thread_hardware_concurrency();
+
+  gp_bvh_build_context context;
+  context.params = params;
+  context.bvh = bvh;
+  context.thread_count = thread_count;
+  context.job_deques = (gp_bvh_job_deque*) malloc(thread_count * sizeof(gp_bvh_job_deque));
+  atomic_init(&context.node_count, 1);
+  atomic_init(&context.face_count, 0);
+  atomic_init(&context.pending_job_count, 1);
+
+  context.tasks = (gp_bvh_parallel_task*) malloc(thread_count * sizeof(gp_bvh_parallel_task));
+
+  for (uint32_t i = 0; i < thread_count; ++i)
+  {
+    gp_bvh_parallel_task* task = &context.tasks[i];
+    atomic_init(&task->next_chunk, 0);
+    atomic_init(&task->helper_count, 0);
+    atomic_init(&task->is_open, false);
+
+    gp_bvh_job_deque* deque = &context.job_deques[i];
+    gp_mutex_create(&deque->mutex);
+    deque->capacity = 64;
+    deque->jobs = (gp_bvh_work_job*) malloc(deque->capacity * sizeof(gp_bvh_work_job));
+    deque->head = 0;
+    deque->tail = 0;
+  }
+
+  gp_bvh_work_job root_job;
+  root_job.range.stack            = root_stack;
+  root_job.range.stack_dir        = 1;
+  root_job.range.stack_size       = root_stack_size;
+  root_job.range.stack_size_limit = root_stack_size_limit;
+  root_job.range.aabb_bounds      = root_aabb_bounds;
+  root_job.range.centroid_bounds  = root_centroid_bounds;
+  root_job.node_index             = 0;
+
+  gp_bvh_push_job(&context.job_deques[0], &root_job);
+
   /* Allocate thread-local memory. */
 
-  const uint32_t object_bins_size = params->object_bin_count * sizeof(gp_bvh_object_bin);
+  const uint32_t object_bins_size = params->object_bin_count * sizeof(gp_bvh_object_bin) * 3;
   const uint32_t spatial_bins_size =
     (params->spatial_split_alpha == 1.0f) ? 0 : (params->spatial_bin_count * sizeof(gp_bvh_spatial_bin) * 3);
   const uint32_t reused_bins_size = imax(object_bins_size, spatial_bins_size);
+  /* The binned sweeps store one AABB per bin. */
+  const uint32_t reused_aabbs_count = imax(params->object_bin_count, params->spatial_bin_count);
 
-  int32_t reserve_buffer_capacity = (int32_t) (params->spatial_reserve_factor * params->face_count);
-  gp_bvh_face_ref* reserve_buffer = (gp_bvh_face_ref*) malloc(reserve_buffer_capacity * sizeof(gp_bvh_face_ref));
+  const int32_t reserve_buffer_size = (int32_t) (params->spatial_reserve_factor * params->face_count);
+  gp_bvh_face_ref* reserve_buffer = (gp_bvh_face_ref*) malloc(reserve_buffer_size * sizeof(gp_bvh_face_ref));
 
-  gp_bvh_thread_data thread_data;
-  thread_data.params = params;
-  thread_data.reused_bins = (void*) malloc(reused_bins_size);
-  thread_data.reused_aabbs = (gp_aabb*) malloc(params->face_count * sizeof(gp_aabb));
-  thread_data.root_half_area = root_half_area;
-  thread_data.reserve_buffer = reserve_buffer;
-  thread_data.reserve_buffer_capacity = &reserve_buffer_capacity;
+  _Atomic int32_t reserve_buffer_capacity;
+  atomic_init(&reserve_buffer_capacity, reserve_buffer_size);
 
-  /* Perform work until queue is empty. */
+  gp_bvh_thread_data* thread_datas =
+    (gp_bvh_thread_data*) malloc(thread_count * sizeof(gp_bvh_thread_data));
+  gp_bvh_sweep_memory* sweep_memories =
+    (gp_bvh_sweep_memory*) calloc(thread_count, sizeof(gp_bvh_sweep_memory));
 
-  while (job_stack_size > 0)
+  for (uint32_t i = 0; i < thread_count; ++i)
   {
-    job_stack_size--;
-
-    /* Process bvh range. */
-    const gp_bvh_work_job job = job_stack[job_stack_size];
-
-    gp_bvh_work_range left_range;
-    gp_bvh_work_range right_range;
-
-    const bool make_leaf = !gp_bvh_build_work_range(
-      &thread_data,
-      &job.range,
-      &left_range,
-      &right_range
-    );
+    gp_bvh_thread_data* thread_data = &thread_datas[i];
+    thread_data->params = params;
+    thread_data->context = &context;
+    thread_data->thread_index = i;
+    thread_data->task = &context.tasks[i];
+    thread_data->reused_bins = (void*) malloc(reused_bins_size);
+    thread_data->reused_aabbs = (gp_aabb*) malloc(reused_aabbs_count * sizeof(gp_aabb));
+    thread_data->sweep_memory = &sweep_memories[i];
+    thread_data->root_half_area = root_half_area;
+    thread_data->reserve_buffer = reserve_buffer;
+    thread_data->reserve_buffer_capacity = &reserve_buffer_capacity;
+  }
 
-    gp_bvh_node* node = &bvh->nodes[job.node_index];
+  /* Launch worker threads. The calling thread participates as well. If a
+   * thread fails to launch, the remaining ones simply take over its work. */
 
-    node->aabb = job.range.aabb_bounds;
+  gp_thread** threads = (gp_thread**) malloc(thread_count * sizeof(gp_thread*));
+  uint32_t launched_thread_count = 0;
 
-    /* We did not split the range, make a leaf instead. */
-    if (make_leaf)
+  for (uint32_t i = 1; i < thread_count; ++i)
+  {
+    if (gp_thread_create(gp_bvh_build_thread, &thread_datas[i], &threads[launched_thread_count]))
     {
-      node->field1 = bvh->face_count;
-      node->field2 = 0x80000000 | job.range.stack_size;
-
-      /* Resolve face references and write them into the bvh. */
-      for (uint32_t i = 0; i < job.range.stack_size; ++i)
-      {
-        const gp_bvh_face_ref* ref = &job.range.stack[(int32_t)i * job.range.stack_dir];
-        const gp_face* face = &params->faces[ref->index];
-        bvh->faces[bvh->face_count] = *face;
-        bvh->face_count++;
-      }
-
-      continue;
+      launched_thread_count++;
     }
+  }
 
-    /* Otherwise, create two new nodes. */
-    node->field1 = bvh->node_count;
-    bvh->node_count++;
-    node->field2 = bvh->node_count;
-    bvh->node_count++;
-
-    /* Enqueue new subranges. */
-    job_stack[job_stack_size].node_index = node->field1;
-    job_stack[job_stack_size].range = left_range;
-    job_stack_size++;
+  gp_bvh_build_thread(&thread_datas[0]);
 
-    job_stack[job_stack_size].node_index = node->field2;
-    job_stack[job_stack_size].range = right_range;
-    job_stack_size++;
+  for (uint32_t i = 0; i < launched_thread_count; ++i)
+  {
+    gp_thread_join(threads[i]);
   }
 
+  bvh->node_count = atomic_load(&context.node_count);
+  bvh->face_count = atomic_load(&context.face_count);
+
   /* Free memory. */
 
-  free(thread_data.reused_bins);
-  free(thread_data.reused_aabbs);
-  free(reserve_buffer);
+  for (uint32_t i = 0; i < thread_count; ++i)
+  {
+    free(thread_datas[i].reused_bins);
+    free(thread_datas[i].reused_aabbs);
+    free(sweep_memories[i].right_aabbs);
+    free(sweep_memories[i].sort_data);
+    free(sweep_memories[i].areas);
+    free(context.job_deques[i].jobs);
+    gp_mutex_destroy(context.job_deques[i].mutex);
+  }
 
-  free(job_stack);
+  free(threads);
+  free(thread_datas);
+  free(sweep_memories);
+  free(context.job_deques);
+  free(context.tasks);
+  free(reserve_buffer);
   free(root_stack);
 
   /* Reallocate bvh memory. */
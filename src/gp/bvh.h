@@ -40,9 +40,13 @@ typedef struct gp_bvh_build_params {
   GpBvhBinningMode object_binning_mode;
   uint32_t         object_binning_threshold;
   uint32_t         object_bin_count;
+  /* Ranges with more faces are binned and partitioned by all threads. */
+  uint32_t         parallel_binning_threshold;
   uint32_t         spatial_bin_count;
   float            spatial_reserve_factor;
   float            spatial_split_alpha;
+  /* Number of threads to build with, or 0 to use all available cores. */
+  uint32_t         thread_count;
   uint32_t         vertex_count;
   gp_vertex*       vertices;
 } gp_bvh_build_params;
@@ -0,0 +1,276 @@
+#include "bvh_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "mmap.h"
+
+#define GP_BVH_CACHE_MAGIC 0x43425047 /* "GPBC" */
+#define GP_BVH_CACHE_VERSION 2
+#define GP_BVH_CACHE_HEADER_SIZE 56
+#define GP_BVH_CACHE_MAX_PATH_LENGTH 2048
+
+#define GP_FNV_OFFSET_BASIS 0xCBF29CE484222325ull
+#define GP_FNV_PRIME 0x100000001B3ull
+
+typedef struct gp_bvh_cache_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  /* Hash of the node and face data. */
+  uint64_t checksum;
+  uint32_t node_count;
+  uint32_t face_count;
+  gp_aabb  aabb;
+} gp_bvh_cache_header;
+
+static_assert(sizeof(gp_bvh_cache_header) == GP_BVH_CACHE_HEADER_SIZE,
+  "Cache header size should be 56 bytes.");
+
+/* 64-bit FNV-1a. */
+static uint64_t gp_hash_bytes(uint64_t hash, const void* data, uint64_t size)
+{
+  const uint8_t* bytes = (const uint8_t*) data;
+
+  for (uint64_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= GP_FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static uint64_t gp_hash_u32(uint64_t hash, uint32_t value)
+{
+  return gp_hash_bytes(hash, &value, sizeof(value));
+}
+
+static uint64_t gp_hash_f32(uint64_t hash, float value)
+{
+  return gp_hash_bytes(hash, &value, sizeof(value));
+}
+
+/* Processes eight bytes at a time, since entries can be large. */
+static uint64_t gp_checksum(const uint8_t* data, uint64_t size)
+{
+  uint64_t hash = GP_FNV_OFFSET_BASIS;
+  uint64_t i = 0;
+
+  for (; (i + sizeof(uint64_t)) <= size; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, &data[i], sizeof(word));
+    hash ^= word;
+    hash *= GP_FNV_PRIME;
+    hash ^= hash >> 32;
+  }
+
+  return gp_hash_bytes(hash, &data[i], size - i);
+}
+
+static void gp_bvh_cache_make_path(const char* dir_path, uint64_t key, char* path)
+{
+  snprintf(path, GP_BVH_CACHE_MAX_PATH_LENGTH, "%s/%016" PRIx64 ".gpc", dir_path, key);
+}
+
+uint64_t gp_bvh_cache_key(
+  uint32_t variant_count,
+  const gp_bvh_build_params* params,
+  const gp_bvh_collapse_params* cparams,
+  uint32_t vertex_offset,
+  uint32_t vertex_count)
+{
+  uint64_t hash = GP_FNV_OFFSET_BASIS;
+
+  hash = gp_hash_u32(hash, GP_BVH_CACHE_VERSION);
+  hash = gp_hash_u32(hash, variant_count);
+
+  /* The thread count is not part of the key since it does
+   * not affect the quality of the result. */
+  for (uint32_t i = 0; i < variant_count; ++i)
+  {
+    const gp_bvh_build_params* p = &params[i];
+    hash = gp_hash_u32(hash, p->face_batch_size);
+    hash = gp_hash_f32(hash, p->face_intersection_cost);
+    hash = gp_hash_u32(hash, p->leaf_max_face_count);
+    hash = gp_hash_u32(hash, (uint32_t) p->object_binning_mode);
+    hash = gp_hash_u32(hash, p->object_binning_threshold);
+    hash = gp_hash_u32(hash, p->object_bin_count);
+    hash = gp_hash_u32(hash, p->parallel_binning_threshold);
+    hash = gp_hash_u32(hash, p->spatial_bin_count);
+    hash = gp_hash_f32(hash, p->spatial_reserve_factor);
+    hash = gp_hash_f32(hash, p->spatial_split_alpha);
+
+    const gp_bvh_collapse_params* c = &cparams[i];
+    hash = gp_hash_f32(hash, c->face_intersection_cost);
+    hash = gp_hash_u32(hash, c->max_leaf_size);
+    hash = gp_hash_f32(hash, c->node_traversal_cost);
+  }
+
+  /* Only positions are relevant for the BVH. */
+  hash = gp_hash_u32(hash, vertex_count);
+
+  for (uint32_t i = 0; i < vertex_count; ++i)
+  {
+    hash = gp_hash_bytes(hash, params->vertices[vertex_offset + i].pos, sizeof(float) * 3);
+  }
+
+  hash = gp_hash_u32(hash, params->face_count);
+
+  for (uint32_t i = 0; i < params->face_count; ++i)
+  {
+    const gp_face* face = &params->faces[i];
+    hash = gp_hash_u32(hash, face->v_i[0] - vertex_offset);
+    hash = gp_hash_u32(hash, face->v_i[1] - vertex_offset);
+    hash = gp_hash_u32(hash, face->v_i[2] - vertex_offset);
+    hash = gp_hash_u32(hash, face->mat_index);
+  }
+
+  return hash;
+}
+
+bool gp_bvh_cache_load(
+  const char* dir_path,
+  uint64_t key,
+  uint32_t vertex_offset,
+  gp_bvhcc* bvhcc,
+  uint32_t* face_count,
+  gp_face** faces)
+{
+  char path[GP_BVH_CACHE_MAX_PATH_LENGTH];
+  gp_bvh_cache_make_path(dir_path, key, path);
+
+  gatling_file* file;
+  if (!gatling_file_open(path, GATLING_FILE_USAGE_READ, &file)) {
+    return false;
+  }
+
+  const uint64_t file_size = gatling_file_size(file);
+
+  if (file_size < GP_BVH_CACHE_HEADER_SIZE)
+  {
+    gatling_file_close(file);
+    return false;
+  }
+
+  const uint8_t* data = (const uint8_t*) gatling_mmap(file, 0, file_size);
+
+  if (!data)
+  {
+    gatling_file_close(file);
+    return false;
+  }
+
+  gp_bvh_cache_header header;
+  memcpy(&header, data, sizeof(header));
+
+  const uint64_t node_buf_size = (uint64_t) header.node_count * sizeof(gp_bvhcc_node);
+  const uint64_t face_buf_size = (uint64_t) header.face_count * sizeof(gp_face);
+
+  /* Reject entries of other versions, hash collisions of the file
+   * name and truncated or otherwise damaged files. */
+  const bool is_valid =
+    header.magic == GP_BVH_CACHE_MAGIC &&
+    header.version == GP_BVH_CACHE_VERSION &&
+    header.key == key &&
+    file_size == (GP_BVH_CACHE_HEADER_SIZE + node_buf_size + face_buf_size) &&
+    header.checksum == gp_checksum(&data[GP_BVH_CACHE_HEADER_SIZE], node_buf_size + face_buf_size);
+
+  if (is_valid)
+  {
+    bvhcc->aabb = header.aabb;
+    bvhcc->node_count = header.node_count;
+    bvhcc->nodes = (gp_bvhcc_node*) malloc(node_buf_size);
+    memcpy(bvhcc->nodes, &data[GP_BVH_CACHE_HEADER_SIZE], node_buf_size);
+
+    (*face_count) = header.face_count;
+    (*faces) = (gp_face*) malloc(face_buf_size);
+    memcpy(*faces, &data[GP_BVH_CACHE_HEADER_SIZE + node_buf_size], face_buf_size);
+
+    for (uint32_t i = 0; i < header.face_count; ++i)
+    {
+      gp_face* face = &(*faces)[i];
+      face->v_i[0] += vertex_offset;
+      face->v_i[1] += vertex_offset;
+      face->v_i[2] += vertex_offset;
+    }
+  }
+
+  gatling_munmap(file, (void*) data);
+  gatling_file_close(file);
+
+  return is_valid;
+}
+
+bool gp_bvh_cache_store(
+  const char* dir_path,
+  uint64_t key,
+  uint32_t vertex_offset,
+  const gp_bvhcc* bvhcc,
+  uint32_t face_count,
+  const gp_face* faces)
+{
+  char path[GP_BVH_CACHE_MAX_PATH_LENGTH];
+  gp_bvh_cache_make_path(dir_path, key, path);
+
+  const uint64_t node_buf_size = (uint64_t) bvhcc->node_count * sizeof(gp_bvhcc_node);
+  const uint64_t face_buf_size = (uint64_t) face_count * sizeof(gp_face);
+  const uint64_t file_size = GP_BVH_CACHE_HEADER_SIZE + node_buf_size + face_buf_size;
+
+  /* Other processes may write or read the same entry at the same time. */
+  char temp_path[GP_BVH_CACHE_MAX_PATH_LENGTH];
+  gatling_file_make_temp_path(path, temp_path, GP_BVH_CACHE_MAX_PATH_LENGTH);
+
+  gatling_file* file;
+  if (!gatling_file_create(temp_path, file_size, &file)) {
+    return false;
+  }
+
+  uint8_t* data = (uint8_t*) gatling_mmap(file, 0, file_size);
+
+  if (!data)
+  {
+    gatling_file_close(file);
+    remove(temp_path);
+    return false;
+  }
+
+  memcpy(&data[GP_BVH_CACHE_HEADER_SIZE], bvhcc->nodes, node_buf_size);
+
+  gp_face* out_faces = (gp_face*) &data[GP_BVH_CACHE_HEADER_SIZE + node_buf_size];
+
+  for (uint32_t i = 0; i < face_count; ++i)
+  {
+    gp_face face = faces[i];
+    face.v_i[0] -= vertex_offset;
+    face.v_i[1] -= vertex_offset;
+    face.v_i[2] -= vertex_offset;
+    memcpy(&out_faces[i], &face, sizeof(gp_face));
+  }
+
+  const gp_bvh_cache_header header = {
+    .magic      = GP_BVH_CACHE_MAGIC,
+    .version    = GP_BVH_CACHE_VERSION,
+    .key        = key,
+    .checksum   = gp_checksum(&data[GP_BVH_CACHE_HEADER_SIZE], node_buf_size + face_buf_size),
+    .node_count = bvhcc->node_count,
+    .face_count = face_count,
+    .aabb       = bvhcc->aabb
+  };
+
+  memcpy(data, &header, sizeof(header));
+
+  const bool unmapped = gatling_munmap(file, data);
+  const bool closed = gatling_file_close(file);
+  const bool stored = unmapped && closed && gatling_file_replace(temp_path, path);
+
+  if (!stored) {
+    remove(temp_path);
+  }
+
+  return stored;
+}
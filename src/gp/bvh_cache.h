@@ -0,0 +1,46 @@
+#ifndef GP_BVH_CACHE_H
+#define GP_BVH_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "bvh_collapse.h"
+#include "bvh_compress.h"
+
+/*
+ * Cache entries store the compressed BVH of a single mesh together with its faces in
+ * leaf order. They are keyed on a hash of the mesh data and all build parameters that
+ * affect the result. Vertex indices are stored relative to the first vertex of the mesh,
+ * so entries stay valid if the mesh moves within the scene's vertex buffer.
+ */
+
+/* Builds which keep the best BVH of several parameter sets pass all of them, in
+ * the order they are tried. The mesh is taken from the first one. */
+uint64_t gp_bvh_cache_key(
+  uint32_t variant_count,
+  const gp_bvh_build_params* params,
+  const gp_bvh_collapse_params* cparams,
+  uint32_t vertex_offset,
+  uint32_t vertex_count
+);
+
+bool gp_bvh_cache_load(
+  const char* dir_path,
+  uint64_t key,
+  uint32_t vertex_offset,
+  gp_bvhcc* bvhcc,
+  uint32_t* face_count,
+  gp_face** faces
+);
+
+bool gp_bvh_cache_store(
+  const char* dir_path,
+  uint64_t key,
+  uint32_t vertex_offset,
+  const gp_bvhcc* bvhcc,
+  uint32_t face_count,
+  const gp_face* faces
+);
+
+#endif
@@ -2,16 +2,23 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <assert.h>
 
+#include "thread.h"
+
 /*
  * This file implements construction of an 8-wide BVH from a binary BVH as described
  * by Ylitie, Karras and Laine.
  * It works by first calculating SAH costs for representing the contents of each subtree
  * as a forest of at most i BVHs. By doing this bottom-up, previous results can be reused.
  * For each node and subtree count, we store the minimal cost in an N * (I-1) table, where
- * N is the number of nodes and I is the width of the BVH.
+ * N is the number of nodes and I is the width of the BVH. The I-1 entries of a node share
+ * a cache line. The table is filled without recursion: the tree is cut into independent
+ * subtrees, which are processed in parallel, each in reversed pre-order. The remaining
+ * upper nodes are processed afterwards in reversed breadth-first order.
  * In a second pass, we traverse top-down and trace the decisions leading to the minimal
  * costs stored in the table. We inline DISTRIBUTE splits and combine leaf nodes. For each
  * INTERNAL split decision, we recurse further down.
@@ -24,6 +31,9 @@
  *     DOI: https://doi.org/10.1145/3105762.3105773
  */
 
+#define GP_BVH_COLLAPSE_CACHE_LINE_SIZE 64
+#define GP_BVH_COLLAPSE_SUBTREES_PER_THREAD 8
+
 typedef enum GpBvhCollapseSplitType {
   GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL = 1,
   GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF = 2,
@@ -37,41 +47,100 @@ typedef struct gp_bvh_collapse_split {
   float cost;
 } gp_bvh_collapse_split;
 
+/* The seven splits of a node are stored together in one cache line. */
+typedef struct gp_bvh_collapse_node_splits {
+  float   costs[7];
+  uint8_t split_types[7];
+  uint8_t left_counts[7];
+  uint8_t right_counts[7];
+  uint8_t padding[15];
+} gp_bvh_collapse_node_splits;
+
+static_assert(sizeof(gp_bvh_collapse_node_splits) == GP_BVH_COLLAPSE_CACHE_LINE_SIZE,
+  "Node splits must match the cache line size.");
+
 typedef struct gp_bvh_collapse_work_data {
   gp_bvhc*                      bvhc;
   const gp_bvh_collapse_params* params;
-  gp_bvh_collapse_split*        splits;
+  gp_bvh_collapse_node_splits*  splits;
+  uint32_t*                     face_counts;
 } gp_bvh_collapse_work_data;
 
-static uint32_t gp_bvh_collapse_count_child_faces(const gp_bvh_collapse_work_data* wdata, uint32_t node_idx)
+typedef struct gp_bvh_collapse_node_list {
+  uint32_t* indices;
+  uint32_t  count;
+  uint32_t  capacity;
+} gp_bvh_collapse_node_list;
+
+typedef struct gp_bvh_collapse_thread_data {
+  const gp_bvh_collapse_work_data* wdata;
+  const uint32_t*                  subtree_roots;
+  uint32_t                         subtree_count;
+  _Atomic uint32_t*                next_subtree;
+  gp_bvh_collapse_node_list        stack;
+  gp_bvh_collapse_node_list        order;
+} gp_bvh_collapse_thread_data;
+
+GP_INLINE static bool gp_bvh_collapse_is_leaf(const gp_bvh_node* node)
 {
-  const gp_bvh_node* node = &wdata->params->bvh->nodes[node_idx];
+  return (node->field2 & 0x80000000) == 0x80000000;
+}
 
-  if ((node->field2 & 0x80000000) == 0x80000000) {
-    return (node->field2 & 0x7FFFFFFF);
-  }
+GP_INLINE static gp_bvh_collapse_split gp_bvh_collapse_get_split(
+  const gp_bvh_collapse_work_data* wdata,
+  uint32_t n,
+  uint32_t i)
+{
+  const gp_bvh_collapse_node_splits* node_splits = &wdata->splits[n];
 
-  return gp_bvh_collapse_count_child_faces(wdata, node->field1) +
-         gp_bvh_collapse_count_child_faces(wdata, node->field2);
+  gp_bvh_collapse_split split;
+  split.split_type = node_splits->split_types[i];
+  split.left_count = node_splits->left_counts[i];
+  split.right_count = node_splits->right_counts[i];
+  split.cost = node_splits->costs[i];
+  return split;
 }
 
-static gp_bvh_collapse_split gp_bvh_collapse_C(const gp_bvh_collapse_work_data* wdata, uint32_t n, uint32_t i);
+GP_INLINE static void gp_bvh_collapse_set_split(
+  const gp_bvh_collapse_work_data* wdata,
+  uint32_t n,
+  uint32_t i,
+  const gp_bvh_collapse_split* split)
+{
+  gp_bvh_collapse_node_splits* node_splits = &wdata->splits[n];
+  node_splits->split_types[i] = (uint8_t) split->split_type;
+  node_splits->left_counts[i] = (uint8_t) split->left_count;
+  node_splits->right_counts[i] = (uint8_t) split->right_count;
+  node_splits->costs[i] = split->cost;
+}
 
-static gp_bvh_collapse_split gp_bvh_collapse_C_distribute(const gp_bvh_collapse_work_data* wdata, uint32_t n, uint32_t j)
+static void gp_bvh_collapse_node_list_push(gp_bvh_collapse_node_list* list, uint32_t index)
 {
-  const gp_bvh_node* node = &wdata->params->bvh->nodes[n];
+  if (list->count == list->capacity)
+  {
+    list->capacity = (list->capacity == 0) ? 64 : (list->capacity * 2);
+    list->indices = (uint32_t*) realloc(list->indices, list->capacity * sizeof(uint32_t));
+  }
+  list->indices[list->count++] = index;
+}
 
+static gp_bvh_collapse_split gp_bvh_collapse_C_distribute(
+  const gp_bvh_collapse_work_data* wdata,
+  const gp_bvh_node* node,
+  uint32_t j)
+{
   gp_bvh_collapse_split split;
   split.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_DISTRIBUTE;
+  split.left_count = 0;
+  split.right_count = 0;
   split.cost = INFINITY;
 
+  const gp_bvh_collapse_node_splits* left_splits = &wdata->splits[node->field1];
+  const gp_bvh_collapse_node_splits* right_splits = &wdata->splits[node->field2];
+
   for (uint32_t k = 0; k < j; ++k)
   {
-    const uint32_t n_left = node->field1;
-    const uint32_t n_right = node->field2;
-    const gp_bvh_collapse_split split_left = gp_bvh_collapse_C(wdata, n_left, k);
-    const gp_bvh_collapse_split split_right = gp_bvh_collapse_C(wdata, n_right, j - k - 1);
-    const float cost = split_left.cost + split_right.cost;
+    const float cost = left_splits->costs[k] + right_splits->costs[j - k - 1];
 
     if (cost < split.cost) {
       split.cost = cost;
@@ -83,83 +152,208 @@ static gp_bvh_collapse_split gp_bvh_collapse_C_distribute(const gp_bvh_collapse_
   return split;
 }
 
-static gp_bvh_collapse_split gp_bvh_collapse_C_internal(const gp_bvh_collapse_work_data* wdata, uint32_t n)
+/* Calculates the face count and the costs of all splits of a node.
+ * Its children must have been processed already. */
+static void gp_bvh_collapse_calc_node_costs(const gp_bvh_collapse_work_data* wdata, uint32_t n)
 {
   const gp_bvh_node* node = &wdata->params->bvh->nodes[n];
   const float A_n = gp_aabb_area(&node->aabb);
 
-  gp_bvh_collapse_split split = gp_bvh_collapse_C_distribute(wdata, n, 7);
-  split.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL;
-  split.cost += A_n * wdata->params->node_traversal_cost;
-  return split;
-}
+  if (gp_bvh_collapse_is_leaf(node))
+  {
+    const uint32_t p_n = (node->field2 & 0x7FFFFFFF);
+    wdata->face_counts[n] = p_n;
 
-static gp_bvh_collapse_split gp_bvh_collapse_C_leaf(const gp_bvh_collapse_work_data* wdata, uint32_t n)
-{
-  const uint32_t p_n = gp_bvh_collapse_count_child_faces(wdata, n);
+    gp_bvh_collapse_split split;
+    split.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF;
+    split.left_count = 0;
+    split.right_count = 0;
+    split.cost = A_n * p_n * wdata->params->face_intersection_cost;
 
-  gp_bvh_collapse_split split;
-  split.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF;
+    for (uint32_t i = 0; i < 7; ++i)
+    {
+      gp_bvh_collapse_set_split(wdata, n, i, &split);
+    }
+    return;
+  }
+
+  const uint32_t p_n = wdata->face_counts[node->field1] + wdata->face_counts[node->field2];
+  wdata->face_counts[n] = p_n;
+
+  /* C_leaf(n) */
+  gp_bvh_collapse_split c_leaf;
+  c_leaf.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF;
+  c_leaf.left_count = 0;
+  c_leaf.right_count = 0;
+  c_leaf.cost = (p_n > wdata->params->max_leaf_size) ?
+    INFINITY : (A_n * p_n * wdata->params->face_intersection_cost);
+
+  /* C_internal(n) */
+  gp_bvh_collapse_split c_internal = gp_bvh_collapse_C_distribute(wdata, node, 7);
+  c_internal.split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL;
+  c_internal.cost += A_n * wdata->params->node_traversal_cost;
+
+  /* C(n, 0) */
+  gp_bvh_collapse_split c_prev = (c_leaf.cost < c_internal.cost) ? c_leaf : c_internal;
+  gp_bvh_collapse_set_split(wdata, n, 0, &c_prev);
 
-  if (p_n > wdata->params->max_leaf_size)
+  /* C(n, i) = min(C_distribute(n, i), C(n, i - 1)) */
+  for (uint32_t i = 1; i < 7; ++i)
   {
-    split.cost = INFINITY;
-    return split;
-  }
+    const gp_bvh_collapse_split c_dist = gp_bvh_collapse_C_distribute(wdata, node, i);
 
-  const gp_bvh_node* node = &wdata->params->bvh->nodes[n];
-  const float A_n = gp_aabb_area(&node->aabb);
-  split.cost = A_n * p_n * wdata->params->face_intersection_cost;
+    if (c_dist.cost < c_prev.cost) {
+      c_prev = c_dist;
+    }
 
-  return split;
+    gp_bvh_collapse_set_split(wdata, n, i, &c_prev);
+  }
 }
 
-static gp_bvh_collapse_split gp_bvh_collapse_C(const gp_bvh_collapse_work_data* wdata, uint32_t n, uint32_t i)
+static void gp_bvh_collapse_calc_subtree_costs(
+  const gp_bvh_collapse_work_data* wdata,
+  uint32_t root_index,
+  gp_bvh_collapse_node_list* stack,
+  gp_bvh_collapse_node_list* order)
 {
-  if (wdata->splits[n * 7 + i].split_type != -1)
+  /* A reversed pre-order visits children before their parents. */
+  const gp_bvh_node* nodes = wdata->params->bvh->nodes;
+
+  stack->count = 0;
+  order->count = 0;
+  gp_bvh_collapse_node_list_push(stack, root_index);
+
+  while (stack->count > 0)
   {
-    return wdata->splits[n * 7 + i];
+    const uint32_t n = stack->indices[--stack->count];
+    gp_bvh_collapse_node_list_push(order, n);
+
+    const gp_bvh_node* node = &nodes[n];
+
+    if (!gp_bvh_collapse_is_leaf(node))
+    {
+      gp_bvh_collapse_node_list_push(stack, node->field1);
+      gp_bvh_collapse_node_list_push(stack, node->field2);
+    }
   }
 
-  if (i == 0)
+  for (uint32_t i = order->count; i > 0; --i)
   {
-    gp_bvh_collapse_split c_leaf = gp_bvh_collapse_C_leaf(wdata, n);
-    gp_bvh_collapse_split c_internal = gp_bvh_collapse_C_internal(wdata, n);
-    return (c_leaf.cost < c_internal.cost) ? c_leaf : c_internal;
+    gp_bvh_collapse_calc_node_costs(wdata, order->indices[i - 1]);
   }
-  else
+}
+
+static void gp_bvh_collapse_calc_costs_thread(void* data)
+{
+  gp_bvh_collapse_thread_data* thread_data = (gp_bvh_collapse_thread_data*) data;
+
+  uint32_t subtree_index;
+  while ((subtree_index = atomic_fetch_add(thread_data->next_subtree, 1)) < thread_data->subtree_count)
   {
-    gp_bvh_collapse_split c_dist = gp_bvh_collapse_C_distribute(wdata, n, i);
-    gp_bvh_collapse_split c_recur = gp_bvh_collapse_C(wdata, n, i - 1);
-    return (c_dist.cost < c_recur.cost) ? c_dist : c_recur;
+    gp_bvh_collapse_calc_subtree_costs(
+      thread_data->wdata,
+      thread_data->subtree_roots[subtree_index],
+      &thread_data->stack,
+      &thread_data->order
+    );
   }
 }
 
-static void gp_bvh_collapse_calc_costs(const gp_bvh_collapse_work_data* wdata, uint32_t n)
+static void gp_bvh_collapse_calc_costs(const gp_bvh_collapse_work_data* wdata)
 {
-  const gp_bvh_node* node = &wdata->params->bvh->nodes[n];
+  const gp_bvh_node* nodes = wdata->params->bvh->nodes;
 
-  if ((node->field2 & 0x80000000) == 0x80000000)
+  const uint32_t thread_count = (wdata->params->thread_count > 0) ?
+    wdata->params->thread_count : gp_thread_hardware_concurrency();
+
+  /* Split the tree into upper nodes and independent subtrees by expanding
+   * interior nodes in breadth-first order. Leaves are not expanded. */
+  const uint32_t min_subtree_count = (thread_count > 1) ?
+    (thread_count * GP_BVH_COLLAPSE_SUBTREES_PER_THREAD) : 1;
+
+  gp_bvh_collapse_node_list upper_nodes = { NULL, 0, 0 };
+  gp_bvh_collapse_node_list subtree_roots = { NULL, 0, 0 };
+  gp_bvh_collapse_node_list queue = { NULL, 0, 0 };
+  gp_bvh_collapse_node_list_push(&queue, 0);
+
+  uint32_t queue_begin = 0;
+
+  while (queue_begin < queue.count && (queue.count - queue_begin + subtree_roots.count) < min_subtree_count)
   {
-    const float A_n = gp_aabb_area(&node->aabb);
-    const uint32_t p_n = (node->field2 & 0x7FFFFFFF);
-    const float cost = A_n * p_n * wdata->params->face_intersection_cost;
+    const uint32_t n = queue.indices[queue_begin++];
+    const gp_bvh_node* node = &nodes[n];
 
-    for (uint32_t i = 0; i < 7; ++i)
+    if (gp_bvh_collapse_is_leaf(node))
     {
-      wdata->splits[n * 7 + i].split_type = GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF;
-      wdata->splits[n * 7 + i].cost = cost;
+      gp_bvh_collapse_node_list_push(&subtree_roots, n);
+      continue;
     }
-    return;
+
+    gp_bvh_collapse_node_list_push(&upper_nodes, n);
+    gp_bvh_collapse_node_list_push(&queue, node->field1);
+    gp_bvh_collapse_node_list_push(&queue, node->field2);
+  }
+
+  for (uint32_t i = queue_begin; i < queue.count; ++i)
+  {
+    gp_bvh_collapse_node_list_push(&subtree_roots, queue.indices[i]);
   }
 
-  gp_bvh_collapse_calc_costs(wdata, node->field1);
-  gp_bvh_collapse_calc_costs(wdata, node->field2);
+  free(queue.indices);
+
+  /* Process subtrees in parallel. */
+  _Atomic uint32_t next_subtree;
+  atomic_init(&next_subtree, 0);
 
-  for (uint32_t i = 0; i < 7; ++i)
+  gp_bvh_collapse_thread_data* thread_datas =
+    (gp_bvh_collapse_thread_data*) malloc(thread_count * sizeof(gp_bvh_collapse_thread_data));
+
+  for (uint32_t i = 0; i < thread_count; ++i)
   {
-    wdata->splits[n * 7 + i] = gp_bvh_collapse_C(wdata, n, i);
+    gp_bvh_collapse_thread_data* thread_data = &thread_datas[i];
+    thread_data->wdata = wdata;
+    thread_data->subtree_roots = subtree_roots.indices;
+    thread_data->subtree_count = subtree_roots.count;
+    thread_data->next_subtree = &next_subtree;
+    thread_data->stack = (gp_bvh_collapse_node_list) { NULL, 0, 0 };
+    thread_data->order = (gp_bvh_collapse_node_list) { NULL, 0, 0 };
   }
+
+  gp_thread** threads = (gp_thread**) malloc(thread_count * sizeof(gp_thread*));
+  uint32_t launched_thread_count = 0;
+
+  for (uint32_t i = 1; i < thread_count; ++i)
+  {
+    if (gp_thread_create(gp_bvh_collapse_calc_costs_thread, &thread_datas[i], &threads[launched_thread_count]))
+    {
+      launched_thread_count++;
+    }
+  }
+
+  gp_bvh_collapse_calc_costs_thread(&thread_datas[0]);
+
+  for (uint32_t i = 0; i < launched_thread_count; ++i)
+  {
+    gp_thread_join(threads[i]);
+  }
+
+  /* Finish with the upper part. In reversed breadth-first order,
+   * children come before their parents as well. */
+  for (uint32_t i = upper_nodes.count; i > 0; --i)
+  {
+    gp_bvh_collapse_calc_node_costs(wdata, upper_nodes.indices[i - 1]);
+  }
+
+  for (uint32_t i = 0; i < thread_count; ++i)
+  {
+    free(thread_datas[i].stack.indices);
+    free(thread_datas[i].order.indices);
+  }
+
+  free(threads);
+  free(thread_datas);
+  free(subtree_roots.indices);
+  free(upper_nodes.indices);
 }
 
 static void gp_bvh_collapse_collect_childs(
@@ -171,21 +365,21 @@ static void gp_bvh_collapse_collect_childs(
 {
   assert(*child_count <= 8);
 
-  const gp_bvh_collapse_split* split = &wdata->splits[node_index * 7 + child_index];
+  const gp_bvh_collapse_split split = gp_bvh_collapse_get_split(wdata, node_index, child_index);
 
   const gp_bvh_node* node = &wdata->params->bvh->nodes[node_index];
-  const gp_bvh_collapse_split* left_split = &wdata->splits[node->field1 * 7 + split->left_count];
-  const gp_bvh_collapse_split* right_split = &wdata->splits[node->field2 * 7 + split->right_count];
+  const uint8_t left_split_type = wdata->splits[node->field1].split_types[split.left_count];
+  const uint8_t right_split_type = wdata->splits[node->field2].split_types[split.right_count];
 
-  if (left_split->split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_DISTRIBUTE) {
-    gp_bvh_collapse_collect_childs(wdata, node->field1, split->left_count, child_count, child_indices);
+  if (left_split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_DISTRIBUTE) {
+    gp_bvh_collapse_collect_childs(wdata, node->field1, split.left_count, child_count, child_indices);
   }
   else {
     child_indices[(*child_count)++] = node->field1;
   }
 
-  if (right_split->split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_DISTRIBUTE) {
-    gp_bvh_collapse_collect_childs(wdata, node->field2, split->right_count, child_count, child_indices);
+  if (right_split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_DISTRIBUTE) {
+    gp_bvh_collapse_collect_childs(wdata, node->field2, split.right_count, child_count, child_indices);
   }
   else {
     child_indices[(*child_count)++] = node->field2;
@@ -236,9 +430,9 @@ static uint32_t gp_bvh_collapse_create_nodes(
   for (uint32_t i = 0; i < child_node_count; ++i)
   {
     const int32_t child_node_idx = child_node_indices[i];
-    const gp_bvh_collapse_split* split = &wdata->splits[child_node_idx * 7];
+    const uint8_t split_type = wdata->splits[child_node_idx].split_types[0];
 
-    if (split->split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF)
+    if (split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_LEAF)
     {
       const uint32_t face_offset = wdata->bvhc->face_count;
       const uint32_t face_count = gp_bvh_collapse_push_child_leaves(
@@ -252,7 +446,7 @@ static uint32_t gp_bvh_collapse_create_nodes(
 
       gp_aabb_merge(parent_aabb, &parent_node->aabbs[i], parent_aabb);
     }
-    else if (split->split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL)
+    else if (split_type == GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL)
     {
       const uint32_t new_node_idx = (wdata->bvhc->node_count++);
       parent_node->offsets[i] = new_node_idx - parent_node->child_index;
@@ -267,9 +461,9 @@ static uint32_t gp_bvh_collapse_create_nodes(
   for (uint32_t i = 0; i < child_node_count; ++i)
   {
     const int32_t child_node_idx = child_node_indices[i];
-    const gp_bvh_collapse_split* split = &wdata->splits[child_node_idx * 7];
+    const uint8_t split_type = wdata->splits[child_node_idx].split_types[0];
 
-    if (split->split_type != GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL) {
+    if (split_type != GP_BVH_COLLAPSE_SPLIT_TYPE_INTERNAL) {
       continue;
     }
 
@@ -293,23 +487,23 @@ static uint32_t gp_bvh_collapse_create_nodes(
 
 void gp_bvh_collapse(const gp_bvh_collapse_params* params, gp_bvhc* bvhc)
 {
-  /* Calculate cost lookup table. */
-  const uint32_t num_splits = params->bvh->node_count * 7;
-  gp_bvh_collapse_split* splits = malloc(num_splits * sizeof(gp_bvh_collapse_split));
+  /* Calculate cost lookup table. The allocation is padded so that node
+   * splits can be aligned to cache line boundaries. */
+  const uint32_t node_count = params->bvh->node_count;
 
-  for (uint32_t i = 0; i < num_splits; ++i)
-  {
-    gp_bvh_collapse_split* split = &splits[i];
-    split->split_type = -1;
-  }
+  void* splits_memory = malloc(node_count * sizeof(gp_bvh_collapse_node_splits) + GP_BVH_COLLAPSE_CACHE_LINE_SIZE - 1);
+
+  const uintptr_t splits_address =
+    ((uintptr_t) splits_memory + GP_BVH_COLLAPSE_CACHE_LINE_SIZE - 1) & ~((uintptr_t) GP_BVH_COLLAPSE_CACHE_LINE_SIZE - 1);
 
   const gp_bvh_collapse_work_data work_data = {
     .bvhc = bvhc,
     .params = params,
-    .splits = splits
+    .splits = (gp_bvh_collapse_node_splits*) splits_address,
+    .face_counts = malloc(node_count * sizeof(uint32_t))
   };
 
-  gp_bvh_collapse_calc_costs(&work_data, 0);
+  gp_bvh_collapse_calc_costs(&work_data);
 
   /* Set up new bvh and include a root node. */
   bvhc->aabb = params->bvh->aabb;
@@ -326,13 +520,25 @@ void gp_bvh_collapse(const gp_bvh_collapse_params* params, gp_bvhc* bvhc)
     gp_aabb_make_smallest(&root_node->aabbs[j]);
   }
 
-  /* Construct wide bvh recursively using previously calculated costs. */
-  gp_bvh_collapse_create_nodes(&work_data, 0, root_node, &bvhc->aabb);
+  /* Construct wide bvh recursively using previously calculated costs. A leaf
+   * root has no splits to follow, so it becomes the only child of the root. */
+  if (gp_bvh_collapse_is_leaf(&params->bvh->nodes[0]))
+  {
+    root_node->child_index = bvhc->node_count;
+    root_node->face_index = 0;
+    root_node->offsets[0] = 0;
+    root_node->counts[0] = (0x80000000 | gp_bvh_collapse_push_child_leaves(&work_data, 0, &root_node->aabbs[0]));
+  }
+  else
+  {
+    gp_bvh_collapse_create_nodes(&work_data, 0, root_node, &bvhc->aabb);
+  }
 
   /* There can be less nodes than in the input BVH because we collapse leaves. */
   bvhc->nodes = realloc(bvhc->nodes, bvhc->node_count * sizeof(gp_bvhc_node));
 
-  free(splits);
+  free(work_data.face_counts);
+  free(splits_memory);
 }
 
 void gp_free_bvhc(gp_bvhc* bvhc)
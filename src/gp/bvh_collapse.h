@@ -26,6 +26,8 @@ typedef struct gp_bvh_collapse_params {
   float         face_intersection_cost;
   uint32_t      max_leaf_size;
   float         node_traversal_cost;
+  /* Number of threads to use, or 0 to use all available cores. */
+  uint32_t      thread_count;
 } gp_bvh_collapse_params;
 
 void gp_bvh_collapse(const gp_bvh_collapse_params* params, gp_bvhc* bvhc);
@@ -21,20 +21,78 @@ typedef struct gp_vertex {
   float uv[2];
 } gp_vertex;
 
+/* Vertex layout with --compress-vertices. The octahedral normal is stored
+ * as two 16-bit snorms [Cigolle et al. 2014], the UVs as two half floats.
+ * Positions are only needed for intersection and are part of gp_triangle. */
+typedef struct gp_compressed_vertex {
+  uint32_t norm;
+  uint32_t uv;
+} gp_compressed_vertex;
+
 typedef struct gp_face {
   uint32_t v_i[3];
   uint32_t mat_index;
 } gp_face;
 
-typedef struct gp_material {
-  float albedo_r;
-  float albedo_g;
-  float albedo_b;
+/* Face positions in the form used by the intersection test, so that
+ * traversal doesn't need to fetch the face and its vertices. */
+typedef struct gp_triangle {
+  float v_0[3];
   float padding1;
-  float emission_r;
-  float emission_g;
-  float emission_b;
+  float e_1[3];
   float padding2;
+  float e_2[3];
+  float padding3;
+} gp_triangle;
+
+#define GP_NO_TEXTURE UINT32_MAX
+
+typedef struct gp_material {
+  float    albedo_r;
+  float    albedo_g;
+  float    albedo_b;
+  /* Multiplies the albedo, or GP_NO_TEXTURE. */
+  uint32_t albedo_texture;
+  float    emission_r;
+  float    emission_g;
+  float    emission_b;
+  float    padding2;
 } gp_material;
 
+/* A mip-mapped texture in pages of GATLING_GSD_TEXTURE_PAGE_SIZE squared texels.
+ * Each level is half the size of the previous one, rounded down but at least
+ * one texel, and its pages follow those of the previous level in row-major order. */
+typedef struct gp_texture {
+  uint32_t width;
+  uint32_t height;
+  uint32_t level_count;
+  /* First page of level 0 in the texture page section. */
+  uint32_t page_offset;
+} gp_texture;
+
+typedef struct gp_instance {
+  /* Row-major affine transform from world to object space. */
+  float    world_to_object[3][4];
+  /* Root node of the mesh BVH this instance refers to. */
+  uint32_t node_index;
+  /* Range of the mesh faces in leaf order, for hardware acceleration structures. */
+  uint32_t face_offset;
+  uint32_t face_count;
+  uint32_t padding;
+} gp_instance;
+
+/* An emissive face in world space. Lights are selected in proportion to their
+ * power using an alias table: entry i is chosen with probability alias_prob,
+ * otherwise entry alias_index is chosen instead [Walker 1977]. */
+typedef struct gp_light {
+  float    v_0[3];
+  float    alias_prob;
+  float    v_1[3];
+  uint32_t alias_index;
+  float    v_2[3];
+  float    padding1;
+  float    emission[3];
+  float    padding2;
+} gp_light;
+
 #endif
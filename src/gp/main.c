@@ -1,93 +1,843 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include <assert.h>
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "mmap.h"
+#include "gsd.h"
+
 #include "gp.h"
 #include "bvh.h"
 #include "bvh_collapse.h"
 #include "bvh_compress.h"
+#include "bvh_cache.h"
+#include "texture.h"
+
+/* Named sets of build parameters, which trade build time for trace speed.
+ * The default is in between the other two. */
+typedef enum GpBvhPreset {
+  GP_BVH_PRESET_DEFAULT     = 0,
+  /* Binned object splits only, for quick previews. */
+  GP_BVH_PRESET_FAST_BUILD  = 1,
+  /* Exact SAH sweeps and spatial splits wherever children overlap. */
+  GP_BVH_PRESET_MAX_QUALITY = 2,
+  /* Tries a few variants of the parameters per mesh, see gp_build_wide_bvh_auto. */
+  GP_BVH_PRESET_AUTO        = 3,
+  GP_BVH_PRESET_COUNT
+} GpBvhPreset;
+
+static const char* GP_BVH_PRESET_NAMES[GP_BVH_PRESET_COUNT] = {
+  "default", "fast-build", "max-quality", "auto"
+};
 
 typedef struct gp_scene {
+  GpBvhPreset            bvh_preset;
+  gp_bvh_build_params    bvh_params;
+  gp_bvh_collapse_params cparams;
   gp_bvhcc     bvhcc;
   uint32_t     face_count;
   gp_face*     faces;
+  uint32_t     instance_count;
+  gp_instance* instances;
   gp_material* materials;
   uint32_t     material_count;
   uint32_t     vertex_count;
   gp_vertex*   vertices;
+  uint32_t     light_count;
+  gp_light*    lights;
+  float        light_power;
+  uint32_t     texture_count;
+  gp_texture*  textures;
+  uint32_t     texture_page_count;
+  uint8_t*     texture_pages;
 } gp_scene;
 
+/* A reference to a mesh from the node hierarchy. */
+typedef struct gp_mesh_ref {
+  uint32_t mesh_index;
+  float    object_to_world[3][4];
+} gp_mesh_ref;
+
+typedef struct gp_mesh {
+  uint32_t face_offset;
+  uint32_t face_count;
+  uint32_t vertex_offset;
+  uint32_t vertex_count;
+  bool     is_referenced;
+  gp_bvhcc bvhcc;
+  uint32_t node_offset;
+  uint32_t leaf_face_offset;
+  uint32_t leaf_face_count;
+} gp_mesh;
+
+/* Leaves with more faces are counted in the last bucket of the histogram. */
+#define GP_STATS_MAX_LEAF_SIZE 8
+
+#define GP_BVH_AUTO_CANDIDATE_COUNT 4
+
+/* Options which were given explicitly, so that the auto preset keeps them. */
+typedef enum GpBvhFixedParamFlagBits {
+  GP_BVH_FIXED_PARAM_SPATIAL_SPLIT_ALPHA = 1,
+  GP_BVH_FIXED_PARAM_MAX_LEAF_SIZE       = 2
+} GpBvhFixedParamFlagBits;
+
+/* Quality metrics of a wide BVH, using the costs it was collapsed with. */
+typedef struct gp_bvh_quality {
+  float    sah_cost;
+  uint32_t binary_node_count;
+  uint32_t node_count;
+  uint32_t face_reference_count;
+  uint32_t leaf_size_counts[GP_STATS_MAX_LEAF_SIZE + 1];
+} gp_bvh_quality;
+
+/* Timings of the build phases and quality of the mesh BVHs, written with --stats.
+ * Cached BVHs are not measured. */
+typedef struct gp_stats {
+  double   import_time;
+  double   build_time;
+  double   collapse_time;
+  double   compress_time;
+  double   write_time;
+  uint32_t built_bvh_count;
+  uint32_t cached_bvh_count;
+  uint64_t face_count;
+  uint64_t face_reference_count;
+  uint64_t binary_node_count;
+  uint64_t node_count;
+  uint64_t leaf_size_counts[GP_STATS_MAX_LEAF_SIZE + 1];
+  /* Sum of the SAH costs weighted by face count. */
+  double   weighted_sah_cost;
+  float    tlas_sah_cost;
+  /* How often each candidate of the auto preset was chosen. */
+  uint32_t auto_candidate_counts[GP_BVH_AUTO_CANDIDATE_COUNT];
+  uint32_t texture_count;
+  uint32_t texture_page_count;
+} gp_stats;
+
 static void gp_fail(const char* msg)
 {
   printf("Gatling encountered a fatal error: %s\n", msg);
   exit(-1);
 }
 
-static void gp_assimp_add_node_mesh(
-  const struct aiScene* ai_scene, const struct aiNode* ai_node,
-  const struct aiMatrix4x4* ai_parent_transform,
+static void gp_assimp_add_mesh(
+  const struct aiMesh* ai_mesh,
   uint32_t* face_index, gp_face* faces,
   uint32_t* vertex_index, gp_vertex* vertices)
+{
+  for (uint32_t f = 0; f < ai_mesh->mNumFaces; ++f)
+  {
+    const struct aiFace* ai_face = &ai_mesh->mFaces[f];
+    assert(ai_face->mNumIndices == 3);
+
+    struct gp_face* face = &faces[*face_index];
+    face->v_i[0] = (*vertex_index) + ai_face->mIndices[0];
+    face->v_i[1] = (*vertex_index) + ai_face->mIndices[1];
+    face->v_i[2] = (*vertex_index) + ai_face->mIndices[2];
+    face->mat_index = ai_mesh->mMaterialIndex;
+
+    (*face_index)++;
+  }
+
+  for (uint32_t v = 0; v < ai_mesh->mNumVertices; ++v)
+  {
+    const struct aiVector3D* ai_position = &ai_mesh->mVertices[v];
+    const struct aiVector3D* ai_normal = &ai_mesh->mNormals[v];
+
+    struct gp_vertex* vertex = &vertices[*vertex_index];
+    vertex->pos[0] = ai_position->x;
+    vertex->pos[1] = ai_position->y;
+    vertex->pos[2] = ai_position->z;
+    vertex->norm[0] = ai_normal->x;
+    vertex->norm[1] = ai_normal->y;
+    vertex->norm[2] = ai_normal->z;
+
+    /* Texture rows are stored top-down, while V points up. */
+    if (ai_mesh->mTextureCoords[0])
+    {
+      vertex->uv[0] = ai_mesh->mTextureCoords[0][v].x;
+      vertex->uv[1] = 1.0f - ai_mesh->mTextureCoords[0][v].y;
+    }
+    else
+    {
+      vertex->uv[0] = 0.0f;
+      vertex->uv[1] = 0.0f;
+    }
+
+    (*vertex_index)++;
+  }
+}
+
+static void gp_assimp_add_node_mesh_refs(
+  const struct aiNode* ai_node,
+  const struct aiMatrix4x4* ai_parent_transform,
+  uint32_t* mesh_ref_count,
+  uint32_t* mesh_ref_capacity,
+  gp_mesh_ref** mesh_refs)
 {
   struct aiMatrix4x4 ai_node_matrix = ai_node->mTransformation;
   aiMultiplyMatrix4(&ai_node_matrix, ai_parent_transform);
 
   for (uint32_t m = 0; m < ai_node->mNumMeshes; ++m)
   {
-    const struct aiMesh* ai_mesh = ai_scene->mMeshes[ai_node->mMeshes[m]];
+    if ((*mesh_ref_count) == (*mesh_ref_capacity))
+    {
+      (*mesh_ref_capacity) = ((*mesh_ref_capacity) == 0) ? 64 : ((*mesh_ref_capacity) * 2);
+      (*mesh_refs) = realloc(*mesh_refs, (*mesh_ref_capacity) * sizeof(gp_mesh_ref));
+    }
+
+    gp_mesh_ref* mesh_ref = &(*mesh_refs)[*mesh_ref_count];
+    mesh_ref->mesh_index = ai_node->mMeshes[m];
+
+    const float object_to_world[3][4] = {
+      { ai_node_matrix.a1, ai_node_matrix.a2, ai_node_matrix.a3, ai_node_matrix.a4 },
+      { ai_node_matrix.b1, ai_node_matrix.b2, ai_node_matrix.b3, ai_node_matrix.b4 },
+      { ai_node_matrix.c1, ai_node_matrix.c2, ai_node_matrix.c3, ai_node_matrix.c4 }
+    };
+    memcpy(mesh_ref->object_to_world, object_to_world, sizeof(object_to_world));
+
+    (*mesh_ref_count)++;
+  }
+
+  for (uint32_t i = 0; i < ai_node->mNumChildren; ++i)
+  {
+    gp_assimp_add_node_mesh_refs(
+      ai_node->mChildren[i], &ai_node_matrix,
+      mesh_ref_count, mesh_ref_capacity, mesh_refs
+    );
+  }
+}
+
+static bool gp_invert_transform(const float m[3][4], float inv[3][4])
+{
+  const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  const float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+  const float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+
+  const float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+
+  if (det == 0.0f || !isfinite(det)) {
+    return false;
+  }
+
+  const float inv_det = 1.0f / det;
+
+  inv[0][0] = c00 * inv_det;
+  inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+  inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+  inv[1][0] = c01 * inv_det;
+  inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+  inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+  inv[2][0] = c02 * inv_det;
+  inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+  inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    inv[i][3] = -(inv[i][0] * m[0][3] + inv[i][1] * m[1][3] + inv[i][2] * m[2][3]);
+  }
+
+  return true;
+}
+
+/* Transforms an AABB using the method described by Arvo in Graphics Gems (1990). */
+static void gp_transform_aabb(const float m[3][4], const gp_aabb* in, gp_aabb* out)
+{
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    out->min[i] = m[i][3];
+    out->max[i] = m[i][3];
+
+    for (uint32_t j = 0; j < 3; ++j)
+    {
+      const float a = m[i][j] * in->min[j];
+      const float b = m[i][j] * in->max[j];
+      out->min[i] += (a < b) ? a : b;
+      out->max[i] += (a < b) ? b : a;
+    }
+  }
+}
+
+/* The shaders compute light power in the same way. */
+static float gp_luminance(const gp_vec3 c)
+{
+  return c[0] * 0.2126f + c[1] * 0.7152f + c[2] * 0.0722f;
+}
+
+/* Appends the emissive faces of a mesh instance to the light list. The power of
+ * each light is temporarily stored in its alias probability field. */
+static void gp_add_instance_lights(
+  const float object_to_world[3][4],
+  uint32_t face_count,
+  const gp_face* faces,
+  const gp_vertex* vertices,
+  const gp_material* materials,
+  uint32_t* light_count,
+  uint32_t* light_capacity,
+  gp_light** lights)
+{
+  for (uint32_t f = 0; f < face_count; ++f)
+  {
+    const gp_face* face = &faces[f];
+    const gp_material* material = &materials[face->mat_index];
+
+    if (material->emission_r <= 0.0f &&
+        material->emission_g <= 0.0f &&
+        material->emission_b <= 0.0f)
+    {
+      continue;
+    }
 
-    for (uint32_t f = 0; f < ai_mesh->mNumFaces; ++f)
+    gp_vec3 pos[3];
+    for (uint32_t v = 0; v < 3; ++v)
     {
-      const struct aiFace* ai_face = &ai_mesh->mFaces[f];
-      assert(ai_face->mNumIndices == 3);
+      const float* p = vertices[face->v_i[v]].pos;
+
+      for (uint32_t i = 0; i < 3; ++i)
+      {
+        pos[v][i] = object_to_world[i][0] * p[0] +
+                    object_to_world[i][1] * p[1] +
+                    object_to_world[i][2] * p[2] +
+                    object_to_world[i][3];
+      }
+    }
 
-      struct gp_face* face = &faces[*face_index];
-      face->v_i[0] = (*vertex_index) + ai_face->mIndices[0];
-      face->v_i[1] = (*vertex_index) + ai_face->mIndices[1];
-      face->v_i[2] = (*vertex_index) + ai_face->mIndices[2];
-      face->mat_index = ai_mesh->mMaterialIndex;
+    gp_vec3 e1, e2, c;
+    gp_vec3_sub(pos[1], pos[0], e1);
+    gp_vec3_sub(pos[2], pos[0], e2);
+    gp_vec3_cross(e1, e2, c);
 
-      (*face_index)++;
+    const gp_vec3 emission = { material->emission_r, material->emission_g, material->emission_b };
+    const float area = gp_vec3_length(c) * 0.5f;
+    const float power = gp_luminance(emission) * area;
+
+    if (!(power > 0.0f) || !isfinite(power)) {
+      continue;
     }
 
-    for (uint32_t v = 0; v < ai_mesh->mNumVertices; ++v)
+    if ((*light_count) == (*light_capacity))
     {
-      struct aiVector3D* ai_position = &ai_mesh->mVertices[v];
-      const struct aiVector3D* ai_normal = &ai_mesh->mNormals[v];
-      const struct aiVector3D* ai_tex_coords = &ai_mesh->mTextureCoords[0][v];
+      (*light_capacity) = ((*light_capacity) == 0) ? 64 : ((*light_capacity) * 2);
+      (*lights) = realloc(*lights, (*light_capacity) * sizeof(gp_light));
+    }
 
-      aiTransformVecByMatrix4(ai_position, &ai_node_matrix);
+    gp_light* light = &(*lights)[*light_count];
+    gp_vec3_assign(pos[0], light->v_0);
+    gp_vec3_assign(pos[1], light->v_1);
+    gp_vec3_assign(pos[2], light->v_2);
+    gp_vec3_assign(emission, light->emission);
+    light->alias_prob = power;
+    light->alias_index = *light_count;
+    light->padding1 = 0.0f;
+    light->padding2 = 0.0f;
 
-      struct gp_vertex* vertex = &vertices[*vertex_index];
-      vertex->pos[0] = ai_position->x;
-      vertex->pos[1] = ai_position->y;
-      vertex->pos[2] = ai_position->z;
-      vertex->norm[0] = ai_normal->x;
-      vertex->norm[1] = ai_normal->y;
-      vertex->norm[2] = ai_normal->z;
-      vertex->uv[0] = 0.0f;
-      vertex->uv[1] = 0.0f;
+    (*light_count)++;
+  }
+}
+
+/* Replaces the light powers by an alias table using Vose's method, which
+ * allows the shaders to select a light in constant time. Returns the sum
+ * of all powers. */
+static float gp_build_light_alias_table(uint32_t light_count, gp_light* lights)
+{
+  double power_sum = 0.0;
+
+  for (uint32_t i = 0; i < light_count; ++i)
+  {
+    power_sum += lights[i].alias_prob;
+  }
+
+  float* scaled_probs = (float*) malloc(light_count * sizeof(float));
+  uint32_t* small_indices = (uint32_t*) malloc(light_count * sizeof(uint32_t));
+  uint32_t* large_indices = (uint32_t*) malloc(light_count * sizeof(uint32_t));
+  uint32_t small_count = 0;
+  uint32_t large_count = 0;
 
-      (*vertex_index)++;
+  for (uint32_t i = 0; i < light_count; ++i)
+  {
+    scaled_probs[i] = (float) (lights[i].alias_prob * light_count / power_sum);
+
+    if (scaled_probs[i] < 1.0f) {
+      small_indices[small_count++] = i;
+    } else {
+      large_indices[large_count++] = i;
     }
   }
 
-  for (uint32_t i = 0; i < ai_node->mNumChildren; ++i)
+  while (small_count > 0 && large_count > 0)
+  {
+    const uint32_t s = small_indices[--small_count];
+    const uint32_t l = large_indices[large_count - 1];
+
+    lights[s].alias_prob = scaled_probs[s];
+    lights[s].alias_index = l;
+
+    scaled_probs[l] = (scaled_probs[l] + scaled_probs[s]) - 1.0f;
+
+    if (scaled_probs[l] < 1.0f)
+    {
+      large_count--;
+      small_indices[small_count++] = l;
+    }
+  }
+
+  /* Leftovers are due to rounding and have a probability of one. */
+  while (large_count > 0)
+  {
+    const uint32_t l = large_indices[--large_count];
+    lights[l].alias_prob = 1.0f;
+    lights[l].alias_index = l;
+  }
+  while (small_count > 0)
+  {
+    const uint32_t s = small_indices[--small_count];
+    lights[s].alias_prob = 1.0f;
+    lights[s].alias_index = s;
+  }
+
+  free(scaled_probs);
+  free(small_indices);
+  free(large_indices);
+
+  return (float) power_sum;
+}
+
+static double gp_get_time()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/* The SAH cost is the expected cost of tracing a ray which hits the root
+ * node, assuming that the probability of hitting a child is proportional
+ * to its surface area [MacDonald and Booth 1990]. */
+static void gp_measure_bvh_quality(
+  const gp_bvhc* bvhc,
+  const gp_bvh_collapse_params* cparams,
+  gp_bvh_quality* quality)
+{
+  memset(quality, 0, sizeof(gp_bvh_quality));
+
+  const float root_area = gp_aabb_half_area(&bvhc->aabb);
+  double cost = cparams->node_traversal_cost * root_area;
+
+  for (uint32_t n = 0; n < bvhc->node_count; ++n)
+  {
+    const gp_bvhc_node* node = &bvhc->nodes[n];
+
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+      const uint32_t count = node->counts[i];
+
+      if (count == 0) {
+        continue;
+      }
+
+      const float area = gp_aabb_half_area(&node->aabbs[i]);
+
+      if (count & 0x80000000)
+      {
+        const uint32_t leaf_size = count & 0x7FFFFFFF;
+        cost += area * leaf_size * cparams->face_intersection_cost;
+        quality->leaf_size_counts[leaf_size < GP_STATS_MAX_LEAF_SIZE ? leaf_size : GP_STATS_MAX_LEAF_SIZE]++;
+      }
+      else
+      {
+        cost += area * cparams->node_traversal_cost;
+      }
+    }
+  }
+
+  quality->sah_cost = (root_area > 0.0f) ? (float) (cost / root_area) : 0.0f;
+  quality->node_count = bvhc->node_count;
+  quality->face_reference_count = bvhc->face_count;
+}
+
+static void gp_build_wide_bvh(
+  const gp_bvh_build_params* params,
+  const gp_bvh_collapse_params* cparams,
+  gp_stats* stats,
+  gp_bvh_quality* quality,
+  gp_bvhcc* bvhcc,
+  uint32_t* face_count,
+  gp_face** faces)
+{
+  const double build_start = gp_get_time();
+
+  gp_bvh bvh;
+  gp_bvh_build(params, &bvh);
+
+  const double collapse_start = gp_get_time();
+
+  gp_bvhc bvhc;
+  gp_bvh_collapse_params bvh_cparams = *cparams;
+  bvh_cparams.bvh = &bvh;
+
+  gp_bvh_collapse(&bvh_cparams, &bvhc);
+
+  const double compress_start = gp_get_time();
+
+  gp_measure_bvh_quality(&bvhc, cparams, quality);
+  quality->binary_node_count = bvh.node_count;
+  gp_free_bvh(&bvh);
+
+  /* Take ownership of the reordered faces instead of copying them. */
+  (*face_count) = bvhc.face_count;
+  (*faces) = bvhc.faces;
+  bvhc.faces = NULL;
+
+  gp_bvh_compress(&bvhc, bvhcc);
+  gp_free_bvhc(&bvhc);
+
+  const double compress_end = gp_get_time();
+
+  stats->build_time += collapse_start - build_start;
+  stats->collapse_time += compress_start - collapse_start;
+  stats->compress_time += compress_end - compress_start;
+}
+
+/* Variations of the spatial split threshold and the leaf size tried by the
+ * auto preset. Compressed leaves hold at most three faces. */
+typedef struct gp_bvh_auto_candidate {
+  float    spatial_split_alpha;
+  uint32_t max_leaf_size;
+} gp_bvh_auto_candidate;
+
+static const gp_bvh_auto_candidate GP_BVH_AUTO_CANDIDATES[GP_BVH_AUTO_CANDIDATE_COUNT] = {
+  { 10e-5f, 3 },
+  { 10e-6f, 3 },
+  { 10e-5f, 2 },
+  { 10e-6f, 2 }
+};
+
+/* Returns the parameter sets of the auto preset. Explicitly set parameters are not
+ * varied, and candidates which only differ in those are tried once. The indices of
+ * the candidates are returned as well, for the stats. */
+static uint32_t gp_make_bvh_auto_candidates(
+  uint32_t fixed_params,
+  const gp_bvh_build_params* params,
+  const gp_bvh_collapse_params* cparams,
+  gp_bvh_build_params* candidate_params,
+  gp_bvh_collapse_params* candidate_cparams,
+  uint32_t* candidate_indices)
+{
+  uint32_t candidate_count = 0;
+
+  for (uint32_t i = 0; i < GP_BVH_AUTO_CANDIDATE_COUNT; ++i)
+  {
+    gp_bvh_build_params p = *params;
+    gp_bvh_collapse_params c = *cparams;
+
+    if (!(fixed_params & GP_BVH_FIXED_PARAM_SPATIAL_SPLIT_ALPHA)) {
+      p.spatial_split_alpha = GP_BVH_AUTO_CANDIDATES[i].spatial_split_alpha;
+    }
+    if (!(fixed_params & GP_BVH_FIXED_PARAM_MAX_LEAF_SIZE)) {
+      c.max_leaf_size = GP_BVH_AUTO_CANDIDATES[i].max_leaf_size;
+    }
+
+    bool is_duplicate = false;
+
+    for (uint32_t j = 0; j < candidate_count; ++j)
+    {
+      is_duplicate |=
+        candidate_params[j].spatial_split_alpha == p.spatial_split_alpha &&
+        candidate_cparams[j].max_leaf_size == c.max_leaf_size;
+    }
+
+    if (is_duplicate) {
+      continue;
+    }
+
+    candidate_params[candidate_count] = p;
+    candidate_cparams[candidate_count] = c;
+    candidate_indices[candidate_count] = i;
+    candidate_count++;
+  }
+
+  return candidate_count;
+}
+
+/* Builds the BVH with every candidate and keeps the one of the lowest SAH cost.
+ * All of them are measured with the same intersection costs, which makes the
+ * costs comparable, but the build takes as long as all candidates together. */
+static void gp_build_wide_bvh_auto(
+  uint32_t candidate_count,
+  const gp_bvh_build_params* candidate_params,
+  const gp_bvh_collapse_params* candidate_cparams,
+  const uint32_t* candidate_indices,
+  gp_stats* stats,
+  gp_bvh_quality* quality,
+  gp_bvhcc* bvhcc,
+  uint32_t* face_count,
+  gp_face** faces)
+{
+  uint32_t best_index = 0;
+
+  for (uint32_t i = 0; i < candidate_count; ++i)
+  {
+    gp_bvh_quality candidate_quality;
+    gp_bvhcc candidate_bvhcc;
+    uint32_t candidate_face_count;
+    gp_face* candidate_faces;
+
+    gp_build_wide_bvh(
+      &candidate_params[i], &candidate_cparams[i], stats, &candidate_quality,
+      &candidate_bvhcc, &candidate_face_count, &candidate_faces
+    );
+
+    if (i > 0 && candidate_quality.sah_cost >= quality->sah_cost)
+    {
+      gp_free_bvhcc(&candidate_bvhcc);
+      free(candidate_faces);
+      continue;
+    }
+
+    if (i > 0)
+    {
+      gp_free_bvhcc(bvhcc);
+      free(*faces);
+    }
+
+    (*quality) = candidate_quality;
+    (*bvhcc) = candidate_bvhcc;
+    (*face_count) = candidate_face_count;
+    (*faces) = candidate_faces;
+    best_index = candidate_indices[i];
+  }
+
+  stats->auto_candidate_counts[best_index]++;
+}
+
+/* Only sets the parameters which don't depend on the scene. */
+static void gp_set_bvh_preset(
+  GpBvhPreset preset,
+  gp_bvh_build_params* params,
+  gp_bvh_collapse_params* cparams)
+{
+  const gp_bvh_build_params default_params = {
+    .face_batch_size            = 1,
+    .face_count                 = 0,
+    .face_intersection_cost     = 1.2f,
+    .faces                      = NULL,
+    .leaf_max_face_count        = 1,
+    .object_binning_mode        = GP_BVH_BINNING_MODE_FIXED,
+    .object_binning_threshold   = 1024,
+    .object_bin_count           = 16,
+    .parallel_binning_threshold = 65536,
+    .spatial_bin_count          = 32,
+    .spatial_reserve_factor     = 1.25f,
+    .spatial_split_alpha        = 10e-5f,
+    .thread_count               = 0,
+    .vertex_count               = 0,
+    .vertices                   = NULL
+  };
+
+  const gp_bvh_collapse_params default_cparams = {
+    .bvh                    = NULL,
+    .max_leaf_size          = 3,
+    .node_traversal_cost    = 1.0f,
+    .face_intersection_cost = 0.3f,
+    .thread_count           = 0
+  };
+
+  (*params) = default_params;
+  (*cparams) = default_cparams;
+
+  if (preset == GP_BVH_PRESET_FAST_BUILD)
+  {
+    /* A spatial split alpha of one disables spatial splits. */
+    params->object_binning_threshold = 0;
+    params->object_bin_count = 8;
+    params->spatial_split_alpha = 1.0f;
+  }
+  else if (preset == GP_BVH_PRESET_MAX_QUALITY)
+  {
+    params->object_binning_mode = GP_BVH_BINNING_MODE_OFF;
+    params->spatial_bin_count = 64;
+    params->spatial_reserve_factor = 2.0f;
+    params->spatial_split_alpha = 10e-7f;
+  }
+}
+
+/* Materials referring to the same texture file share its converted pages.
+ * Textures which fail to load are remembered as well, to warn only once. */
+typedef struct gp_texture_ref {
+  struct aiString path;
+  uint32_t        texture_index;
+} gp_texture_ref;
+
+static bool gp_read_texture_file(
+  const char* scene_file_path,
+  const char* texture_path,
+  uint8_t** data,
+  uint64_t* size)
+{
+  /* Paths are relative to the directory of the scene file. */
+  char file_path[2048];
+  const char* separator = strrchr(scene_file_path, '/');
+  const char* backslash = strrchr(scene_file_path, '\\');
+  if (backslash && (!separator || backslash > separator)) {
+    separator = backslash;
+  }
+  const int dir_length = separator ? (int) (separator - scene_file_path + 1) : 0;
+
+  const int length = snprintf(file_path, sizeof(file_path), "%.*s%s", dir_length, scene_file_path, texture_path);
+  if (length < 0 || length >= (int) sizeof(file_path)) {
+    return false;
+  }
+
+  FILE* file = fopen(file_path, "rb");
+  if (!file) {
+    return false;
+  }
+
+  bool result = false;
+
+  if (fseek(file, 0, SEEK_END) == 0)
+  {
+    const long file_size = ftell(file);
+
+    if (file_size > 0 && fseek(file, 0, SEEK_SET) == 0)
+    {
+      *data = (uint8_t*) malloc((size_t) file_size);
+      *size = (uint64_t) file_size;
+      result = fread(*data, 1, (size_t) file_size, file) == (size_t) file_size;
+
+      if (!result) {
+        free(*data);
+      }
+    }
+  }
+
+  fclose(file);
+  return result;
+}
+
+/* Decodes a texture into RGBA8. Embedded textures are referred to as "*<index>"
+ * and are either raw BGRA8 texels or the contents of an image file. Only TGA
+ * files can be decoded. */
+static bool gp_decode_texture(
+  const struct aiScene* ai_scene,
+  const char* scene_file_path,
+  const char* texture_path,
+  uint32_t* width,
+  uint32_t* height,
+  uint8_t** rgba)
+{
+  if (texture_path[0] == '*')
+  {
+    const uint32_t index = (uint32_t) strtoul(&texture_path[1], NULL, 10);
+
+    if (index >= ai_scene->mNumTextures) {
+      return false;
+    }
+
+    const struct aiTexture* ai_texture = ai_scene->mTextures[index];
+
+    if (ai_texture->mHeight == 0) {
+      return gp_texture_decode_tga((const uint8_t*) ai_texture->pcData, ai_texture->mWidth, width, height, rgba);
+    }
+
+    const uint32_t texel_count = ai_texture->mWidth * ai_texture->mHeight;
+    uint8_t* out = (uint8_t*) malloc((size_t) texel_count * 4);
+
+    for (uint32_t i = 0; i < texel_count; ++i)
+    {
+      const struct aiTexel* texel = &ai_texture->pcData[i];
+      out[i * 4 + 0] = texel->r;
+      out[i * 4 + 1] = texel->g;
+      out[i * 4 + 2] = texel->b;
+      out[i * 4 + 3] = texel->a;
+    }
+
+    *width = ai_texture->mWidth;
+    *height = ai_texture->mHeight;
+    *rgba = out;
+    return true;
+  }
+
+  uint8_t* data;
+  uint64_t size;
+  if (!gp_read_texture_file(scene_file_path, texture_path, &data, &size)) {
+    return false;
+  }
+
+  const bool result = gp_texture_decode_tga(data, size, width, height, rgba);
+  free(data);
+  return result;
+}
+
+static uint32_t gp_load_albedo_texture(
+  const struct aiScene* ai_scene,
+  const struct aiMaterial* ai_mat,
+  const char* scene_file_path,
+  uint32_t* texture_ref_count,
+  gp_texture_ref** texture_refs,
+  gp_scene* scene)
+{
+  struct aiString path;
+  if (aiGetMaterialTexture(ai_mat, aiTextureType_DIFFUSE, 0, &path, NULL, NULL, NULL, NULL, NULL, NULL) != AI_SUCCESS) {
+    return GP_NO_TEXTURE;
+  }
+
+  for (uint32_t i = 0; i < *texture_ref_count; ++i)
+  {
+    if (strcmp((*texture_refs)[i].path.data, path.data) == 0) {
+      return (*texture_refs)[i].texture_index;
+    }
+  }
+
+  uint32_t texture_index = GP_NO_TEXTURE;
+  uint32_t width, height;
+  uint8_t* rgba;
+
+  if (gp_decode_texture(ai_scene, scene_file_path, path.data, &width, &height, &rgba))
   {
-    gp_assimp_add_node_mesh(
-      ai_scene, ai_node->mChildren[i], &ai_node_matrix,
-      face_index, faces, vertex_index, vertices
+    texture_index = scene->texture_count;
+    scene->texture_count++;
+    scene->textures = (gp_texture*) realloc(scene->textures, scene->texture_count * sizeof(gp_texture));
+
+    gp_texture_build(
+      rgba, width, height,
+      &scene->texture_page_count, &scene->texture_pages,
+      &scene->textures[texture_index]
     );
+
+    free(rgba);
+  }
+  else
+  {
+    printf("Warning: unable to load texture '%s', only TGA files are supported\n", path.data);
   }
+
+  (*texture_ref_count)++;
+  *texture_refs = (gp_texture_ref*) realloc(*texture_refs, (*texture_ref_count) * sizeof(gp_texture_ref));
+  (*texture_refs)[*texture_ref_count - 1].path = path;
+  (*texture_refs)[*texture_ref_count - 1].texture_index = texture_index;
+
+  return texture_index;
 }
 
-static void gp_load_scene(gp_scene* scene, const char* file_path)
+static void gp_load_scene(
+  gp_scene* scene,
+  const char* file_path,
+  const char* cache_dir_path,
+  GpBvhPreset bvh_preset,
+  uint32_t fixed_bvh_params,
+  const gp_bvh_build_params* build_params,
+  const gp_bvh_collapse_params* collapse_params,
+  gp_stats* stats)
 {
+  const double import_start = gp_get_time();
+
   struct aiPropertyStore* props = aiCreatePropertyStore();
   aiSetImportPropertyInteger(props, AI_CONFIG_PP_FD_REMOVE, 1);
 
@@ -122,10 +872,15 @@ static void gp_load_scene(gp_scene* scene, const char* file_path)
     printf("Warning: Assimp scene import incomplete\n");
   }
 
+  /* Meshes are stored once, in object space. Each node referencing
+   * a mesh becomes an instance of it. */
   uint32_t vertex_count = 0;
   uint32_t face_count = 0;
 
-  for (uint32_t m = 0; m < ai_scene->mNumMeshes; ++m)
+  const uint32_t mesh_count = ai_scene->mNumMeshes;
+  gp_mesh* meshes = (gp_mesh*) malloc(mesh_count * sizeof(gp_mesh));
+
+  for (uint32_t m = 0; m < mesh_count; ++m)
   {
     const struct aiMesh* ai_mesh = ai_scene->mMeshes[m];
     vertex_count += ai_mesh->mNumVertices;
@@ -135,65 +890,50 @@ static void gp_load_scene(gp_scene* scene, const char* file_path)
   gp_vertex* vertices = (gp_vertex*) malloc(vertex_count * sizeof(gp_vertex));
   gp_face* faces = (gp_face*) malloc(face_count * sizeof(gp_face));
 
-  struct aiMatrix4x4 ai_identity_matrix;
-  aiIdentityMatrix4(&ai_identity_matrix);
-
   vertex_count = 0;
   face_count = 0;
 
-  gp_assimp_add_node_mesh(
-    ai_scene, ai_scene->mRootNode, &ai_identity_matrix,
-    &face_count, faces, &vertex_count, vertices
-  );
-
-  scene->vertex_count = vertex_count;
-  scene->vertices = realloc(vertices, vertex_count * sizeof(gp_vertex));
-
-  gp_bvh bvh;
-  const gp_bvh_build_params bvh_params = {
-    .face_batch_size          = 1,
-    .face_count               = face_count,
-    .face_intersection_cost   = 1.2f,
-    .faces                    = faces,
-    .leaf_max_face_count      = 1,
-    .object_binning_mode      = GP_BVH_BINNING_MODE_FIXED,
-    .object_binning_threshold = 1024,
-    .object_bin_count         = 16,
-    .spatial_bin_count        = 32,
-    .spatial_reserve_factor   = 1.25f,
-    .spatial_split_alpha      = 10e-5f,
-    .vertex_count             = scene->vertex_count,
-    .vertices                 = scene->vertices
-  };
+  for (uint32_t m = 0; m < mesh_count; ++m)
+  {
+    gp_mesh* mesh = &meshes[m];
+    mesh->face_offset = face_count;
+    mesh->vertex_offset = vertex_count;
+    mesh->is_referenced = false;
 
-  gp_bvh_build(
-    &bvh_params,
-    &bvh
-  );
+    gp_assimp_add_mesh(
+      ai_scene->mMeshes[m],
+      &face_count, faces, &vertex_count, vertices
+    );
 
-  free(faces);
+    mesh->face_count = face_count - mesh->face_offset;
+    mesh->vertex_count = vertex_count - mesh->vertex_offset;
+  }
 
-  gp_bvhc bvhc;
-  gp_bvh_collapse_params cparams  = {
-    .bvh                    = &bvh,
-    .max_leaf_size          = 3,
-    .node_traversal_cost    = 1.0f,
-    .face_intersection_cost = 0.3f
-  };
+  scene->vertex_count = vertex_count;
+  scene->vertices = realloc(vertices, vertex_count * sizeof(gp_vertex));
 
-  gp_bvh_collapse(&cparams, &bvhc);
-  gp_free_bvh(&bvh);
+  struct aiMatrix4x4 ai_identity_matrix;
+  aiIdentityMatrix4(&ai_identity_matrix);
 
-  scene->face_count = bvhc.face_count;
-  scene->faces = malloc(bvhc.face_count * sizeof(gp_face));
-  memcpy(scene->faces, bvhc.faces, bvhc.face_count * sizeof(gp_face));
+  uint32_t mesh_ref_count = 0;
+  uint32_t mesh_ref_capacity = 0;
+  gp_mesh_ref* mesh_refs = NULL;
 
-  gp_bvh_compress(&bvhc, &scene->bvhcc);
-  gp_free_bvhc(&bvhc);
+  gp_assimp_add_node_mesh_refs(
+    ai_scene->mRootNode, &ai_identity_matrix,
+    &mesh_ref_count, &mesh_ref_capacity, &mesh_refs
+  );
 
   scene->material_count = ai_scene->mNumMaterials;
   scene->materials =
     (gp_material*) malloc(scene->material_count * sizeof(gp_material));
+  scene->texture_count = 0;
+  scene->textures = NULL;
+  scene->texture_page_count = 0;
+  scene->texture_pages = NULL;
+
+  uint32_t texture_ref_count = 0;
+  gp_texture_ref* texture_refs = NULL;
 
   for (uint32_t m = 0; m < ai_scene->mNumMaterials; ++m)
   {
@@ -207,82 +947,530 @@ static void gp_load_scene(gp_scene* scene, const char* file_path)
     material->albedo_r = ai_albedo.r;
     material->albedo_g = ai_albedo.g;
     material->albedo_b = ai_albedo.b;
-    material->padding1 = 0.0f;
+    material->albedo_texture = gp_load_albedo_texture(
+      ai_scene, ai_mat, file_path, &texture_ref_count, &texture_refs, scene
+    );
     material->emission_r = ai_emission.r;
     material->emission_g = ai_emission.g;
     material->emission_b = ai_emission.b;
     material->padding2 = 0.0f;
   }
 
+  free(texture_refs);
+  stats->texture_count = scene->texture_count;
+  stats->texture_page_count = scene->texture_page_count;
+
+  /* The imported scene is not needed anymore. We release it before
+   * building the BVHs to keep the peak memory usage low. */
   aiReleaseImport(ai_scene);
+
+  stats->import_time = gp_get_time() - import_start;
+
+  for (uint32_t i = 0; i < mesh_ref_count; ++i)
+  {
+    meshes[mesh_refs[i].mesh_index].is_referenced = true;
+  }
+
+  gp_bvh_build_params bvh_params = *build_params;
+  bvh_params.vertex_count = scene->vertex_count;
+  bvh_params.vertices = scene->vertices;
+
+  const gp_bvh_collapse_params cparams = *collapse_params;
+
+  scene->bvh_preset = bvh_preset;
+  scene->bvh_params = bvh_params;
+  scene->cparams = cparams;
+
+  /* Build one bottom-level BVH per referenced mesh. The faces of all
+   * meshes are concatenated in leaf order. */
+  scene->face_count = 0;
+  scene->faces = NULL;
+
+  uint32_t blas_node_count = 0;
+
+  for (uint32_t m = 0; m < mesh_count; ++m)
+  {
+    gp_mesh* mesh = &meshes[m];
+
+    if (!mesh->is_referenced || mesh->face_count == 0)
+    {
+      mesh->is_referenced = false;
+      continue;
+    }
+
+    bvh_params.face_count = mesh->face_count;
+    bvh_params.faces = &faces[mesh->face_offset];
+
+    /* Other presets build a single candidate. */
+    gp_bvh_build_params candidate_params[GP_BVH_AUTO_CANDIDATE_COUNT];
+    gp_bvh_collapse_params candidate_cparams[GP_BVH_AUTO_CANDIDATE_COUNT];
+    uint32_t candidate_indices[GP_BVH_AUTO_CANDIDATE_COUNT];
+    uint32_t candidate_count = 1;
+
+    candidate_params[0] = bvh_params;
+    candidate_cparams[0] = cparams;
+
+    if (bvh_preset == GP_BVH_PRESET_AUTO)
+    {
+      candidate_count = gp_make_bvh_auto_candidates(
+        fixed_bvh_params, &bvh_params, &cparams,
+        candidate_params, candidate_cparams, candidate_indices
+      );
+    }
+
+    uint32_t mesh_face_count;
+    gp_face* mesh_faces;
+
+    uint64_t cache_key = 0;
+    bool is_cached = false;
+
+    if (cache_dir_path)
+    {
+      /* The preset only affects the result through the candidates. */
+      cache_key = gp_bvh_cache_key(
+        candidate_count, candidate_params, candidate_cparams,
+        mesh->vertex_offset, mesh->vertex_count
+      );
+
+      is_cached = gp_bvh_cache_load(
+        cache_dir_path, cache_key, mesh->vertex_offset,
+        &mesh->bvhcc, &mesh_face_count, &mesh_faces
+      );
+    }
+
+    if (is_cached)
+    {
+      stats->cached_bvh_count++;
+    }
+    else
+    {
+      gp_bvh_quality quality;
+
+      if (bvh_preset == GP_BVH_PRESET_AUTO) {
+        gp_build_wide_bvh_auto(
+          candidate_count, candidate_params, candidate_cparams, candidate_indices,
+          stats, &quality, &mesh->bvhcc, &mesh_face_count, &mesh_faces
+        );
+      } else {
+        gp_build_wide_bvh(&bvh_params, &cparams, stats, &quality, &mesh->bvhcc, &mesh_face_count, &mesh_faces);
+      }
+
+      stats->built_bvh_count++;
+      stats->face_count += mesh->face_count;
+      stats->face_reference_count += quality.face_reference_count;
+      stats->binary_node_count += quality.binary_node_count;
+      stats->node_count += quality.node_count;
+      stats->weighted_sah_cost += (double) quality.sah_cost * mesh->face_count;
+
+      for (uint32_t i = 0; i <= GP_STATS_MAX_LEAF_SIZE; ++i) {
+        stats->leaf_size_counts[i] += quality.leaf_size_counts[i];
+      }
+
+      const bool stored = !cache_dir_path || gp_bvh_cache_store(
+        cache_dir_path, cache_key, mesh->vertex_offset,
+        &mesh->bvhcc, mesh_face_count, mesh_faces
+      );
+
+      if (!stored) {
+        printf("Warning: unable to write BVH cache entry\n");
+      }
+    }
+
+    scene->faces = realloc(scene->faces, (scene->face_count + mesh_face_count) * sizeof(gp_face));
+    memcpy(&scene->faces[scene->face_count], mesh_faces, mesh_face_count * sizeof(gp_face));
+    free(mesh_faces);
+
+    for (uint32_t i = 0; i < mesh->bvhcc.node_count; ++i)
+    {
+      mesh->bvhcc.nodes[i].face_index += scene->face_count;
+    }
+
+    mesh->leaf_face_offset = scene->face_count;
+    mesh->leaf_face_count = mesh_face_count;
+    scene->face_count += mesh_face_count;
+    mesh->node_offset = blas_node_count;
+    blas_node_count += mesh->bvhcc.node_count;
+  }
+
+  if (cache_dir_path) {
+    printf("Built %u mesh BVHs, reused %u from cache\n", stats->built_bvh_count, stats->cached_bvh_count);
+  }
+
+  /* Set up the instances. Each one is represented by a degenerate triangle
+   * spanning its world space AABB, which allows us to build the top-level
+   * BVH with the same builder. The instance index is kept in the material
+   * index field. */
+  gp_instance* instances = (gp_instance*) malloc(mesh_ref_count * sizeof(gp_instance));
+  gp_vertex* instance_vertices = (gp_vertex*) malloc(mesh_ref_count * 2 * sizeof(gp_vertex));
+  gp_face* instance_faces = (gp_face*) malloc(mesh_ref_count * sizeof(gp_face));
+
+  uint32_t instance_count = 0;
+
+  /* Emissive faces are collected per instance from the original faces,
+   * since the leaf order may reference faces more than once. */
+  uint32_t light_capacity = 0;
+  scene->light_count = 0;
+  scene->lights = NULL;
+
+  for (uint32_t i = 0; i < mesh_ref_count; ++i)
+  {
+    const gp_mesh_ref* mesh_ref = &mesh_refs[i];
+    const gp_mesh* mesh = &meshes[mesh_ref->mesh_index];
+
+    if (!mesh->is_referenced) {
+      continue;
+    }
+
+    gp_instance* instance = &instances[instance_count];
+
+    if (!gp_invert_transform(mesh_ref->object_to_world, instance->world_to_object))
+    {
+      printf("Warning: skipping instance with singular transform\n");
+      continue;
+    }
+
+    instance->node_index = mesh->node_offset;
+    instance->face_offset = mesh->leaf_face_offset;
+    instance->face_count = mesh->leaf_face_count;
+    instance->padding = 0;
+
+    gp_aabb aabb;
+    gp_transform_aabb(mesh_ref->object_to_world, &mesh->bvhcc.aabb, &aabb);
+
+    gp_vertex* vertex_min = &instance_vertices[instance_count * 2 + 0];
+    gp_vertex* vertex_max = &instance_vertices[instance_count * 2 + 1];
+    memset(vertex_min, 0, sizeof(gp_vertex));
+    memset(vertex_max, 0, sizeof(gp_vertex));
+    gp_vec3_assign(aabb.min, vertex_min->pos);
+    gp_vec3_assign(aabb.max, vertex_max->pos);
+
+    gp_face* face = &instance_faces[instance_count];
+    face->v_i[0] = instance_count * 2 + 0;
+    face->v_i[1] = instance_count * 2 + 1;
+    face->v_i[2] = instance_count * 2 + 1;
+    face->mat_index = instance_count;
+
+    gp_add_instance_lights(
+      mesh_ref->object_to_world,
+      mesh->face_count, &faces[mesh->face_offset],
+      scene->vertices, scene->materials,
+      &scene->light_count, &light_capacity, &scene->lights
+    );
+
+    instance_count++;
+  }
+
+  free(mesh_refs);
+  free(faces);
+
+  scene->light_power = gp_build_light_alias_table(scene->light_count, scene->lights);
+
+  if (instance_count == 0) {
+    gp_fail("Scene contains no geometry.");
+  }
+
+  /* Build the top-level BVH. Spatial splits are disabled because
+   * instances can not be clipped. */
+  bvh_params.face_count = instance_count;
+  bvh_params.faces = instance_faces;
+  bvh_params.spatial_split_alpha = 1.0f;
+  bvh_params.vertex_count = instance_count * 2;
+  bvh_params.vertices = instance_vertices;
+
+  gp_bvhcc tlas;
+  gp_bvh_quality tlas_quality;
+  uint32_t tlas_instance_count;
+  gp_face* tlas_instance_faces;
+  gp_build_wide_bvh(&bvh_params, &cparams, stats, &tlas_quality, &tlas, &tlas_instance_count, &tlas_instance_faces);
+
+  stats->tlas_sah_cost = tlas_quality.sah_cost;
+
+  free(instance_faces);
+  free(instance_vertices);
+
+  /* Store instances in leaf order and combine all nodes into a single
+   * array, starting with the top-level BVH. */
+  scene->instance_count = tlas_instance_count;
+  scene->instances = (gp_instance*) malloc(tlas_instance_count * sizeof(gp_instance));
+
+  for (uint32_t i = 0; i < tlas_instance_count; ++i)
+  {
+    scene->instances[i] = instances[tlas_instance_faces[i].mat_index];
+    scene->instances[i].node_index += tlas.node_count;
+  }
+
+  free(tlas_instance_faces);
+  free(instances);
+
+  scene->bvhcc.aabb = tlas.aabb;
+  scene->bvhcc.node_count = tlas.node_count + blas_node_count;
+  scene->bvhcc.nodes = realloc(tlas.nodes, scene->bvhcc.node_count * sizeof(gp_bvhcc_node));
+
+  for (uint32_t m = 0; m < mesh_count; ++m)
+  {
+    gp_mesh* mesh = &meshes[m];
+
+    if (!mesh->is_referenced) {
+      continue;
+    }
+
+    gp_bvhcc_node* nodes = &scene->bvhcc.nodes[tlas.node_count + mesh->node_offset];
+    memcpy(nodes, mesh->bvhcc.nodes, mesh->bvhcc.node_count * sizeof(gp_bvhcc_node));
+
+    for (uint32_t i = 0; i < mesh->bvhcc.node_count; ++i)
+    {
+      nodes[i].child_index += tlas.node_count + mesh->node_offset;
+    }
+
+    gp_free_bvhcc(&mesh->bvhcc);
+  }
+
+  free(meshes);
 }
 
-static void gp_write_file(
-  const uint8_t* data,
-  uint64_t size,
-  const char* file_path)
+static uint32_t gp_pack_snorm16x2(float x, float y)
 {
-  FILE *file = fopen(file_path, "wb");
-  if (file == NULL) {
-    gp_fail("Unable to open file for writing.");
+  const int32_t qx = (int32_t) roundf(gp_maxf(-1.0f, gp_minf(1.0f, x)) * 32767.0f);
+  const int32_t qy = (int32_t) roundf(gp_maxf(-1.0f, gp_minf(1.0f, y)) * 32767.0f);
+  return ((uint32_t) qx & 0xFFFF) | (((uint32_t) qy & 0xFFFF) << 16);
+}
+
+/* Projects the normal onto the octahedron and unfolds the lower half. */
+static uint32_t gp_encode_octahedral_normal(const gp_vec3 n)
+{
+  const float l1_norm = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+
+  if (l1_norm == 0.0f) {
+    return gp_pack_snorm16x2(0.0f, 0.0f);
   }
 
-  const uint64_t written_size = fwrite(data, 1, size, file);
-  if (written_size != size) {
-    gp_fail("Unable to write file.");
+  float x = n[0] / l1_norm;
+  float y = n[1] / l1_norm;
+
+  if (n[2] < 0.0f)
+  {
+    const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
   }
 
-  const int close_result = fclose(file);
-  if (close_result != 0) {
-    printf("Unable to close file '%s'.", file_path);
+  return gp_pack_snorm16x2(x, y);
+}
+
+/* Rounds to the nearest half float. Values out of range become infinity. */
+static uint16_t gp_float_to_half(float f)
+{
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const int32_t exponent = (int32_t) ((bits >> 23) & 0xFF) - 127 + 15;
+  uint32_t mantissa = bits & 0x7FFFFF;
+
+  /* NaN and infinity. */
+  if (((bits >> 23) & 0xFF) == 0xFF) {
+    return (uint16_t) (sign | 0x7C00 | (mantissa ? 0x200 : 0));
+  }
+  if (exponent >= 31) {
+    return (uint16_t) (sign | 0x7C00);
+  }
+  /* Subnormal halves, or zero if too small. */
+  if (exponent <= 0)
+  {
+    if (exponent < -10) {
+      return (uint16_t) sign;
+    }
+    mantissa |= 0x800000;
+    const uint32_t shift = (uint32_t) (14 - exponent);
+    const uint32_t half_mantissa = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    const uint32_t round_up = (remainder > halfway) || (remainder == halfway && (half_mantissa & 1));
+    return (uint16_t) (sign | (half_mantissa + round_up));
   }
+
+  const uint32_t half = sign | ((uint32_t) exponent << 10) | (mantissa >> 13);
+  const uint32_t remainder = mantissa & 0x1FFF;
+  const uint32_t round_up = (remainder > 0x1000) || (remainder == 0x1000 && (half & 1));
+  /* A carry into the exponent is the correct result, up to infinity. */
+  return (uint16_t) (half + round_up);
 }
 
-static void gp_free_scene(gp_scene* scene)
+static uint64_t gp_add_section(
+  gatling_gsd_header* header,
+  GatlingGsdSectionType type,
+  uint64_t size,
+  uint64_t* file_size)
 {
-  gp_free_bvhcc(&scene->bvhcc);
-  free(scene->materials);
-  free(scene->vertices);
-  free(scene->faces);
+  const uint64_t offset =
+    ((*file_size) + GATLING_GSD_SECTION_ALIGNMENT - 1) / GATLING_GSD_SECTION_ALIGNMENT
+    * GATLING_GSD_SECTION_ALIGNMENT;
+
+  assert(header->section_count < GATLING_GSD_MAX_SECTION_COUNT);
+  gatling_gsd_section* section = &header->sections[header->section_count];
+  header->section_count++;
+
+  section->type = type;
+  section->padding = 0;
+  section->offset = offset;
+  section->size = size;
+
+  (*file_size) = offset + size;
+
+  return offset;
 }
 
-static void gp_write_scene(
+static int gp_print_build_info(
   const gp_scene* scene,
+  bool compress_vertices,
+  char* build_info,
+  size_t size)
+{
+  const gp_bvh_build_params* params = &scene->bvh_params;
+  const gp_bvh_collapse_params* cparams = &scene->cparams;
+
+  return snprintf(
+    build_info,
+    size,
+    "gp_version=%d.%d.%d\n"
+    "bvh_preset=%s\n"
+    "face_batch_size=%u\n"
+    "face_intersection_cost=%g\n"
+    "leaf_max_face_count=%u\n"
+    "object_binning_mode=%d\n"
+    "object_binning_threshold=%u\n"
+    "object_bin_count=%u\n"
+    "spatial_bin_count=%u\n"
+    "spatial_reserve_factor=%g\n"
+    "spatial_split_alpha=%g\n"
+    "collapse_face_intersection_cost=%g\n"
+    "collapse_max_leaf_size=%u\n"
+    "collapse_node_traversal_cost=%g\n"
+    "compress_vertices=%d\n",
+    GATLING_VERSION_MAJOR,
+    GATLING_VERSION_MINOR,
+    GATLING_VERSION_PATCH,
+    GP_BVH_PRESET_NAMES[scene->bvh_preset],
+    params->face_batch_size,
+    params->face_intersection_cost,
+    params->leaf_max_face_count,
+    (int) params->object_binning_mode,
+    params->object_binning_threshold,
+    params->object_bin_count,
+    params->spatial_bin_count,
+    params->spatial_reserve_factor,
+    params->spatial_split_alpha,
+    cparams->face_intersection_cost,
+    cparams->max_leaf_size,
+    cparams->node_traversal_cost,
+    (int) compress_vertices
+  );
+}
+
+/* Streams the scene sections into a memory-mapped file. Each section is
+ * released as soon as it has been written, so the scene must not be used
+ * afterwards. */
+static void gp_write_scene(
+  gp_scene* scene,
+  bool compress_vertices,
   const char* file_path)
 {
-  const gp_bvhcc* bvhcc = &scene->bvhcc;
+  gp_bvhcc* bvhcc = &scene->bvhcc;
+
+  char build_info[1024];
+  const int build_info_length = gp_print_build_info(scene, compress_vertices, build_info, sizeof(build_info));
+  assert(build_info_length > 0 && build_info_length < (int) sizeof(build_info));
+
+  gatling_gsd_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = GATLING_GSD_MAGIC;
+  header.version = GATLING_GSD_VERSION;
+  memcpy(header.aabb_min, bvhcc->aabb.min, sizeof(header.aabb_min));
+  memcpy(header.aabb_max, bvhcc->aabb.max, sizeof(header.aabb_max));
+  header.light_power = scene->light_power;
+  header.flags = compress_vertices ? GATLING_GSD_FLAG_COMPRESSED_VERTICES : 0;
+
+  uint64_t file_size = sizeof(gatling_gsd_header);
 
-  const uint64_t header_size = 88;
-  const uint64_t node_buf_offset = header_size;
   const uint64_t node_buf_size = bvhcc->node_count * sizeof(gp_bvhcc_node);
-  const uint64_t face_buf_offset = node_buf_offset + node_buf_size;
+  const uint64_t node_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_NODES, node_buf_size, &file_size);
   const uint64_t face_buf_size = scene->face_count * sizeof(gp_face);
-  const uint64_t vertex_buf_offset = face_buf_offset + face_buf_size;
-  const uint64_t vertex_buf_size = scene->vertex_count * sizeof(gp_vertex);
-  const uint64_t material_buf_offset = vertex_buf_offset + vertex_buf_size;
+  const uint64_t face_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_FACES, face_buf_size, &file_size);
+  const uint64_t triangle_buf_size = scene->face_count * sizeof(gp_triangle);
+  const uint64_t triangle_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_TRIANGLES, triangle_buf_size, &file_size);
+  const uint64_t vertex_size = compress_vertices ? sizeof(gp_compressed_vertex) : 32;
+  const uint64_t vertex_buf_size = scene->vertex_count * vertex_size;
+  const uint64_t vertex_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_VERTICES, vertex_buf_size, &file_size);
   const uint64_t material_buf_size = scene->material_count * sizeof(gp_material);
+  const uint64_t material_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_MATERIALS, material_buf_size, &file_size);
+  const uint64_t instance_buf_size = scene->instance_count * sizeof(gp_instance);
+  const uint64_t instance_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_INSTANCES, instance_buf_size, &file_size);
+  const uint64_t light_buf_size = scene->light_count * sizeof(gp_light);
+  const uint64_t light_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_LIGHTS, light_buf_size, &file_size);
+  const uint64_t build_info_size = (uint64_t) build_info_length;
+  const uint64_t build_info_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_BUILD_INFO, build_info_size, &file_size);
+  const uint64_t texture_buf_size = scene->texture_count * sizeof(gp_texture);
+  const uint64_t texture_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_TEXTURES, texture_buf_size, &file_size);
 
-  const uint64_t file_size = material_buf_offset + material_buf_size;
+  /* Pad the file so that its mapping can be imported as host memory. Texture
+   * pages are not part of that, so they start at the padded size. */
+  file_size = ((file_size + GATLING_GSD_FILE_ALIGNMENT - 1) / GATLING_GSD_FILE_ALIGNMENT) * GATLING_GSD_FILE_ALIGNMENT;
+  const uint64_t texture_page_buf_size = (uint64_t) scene->texture_page_count * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE;
+  const uint64_t texture_page_buf_offset = gp_add_section(&header, GATLING_GSD_SECTION_TYPE_TEXTURE_PAGES, texture_page_buf_size, &file_size);
+  file_size = ((file_size + GATLING_GSD_FILE_ALIGNMENT - 1) / GATLING_GSD_FILE_ALIGNMENT) * GATLING_GSD_FILE_ALIGNMENT;
+  header.file_size = file_size;
 
-  uint8_t* buffer = malloc(file_size);
+  gatling_file* file;
+  if (!gatling_file_create(file_path, file_size, &file)) {
+    gp_fail("Unable to open file for writing.");
+  }
 
-  memcpy(&buffer[ 0], &node_buf_offset,     8);
-  memcpy(&buffer[ 8], &node_buf_size,       8);
-  memcpy(&buffer[16], &face_buf_offset,     8);
-  memcpy(&buffer[24], &face_buf_size,       8);
-  memcpy(&buffer[32], &vertex_buf_offset,   8);
-  memcpy(&buffer[40], &vertex_buf_size,     8);
-  memcpy(&buffer[48], &material_buf_offset, 8);
-  memcpy(&buffer[56], &material_buf_size,   8);
-  memcpy(&buffer[64], &bvhcc->aabb, sizeof(gp_aabb));
+  uint8_t* buffer = (uint8_t*) gatling_mmap(file, 0, file_size);
+  if (!buffer) {
+    gp_fail("Unable to map file.");
+  }
+
+  /* The file is zero-initialized, so padding between sections is deterministic. */
+  memcpy(buffer, &header, sizeof(header));
 
   memcpy(&buffer[node_buf_offset], bvhcc->nodes, node_buf_size);
+  gp_free_bvhcc(bvhcc);
+
+  /* Traversal only reads the positions of the faces in leaf order, so they are
+   * stored contiguously next to each other, with the edges precomputed. */
+  for (uint32_t i = 0; i < scene->face_count; ++i)
+  {
+    const gp_face* face = &scene->faces[i];
+    const float* p0 = scene->vertices[face->v_i[0]].pos;
+    const float* p1 = scene->vertices[face->v_i[1]].pos;
+    const float* p2 = scene->vertices[face->v_i[2]].pos;
+
+    gp_triangle triangle;
+    memset(&triangle, 0, sizeof(triangle));
+    gp_vec3_assign(p0, triangle.v_0);
+    gp_vec3_sub(p1, p0, triangle.e_1);
+    gp_vec3_sub(p2, p0, triangle.e_2);
+
+    memcpy(&buffer[triangle_buf_offset + i * sizeof(gp_triangle)], &triangle, sizeof(gp_triangle));
+  }
 
   memcpy(&buffer[face_buf_offset], scene->faces, face_buf_size);
+  free(scene->faces);
+
+  for (uint32_t i = 0; i < scene->vertex_count && compress_vertices; ++i)
+  {
+    gp_compressed_vertex vertex;
+    vertex.norm = gp_encode_octahedral_normal(scene->vertices[i].norm);
+    vertex.uv = (uint32_t) gp_float_to_half(scene->vertices[i].uv[0]) |
+                ((uint32_t) gp_float_to_half(scene->vertices[i].uv[1]) << 16);
+
+    memcpy(&buffer[vertex_buf_offset + i * vertex_size], &vertex, sizeof(vertex));
+  }
 
-  for (uint32_t i = 0; i < scene->vertex_count; ++i)
+  for (uint32_t i = 0; i < scene->vertex_count && !compress_vertices; ++i)
   {
-    uint8_t* ptr = &buffer[vertex_buf_offset + i * 32];
+    uint8_t* ptr = &buffer[vertex_buf_offset + i * vertex_size];
     memcpy(&ptr[ 0], &scene->vertices[i].pos[0],  4);
     memcpy(&ptr[ 4], &scene->vertices[i].pos[1],  4);
     memcpy(&ptr[ 8], &scene->vertices[i].pos[2],  4);
@@ -292,37 +1480,262 @@ static void gp_write_scene(
     memcpy(&ptr[24], &scene->vertices[i].norm[2], 4);
     memcpy(&ptr[28], &scene->vertices[i].uv[1],   4);
   }
+  free(scene->vertices);
 
   memcpy(&buffer[material_buf_offset], scene->materials, material_buf_size);
+  free(scene->materials);
+
+  memcpy(&buffer[instance_buf_offset], scene->instances, instance_buf_size);
+  free(scene->instances);
+
+  memcpy(&buffer[light_buf_offset], scene->lights, light_buf_size);
+  free(scene->lights);
 
-  gp_write_file(buffer, file_size, file_path);
+  memcpy(&buffer[build_info_offset], build_info, build_info_size);
+
+  memcpy(&buffer[texture_buf_offset], scene->textures, texture_buf_size);
+  free(scene->textures);
+
+  memcpy(&buffer[texture_page_buf_offset], scene->texture_pages, texture_page_buf_size);
+  free(scene->texture_pages);
+
+  if (!gatling_munmap(file, buffer)) {
+    gp_fail("Unable to unmap file.");
+  }
 
-  free(buffer);
+  if (!gatling_file_close(file)) {
+    printf("Unable to close file '%s'.", file_path);
+  }
+}
+
+static void gp_write_stats(const gp_stats* stats, GpBvhPreset bvh_preset, const char* file_path)
+{
+  FILE* file = fopen(file_path, "w");
+  if (!file) {
+    gp_fail("Unable to open stats file.");
+  }
+
+  const double sah_cost = (stats->face_count > 0) ? (stats->weighted_sah_cost / stats->face_count) : 0.0;
+  const double duplication_ratio = (stats->face_count > 0) ?
+    ((double) stats->face_reference_count / stats->face_count) : 0.0;
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"bvh_preset\": \"%s\",\n", GP_BVH_PRESET_NAMES[bvh_preset]);
+  fprintf(file, "  \"timings\": {\n");
+  fprintf(file, "    \"import\": %.6f,\n", stats->import_time);
+  fprintf(file, "    \"build\": %.6f,\n", stats->build_time);
+  fprintf(file, "    \"collapse\": %.6f,\n", stats->collapse_time);
+  fprintf(file, "    \"compress\": %.6f,\n", stats->compress_time);
+  fprintf(file, "    \"write\": %.6f\n", stats->write_time);
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"built_bvh_count\": %u,\n", stats->built_bvh_count);
+  fprintf(file, "  \"cached_bvh_count\": %u,\n", stats->cached_bvh_count);
+  fprintf(file, "  \"face_count\": %llu,\n", (unsigned long long) stats->face_count);
+  fprintf(file, "  \"face_reference_count\": %llu,\n", (unsigned long long) stats->face_reference_count);
+  fprintf(file, "  \"duplication_ratio\": %.6f,\n", duplication_ratio);
+  fprintf(file, "  \"binary_node_count\": %llu,\n", (unsigned long long) stats->binary_node_count);
+  fprintf(file, "  \"node_count\": %llu,\n", (unsigned long long) stats->node_count);
+  fprintf(file, "  \"sah_cost\": %.6f,\n", sah_cost);
+  fprintf(file, "  \"tlas_sah_cost\": %.6f,\n", stats->tlas_sah_cost);
+  fprintf(file, "  \"leaf_size_histogram\": [");
+  for (uint32_t i = 0; i <= GP_STATS_MAX_LEAF_SIZE; ++i) {
+    fprintf(file, "%s%llu", (i > 0) ? ", " : "", (unsigned long long) stats->leaf_size_counts[i]);
+  }
+  fprintf(file, "],\n");
+  fprintf(file, "  \"auto_candidate_counts\": [");
+  for (uint32_t i = 0; i < GP_BVH_AUTO_CANDIDATE_COUNT; ++i) {
+    fprintf(file, "%s%u", (i > 0) ? ", " : "", stats->auto_candidate_counts[i]);
+  }
+  fprintf(file, "],\n");
+  fprintf(file, "  \"texture_count\": %u,\n", stats->texture_count);
+  fprintf(file, "  \"texture_page_count\": %u\n", stats->texture_page_count);
+  fprintf(file, "}\n");
+
+  if (fclose(file) != 0) {
+    gp_fail("Unable to write stats file.");
+  }
+}
+
+static void gp_print_usage_and_exit()
+{
+  printf("Usage: gp <input_file> <output.gsd> [options]\n");
+  printf("\n");
+  printf("Options:\n");
+  printf("--cache-dir  Directory for reusing mesh BVHs between runs\n");
+  printf("--compress-vertices  Store normals and UVs with reduced precision [default: 0]\n");
+  printf("--stats      JSON file for build timings and BVH quality metrics\n");
+  printf("--bvh-preset [default: default, fast-build, max-quality or auto]\n");
+  printf("\n");
+  printf("BVH options, which override the preset:\n");
+  printf("--leaf-max-face-count\n");
+  printf("--object-bin-count\n");
+  printf("--spatial-bin-count\n");
+  printf("--spatial-split-alpha  Overlap relative to the root area above which spatial splits are tried, 1 disables them\n");
+  printf("--face-intersection-cost  Relative to a node traversal, for building\n");
+  printf("--collapse-face-intersection-cost  Relative to a node traversal, for collapsing\n");
+  printf("--max-leaf-size  Faces per leaf of the wide BVH, at most 3\n");
+  exit(EXIT_FAILURE);
+}
+
+static bool gp_parse_uint(const char* value, uint32_t* result)
+{
+  char* endptr = NULL;
+  const long parsed = strtol(value, &endptr, 10);
+  (*result) = (uint32_t) parsed;
+  return endptr != value && (*endptr) == '\0' && parsed > 0;
+}
+
+static bool gp_parse_float(const char* value, float* result)
+{
+  char* endptr = NULL;
+  (*result) = strtof(value, &endptr);
+  return endptr != value && (*endptr) == '\0' && (*result) >= 0.0f;
 }
 
 int main(int argc, const char* argv[])
 {
-  if (argc != 3)
-  {
-    printf("Usage: gp <input_file> <output.gsd>\n");
-    return EXIT_FAILURE;
+  if (argc < 3) {
+    gp_print_usage_and_exit();
   }
 
   const char* file_path_in = argv[1];
   const char* file_path_out = argv[2];
+  const char* cache_dir_path = NULL;
+  const char* stats_path = NULL;
+  bool compress_vertices = false;
+
+  /* The preset is applied first, so that the other options can override it
+   * regardless of their order. */
+  GpBvhPreset bvh_preset = GP_BVH_PRESET_DEFAULT;
+
+  for (int i = 3; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+
+    if (strstr(arg, "--bvh-preset=") != arg) {
+      continue;
+    }
+
+    const char* value = &arg[strlen("--bvh-preset=")];
+
+    bvh_preset = GP_BVH_PRESET_COUNT;
+
+    for (uint32_t p = 0; p < GP_BVH_PRESET_COUNT; ++p)
+    {
+      if (!strcmp(value, GP_BVH_PRESET_NAMES[p])) {
+        bvh_preset = (GpBvhPreset) p;
+      }
+    }
+
+    if (bvh_preset == GP_BVH_PRESET_COUNT) {
+      gp_print_usage_and_exit();
+    }
+  }
+
+  gp_bvh_build_params bvh_params;
+  gp_bvh_collapse_params cparams;
+  gp_set_bvh_preset(bvh_preset, &bvh_params, &cparams);
+
+  uint32_t fixed_bvh_params = 0;
+
+  for (int i = 3; i < argc; ++i)
+  {
+    const char* arg = argv[i];
+
+    const char* value = strpbrk(arg, "=");
+
+    if (value == NULL) {
+      gp_print_usage_and_exit();
+    }
+
+    value++;
+
+    if (strstr(arg, "--cache-dir=") == arg && value[0] != '\0')
+    {
+      cache_dir_path = value;
+    }
+    else if (strstr(arg, "--stats=") == arg && value[0] != '\0')
+    {
+      stats_path = value;
+    }
+    else if (strstr(arg, "--compress-vertices=") == arg && (!strcmp(value, "0") || !strcmp(value, "1")))
+    {
+      compress_vertices = (value[0] == '1');
+    }
+    else if (strstr(arg, "--bvh-preset=") == arg)
+    {
+      continue;
+    }
+    else if (strstr(arg, "--leaf-max-face-count=") == arg && gp_parse_uint(value, &bvh_params.leaf_max_face_count))
+    {
+      continue;
+    }
+    else if (strstr(arg, "--object-bin-count=") == arg && gp_parse_uint(value, &bvh_params.object_bin_count))
+    {
+      continue;
+    }
+    else if (strstr(arg, "--spatial-bin-count=") == arg && gp_parse_uint(value, &bvh_params.spatial_bin_count))
+    {
+      continue;
+    }
+    else if (strstr(arg, "--spatial-split-alpha=") == arg && gp_parse_float(value, &bvh_params.spatial_split_alpha) &&
+             bvh_params.spatial_split_alpha <= 1.0f)
+    {
+      fixed_bvh_params |= GP_BVH_FIXED_PARAM_SPATIAL_SPLIT_ALPHA;
+    }
+    else if (strstr(arg, "--face-intersection-cost=") == arg && gp_parse_float(value, &bvh_params.face_intersection_cost))
+    {
+      continue;
+    }
+    else if (strstr(arg, "--collapse-face-intersection-cost=") == arg && gp_parse_float(value, &cparams.face_intersection_cost))
+    {
+      continue;
+    }
+    else if (strstr(arg, "--max-leaf-size=") == arg && gp_parse_uint(value, &cparams.max_leaf_size) &&
+             cparams.max_leaf_size <= 3)
+    {
+      fixed_bvh_params |= GP_BVH_FIXED_PARAM_MAX_LEAF_SIZE;
+    }
+    else
+    {
+      gp_print_usage_and_exit();
+    }
+  }
+
+  gp_stats stats;
+  memset(&stats, 0, sizeof(stats));
 
   gp_scene scene;
   gp_load_scene(
     &scene,
-    file_path_in
+    file_path_in,
+    cache_dir_path,
+    bvh_preset,
+    fixed_bvh_params,
+    &bvh_params,
+    &cparams,
+    &stats
   );
 
+  const double write_start = gp_get_time();
+
   gp_write_scene(
     &scene,
+    compress_vertices,
     file_path_out
   );
 
-  gp_free_scene(&scene);
+  stats.write_time = gp_get_time() - write_start;
+
+  printf("Imported in %.2fs, built BVHs in %.2fs, wrote scene in %.2fs\n",
+    stats.import_time,
+    stats.build_time + stats.collapse_time + stats.compress_time,
+    stats.write_time
+  );
+
+  if (stats_path) {
+    gp_write_stats(&stats, bvh_preset, stats_path);
+  }
 
   return EXIT_SUCCESS;
 }
@@ -4,6 +4,30 @@
 #include "gp.h"
 
 #include <stdint.h>
+#include <math.h>
+#include <assert.h>
+
+/*
+ * Functions used in the inner loops of the BVH builder are defined inline
+ * in this header. AABB merging and intersection use 4-wide min/max
+ * operations if supported by the target ISA, which is determined at
+ * compile time. The AABB memory layout is left untouched: we operate on
+ * two overlapping 4-float windows [min.xyz, max.x] and [min.z, max.xyz].
+ * All code paths have the same min/max semantics as SSE (the second
+ * operand is returned in case of equality), so that results do not
+ * depend on the ISA.
+ */
+
+#if defined(__SSE4_1__) || defined(__AVX__)
+  #define GP_MATH_SSE41
+  #include <smmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define GP_MATH_SSE2
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define GP_MATH_NEON
+  #include <arm_neon.h>
+#endif
 
 typedef float gp_vec3[3];
 
@@ -12,31 +36,222 @@ typedef struct gp_aabb {
   gp_vec3 max;
 } gp_aabb;
 
-void gp_vec3_assign(const gp_vec3 a, gp_vec3 b);
-void gp_vec3_add(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
-void gp_vec3_sub(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
+static inline float gp_minf(float a, float b) { return (a < b) ? a : b; }
+static inline float gp_maxf(float a, float b) { return (a > b) ? a : b; }
+
+static inline void gp_vec3_assign(const gp_vec3 a, gp_vec3 b)
+{
+  b[0] = a[0];
+  b[1] = a[1];
+  b[2] = a[2];
+}
+
+static inline void gp_vec3_add(const gp_vec3 a, const gp_vec3 b, gp_vec3 c)
+{
+  c[0] = a[0] + b[0];
+  c[1] = a[1] + b[1];
+  c[2] = a[2] + b[2];
+}
+
+static inline void gp_vec3_sub(const gp_vec3 a, const gp_vec3 b, gp_vec3 c)
+{
+  c[0] = a[0] - b[0];
+  c[1] = a[1] - b[1];
+  c[2] = a[2] - b[2];
+}
+
+static inline void gp_vec3_divs(const gp_vec3 a, float s, gp_vec3 b)
+{
+  assert(s != 0.0f);
+  b[0] = a[0] / s;
+  b[1] = a[1] / s;
+  b[2] = a[2] / s;
+}
+
+static inline void gp_vec3_muls(const gp_vec3 a, float s, gp_vec3 b)
+{
+  b[0] = a[0] * s;
+  b[1] = a[1] * s;
+  b[2] = a[2] * s;
+}
+
+static inline void gp_vec3_lerp(const gp_vec3 a, const gp_vec3 b, float t, gp_vec3 v)
+{
+  v[0] = (1.0f - t) * a[0] + t * b[0];
+  v[1] = (1.0f - t) * a[1] + t * b[1];
+  v[2] = (1.0f - t) * a[2] + t * b[2];
+}
+
+static inline void gp_vec3_max(const gp_vec3 a, const gp_vec3 b, gp_vec3 c)
+{
+  c[0] = gp_maxf(a[0], b[0]);
+  c[1] = gp_maxf(a[1], b[1]);
+  c[2] = gp_maxf(a[2], b[2]);
+}
+
+static inline void gp_vec3_min(const gp_vec3 a, const gp_vec3 b, gp_vec3 c)
+{
+  c[0] = gp_minf(a[0], b[0]);
+  c[1] = gp_minf(a[1], b[1]);
+  c[2] = gp_minf(a[2], b[2]);
+}
+
 void gp_vec3_div(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
-void gp_vec3_divs(const gp_vec3 a, float s, gp_vec3 b);
 void gp_vec3_sdiv(float s, const gp_vec3 a, gp_vec3 b);
 void gp_vec3_mul(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
-void gp_vec3_muls(const gp_vec3 a, float s, gp_vec3 b);
 float gp_vec3_dot(const gp_vec3 a, const gp_vec3 b);
 void gp_vec3_cross(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
-void gp_vec3_lerp(const gp_vec3 a, const gp_vec3 b, float t, gp_vec3 v);
 float gp_vec3_length(const gp_vec3 v);
-void gp_vec3_max(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
-void gp_vec3_min(const gp_vec3 a, const gp_vec3 b, gp_vec3 c);
 float gp_vec3_comp_min(const gp_vec3 v);
 float gp_vec3_comp_max(const gp_vec3 v);
 
-void gp_aabb_make_smallest(gp_aabb* aabb);
+static inline void gp_aabb_make_smallest(gp_aabb* aabb)
+{
+  aabb->min[0] = +INFINITY;
+  aabb->min[1] = +INFINITY;
+  aabb->min[2] = +INFINITY;
+  aabb->max[0] = -INFINITY;
+  aabb->max[1] = -INFINITY;
+  aabb->max[2] = -INFINITY;
+}
+
+static inline void gp_aabb_make_from_triangle(const gp_vec3 v_a,
+                                              const gp_vec3 v_b,
+                                              const gp_vec3 v_c,
+                                              gp_aabb* aabb)
+{
+  aabb->min[0] = gp_minf(gp_minf(v_a[0], v_b[0]), v_c[0]);
+  aabb->min[1] = gp_minf(gp_minf(v_a[1], v_b[1]), v_c[1]);
+  aabb->min[2] = gp_minf(gp_minf(v_a[2], v_b[2]), v_c[2]);
+  aabb->max[0] = gp_maxf(gp_maxf(v_a[0], v_b[0]), v_c[0]);
+  aabb->max[1] = gp_maxf(gp_maxf(v_a[1], v_b[1]), v_c[1]);
+  aabb->max[2] = gp_maxf(gp_maxf(v_a[2], v_b[2]), v_c[2]);
+}
+
+#if defined(GP_MATH_SSE41) || defined(GP_MATH_SSE2)
+
+static inline __m128 gp_m128_select(__m128 mask, __m128 a, __m128 b)
+{
+#if defined(GP_MATH_SSE41)
+  return _mm_blendv_ps(b, a, mask);
+#else
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+#endif
+}
+
+/* Applies op_min to the min and op_max to the max components. */
+#define GP_AABB_SSE_MINMAX(aabb_a, aabb_b, aabb_c, op_min, op_max)                   \
+  do {                                                                               \
+    const __m128 lo_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));           \
+    const __m128 hi_mask = _mm_castsi128_ps(_mm_set_epi32(0, 0, 0, -1));             \
+    const __m128 a_lo = _mm_loadu_ps(&(aabb_a)->min[0]);                             \
+    const __m128 a_hi = _mm_loadu_ps(&(aabb_a)->min[2]);                             \
+    const __m128 b_lo = _mm_loadu_ps(&(aabb_b)->min[0]);                             \
+    const __m128 b_hi = _mm_loadu_ps(&(aabb_b)->min[2]);                             \
+    const __m128 c_lo = gp_m128_select(lo_mask, op_min(a_lo, b_lo), op_max(a_lo, b_lo)); \
+    const __m128 c_hi = gp_m128_select(hi_mask, op_min(a_hi, b_hi), op_max(a_hi, b_hi)); \
+    _mm_storeu_ps(&(aabb_c)->min[0], c_lo);                                          \
+    _mm_storeu_ps(&(aabb_c)->min[2], c_hi);                                          \
+  } while (0)
+
+static inline void gp_aabb_merge(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  GP_AABB_SSE_MINMAX(aabb_a, aabb_b, aabb_c, _mm_min_ps, _mm_max_ps);
+}
+
+static inline void gp_aabb_intersect(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  GP_AABB_SSE_MINMAX(aabb_a, aabb_b, aabb_c, _mm_max_ps, _mm_min_ps);
+}
+
+#undef GP_AABB_SSE_MINMAX
+
+#elif defined(GP_MATH_NEON)
+
+/* Applies op_min to the min and op_max to the max components. */
+#define GP_AABB_NEON_MINMAX(aabb_a, aabb_b, aabb_c, op_min, op_max)                   \
+  do {                                                                                \
+    const uint32_t lo_mask_data[4] = { ~0u, ~0u, ~0u, 0u };                           \
+    const uint32_t hi_mask_data[4] = { ~0u, 0u, 0u, 0u };                             \
+    const uint32x4_t lo_mask = vld1q_u32(lo_mask_data);                               \
+    const uint32x4_t hi_mask = vld1q_u32(hi_mask_data);                               \
+    const float32x4_t a_lo = vld1q_f32(&(aabb_a)->min[0]);                            \
+    const float32x4_t a_hi = vld1q_f32(&(aabb_a)->min[2]);                            \
+    const float32x4_t b_lo = vld1q_f32(&(aabb_b)->min[0]);                            \
+    const float32x4_t b_hi = vld1q_f32(&(aabb_b)->min[2]);                            \
+    const float32x4_t c_lo = vbslq_f32(lo_mask, op_min(a_lo, b_lo), op_max(a_lo, b_lo)); \
+    const float32x4_t c_hi = vbslq_f32(hi_mask, op_min(a_hi, b_hi), op_max(a_hi, b_hi)); \
+    vst1q_f32(&(aabb_c)->min[0], c_lo);                                               \
+    vst1q_f32(&(aabb_c)->min[2], c_hi);                                               \
+  } while (0)
+
+/* NEON min/max differ from SSE for NaNs and when comparing signed zeros. */
+static inline float32x4_t gp_neon_min(float32x4_t a, float32x4_t b) { return vbslq_f32(vcltq_f32(a, b), a, b); }
+static inline float32x4_t gp_neon_max(float32x4_t a, float32x4_t b) { return vbslq_f32(vcgtq_f32(a, b), a, b); }
+
+static inline void gp_aabb_merge(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  GP_AABB_NEON_MINMAX(aabb_a, aabb_b, aabb_c, gp_neon_min, gp_neon_max);
+}
+
+static inline void gp_aabb_intersect(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  GP_AABB_NEON_MINMAX(aabb_a, aabb_b, aabb_c, gp_neon_max, gp_neon_min);
+}
+
+#undef GP_AABB_NEON_MINMAX
+
+#else
+
+static inline void gp_aabb_merge(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  aabb_c->min[0] = gp_minf(aabb_a->min[0], aabb_b->min[0]);
+  aabb_c->min[1] = gp_minf(aabb_a->min[1], aabb_b->min[1]);
+  aabb_c->min[2] = gp_minf(aabb_a->min[2], aabb_b->min[2]);
+  aabb_c->max[0] = gp_maxf(aabb_a->max[0], aabb_b->max[0]);
+  aabb_c->max[1] = gp_maxf(aabb_a->max[1], aabb_b->max[1]);
+  aabb_c->max[2] = gp_maxf(aabb_a->max[2], aabb_b->max[2]);
+}
+
+static inline void gp_aabb_intersect(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c)
+{
+  aabb_c->min[0] = gp_maxf(aabb_a->min[0], aabb_b->min[0]);
+  aabb_c->min[1] = gp_maxf(aabb_a->min[1], aabb_b->min[1]);
+  aabb_c->min[2] = gp_maxf(aabb_a->min[2], aabb_b->min[2]);
+  aabb_c->max[0] = gp_minf(aabb_a->max[0], aabb_b->max[0]);
+  aabb_c->max[1] = gp_minf(aabb_a->max[1], aabb_b->max[1]);
+  aabb_c->max[2] = gp_minf(aabb_a->max[2], aabb_b->max[2]);
+}
+
+#endif
+
+/* Edge clipping may produce NaN points for degenerate edges. Because the
+ * second operand is returned if a comparison fails, these are ignored. */
+static inline void gp_aabb_include(const gp_aabb* aabb_a, const gp_vec3 v, gp_aabb* aabb_b)
+{
+  aabb_b->min[0] = gp_minf(v[0], aabb_a->min[0]);
+  aabb_b->min[1] = gp_minf(v[1], aabb_a->min[1]);
+  aabb_b->min[2] = gp_minf(v[2], aabb_a->min[2]);
+  aabb_b->max[0] = gp_maxf(v[0], aabb_a->max[0]);
+  aabb_b->max[1] = gp_maxf(v[1], aabb_a->max[1]);
+  aabb_b->max[2] = gp_maxf(v[2], aabb_a->max[2]);
+}
+
+static inline void gp_aabb_size(const gp_aabb* aabb, gp_vec3 size)
+{
+  size[0] = gp_maxf(aabb->max[0] - aabb->min[0], 0.0f);
+  size[1] = gp_maxf(aabb->max[1] - aabb->min[1], 0.0f);
+  size[2] = gp_maxf(aabb->max[2] - aabb->min[2], 0.0f);
+}
+
+static inline float gp_aabb_half_area(const gp_aabb* aabb)
+{
+  gp_vec3 size;
+  gp_aabb_size(aabb, size);
+  return size[0] * size[1] + size[0] * size[2] + size[1] * size[2];
+}
+
 void gp_aabb_make_biggest(gp_aabb* aabb);
-void gp_aabb_make_from_triangle(const gp_vec3 v_a, const gp_vec3 v_b, const gp_vec3 v_c, gp_aabb* aabb);
-void gp_aabb_merge(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c);
-void gp_aabb_include(const gp_aabb* aabb_a, const gp_vec3 v, gp_aabb* aabb_b);
-void gp_aabb_intersect(const gp_aabb* aabb_a, const gp_aabb* aabb_b, gp_aabb* aabb_c);
-void gp_aabb_size(const gp_aabb* aabb, gp_vec3 size);
-float gp_aabb_half_area(const gp_aabb* aabb);
 float gp_aabb_area(const gp_aabb* aabb);
 
 #endif
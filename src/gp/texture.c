@@ -0,0 +1,351 @@
+#include "texture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "gsd.h"
+
+#define GP_TEXTURE_PAGE_SIZE GATLING_GSD_TEXTURE_PAGE_SIZE
+#define GP_TEXTURE_PAGE_BLOCK_COUNT (GATLING_GSD_TEXTURE_PAGE_SIZE / 4)
+
+bool gp_texture_decode_tga(
+  const uint8_t* data,
+  uint64_t size,
+  uint32_t* width,
+  uint32_t* height,
+  uint8_t** rgba)
+{
+  if (size < 18)
+  {
+    return false;
+  }
+
+  const uint32_t id_length = data[0];
+  const uint32_t color_map_type = data[1];
+  const uint32_t image_type = data[2];
+  const uint32_t w = data[12] | (data[13] << 8);
+  const uint32_t h = data[14] | (data[15] << 8);
+  const uint32_t bits_per_pixel = data[16];
+  const uint32_t descriptor = data[17];
+
+  const bool is_color = image_type == 2 && (bits_per_pixel == 24 || bits_per_pixel == 32);
+  const bool is_gray = image_type == 3 && bits_per_pixel == 8;
+
+  if (color_map_type != 0 || (!is_color && !is_gray) || w == 0 || h == 0)
+  {
+    return false;
+  }
+
+  const uint32_t bytes_per_pixel = bits_per_pixel / 8;
+  const uint64_t pixel_offset = 18 + id_length;
+
+  if (size < pixel_offset + (uint64_t) w * h * bytes_per_pixel)
+  {
+    return false;
+  }
+
+  /* Rows are stored bottom-up, unless bit 5 of the descriptor is set. */
+  const bool is_top_down = (descriptor & 0x20) != 0;
+
+  uint8_t* out = (uint8_t*) malloc((size_t) w * h * 4);
+
+  for (uint32_t y = 0; y < h; ++y)
+  {
+    const uint32_t out_y = is_top_down ? y : (h - 1 - y);
+
+    for (uint32_t x = 0; x < w; ++x)
+    {
+      const uint8_t* src = &data[pixel_offset + ((uint64_t) y * w + x) * bytes_per_pixel];
+      uint8_t* dst = &out[((size_t) out_y * w + x) * 4];
+
+      if (is_gray)
+      {
+        dst[0] = src[0];
+        dst[1] = src[0];
+        dst[2] = src[0];
+        dst[3] = 255;
+      }
+      else
+      {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = (bytes_per_pixel == 4) ? src[3] : 255;
+      }
+    }
+  }
+
+  *width = w;
+  *height = h;
+  *rgba = out;
+  return true;
+}
+
+static uint32_t gp_texture_level_size(uint32_t size, uint32_t level)
+{
+  const uint32_t level_size = size >> level;
+  return (level_size > 0) ? level_size : 1;
+}
+
+static uint32_t gp_texture_level_page_count(uint32_t width, uint32_t height, uint32_t level)
+{
+  const uint32_t level_width = gp_texture_level_size(width, level);
+  const uint32_t level_height = gp_texture_level_size(height, level);
+  const uint32_t page_count_x = (level_width + GP_TEXTURE_PAGE_SIZE - 1) / GP_TEXTURE_PAGE_SIZE;
+  const uint32_t page_count_y = (level_height + GP_TEXTURE_PAGE_SIZE - 1) / GP_TEXTURE_PAGE_SIZE;
+  return page_count_x * page_count_y;
+}
+
+static float gp_srgb_to_linear(float c)
+{
+  return (c <= 0.04045f) ? (c / 12.92f) : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t gp_linear_to_srgb(float c)
+{
+  const float s = (c <= 0.0031308f) ? (c * 12.92f) : (1.055f * powf(c, 1.0f / 2.4f) - 0.055f);
+  const float clamped = fminf(fmaxf(s, 0.0f), 1.0f);
+  return (uint8_t) (clamped * 255.0f + 0.5f);
+}
+
+/* Averages 2x2 texels, or fewer at odd edges. Color is filtered in linear
+ * space, since averaging sRGB values darkens high-contrast regions. */
+static void gp_texture_downsample(
+  const float* srgb_to_linear,
+  const uint8_t* src,
+  uint32_t src_width,
+  uint32_t src_height,
+  uint8_t* dst,
+  uint32_t dst_width,
+  uint32_t dst_height)
+{
+  for (uint32_t y = 0; y < dst_height; ++y)
+  {
+    const uint32_t y0 = (y * 2 < src_height) ? (y * 2) : (src_height - 1);
+    const uint32_t y1 = (y * 2 + 1 < src_height) ? (y * 2 + 1) : y0;
+
+    for (uint32_t x = 0; x < dst_width; ++x)
+    {
+      const uint32_t x0 = (x * 2 < src_width) ? (x * 2) : (src_width - 1);
+      const uint32_t x1 = (x * 2 + 1 < src_width) ? (x * 2 + 1) : x0;
+
+      const uint8_t* t00 = &src[((size_t) y0 * src_width + x0) * 4];
+      const uint8_t* t01 = &src[((size_t) y0 * src_width + x1) * 4];
+      const uint8_t* t10 = &src[((size_t) y1 * src_width + x0) * 4];
+      const uint8_t* t11 = &src[((size_t) y1 * src_width + x1) * 4];
+      uint8_t* out = &dst[((size_t) y * dst_width + x) * 4];
+
+      for (uint32_t c = 0; c < 3; ++c)
+      {
+        const float sum = srgb_to_linear[t00[c]] + srgb_to_linear[t01[c]] +
+                          srgb_to_linear[t10[c]] + srgb_to_linear[t11[c]];
+        out[c] = gp_linear_to_srgb(sum * 0.25f);
+      }
+
+      out[3] = (uint8_t) ((t00[3] + t01[3] + t10[3] + t11[3] + 2) / 4);
+    }
+  }
+}
+
+static uint16_t gp_pack_rgb565(const float c[3])
+{
+  const uint32_t r = (uint32_t) (c[0] * 31.0f / 255.0f + 0.5f);
+  const uint32_t g = (uint32_t) (c[1] * 63.0f / 255.0f + 0.5f);
+  const uint32_t b = (uint32_t) (c[2] * 31.0f / 255.0f + 0.5f);
+  return (uint16_t) ((r << 11) | (g << 5) | b);
+}
+
+static void gp_unpack_rgb565(uint16_t c, float out[3])
+{
+  out[0] = (float) ((c >> 11) & 0x1F) * 255.0f / 31.0f;
+  out[1] = (float) ((c >> 5) & 0x3F) * 255.0f / 63.0f;
+  out[2] = (float) (c & 0x1F) * 255.0f / 31.0f;
+}
+
+/* Every channel of the first endpoint is at least that of the second one, so
+ * unless they are equal, the block uses the four-color mode. Indices of equal
+ * endpoints are zero, which selects the first one in either mode. */
+static void gp_texture_compress_bc1(const uint8_t texels[16][4], uint8_t block[8])
+{
+  float min[3] = { 255.0f, 255.0f, 255.0f };
+  float max[3] = { 0.0f, 0.0f, 0.0f };
+
+  for (uint32_t i = 0; i < 16; ++i)
+  {
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+      min[c] = fminf(min[c], (float) texels[i][c]);
+      max[c] = fmaxf(max[c], (float) texels[i][c]);
+    }
+  }
+
+  const uint16_t c0 = gp_pack_rgb565(max);
+  const uint16_t c1 = gp_pack_rgb565(min);
+  uint32_t indices = 0;
+
+  if (c0 != c1)
+  {
+    float palette[4][3];
+    gp_unpack_rgb565(c0, palette[0]);
+    gp_unpack_rgb565(c1, palette[1]);
+
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+      palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+      palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+      uint32_t best_index = 0;
+      float best_dist = INFINITY;
+
+      for (uint32_t p = 0; p < 4; ++p)
+      {
+        float dist = 0.0f;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+          const float d = (float) texels[i][c] - palette[p][c];
+          dist += d * d;
+        }
+
+        if (dist < best_dist)
+        {
+          best_dist = dist;
+          best_index = p;
+        }
+      }
+
+      indices |= best_index << (i * 2);
+    }
+  }
+
+  block[0] = (uint8_t) (c0 & 0xFF);
+  block[1] = (uint8_t) (c0 >> 8);
+  block[2] = (uint8_t) (c1 & 0xFF);
+  block[3] = (uint8_t) (c1 >> 8);
+  block[4] = (uint8_t) (indices & 0xFF);
+  block[5] = (uint8_t) ((indices >> 8) & 0xFF);
+  block[6] = (uint8_t) ((indices >> 16) & 0xFF);
+  block[7] = (uint8_t) (indices >> 24);
+}
+
+static void gp_texture_compress_level(
+  const uint8_t* rgba,
+  uint32_t width,
+  uint32_t height,
+  uint8_t* pages)
+{
+  const uint32_t page_count_x = (width + GP_TEXTURE_PAGE_SIZE - 1) / GP_TEXTURE_PAGE_SIZE;
+  const uint32_t page_count_y = (height + GP_TEXTURE_PAGE_SIZE - 1) / GP_TEXTURE_PAGE_SIZE;
+
+  for (uint32_t page_y = 0; page_y < page_count_y; ++page_y)
+  {
+    for (uint32_t page_x = 0; page_x < page_count_x; ++page_x)
+    {
+      uint8_t* page = &pages[(size_t) (page_y * page_count_x + page_x) * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE];
+
+      for (uint32_t block_y = 0; block_y < GP_TEXTURE_PAGE_BLOCK_COUNT; ++block_y)
+      {
+        for (uint32_t block_x = 0; block_x < GP_TEXTURE_PAGE_BLOCK_COUNT; ++block_x)
+        {
+          const uint32_t x = page_x * GP_TEXTURE_PAGE_SIZE + block_x * 4;
+          const uint32_t y = page_y * GP_TEXTURE_PAGE_SIZE + block_y * 4;
+
+          /* Blocks outside of the level are never sampled. */
+          if (x >= width || y >= height)
+          {
+            continue;
+          }
+
+          uint8_t texels[16][4];
+          for (uint32_t i = 0; i < 16; ++i)
+          {
+            const uint32_t tx = (x + (i % 4) < width) ? (x + (i % 4)) : (width - 1);
+            const uint32_t ty = (y + (i / 4) < height) ? (y + (i / 4)) : (height - 1);
+            memcpy(texels[i], &rgba[((size_t) ty * width + tx) * 4], 4);
+          }
+
+          uint8_t* block = &page[(block_y * GP_TEXTURE_PAGE_BLOCK_COUNT + block_x) * 8];
+          gp_texture_compress_bc1(texels, block);
+        }
+      }
+    }
+  }
+}
+
+void gp_texture_build(
+  const uint8_t* rgba,
+  uint32_t width,
+  uint32_t height,
+  uint32_t* page_count,
+  uint8_t** pages,
+  gp_texture* texture)
+{
+  uint32_t level_count = 1;
+  while (gp_texture_level_size(width, level_count - 1) > 1 ||
+         gp_texture_level_size(height, level_count - 1) > 1)
+  {
+    level_count++;
+  }
+
+  uint32_t texture_page_count = 0;
+  for (uint32_t l = 0; l < level_count; ++l)
+  {
+    texture_page_count += gp_texture_level_page_count(width, height, l);
+  }
+
+  texture->width = width;
+  texture->height = height;
+  texture->level_count = level_count;
+  texture->page_offset = *page_count;
+
+  const size_t old_size = (size_t) (*page_count) * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE;
+  const size_t new_size = (size_t) (*page_count + texture_page_count) * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE;
+  *pages = (uint8_t*) realloc(*pages, new_size);
+  memset(&(*pages)[old_size], 0, new_size - old_size);
+
+  float srgb_to_linear[256];
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    srgb_to_linear[i] = gp_srgb_to_linear((float) i / 255.0f);
+  }
+
+  const uint8_t* level = rgba;
+  uint8_t* next_level = NULL;
+  uint32_t level_page_offset = *page_count;
+
+  for (uint32_t l = 0; l < level_count; ++l)
+  {
+    const uint32_t level_width = gp_texture_level_size(width, l);
+    const uint32_t level_height = gp_texture_level_size(height, l);
+
+    gp_texture_compress_level(
+      level, level_width, level_height,
+      &(*pages)[(size_t) level_page_offset * GATLING_GSD_TEXTURE_PAGE_BYTE_SIZE]
+    );
+    level_page_offset += gp_texture_level_page_count(width, height, l);
+
+    if (l + 1 == level_count)
+    {
+      break;
+    }
+
+    const uint32_t next_width = gp_texture_level_size(width, l + 1);
+    const uint32_t next_height = gp_texture_level_size(height, l + 1);
+    uint8_t* downsampled = (uint8_t*) malloc((size_t) next_width * next_height * 4);
+
+    gp_texture_downsample(srgb_to_linear, level, level_width, level_height, downsampled, next_width, next_height);
+
+    free(next_level);
+    next_level = downsampled;
+    level = downsampled;
+  }
+
+  free(next_level);
+
+  assert(level_page_offset == *page_count + texture_page_count);
+  *page_count += texture_page_count;
+}
@@ -0,0 +1,39 @@
+#ifndef GP_TEXTURE_H
+#define GP_TEXTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "gp.h"
+
+/*
+ * Textures are converted into the paged layout that the renderer streams on
+ * demand (see gsd.h). The mip chain is built with a box filter in linear space
+ * and every level is split into pages, which are padded by repeating the edge
+ * texels. Pages consist of BC1 blocks, so that a cached page takes an eighth of
+ * the memory of an RGBA8 one. Endpoints are the corners of the color bounding
+ * box of a block, which is fast and good enough for albedo maps. Alpha is
+ * ignored, as the renderer has no notion of transparency.
+ */
+
+/* Decodes an uncompressed true-color or grayscale TGA image into RGBA8. */
+bool gp_texture_decode_tga(
+  const uint8_t* data,
+  uint64_t size,
+  uint32_t* width,
+  uint32_t* height,
+  uint8_t** rgba
+);
+
+/* Appends the pages of all mip levels of an sRGB RGBA8 image to the page
+ * array, which is reallocated. */
+void gp_texture_build(
+  const uint8_t* rgba,
+  uint32_t width,
+  uint32_t height,
+  uint32_t* page_count,
+  uint8_t** pages,
+  gp_texture* texture
+);
+
+#endif
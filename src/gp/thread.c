@@ -0,0 +1,170 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+typedef struct gp_thread {
+  gp_thread_func func;
+  void*          data;
+#if defined(_WIN32)
+  HANDLE         handle;
+#else
+  pthread_t      handle;
+#endif
+} gp_thread;
+
+typedef struct gp_mutex {
+#if defined(_WIN32)
+  CRITICAL_SECTION critical_section;
+#else
+  pthread_mutex_t  handle;
+#endif
+} gp_mutex;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI gp_thread_entry(LPVOID param)
+{
+  gp_thread* thread = (gp_thread*) param;
+  thread->func(thread->data);
+  return 0;
+}
+
+bool gp_thread_create(gp_thread_func func, void* data, gp_thread** thread)
+{
+  gp_thread* new_thread = (gp_thread*) malloc(sizeof(gp_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+  new_thread->handle = CreateThread(NULL, 0, gp_thread_entry, new_thread, 0, NULL);
+
+  if (new_thread->handle == NULL) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void gp_thread_join(gp_thread* thread)
+{
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  free(thread);
+}
+
+void gp_thread_yield(void)
+{
+  SwitchToThread();
+}
+
+uint32_t gp_thread_hardware_concurrency(void)
+{
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return (uint32_t) system_info.dwNumberOfProcessors;
+}
+
+bool gp_mutex_create(gp_mutex** mutex)
+{
+  gp_mutex* new_mutex = (gp_mutex*) malloc(sizeof(gp_mutex));
+  InitializeCriticalSection(&new_mutex->critical_section);
+  *mutex = new_mutex;
+  return true;
+}
+
+void gp_mutex_destroy(gp_mutex* mutex)
+{
+  DeleteCriticalSection(&mutex->critical_section);
+  free(mutex);
+}
+
+void gp_mutex_lock(gp_mutex* mutex)
+{
+  EnterCriticalSection(&mutex->critical_section);
+}
+
+void gp_mutex_unlock(gp_mutex* mutex)
+{
+  LeaveCriticalSection(&mutex->critical_section);
+}
+
+#else
+
+static void* gp_thread_entry(void* param)
+{
+  gp_thread* thread = (gp_thread*) param;
+  thread->func(thread->data);
+  return NULL;
+}
+
+bool gp_thread_create(gp_thread_func func, void* data, gp_thread** thread)
+{
+  gp_thread* new_thread = (gp_thread*) malloc(sizeof(gp_thread));
+  new_thread->func = func;
+  new_thread->data = data;
+
+  if (pthread_create(&new_thread->handle, NULL, gp_thread_entry, new_thread) != 0) {
+    free(new_thread);
+    return false;
+  }
+
+  *thread = new_thread;
+  return true;
+}
+
+void gp_thread_join(gp_thread* thread)
+{
+  pthread_join(thread->handle, NULL);
+  free(thread);
+}
+
+void gp_thread_yield(void)
+{
+  sched_yield();
+}
+
+uint32_t gp_thread_hardware_concurrency(void)
+{
+  const long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (processor_count > 0) ? (uint32_t) processor_count : 1;
+}
+
+bool gp_mutex_create(gp_mutex** mutex)
+{
+  gp_mutex* new_mutex = (gp_mutex*) malloc(sizeof(gp_mutex));
+
+  if (pthread_mutex_init(&new_mutex->handle, NULL) != 0) {
+    free(new_mutex);
+    return false;
+  }
+
+  *mutex = new_mutex;
+  return true;
+}
+
+void gp_mutex_destroy(gp_mutex* mutex)
+{
+  pthread_mutex_destroy(&mutex->handle);
+  free(mutex);
+}
+
+void gp_mutex_lock(gp_mutex* mutex)
+{
+  pthread_mutex_lock(&mutex->handle);
+}
+
+void gp_mutex_unlock(gp_mutex* mutex)
+{
+  pthread_mutex_unlock(&mutex->handle);
+}
+
+#endif
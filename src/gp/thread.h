@@ -0,0 +1,32 @@
+#ifndef GP_THREAD_H
+#define GP_THREAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct gp_thread gp_thread;
+typedef struct gp_mutex gp_mutex;
+
+typedef void (*gp_thread_func)(void* data);
+
+bool gp_thread_create(
+  gp_thread_func func,
+  void* data,
+  gp_thread** thread
+);
+
+void gp_thread_join(gp_thread* thread);
+
+void gp_thread_yield(void);
+
+uint32_t gp_thread_hardware_concurrency(void);
+
+bool gp_mutex_create(gp_mutex** mutex);
+
+void gp_mutex_destroy(gp_mutex* mutex);
+
+void gp_mutex_lock(gp_mutex* mutex);
+
+void gp_mutex_unlock(gp_mutex* mutex);
+
+#endif